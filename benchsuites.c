@@ -0,0 +1,421 @@
+#include "util.h"
+#include "submatch.h"
+#include "psearch.h"
+#include "fuzzy.h"
+#include "modemap.h"
+#include "editor.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <regex.h>
+
+/**
+ * micro benchmarks, not run by test_semacs.
+ * usage: bench_semacs [corpus size in MB]
+ */
+
+static const char* bench_words[] = {
+    "request", "worker", "finished", "started", "timeout", "cache", "miss",
+    "hit", "user", "session", "INFO", "WARN", "DEBUG", "queue", "flush",
+};
+
+// log-like text, so there are plenty of partial matches
+static char* bench_make_corpus( size_t size )
+{
+    char *corpus = g_malloc( size + 1 );
+    GRand *rand = g_rand_new_with_seed( 2010 );
+    size_t used = 0;
+    while ( used < size ) {
+        char line[256];
+        int len = snprintf( line, sizeof line, "2010-06-%02d %02d:%02d:%02d [%s] %s-%d: %s %s in %dms\n",
+                            g_rand_int_range(rand, 1, 31), g_rand_int_range(rand, 0, 24),
+                            g_rand_int_range(rand, 0, 60), g_rand_int_range(rand, 0, 60),
+                            bench_words[g_rand_int_range(rand, 10, 13)],
+                            bench_words[g_rand_int_range(rand, 0, 10)],
+                            g_rand_int_range(rand, 0, 64),
+                            bench_words[g_rand_int_range(rand, 0, ARRAY_LEN(bench_words))],
+                            bench_words[g_rand_int_range(rand, 0, ARRAY_LEN(bench_words))],
+                            g_rand_int_range(rand, 0, 5000) );
+        len = MIN( (size_t)len, size - used );
+        memcpy( corpus + used, line, len );
+        used += len;
+    }
+    corpus[size] = 0;
+    g_rand_free( rand );
+    return corpus;
+}
+
+static void bench_report( const char* name, double secs, size_t bytes )
+{
+    printf( "  %-24s %10.3f s %10.1f MB/s\n", name, secs, bytes / secs / (1<<20) );
+}
+
+static void bench_substr( const char* corpus, size_t size )
+{
+    // none of them occurs, so every engine scans the whole corpus
+    const char *pats[] = {
+        "Q",
+        "requesT",
+        "worker-99: finished",
+        "2010-06-15 12:00:00 [INFO] session-77: cache miss in 1ms",
+    };
+    const struct {
+        const char *name;
+        substr_strategy strategy;
+    } engines[] = {
+        { "substr auto", SUBSTR_AUTO },
+        { "substr scalar", SUBSTR_SCALAR },
+        { "substr sse2", SUBSTR_SSE2 },
+        { "substr avx2", SUBSTR_AVX2 },
+        { "substr horspool", SUBSTR_HORSPOOL },
+    };
+
+    GTimer *timer = g_timer_new();
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        printf( "pattern \"%s\" (%d bytes):\n", pats[p], (int)strlen(pats[p]) );
+
+        kmp_entry *kmp = kmp_init( pats[p] );
+        g_timer_start( timer );
+        int expect = kmp_match( kmp, corpus );
+        bench_report( "kmp_match", g_timer_elapsed(timer, NULL), size );
+        kmp_free( kmp );
+
+        for (int e = 0; e < ARRAY_LEN(engines); ++e) {
+            substr_entry *substr = substr_init_with_strategy(
+                pats[p], strlen(pats[p]), engines[e].strategy );
+            g_timer_start( timer );
+            long long found = substr_search( substr, corpus, size );
+            bench_report( engines[e].name, g_timer_elapsed(timer, NULL), size );
+            g_assert( found == (expect < 0 ? -1 : expect - 1) );
+            substr_free( substr );
+        }
+    }
+    g_timer_destroy( timer );
+}
+
+static void bench_aho_corasick( const char* corpus, size_t size )
+{
+    const int nr_sets[] = { 16, 10000, 100000 };
+    GTimer *timer = g_timer_new();
+    for (int n = 0; n < ARRAY_LEN(nr_sets); ++n) {
+        int nr_keywords = nr_sets[n];
+        printf( "%d keywords:\n", nr_keywords );
+        
+        // error codes which never occur, and identifiers which often do
+        char **keywords = g_new( char*, nr_keywords );
+        for (int i = 0; i < nr_keywords; ++i) {
+            if ( i % 2 )
+                keywords[i] = g_strdup_printf( "E%06d", i );
+            else
+                keywords[i] = g_strdup_printf( "%s-%d:", bench_words[i % 10], i % 97 );
+        }
+
+        g_timer_start( timer );
+        trie_t *trie = trie_init();
+        for (int i = 0; i < nr_keywords; ++i)
+            trie_add_keyword( trie, keywords[i] );
+        trie_dfa *dfa = trie_dfa_compile( trie );
+        printf( "  %-24s %10.3f s %10d states %4d classes\n", "build dfa",
+                g_timer_elapsed(timer, NULL), dfa->nr_states, dfa->nr_classes );
+
+        g_timer_start( timer );
+        long long nr_match = trie_dfa_match( dfa, corpus, size );
+        bench_report( "trie_dfa_match", g_timer_elapsed(timer, NULL), size );
+        printf( "  %lld matches\n", nr_match );
+
+        g_timer_start( timer );
+        trie_dfa_cursor cur;
+        trie_dfa_cursor_init( dfa, &cur );
+        trie_dfa_cursor_feed( &cur, corpus, size );
+        trie_match_hit hits[256];
+        long long nr_hits = 0;
+        int nr;
+        while ( (nr = trie_dfa_match_ex(dfa, &cur, hits, ARRAY_LEN(hits))) > 0 )
+            nr_hits += nr;
+        bench_report( "trie_dfa_match_ex", g_timer_elapsed(timer, NULL), size );
+        g_assert( nr_hits == nr_match );
+
+        // failure links are built breadth first, in time linear to the trie
+        g_timer_start( timer );
+        trie_t *ac = trie_init_with_keywords( keywords, nr_keywords );
+        printf( "  %-24s %10.3f s %10d states\n", "trie_init_with_keywords",
+                g_timer_elapsed(timer, NULL), ac->nr_states );
+        if ( nr_keywords <= 16 ) {
+            g_timer_start( timer );
+            trie_match( ac, corpus );
+            bench_report( "trie_match", g_timer_elapsed(timer, NULL), size );
+        }
+        trie_free( ac );
+
+        trie_dfa_free( dfa );
+        trie_free( trie );
+        for (int i = 0; i < nr_keywords; ++i)
+            g_free( keywords[i] );
+        g_free( keywords );
+    }
+    g_timer_destroy( timer );
+}
+
+static void bench_regexp( const char* corpus, size_t size )
+{
+    // none of them occurs, the same pattern in Emacs and POSIX syntax
+    const struct {
+        const char *pat;
+        const char *posix;
+    } pats[] = {
+        { "worker-99: finished", "worker-99: finished" },
+        { "\\(timeout\\|flush\\) in 5[0-9]\\{3\\}ms", "(timeout|flush) in 5[0-9]{3}ms" },
+        { "^2010-07", "^2010-07" },
+        { "\\[\\(ERROR\\|FATAL\\)\\]", "\\[(ERROR|FATAL)\\]" },
+    };
+
+    GTimer *timer = g_timer_new();
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        printf( "regexp \"%s\":\n", pats[p].pat );
+        
+        regexp_entry *re = regexp_compile( pats[p].pat, NULL );
+        g_timer_start( timer );
+        long long found = regexp_search( re, corpus, size, 0, NULL );
+        bench_report( "regexp_search", g_timer_elapsed(timer, NULL), size );
+        g_assert( found < 0 );
+        regexp_free( re );
+
+        regex_t preg;
+        regcomp( &preg, pats[p].posix, REG_EXTENDED | REG_NEWLINE | REG_NOSUB );
+        g_timer_start( timer );
+        int ret = regexec( &preg, corpus, 0, NULL, 0 );
+        bench_report( "regexec", g_timer_elapsed(timer, NULL), size );
+        g_assert( ret == REG_NOMATCH );
+        regfree( &preg );
+    }
+    g_timer_destroy( timer );
+}
+
+// reading a file is much faster than inserting
+static se_buffer* bench_load_buffer( const char* corpus, size_t size )
+{
+    char *file_name = g_build_filename( g_get_tmp_dir(), "semacs-bench-XXXXXX", NULL );
+    int fd = g_mkstemp( file_name );
+    g_assert( fd >= 0 && write(fd, corpus, size) == size );
+    close( fd );
+    se_buffer *bufp = se_buffer_create( NULL, "bench" );
+    bufp->setFileName( bufp, file_name );
+    g_assert( bufp->readFile(bufp) );
+    unlink( file_name );
+    g_free( file_name );
+    return bufp;
+}
+
+static void bench_parallel_search( se_buffer* bufp, size_t size )
+{
+    se_snapshot_publish( bufp );
+    
+    const char *pats[] = { "worker-99: finished", "\\(timeout\\|flush\\) in 5[0-9]\\{3\\}ms" };
+    GTimer *timer = g_timer_new();
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        printf( "parallel regexp \"%s\" (%d processors):\n", pats[p], g_get_num_processors() );
+        for (int nr_threads = 1; nr_threads <= 8; nr_threads *= 2) {
+            g_timer_start( timer );
+            se_psearch *ps = se_psearch_start_full( bufp, pats[p], TRUE, 0, nr_threads, 0, NULL );
+            while ( !se_psearch_poll(ps) )
+                g_usleep( 100 );
+            char name[32];
+            snprintf( name, sizeof name, "%d threads", nr_threads );
+            bench_report( name, g_timer_elapsed(timer, NULL), size );
+            se_psearch_free( ps );
+        }
+    }
+    g_timer_destroy( timer );
+}
+
+static void bench_replace_all( se_buffer* bufp, size_t size )
+{
+    const struct { const char *pat, *str; } cases[] = {
+        { "cache", "CACHE" },
+        { "\\[DEBUG\\] ", "" },
+        { " in [0-9]+ms$", "" },
+    };
+    
+    GTimer *timer = g_timer_new();
+    for (int c = 0; c < ARRAY_LEN(cases); ++c) {
+        printf( "replace \"%s\" with \"%s\":\n", cases[c].pat, cases[c].str );
+        regexp_entry *re = regexp_compile( cases[c].pat, NULL );
+        g_timer_start( timer );
+        se_off_t nr_replaced = bufp->replaceAll( bufp, re, cases[c].str );
+        bench_report( "replaceAll", g_timer_elapsed(timer, NULL), size );
+        printf( "  %lld occurrences\n", nr_replaced );
+        
+        g_timer_start( timer );
+        g_assert( bufp->undo(bufp) );
+        bench_report( "undo", g_timer_elapsed(timer, NULL), size );
+        regexp_free( re );
+    }
+    g_timer_destroy( timer );
+}
+
+static void bench_fuzzy()
+{
+    // paths of a large project
+    const char *dirs[] = { "src", "lib", "include", "test", "doc", "tools", "net", "ui" };
+    se_fuzzy *fz = se_fuzzy_new();
+    GRand *rand = g_rand_new_with_seed( 2010 );
+    int nr_candidates = 100000;
+    for (int i = 0; i < nr_candidates; ++i) {
+        char name[128];
+        snprintf( name, sizeof name, "%s/%s/%s_%s%d.c",
+                  dirs[g_rand_int_range(rand, 0, ARRAY_LEN(dirs))],
+                  dirs[g_rand_int_range(rand, 0, ARRAY_LEN(dirs))],
+                  bench_words[g_rand_int_range(rand, 0, ARRAY_LEN(bench_words))],
+                  bench_words[g_rand_int_range(rand, 0, ARRAY_LEN(bench_words))],
+                  g_rand_int_range(rand, 0, 1000) );
+        se_fuzzy_add( fz, name, NULL );
+    }
+    g_rand_free( rand );
+
+    const char *queries[] = { "srcsessq", "e", "utilflush" };
+    GTimer *timer = g_timer_new();
+    for (int q = 0; q < ARRAY_LEN(queries); ++q) {
+        printf( "fuzzy \"%s\" in %d names:\n", queries[q], nr_candidates );
+        char typed[32] = "";
+        double worst = 0;
+        for (int i = 0; queries[q][i]; ++i) {
+            typed[i] = queries[q][i];
+            g_timer_start( timer );
+            int nr = se_fuzzy_set_query( fz, typed );
+            double secs = g_timer_elapsed( timer, NULL );
+            worst = MAX( worst, secs );
+            printf( "  %-24s %10.3f ms %10d matches\n", typed, secs * 1000, nr );
+        }
+        // deleting all of it goes back to what was left before
+        g_timer_start( timer );
+        se_fuzzy_set_query( fz, "" );
+        printf( "  %-24s %10.3f ms\n", "(cleared)", g_timer_elapsed(timer, NULL) * 1000 );
+        printf( "  %-24s %10.3f ms\n", "worst keystroke", worst * 1000 );
+    }
+    g_timer_destroy( timer );
+    se_fuzzy_free( fz );
+}
+
+static void bench_keymap()
+{
+    se_modemap *map = se_modemap_full_create( "bench-map" );
+    // mostly typing, with some commands and prefix keys in between
+    const char *reps[] = { "e", "t", "a", " ", "Z", "~", "C-f", "C-x u", "M-s o", "Return" };
+    se_key_seq seqs[ARRAY_LEN(reps)];
+    for (int i = 0; i < ARRAY_LEN(reps); ++i)
+        seqs[i] = se_key_seq_from_string( reps[i] );
+
+    const int nr_keys = 2000000;
+    printf( "keymap dispatch, %d key sequences:\n", nr_keys );
+    GTimer *timer = g_timer_new();
+    long nr_found = 0;
+    for (int i = 0; i < nr_keys; ++i)
+        nr_found += se_modemap_lookup_command_tree( map, seqs[i % ARRAY_LEN(seqs)] ) != NULL;
+    double secs = g_timer_elapsed( timer, NULL );
+    printf( "  %-24s %10.1f ns/key\n", "tree", secs * 1e9 / nr_keys );
+
+    g_timer_start( timer );
+    for (int i = 0; i < nr_keys; ++i)
+        nr_found -= se_modemap_lookup_command_ex( map, seqs[i % ARRAY_LEN(seqs)] ) != NULL;
+    secs = g_timer_elapsed( timer, NULL );
+    printf( "  %-24s %10.1f ns/key\n", "compiled", secs * 1e9 / nr_keys );
+    g_assert( nr_found == 0 );
+    
+    g_timer_destroy( timer );
+    se_modemap_free( map );
+}
+
+// how keys of events were made before: by name of keysym, allocating
+static se_key bench_key_by_name( KeySym keysym, unsigned int state )
+{
+    se_key key = se_key_null_init();
+    const char *name = XKeysymToString( keysym );
+    if ( g_str_has_prefix(name, "Alt") || g_str_has_prefix(name, "Meta")
+         || g_str_has_prefix(name, "Super") || g_str_has_prefix(name, "Control")
+         || g_str_has_prefix(name, "Shift") )
+        return key;
+    key = se_key_from_event( keysym, state );
+    g_free( se_key_to_string(key) ); // formatted for debug message
+    return key;
+}
+
+static void bench_key_events()
+{
+    // typing with a look back and a line broken, then C-u 12 C-d taking it
+    // all away again, so buffer stays small and only key path is measured
+    const struct {
+        KeySym sym;
+        unsigned int state;
+    } events[] = {
+        { XK_h, 0 }, { XK_e, 0 }, { XK_l, 0 }, { XK_l, 0 }, { XK_o, 0 }, { XK_space, 0 },
+        { XK_Shift_L, 0 }, { XK_W, ShiftMask }, { XK_o, 0 }, { XK_r, 0 }, { XK_l, 0 },
+        { XK_d, 0 }, { XK_Control_L, 0 }, { XK_b, ControlMask }, { XK_f, ControlMask },
+        { XK_Return, 0 },
+        { XK_a, ControlMask }, { XK_p, ControlMask }, { XK_u, ControlMask },
+        { XK_1, ControlMask }, { XK_2, ControlMask }, { XK_d, ControlMask },
+    };
+    const int nr_events = 1000000;
+    printf( "key events, %d:\n", nr_events );
+    se_world *world = se_world_create();
+    GTimer *timer = g_timer_new();
+
+    for (int round = 0; round < 2; ++round) {
+        world->bufferCreate( world, round ? "bench-after": "bench-before" );
+        se_buffer *bufp = world->current;
+        bufp->setMajorMode( bufp, "Fundamental" );
+        se_command_args args = se_command_args_init();
+        gboolean pending = FALSE;
+
+        g_timer_start( timer );
+        // both rounds hand each key to dispatchKeys, so only what comes
+        // before it differs
+        for (int i = 0; i < nr_events; ++i) {
+            KeySym sym = events[i % ARRAY_LEN(events)].sym;
+            unsigned int state = events[i % ARRAY_LEN(events)].state;
+            if ( round == 0 ) {
+                // fresh strings for each event, and args for each command,
+                // as key handler of view did
+                GString *chars = g_string_new( "" );
+                se_key key = bench_key_by_name( sym, state );
+                if ( !se_key_is_null(key) ) {
+                    if ( !pending ) {
+                        se_command_args_release( &args );
+                        args = se_command_args_init();
+                    }
+                    pending = world->dispatchKeys( world, &args, &key, 1 ) != TRUE;
+                }
+                g_string_free( chars, TRUE );
+            } else {
+                se_key key = se_key_from_event( sym, state );
+                if ( !se_key_is_null(key) )
+                    world->dispatchKeys( world, &args, &key, 1 );
+            }
+        }
+        double secs = g_timer_elapsed( timer, NULL );
+        printf( "  %-24s %10.0f events/s\n", round ? "after": "before", nr_events / secs );
+
+        se_command_args_release( &args );
+    }
+
+    g_timer_destroy( timer );
+    se_world_free( world );
+}
+
+int main(int argc, char *argv[])
+{
+    size_t size = (size_t)(argc > 1 ? atoi(argv[1]) : 256) << 20;
+    char *corpus = bench_make_corpus( size );
+
+    bench_substr( corpus, size );
+    bench_aho_corasick( corpus, size );
+    bench_regexp( corpus, size );
+    se_buffer *bufp = bench_load_buffer( corpus, size );
+    bench_parallel_search( bufp, size );
+    bench_replace_all( bufp, size );
+    bench_fuzzy();
+    bench_keymap();
+    bench_key_events();
+
+    g_free( corpus );
+    return 0;
+}
@@ -19,6 +19,7 @@
 
 #include "buffer.h"
 #include "editor.h"
+#include "search.h"
 
 #ifndef _BSD_SOURCE
 #define _BSD_SOURCE // for lstat
@@ -32,36 +33,63 @@
 
 #include <glib/gstdio.h>
 
-struct se_chunk
-{
-    int size;
-    int used;
-    gboolean fullLine; // line ended with '\n'
-    char data[0];
-};
-
 const char* se_line_getData( se_line* lp )
 {
     assert( lp );
     return lp->content->data;
 }
 
-int se_line_getLineLength( se_line* lp )
+se_off_t se_line_getLineLength( se_line* lp )
 {
     assert( lp );
     return lp->content->used;
 }
 
-#define ROUND_TO_BLOCK(size)  ((((size)>>8)<<8) + (1<<8))
+se_chunk* se_chunk_ref( se_chunk* chunk )
+{
+    g_assert( chunk && chunk->refs > 0 );
+    chunk->refs++;
+    return chunk;
+}
+
+void se_chunk_unref( se_chunk* chunk )
+{
+    g_assert( chunk && chunk->refs > 0 );
+    if ( --chunk->refs == 0 )
+        g_free( chunk );
+}
+
+/**
+ * chunk of lp may be shared with published snapshots, which are read by other
+ * threads, so copy it before any modification (copy on write)
+ */
+static void se_line_own_chunk( se_line* lp )
+{
+    se_chunk *chunk = lp->content;
+    if ( chunk->refs == 1 )
+        return;
+
+    se_chunk *copy = g_malloc( sizeof(se_chunk) + chunk->size );
+    memcpy( copy, chunk, sizeof(se_chunk) + chunk->used );
+    copy->refs = 1;
+    lp->content = copy;
+    se_chunk_unref( chunk );
+}
+
+#define ROUND_TO_BLOCK(size)  ((((se_off_t)(size)>>8)<<8) + (1<<8))
+
+// how many bytes readFile pulls from the file each time
+#define SE_READ_BLOCK_SIZE  (1<<20)
 
 /**
  * insert data start from start, and if neccesary, realloc chunk and return new
  * address.  caller should make sure that data contains no '\n' at all if lp is
  * already nl ended.
  */
-static se_line* se_line_insert(se_line* lp, int start, const char* data, int len)
+static se_line* se_line_insert(se_line* lp, se_off_t start, const char* data, se_off_t len)
 {
     g_assert( lp && lp->content );
+    se_line_own_chunk( lp );
 
     se_chunk *chunk = lp->content;
     /* se_debug("B: content(%d): [%s], data(%d): [%s]", chunk->used, chunk->data, */
@@ -70,22 +98,20 @@ static se_line* se_line_insert(se_line* lp, int start, const char* data, int len
 
     start = MIN(start, chunk->used-(nl_ended?1:0) );
 
-    // sanity check: this is not strong enough
-    char* nl_pos = strrchr(data, '\n');
-    if ( nl_pos >= data + len )
-        nl_pos = NULL;
+    // sanity check: a '\n' is only allowed as the last char appended
+    const char* nl_pos = memchr( data, '\n', len );
     g_assert( nl_pos == NULL ||
               ((nl_pos == data + len - 1) && (start == chunk->used)) );
     
-    int new_len = chunk->size;
+    se_off_t new_len = chunk->size;
     if ( chunk->used + len > chunk->size ) {
-        int new_len = ROUND_TO_BLOCK( chunk->used + len );
-        lp->content = g_realloc( lp->content, new_len );
-        se_debug( "realloc %d to %d", chunk->size, new_len );
+        new_len = ROUND_TO_BLOCK( chunk->used + len );
+        se_debug( "realloc %lld to %lld", chunk->size, new_len );
+        lp->content = g_realloc( lp->content, sizeof(se_chunk) + new_len );
     } 
 
     chunk = lp->content;
-    memmove( chunk->data+start+len, chunk->data+start, new_len-start-len );
+    memmove( chunk->data+start+len, chunk->data+start, chunk->used-start );
     memcpy( chunk->data+start, data, len );
     chunk->used += len;
     chunk->size = new_len;
@@ -100,6 +126,7 @@ static se_line* se_line_clear(se_line* lp)
 {
     // lp should nl-ended, if not, it should be destroyed not cleared
     g_assert( lp->content->fullLine );
+    se_line_own_chunk( lp );
     lp->content->data[0] = '\n';
     lp->content->used = 1;        
     return lp;
@@ -107,6 +134,7 @@ static se_line* se_line_clear(se_line* lp)
 
 static void se_line_remove_nl( se_line* lp )
 {
+    se_line_own_chunk( lp );
     se_chunk* chunk = lp->content;
     if ( chunk->fullLine ) {
         g_assert( chunk->data[chunk->used-1] == '\n' );
@@ -120,10 +148,10 @@ static void se_line_remove_nl( se_line* lp )
  * just return original lp for sequencial call
  * note that one can not delete trialing '\n' in a line
  */
-static se_line* se_line_delete(se_line* lp, int start, int len)
+static se_line* se_line_delete(se_line* lp, se_off_t start, se_off_t len)
 {
     g_assert( lp );
-    int used = lp->content->used;
+    se_off_t used = lp->content->used;
     
     if ( lp->content->fullLine )
         used--;    
@@ -135,6 +163,7 @@ static se_line* se_line_delete(se_line* lp, int start, int len)
     if ( start == 0 && len >= used )
         return se_line_clear( lp );
 
+    se_line_own_chunk( lp );
     char *data = lp->content->data;
     used += (lp->content->fullLine?1:0);
     memmove( data+start, data+start+len, used - start - len );
@@ -145,14 +174,14 @@ static se_line* se_line_delete(se_line* lp, int start, int len)
 SE_UNUSED static void se_line_destroy(se_line* lp)
 {
     g_assert( lp );
-    g_free( lp->content );
+    se_chunk_unref( lp->content );
     g_free( lp );
 }
 
 /**
  * copy data into se_line struct
  */
-static se_line* se_line_alloc(const char* data, int len)
+static se_line* se_line_alloc(const char* data, se_off_t len)
 {
     se_line *lp = g_malloc0( sizeof(se_line) );
     if ( !lp ) {
@@ -160,7 +189,7 @@ static se_line* se_line_alloc(const char* data, int len)
         return NULL;
     }
     
-    int new_len = ROUND_TO_BLOCK( len );
+    se_off_t new_len = ROUND_TO_BLOCK( len );
     /* se_debug( "round size %d to %d", len, new_len ); */
     lp->content = g_malloc0( sizeof(se_chunk)+new_len );
     if ( !lp->content ) {
@@ -169,9 +198,10 @@ static se_line* se_line_alloc(const char* data, int len)
         return NULL;
     }
     
+    lp->content->refs = 1;
     lp->content->size = new_len;
     lp->content->used = len;
-    lp->content->fullLine = (data[len-1] == '\n');
+    lp->content->fullLine = (len > 0 && data[len-1] == '\n');
     memcpy( lp->content->data, data, len );
     return lp;
 }
@@ -182,7 +212,7 @@ struct se_mark
     se_mark *next;
 
     char markName[32];
-    int position;
+    se_off_t position;
     int flags;  // persistent or not
 };
 
@@ -193,21 +223,22 @@ struct se_mark
  * use this is sync with optional members( curLine )
  * if count is positive, move forward, else move backward
  */
-static void se_buffer_update_point(se_buffer* bufp, int incr)
+static void se_buffer_update_point(se_buffer* bufp, se_off_t incr)
 {
-    se_debug( "B:incr:%d, point:%d, chars:%d, lines: %d,curLine: %d, col: %d", incr,
+    se_debug( "B:incr:%lld, point:%lld, chars:%lld, lines: %lld,curLine: %lld, col: %lld", incr,
               bufp->position, bufp->charCount, bufp->lineCount, bufp->curLine, bufp->curColumn );
     g_assert( bufp && bufp->lines );
     
     bufp->position += incr;
     if ( bufp->position > bufp->charCount )
         bufp->position = bufp->charCount;
-    bufp->position =  bufp->position? :0;
+    if ( bufp->position < 0 )
+        bufp->position = 0;
     
     se_line *lp = bufp->lines;
-    int total = 0, n = 0;
+    se_off_t total = 0, n = 0;
     while (1) {
-        int pad = se_line_getLineLength(lp) - (lp->content->fullLine?1:0);
+        se_off_t pad = se_line_getLineLength(lp) - (lp->content->fullLine?1:0);
         if ( BETWEEN(bufp->position, total, total + pad) ) {
             bufp->curLine = n;
             bufp->curColumn = bufp->position - total;
@@ -221,7 +252,7 @@ static void se_buffer_update_point(se_buffer* bufp, int incr)
         }
         lp = lp->next;
     }
-    se_debug( "A:incr:%d, point:%d, chars:%d, lines: %d,curLine: %d, col: %d", incr,
+    se_debug( "A:incr:%lld, point:%lld, chars:%lld, lines: %lld,curLine: %lld, col: %lld", incr,
               bufp->position, bufp->charCount, bufp->lineCount, bufp->curLine, bufp->curColumn );
 }
 
@@ -275,6 +306,91 @@ static void se_buffer_delete_line( se_buffer* bufp, se_line* lp )
     lp->previous->next = lp->next;
 }
 
+/**
+ * a run of lines swapped out by replaceAll, kept with its chunks. nr_new
+ * lines from new_first took its place right after before, which is NULL if
+ * run was at head of buffer.
+ */
+DEF_CLS(se_undo_run);
+struct se_undo_run
+{
+    se_line *before;
+    se_line *new_first;
+    se_off_t nr_new;
+    se_line *old_first; // old lines are unlinked from ring, but not each other
+    se_line *old_last;
+};
+
+DEF_CLS(se_undo);
+struct se_undo
+{
+    GArray *runs;  // in buffer order
+    int version;   // version of buffer replaceAll left
+    se_off_t charCount;
+    se_off_t lineCount;
+    se_off_t position;
+};
+
+// free runs of old lines, they can't come back any more once buffer is edited
+static void se_buffer_drop_undo( se_buffer* bufp )
+{
+    se_undo *undo = bufp->undoEntry;
+    if ( !undo )
+        return;
+    
+    for (int i = 0; i < undo->runs->len; ++i) {
+        se_undo_run *run = &g_array_index( undo->runs, se_undo_run, i );
+        se_line *lp = run->old_first;
+        while ( lp ) {
+            se_line *next = lp == run->old_last ? NULL: lp->next;
+            se_line_destroy( lp );
+            lp = next;
+        }
+    }
+    g_array_free( undo->runs, TRUE );
+    g_free( undo );
+    bufp->undoEntry = NULL;
+}
+
+/**
+ * an edit left lines [first, end) changed and added delta lines, merge it
+ * into damage not taken yet. union of them is kept, so what lies between two
+ * edits is rescanned as well.
+ */
+static void se_buffer_damage_lines( se_buffer* bufp, se_off_t first, se_off_t end,
+                                    se_off_t delta )
+{
+    end = MIN( end, bufp->lineCount );
+    end = MAX( end, first );
+    if ( bufp->damageFirst < 0 ) {
+        bufp->damageFirst = first;
+        bufp->damageEnd = end;
+        bufp->damageDelta = delta;
+        return;
+    }
+
+    // old damage behind the edit moves with lines after it
+    se_off_t old_end = bufp->damageEnd;
+    if ( old_end > first )
+        old_end += delta;
+    bufp->damageFirst = MIN( bufp->damageFirst, first );
+    bufp->damageEnd = MAX( old_end, end );
+    bufp->damageDelta += delta;
+}
+
+gboolean se_buffer_take_damage( se_buffer* bufp, se_off_t* first, se_off_t* end,
+                                se_off_t* delta )
+{
+    g_assert( bufp );
+    if ( bufp->damageFirst < 0 )
+        return FALSE;
+    *first = bufp->damageFirst;
+    *end = bufp->damageEnd;
+    *delta = bufp->damageDelta;
+    bufp->damageFirst = -1;
+    return TRUE;
+}
+
 int se_buffer_init(se_buffer* bufp)
 {
     
@@ -283,7 +399,13 @@ int se_buffer_init(se_buffer* bufp)
 
 int se_buffer_release(se_buffer* bufp)
 {
-    
+    se_buffer_drop_undo( bufp );
+    while ( bufp->modes ) {
+        se_mode *modep = bufp->modes;
+        bufp->modes = modep->next;
+        g_free( modep );
+    }
+    se_keymap_cache_clear( &bufp->keymaps );
     return TRUE;
 }
 
@@ -292,9 +414,13 @@ int se_buffer_isModified(se_buffer* bufp)
     return bufp->modified;
 }
 
-int se_buffer_setPoint(se_buffer* bufp, int new_pos)
+int se_buffer_setPoint(se_buffer* bufp, se_off_t new_pos)
 {
-    return 0;
+    g_assert( bufp );
+    if ( !bufp->lines )
+        return FALSE;
+    se_buffer_update_point( bufp, new_pos - bufp->position );
+    return TRUE;
 }
 
 int se_buffer_getChar(se_buffer* bufp)
@@ -302,7 +428,7 @@ int se_buffer_getChar(se_buffer* bufp)
     return 0;
 }
 
-char* se_buffer_getStr(se_buffer* bufp, int max)
+char* se_buffer_getStr(se_buffer* bufp, se_off_t max)
 {
     return 0;
 }
@@ -315,31 +441,31 @@ const char* se_buffer_getBufferName(se_buffer* bufp)
     return bufp->bufferName;
 }
 
-int se_buffer_getCharCount(se_buffer* bufp)
+se_off_t se_buffer_getCharCount(se_buffer* bufp)
 {
     assert( bufp );
     return bufp->charCount;
 }
 
-static inline int se_buffer_getLineCount(se_buffer* bufp)
+static inline se_off_t se_buffer_getLineCount(se_buffer* bufp)
 {
     assert( bufp );
     return bufp->lineCount;
 }
 
-static inline int se_buffer_getPoint(se_buffer* bufp)
+static inline se_off_t se_buffer_getPoint(se_buffer* bufp)
 {
     assert( bufp );
     return bufp->position;
 }
 
-static inline int se_buffer_getLine(se_buffer* bufp)
+static inline se_off_t se_buffer_getLine(se_buffer* bufp)
 {
     assert( bufp );
     return bufp->curLine;
 }
 
-static inline int se_buffer_getCurrentColumn(se_buffer* bufp)
+static inline se_off_t se_buffer_getCurrentColumn(se_buffer* bufp)
 {
     g_assert( bufp );
     return bufp->curColumn;
@@ -351,7 +477,7 @@ static se_line* se_buffer_getCurrentLine(se_buffer* bufp)
 
     if ( !bufp->lines )
         return NULL;
-    se_debug( "point: %d, charCount: %d", bufp->position, bufp->charCount );
+    se_debug( "point: %lld, charCount: %lld", bufp->position, bufp->charCount );
         
     se_line *lp = bufp->lines;
     if ( se_buffer_eob( bufp ) && se_buffer_bol( bufp ) ) {
@@ -360,14 +486,14 @@ static se_line* se_buffer_getCurrentLine(se_buffer* bufp)
         return NULL;
     }
     
-    int nr = bufp->curLine;
+    se_off_t nr = bufp->curLine;
     while ( nr-- ) lp = lp->next;
-    se_debug("No.%d(%d): [%s]", bufp->curLine, lp->content->used, lp->content->data);
+    se_debug("No.%lld(%lld)", bufp->curLine, lp->content->used);
     
     return lp;
 }
 
-int se_buffer_forwardChar(se_buffer* bufp, int count)
+int se_buffer_forwardChar(se_buffer* bufp, se_off_t count)
 {
     se_debug( "" );
     if ( count )
@@ -378,11 +504,11 @@ int se_buffer_forwardChar(se_buffer* bufp, int count)
 /**
  * when moving up/down, try best to keep column remaining
  */
-int se_buffer_forwardLine(se_buffer* bufp, int nr_lines)
+int se_buffer_forwardLine(se_buffer* bufp, se_off_t nr_lines)
 {
-    se_debug( "forward %d lines", nr_lines );
+    se_debug( "forward %lld lines", nr_lines );
     g_assert( bufp && bufp->lines );
-    int orig_col = bufp->curColumn;
+    se_off_t orig_col = bufp->curColumn;
 
     if ( nr_lines > 0 && (nr_lines + bufp->curLine > bufp->lineCount) )
         nr_lines = bufp->lineCount - bufp->curLine;
@@ -394,7 +520,7 @@ int se_buffer_forwardLine(se_buffer* bufp, int nr_lines)
         return TRUE;
 
     se_line *lp = bufp->getCurrentLine( bufp );
-    int count = 0;
+    se_off_t count = 0;
 
     if ( nr_lines > 0 ) {
         if ( !lp ) {  // EOB
@@ -402,8 +528,8 @@ int se_buffer_forwardLine(se_buffer* bufp, int nr_lines)
         }
 
         count = se_line_getLineLength(lp) - orig_col;
-        for (int i = 0; i < nr_lines-1; ++i) {
-            g_assert( lp->next == bufp->lines );
+        for (se_off_t i = 0; i < nr_lines-1; ++i) {
+            g_assert( lp->next != bufp->lines );
             lp = lp->next;
             count += se_line_getLineLength( lp );            
         }
@@ -417,7 +543,7 @@ int se_buffer_forwardLine(se_buffer* bufp, int nr_lines)
     } else {
         count = lp? orig_col: 0;
         lp = lp? : bufp->lines;
-        for (int i = nr_lines; i < -1; ++i) {
+        for (se_off_t i = nr_lines; i < -1; ++i) {
             lp = lp->previous;
             count += se_line_getLineLength( lp );            
         }
@@ -436,7 +562,7 @@ static int se_buffer_beginingOfLine(se_buffer* bufp)
     if ( !bufp->lines || se_buffer_bob(bufp) || se_buffer_bol(bufp) )
         return TRUE;
 
-    int orig_col = bufp->curColumn;
+    se_off_t orig_col = bufp->curColumn;
     if ( orig_col == 0 )
         return TRUE;
 
@@ -453,19 +579,19 @@ static int se_buffer_endOfLine(se_buffer* bufp)
 
     se_line *lp = bufp->getCurrentLine( bufp );
     gboolean nl_ended = lp->content->fullLine;
-    int trail = se_line_getLineLength(lp) - bufp->curColumn - (nl_ended?1:0);
+    se_off_t trail = se_line_getLineLength(lp) - bufp->curColumn - (nl_ended?1:0);
     se_buffer_update_point( bufp, trail );
     g_assert( bufp->curColumn == se_line_getLineLength(lp) - (nl_ended?1:0) );
     
     return TRUE;
 }
 
-static int se_buffer_bufferStart(se_buffer* bufp)
+static se_off_t se_buffer_bufferStart(se_buffer* bufp)
 {
     return TRUE;
 }
 
-static int se_buffer_bufferEnd(se_buffer* bufp)
+static se_off_t se_buffer_bufferEnd(se_buffer* bufp)
 {
     return bufp->charCount;
 }
@@ -490,12 +616,12 @@ static int se_buffer_pointToMark(se_buffer* bufp, const char* name)
     return 0;
 }
 
-static int se_buffer_getMark(se_buffer* bufp, const char* name)
+static se_off_t se_buffer_getMark(se_buffer* bufp, const char* name)
 {
     return 0;
 }
 
-static int se_buffer_setMark(se_buffer* bufp, const char* name, int pos)
+static int se_buffer_setMark(se_buffer* bufp, const char* name, se_off_t pos)
 {
     return 0;
 }
@@ -535,6 +661,30 @@ static void se_buffer_setFileName(se_buffer* bufp, const char* file_name)
 
     size_t siz = strlen(file_name);
     strncpy( bufp->fileName, file_name, MIN(siz, SE_MAX_NAME_SIZE) );
+    bufp->fileName[MIN(siz, SE_MAX_NAME_SIZE)] = '\0';
+}
+
+// free lines from first on to the end of buffer, nothing if first is NULL
+static void se_buffer_unlink_lines_from( se_buffer* bufp, se_line* first )
+{
+    if ( !first )
+        return;
+
+    se_line *head = bufp->lines;
+    se_line *last = head->previous;
+    if ( first == head ) {
+        bufp->lines = NULL;
+    } else {
+        first->previous->next = head;
+        head->previous = first->previous;
+    }
+    
+    se_line *lp = first;
+    while ( lp ) {
+        se_line *next = lp == last ? NULL: lp->next;
+        se_line_destroy( lp );
+        lp = next;
+    }
 }
 
 /**
@@ -565,78 +715,88 @@ int se_buffer_readFile(se_buffer* bufp)
         return FALSE;
     }
 
-    //FIXME: check size in a more elegant way
-    if ( statbuf.st_size > (1<<28) ) {
-        se_debug( "file is too large, so read a big block each time" );
-        //TODO: 
-    }
-    
-    GError *error = NULL;
-    size_t str_len = 0;
-    char *str = NULL;
-    if ( g_file_get_contents(canon_name, &str, &str_len, &error) == FALSE ) {
-        se_error( "read file failed: %s", error->message );
-        g_error_free( error );
+    int fd = open( canon_name, O_RDONLY );
+    free( canon_name );
+    if ( fd < 0 ) {
+        se_warn( "open failed: %s", strerror(errno) );
         return FALSE;
     }
-    free( canon_name );
-    
-    g_clear_error( &error );
-    g_assert( str != NULL && str_len >= 0 );
 
     //se_buffer_clear_content( bufp );
-    if ( str_len == 0 ) {
-        return TRUE;
-    }
-
-    int line_incr = 0, char_incr = 0;
-    char* sp = str;
-    do {
-        char* endp = strchr( sp, '\n' );
-        if ( !endp && (sp - str >= str_len) )
-            break;
 
-        int buf_len = 0;
-        if ( endp ) {
-            buf_len = ++endp - sp; // take '\n' into account
-            
-        } else if ( sp - str < str_len ) {
-            // means this is last line and no trailing '\n'
-            buf_len = sp - str;
-            endp = str + 1;
+    /*
+     * the file is read a big block each time instead of as a whole, so memory
+     * used is about the size of file no matter how large it is. a line may span
+     * several blocks, the tail line is kept open until a '\n' is met.
+     */
+    char *block = g_malloc( SE_READ_BLOCK_SIZE );
+    se_line *tail = NULL;  // last line, not nl-ended yet
+    se_line *first = NULL; // first line read, to take them back on error
+    se_off_t line_incr = 0, char_incr = 0;
+    ssize_t nr_read = 0;
+    
+    while ( (nr_read = read(fd, block, SE_READ_BLOCK_SIZE)) != 0 ) {
+        if ( nr_read < 0 ) {
+            if ( errno == EINTR )
+                continue;
+            se_warn( "read failed: %s", strerror(errno) );
+            g_free( block );
+            close( fd );
+            se_buffer_unlink_lines_from( bufp, first );
+            return FALSE;
         }
 
-        se_line *lp = se_line_alloc( sp, buf_len );
-        
-        sp = endp;        
-        char_incr += buf_len;
-        ++line_incr;
-        
-        if ( bufp->lines ) {
-            se_line *lp1 = bufp->lines->previous;
-            lp1->next = lp;
-            lp->next = bufp->lines;
-            lp->previous = lp1;
-            bufp->lines->previous = lp;
-            
-        } else {
-            bufp->lines = lp;
-            lp->next = lp;
-            lp->previous = lp;
+        const char* sp = block;
+        const char* block_end = block + nr_read;
+        while ( sp < block_end ) {
+            const char* endp = memchr( sp, '\n', block_end - sp );
+            endp = endp? endp+1: block_end;  // take '\n' into account
+            se_off_t buf_len = endp - sp;
+
+            if ( tail ) {
+                se_line_insert( tail, se_line_getLineLength(tail), sp, buf_len );
+                
+            } else {
+                tail = se_line_alloc( sp, buf_len );
+                ++line_incr;
+                if ( !first )
+                    first = tail;
+                
+                if ( bufp->lines ) {
+                    se_buffer_insert_line_after( bufp, bufp->lines->previous, tail );
+                } else {
+                    bufp->lines = tail;
+                    tail->next = tail;
+                    tail->previous = tail;
+                }
+            }
+
+            if ( tail->content->fullLine )
+                tail = NULL;
+            char_incr += buf_len;
+            sp = endp;
         }
+    }
+    
+    g_free( block );
+    close( fd );
 
-        if ( sp - str >= str_len )
-            break;
-        
-    } while (1);
+    if ( char_incr == 0 ) {
+        return TRUE;
+    }
     
+    se_off_t nr_lines = bufp->lineCount;
     bufp->lineCount = line_incr;
     bufp->charCount = char_incr;
 
     se_buffer_update_point( bufp, char_incr );
     bufp->modified = TRUE;
+    bufp->version++;
+    se_buffer_drop_undo( bufp );
+    se_buffer_damage_lines( bufp, 0, bufp->lineCount, bufp->lineCount - nr_lines );
 
-    se_debug( "read file: lines %d, chars: %d", bufp->lineCount, bufp->charCount );
+    se_debug( "read file: lines %lld, chars: %lld",
+              bufp->lineCount, bufp->charCount );
     return TRUE;
 }
 
@@ -687,17 +847,65 @@ int se_buffer_insertFile(se_buffer* bufp, const char* fileName)
 
 int se_buffer_appendMode(se_buffer* bufp, const char* mode, int se_buffer_init_proc(se_mode*), int isFront )
 {
-    return 0;
+    g_assert( bufp && mode );
+    se_mode *registered = bufp->world->getMajorMode( bufp->world, mode );
+    if ( !registered ) {
+        se_debug( "no such mode: %s", mode );
+        return FALSE;
+    }
+    for (se_mode *modep = bufp->modes; modep; modep = modep->next) {
+        if ( strcmp(modep->modeName, mode) == 0 )
+            return TRUE;
+    }
+
+    se_mode *modep = g_malloc( sizeof(se_mode) );
+    *modep = *registered;
+    modep->next = NULL;
+    if ( se_buffer_init_proc && !se_buffer_init_proc(modep) ) {
+        g_free( modep );
+        return FALSE;
+    }
+    
+    se_mode **link = &bufp->modes;
+    if ( !isFront ) {
+        while ( *link )
+            link = &(*link)->next;
+    }
+    modep->next = *link;
+    *link = modep;
+    se_keymap_cache_clear( &bufp->keymaps );
+    se_debug( "append mode: %s", mode );
+    return TRUE;
 }
 
 int se_buffer_deleteMode(se_buffer* bufp, const char* mode)
 {
-    return 0;
+    g_assert( bufp && mode );
+    for (se_mode **link = &bufp->modes; *link; link = &(*link)->next) {
+        se_mode *modep = *link;
+        if ( strcmp(modep->modeName, mode) == 0 ) {
+            *link = modep->next;
+            g_free( modep );
+            se_keymap_cache_clear( &bufp->keymaps );
+            return TRUE;
+        }
+    }
+    return FALSE;
 }
 
 int se_buffer_invokeMode(se_buffer* bufp, const char* mode)
 {
-    return 0;
+    g_assert( bufp && mode );
+    se_mode *modep = bufp->modes;
+    while ( modep && strcmp(modep->modeName, mode) != 0 )
+        modep = modep->next;
+    if ( !modep && bufp->majorMode && strcmp(bufp->majorMode->modeName, mode) == 0 )
+        modep = bufp->majorMode;
+    if ( !modep )
+        return FALSE;
+    
+    se_keymap_cache_clear( &bufp->keymaps );
+    return modep->init( modep );
 }
 
 int se_buffer_setMajorMode(se_buffer* bufp, const char* mode)
@@ -705,16 +913,40 @@ int se_buffer_setMajorMode(se_buffer* bufp, const char* mode)
     g_assert( bufp && mode );
     bufp->majorMode = bufp->world->getMajorMode(bufp->world, mode);
     g_assert( bufp->majorMode );
+    se_keymap_cache_clear( &bufp->keymaps );
     se_debug( "set major mode: %s", mode );
     return TRUE;
 }
 
+se_keymap* se_buffer_getKeymap(se_buffer* bufp)
+{
+    g_assert( bufp );
+    se_keymap_cache *cache = &bufp->keymaps;
+    if ( se_keymap_cache_is_valid(cache, cache->generation) )
+        return cache->keymap;
+
+    GPtrArray *maps = g_ptr_array_new();
+    for (se_mode *modep = bufp->modes; modep; modep = modep->next) {
+        if ( modep->modemap )
+            g_ptr_array_add( maps, modep->modemap );
+    }
+    if ( bufp->majorMode && bufp->majorMode->modemap )
+        g_ptr_array_add( maps, bufp->majorMode->modemap );
+    
+    se_keymap *keymap = se_keymap_cache_build( cache, (se_modemap**)maps->pdata, maps->len );
+    g_ptr_array_free( maps, TRUE );
+    return keymap;
+}
+
 int se_buffer_insertChar(se_buffer* bufp, int c)
 {
     /* se_debug( "B:No.%d, point: %d, col: %d, lines: %d", bufp->curLine, bufp->position, */
     /*           bufp->curColumn, bufp->lineCount ); */
     bufp->modified = TRUE;
+    bufp->version++;
+    se_buffer_drop_undo( bufp );
     char buf[2] = { c, 0 };
+    se_off_t first = bufp->curLine, nr_lines = bufp->lineCount;
     
     if ( !bufp->lines ) {
         bufp->lines = se_line_alloc( buf, 1 );
@@ -723,11 +955,12 @@ int se_buffer_insertChar(se_buffer* bufp, int c)
         bufp->lineCount++;
         bufp->charCount++;    
         se_buffer_update_point( bufp, 1 );
+        se_buffer_damage_lines( bufp, 0, bufp->lineCount, bufp->lineCount - nr_lines );
         return TRUE;
     }
     
     se_line *lp = bufp->getCurrentLine( bufp );
-    int col = bufp->curColumn;
+    se_off_t col = bufp->curColumn;
     if ( lp == NULL ) {
         se_line *lp_new = se_line_alloc( buf, 1 );
         se_buffer_insert_line_after( bufp, bufp->lines->previous, lp_new );
@@ -767,6 +1000,7 @@ int se_buffer_insertChar(se_buffer* bufp, int c)
 
     bufp->charCount++;    
     se_buffer_update_point( bufp, 1 );
+    se_buffer_damage_lines( bufp, first, bufp->curLine + 1, bufp->lineCount - nr_lines );
 
     /* se_debug( "A:No.%d, point: %d, col: %d, lines: %d", bufp->curLine, bufp->position, */
     /*           bufp->curColumn, bufp->lineCount ); */
@@ -782,16 +1016,16 @@ int se_buffer_insertChar(se_buffer* bufp, int c)
 int se_buffer_insertString(se_buffer* bufp, const char* str)
 {
     const char* sp = str;
-    int str_bytes = strlen( str );
-    int nr_chars = g_utf8_strlen( str, -1 );
-    se_debug( "str: %s, bytes: %d, chars: %d", str, str_bytes, nr_chars );
+    se_off_t str_bytes = strlen( str );
+    se_debug( "str: %s, bytes: %lld", str, str_bytes );
+    se_off_t first = bufp->curLine, nr_lines = bufp->lineCount;
     
     do {
         const char* endp = strchr( sp, '\n' );
         if ( !endp && (sp - str >= str_bytes) )
             break;
 
-        int buf_len = 0;
+        se_off_t buf_len = 0;
         gboolean nl_ended = TRUE;
         if ( endp ) {
             buf_len = ++endp - sp; // take '\n' into account
@@ -803,8 +1037,7 @@ int se_buffer_insertString(se_buffer* bufp, const char* str)
             nl_ended = FALSE;
         }
 
-        se_debug("process: endp - sp: %d, sp(%d): [%s], nl_ended: %d",
-                 (endp - sp), buf_len, strndup(sp, buf_len), nl_ended );
+        se_debug("process: sp(%lld), nl_ended: %d", buf_len, nl_ended );
 
         se_line *cur_lp = bufp->getCurrentLine( bufp );
         if ( !cur_lp ) {
@@ -834,18 +1067,21 @@ int se_buffer_insertString(se_buffer* bufp, const char* str)
 
             } else {
                 gboolean nl_ended2 = cur_lp->content->fullLine;
-                int lp_len = se_line_getLineLength(cur_lp);
+                se_off_t lp_len = se_line_getLineLength(cur_lp);
                 
                 if ( se_buffer_eol(bufp) && !nl_ended2 ) {
                     g_assert( bufp->curLine == bufp->lineCount - 1 );
                     se_line_insert( cur_lp, lp_len, sp, buf_len );
+                    bufp->lineCount--; // as in insertChar: no new line actually
                     
                 } else {
                     const char *orig = se_line_getData( cur_lp );
-                    int col = bufp->curColumn;
+                    se_off_t col = bufp->curColumn;
                     
                     se_line *lp_new = se_line_alloc( orig+col, lp_len - col );
                     se_line_delete( cur_lp, col, lp_len );
+                    // '\n' of cur_lp went to lp_new, sp brings its own
+                    se_line_remove_nl( cur_lp );
                     se_line_insert( cur_lp, col, sp, buf_len );
                     se_buffer_insert_line_after( bufp, cur_lp, lp_new ); 
                 }
@@ -853,8 +1089,7 @@ int se_buffer_insertString(se_buffer* bufp, const char* str)
 
         } else {
             /* se_debug("3rd switch"); */
-            int lp_len = se_line_getLineLength(cur_lp);
-            se_line_insert( cur_lp, lp_len, sp, buf_len );
+            se_line_insert( cur_lp, bufp->curColumn, sp, buf_len );
         }
         
         if ( nl_ended ) bufp->lineCount++;
@@ -868,6 +1103,9 @@ int se_buffer_insertString(se_buffer* bufp, const char* str)
     } while (1);
 
     bufp->modified = TRUE;
+    bufp->version++;
+    se_buffer_drop_undo( bufp );
+    se_buffer_damage_lines( bufp, first, bufp->curLine + 1, bufp->lineCount - nr_lines );
     return TRUE;
 }
 
@@ -881,97 +1119,322 @@ static int se_buffer_replaceString(se_buffer* bufp, const char* str)
     return TRUE;
 }
 
-static int se_buffer_deleteChar( se_buffer* bufp )
+// drop lp from ring of lines, as it became empty
+static void se_buffer_drop_line( se_buffer* bufp, se_line* lp )
 {
-    if ( se_buffer_eob(bufp) )
+    if ( bufp->lineCount == 1 )
+        bufp->lines = NULL;
+    else if ( lp == bufp->lines )
+        bufp->lines = lp->next;
+    se_buffer_delete_line( bufp, lp );
+    se_line_destroy( lp );
+    bufp->lineCount--;
+}
+
+/**
+ * chars from point on go as one range: the line of point keeps what is
+ * before point and takes what is after the range in the line it ends in,
+ * lines in between are dropped.
+ */
+static int se_buffer_deleteChars(se_buffer* bufp, se_off_t count)
+{
+    g_assert( bufp );
+    // a negative count deletes as many chars before point
+    if ( count < 0 ) {
+        count = MIN( -count, bufp->position );
+        se_buffer_update_point( bufp, -count );
+    }
+    count = MIN( count, bufp->charCount - bufp->position );
+    if ( count <= 0 )
         return TRUE;
 
+    se_off_t first = bufp->curLine, nr_lines = bufp->lineCount;
+    se_line *lp = bufp->getCurrentLine( bufp );
+    g_assert( lp );
+    se_off_t col = bufp->curColumn;
+
+    // line range ends in and offset there, at start of next line if it ends at '\n'
+    se_line *last = lp;
+    se_off_t end = col + count;
+    while ( end > se_line_getLineLength(last)
+            || (end == se_line_getLineLength(last) && last->next != bufp->lines) ) {
+        end -= se_line_getLineLength( last );
+        last = last->next;
+    }
+    
     bufp->modified = TRUE;
-    se_line *cur_lp = bufp->getCurrentLine( bufp );
-    g_assert( cur_lp );
+    bufp->version++;
+    se_buffer_drop_undo( bufp );
+    if ( last == lp && col == 0 && end == se_line_getLineLength(lp) ) {
+        // all of last line
+        se_buffer_drop_line( bufp, lp );
+    } else if ( last == lp ) {
+        // range only takes '\n' of lp if lp is last line of buffer
+        gboolean take_nl = lp->content->fullLine && end == se_line_getLineLength(lp);
+        se_line_delete( lp, col, count - (take_nl?1:0) );
+        if ( take_nl )
+            se_line_remove_nl( lp );
+    } else {
+        se_line_delete( lp, col, se_line_getLineLength(lp) );
+        se_line_remove_nl( lp );
+        se_line_insert( lp, col, se_line_getData(last) + end,
+                        se_line_getLineLength(last) - end );
+        se_line *np = lp->next;
+        while ( 1 ) {
+            se_line *next = np->next;
+            se_buffer_drop_line( bufp, np );
+            if ( np == last )
+                break;
+            np = next;
+        }
+        if ( lp->content->used == 0 )
+            se_buffer_drop_line( bufp, lp );
+    }
 
-    gboolean nl_ended = cur_lp->content->fullLine;
-    int ln_size = se_line_getLineLength( cur_lp );
-    int col = bufp->getCurrentColumn( bufp );
-    
-    if ( nl_ended ) {
-        ln_size--; // remove '\n'
-        g_assert( BETWEEN(col, 0, ln_size) );
+    bufp->charCount -= count;
+    se_buffer_damage_lines( bufp, first, first + 1, bufp->lineCount - nr_lines );
+    return TRUE;
+}
 
-        if ( ln_size == 0 ) {
-            // delete empty line
+/**
+ * append text between offsets from and to to out. *lpp is a line at or
+ * before from, and *line_start is its offset, both are moved forward.
+ */
+static void se_buffer_copy_text( se_line** lpp, se_off_t* line_start, se_off_t from,
+                                 se_off_t to, GString* out )
+{
+    while ( from < to ) {
+        se_off_t len = se_line_getLineLength( *lpp );
+        if ( from >= *line_start + len ) {
+            *line_start += len;
+            *lpp = (*lpp)->next;
+            continue;
+        }
+        se_off_t n = MIN( to, *line_start + len ) - from;
+        g_string_append_len( out, se_line_getData(*lpp) + (from - *line_start), n );
+        from += n;
+    }
+}
 
-            if ( bufp->lineCount == 1 ) {
-                bufp->lines = NULL;
-            } else if ( cur_lp == bufp->lines ) {
-                bufp->lines = cur_lp->next;
-            }
+// split text into a list of new lines, return how many
+static se_off_t se_buffer_make_lines( const char* text, se_off_t len,
+                                      se_line** first, se_line** last )
+{
+    const char *sp = text, *text_end = text + len;
+    se_off_t nr_lines = 0;
+    *first = *last = NULL;
+    while ( sp < text_end ) {
+        const char *endp = memchr( sp, '\n', text_end - sp );
+        endp = endp ? endp + 1: text_end;
+        se_line *lp = se_line_alloc( sp, endp - sp );
+        if ( *last ) {
+            (*last)->next = lp;
+            lp->previous = *last;
+        } else
+            *first = lp;
+        *last = lp;
+        nr_lines++;
+        sp = endp;
+    }
+    return nr_lines;
+}
 
-            se_buffer_delete_line( bufp, cur_lp );
-            se_line_destroy( cur_lp );
-            bufp->lineCount--;
-            bufp->charCount--;
-            return TRUE;
+static se_off_t se_buffer_replaceAll(se_buffer* bufp, regexp_entry* re, const char* str)
+{
+    g_assert( bufp && re && str );
+    if ( !bufp->lines )
+        return 0;
+
+    // all matches are found before any line changes under the search
+    GArray *hits = g_array_new( FALSE, FALSE, sizeof(se_off_t) );
+    se_search_cursor cur;
+    se_search_cursor_at( bufp, 0, &cur );
+    se_off_t from = 0, start, end, count = bufp->charCount;
+    while ( from <= count && (start = se_search_regexp_forward(bufp, re, from, &cur, &end)) >= 0 ) {
+        g_array_append_val( hits, start );
+        g_array_append_val( hits, end );
+        from = end > start ? end: end + 1;
+    }
+    se_off_t nr_hits = hits->len / 2;
+    const se_off_t *hit = (const se_off_t*)hits->data;
+    if ( !nr_hits ) {
+        g_array_free( hits, TRUE );
+        return 0;
+    }
+
+    se_buffer_drop_undo( bufp );
+    se_undo *undo = g_malloc0( sizeof(se_undo) );
+    undo->runs = g_array_new( FALSE, FALSE, sizeof(se_undo_run) );
+    undo->charCount = bufp->charCount;
+    undo->lineCount = bufp->lineCount;
+    undo->position = bufp->position;
+
+    se_off_t str_len = strlen( str );
+    GString *out = g_string_new( "" );
+    se_line *lp = bufp->lines;
+    se_off_t line_start = 0, lineno = 0, first_lineno = -1;
+    se_off_t i = 0;
+    while ( i < nr_hits ) {
+        // lines before next match stay as they are
+        while ( line_start + se_line_getLineLength(lp) <= hit[2*i] && lp->next != bufp->lines ) {
+            line_start += se_line_getLineLength( lp );
+            lp = lp->next;
+            lineno++;
         }
-        
-        if ( col == ln_size ) {
-            // merge with next line
-            se_debug( "merge with next line" );
-            if ( cur_lp->next == bufp->lines || bufp->lineCount == 1 ) {
-                se_line_remove_nl( cur_lp );
-                bufp->charCount--;
-                se_debug("tail line, remove '\n' only");
-                return TRUE;
+
+        /**
+         * a run is the lines matches start or end in, rewritten as a whole.
+         * it goes on to the next line while what is written does not end a
+         * line, as when a '\n' is replaced.
+         */
+        se_line *run_first = lp, *run_last = lp, *reader = lp;
+        se_off_t run_start = line_start, reader_start = line_start;
+        se_off_t run_end = line_start + se_line_getLineLength( lp ), nr_old = 1;
+        se_off_t pos = run_start;
+        g_string_truncate( out, 0 );
+        for (;;) {
+            while ( i < nr_hits && (hit[2*i] < run_end
+                                    || (hit[2*i] == run_end && run_last->next == bufp->lines)) ) {
+                while ( run_end < hit[2*i+1] ) {
+                    run_last = run_last->next;
+                    run_end += se_line_getLineLength( run_last );
+                    nr_old++;
+                }
+                se_buffer_copy_text( &reader, &reader_start, pos, hit[2*i], out );
+                g_string_append_len( out, str, str_len );
+                pos = hit[2*i+1];
+                i++;
             }
-            
-            se_line *to_merge = cur_lp->next;
-            se_buffer_delete_line( bufp, to_merge );
-            int merge_size = se_line_getLineLength( to_merge );
-            /* if ( to_merge->content->fullLine ) */
-            /*     merge_size--; */
-            
-            se_line_remove_nl( cur_lp );
-            se_line_insert( cur_lp, ln_size, se_line_getData(to_merge), merge_size );
-            bufp->lineCount--;
-            bufp->charCount--;
-            return TRUE;
-        } 
+            se_buffer_copy_text( &reader, &reader_start, pos, run_end, out );
+            pos = run_end;
+            if ( run_last->next == bufp->lines || !out->len || out->str[out->len-1] == '\n' )
+                break;
+            run_last = run_last->next;
+            run_end += se_line_getLineLength( run_last );
+            nr_old++;
+        }
 
-        // else
-        se_line_delete( cur_lp, col, 1 );
-        bufp->charCount--;
-        return TRUE;
+        se_undo_run run = { NULL, NULL, 0, run_first, run_last };
+        se_line *new_last = NULL;
+        run.nr_new = se_buffer_make_lines( out->str, out->len, &run.new_first, &new_last );
+
+        // swap new lines in for the run
+        se_line *prev = run_first->previous, *next = run_last->next;
+        gboolean at_head = run_first == bufp->lines, at_tail = next == bufp->lines;
+        run_first->previous = NULL;
+        run_last->next = NULL;
+        if ( at_head && at_tail ) {
+            bufp->lines = run.new_first;
+            if ( run.new_first ) {
+                new_last->next = run.new_first;
+                run.new_first->previous = new_last;
+            }
+        } else if ( run.nr_new ) {
+            prev->next = run.new_first;
+            run.new_first->previous = prev;
+            new_last->next = next;
+            next->previous = new_last;
+            if ( at_head )
+                bufp->lines = run.new_first;
+        } else {
+            prev->next = next;
+            next->previous = prev;
+            if ( at_head )
+                bufp->lines = next;
+        }
+        run.before = at_head ? NULL: prev;
+        g_array_append_val( undo->runs, run );
+
+        if ( first_lineno < 0 )
+            first_lineno = lineno;
+        bufp->charCount += out->len - (run_end - run_start);
+        bufp->lineCount += run.nr_new - nr_old;
+        lineno += run.nr_new;
+        if ( at_tail )
+            break;
+        lp = next;
+        line_start = run_end;
     }
+    g_assert( i == nr_hits );
+    g_string_free( out, TRUE );
+    g_array_free( hits, TRUE );
 
-    // else !nl_ended, so this should be the last line
-    g_assert( bufp->curLine == bufp->lineCount - 1 );
-    if ( ln_size == 1 ) {
-        se_buffer_delete_line( bufp, cur_lp );
-        if ( bufp->lineCount == 1 ) {
-            g_assert( bufp->lines == cur_lp );
-            bufp->lines = NULL;
-            se_debug("empty buffer");
-        }            
-        se_line_destroy( cur_lp );
-        bufp->lineCount--;
-    } else
-        se_line_delete( cur_lp, col, 1 );
-    
-    bufp->charCount--;
-    
-    return TRUE;
+    bufp->modified = TRUE;
+    bufp->version++;
+    se_buffer_damage_lines( bufp, first_lineno, lineno, bufp->lineCount - undo->lineCount );
+    if ( bufp->lines ) {
+        se_buffer_update_point( bufp, 0 );
+    } else {
+        bufp->position = bufp->curLine = bufp->curColumn = 0;
+    }
+    undo->version = bufp->version;
+    bufp->undoEntry = undo;
+    return nr_hits;
 }
 
-static int se_buffer_deleteChars(se_buffer* bufp, int count)
+static int se_buffer_undo(se_buffer* bufp)
 {
     g_assert( bufp );
-    if ( count <= 0 )
-        return TRUE;
+    se_undo *undo = bufp->undoEntry;
+    if ( !undo )
+        return FALSE;
+    if ( undo->version != bufp->version ) {
+        se_buffer_drop_undo( bufp );
+        return FALSE;
+    }
 
-    for (int i = 0; i < count; ++i) {
-        if ( !se_buffer_deleteChar( bufp ) )
-            return FALSE;
+    // later runs go first, so lines earlier runs hang on are still there
+    for (int i = undo->runs->len - 1; i >= 0; --i) {
+        se_undo_run *run = &g_array_index( undo->runs, se_undo_run, i );
+        se_line *prev, *next;
+        if ( run->nr_new ) {
+            se_line *new_last = run->new_first;
+            for (se_off_t n = 1; n < run->nr_new; ++n)
+                new_last = new_last->next;
+            prev = run->new_first->previous;
+            next = new_last->next;
+            if ( next == run->new_first )  // they are all of buffer
+                prev = next = NULL;
+            
+            se_line *lp = run->new_first;
+            for (se_off_t n = 0; n < run->nr_new; ++n) {
+                se_line *lp_next = lp->next;
+                se_line_destroy( lp );
+                lp = lp_next;
+            }
+        } else if ( !bufp->lines ) {
+            prev = next = NULL;
+        } else {
+            prev = run->before ? run->before: bufp->lines->previous;
+            next = prev->next;
+        }
+
+        if ( prev ) {
+            prev->next = run->old_first;
+            run->old_first->previous = prev;
+            run->old_last->next = next;
+            next->previous = run->old_last;
+        } else {
+            run->old_last->next = run->old_first;
+            run->old_first->previous = run->old_last;
+        }
+        if ( !run->before )
+            bufp->lines = run->old_first;
     }
+
+    se_off_t nr_lines = bufp->lineCount;
+    bufp->charCount = undo->charCount;
+    bufp->lineCount = undo->lineCount;
+    bufp->position = undo->position;
+    se_buffer_update_point( bufp, 0 );
+    bufp->modified = TRUE;
+    bufp->version++;
+    se_buffer_damage_lines( bufp, 0, bufp->lineCount, bufp->lineCount - nr_lines );
+
+    // old lines are back in buffer
+    g_array_free( undo->runs, TRUE );
+    g_free( undo );
+    bufp->undoEntry = NULL;
     return TRUE;
 }
 
@@ -989,6 +1452,7 @@ se_buffer* se_buffer_create(se_world* world, const char* buf_name)
 {
     se_buffer *bufp = g_malloc0( sizeof(se_buffer) );
     bufp->world = world;
+    bufp->damageFirst = -1;
     
     bufp->init = se_buffer_init;
     bufp->release = se_buffer_release;
@@ -1033,6 +1497,7 @@ se_buffer* se_buffer_create(se_world* world, const char* buf_name)
     bufp->deleteMode = se_buffer_deleteMode;
     bufp->invokeMode = se_buffer_invokeMode;
     bufp->setMajorMode = se_buffer_setMajorMode;
+    bufp->getKeymap = se_buffer_getKeymap;
     
     bufp->insertChar = se_buffer_insertChar;
     bufp->insertString = se_buffer_insertString;
@@ -1040,10 +1505,12 @@ se_buffer* se_buffer_create(se_world* world, const char* buf_name)
     bufp->replaceString = se_buffer_replaceString;
     bufp->deleteChars = se_buffer_deleteChars;
     bufp->deleteRegion = se_buffer_deleteRegion;
+    bufp->replaceAll = se_buffer_replaceAll;
+    bufp->undo = se_buffer_undo;
     bufp->copyRegion = se_buffer_copyRegion;
     
     size_t siz = strlen(buf_name);
-    se_debug( "MIN: %d", MIN(siz, SE_MAX_BUF_NAME_SIZE) );
+    se_debug( "MIN: %d", (int)MIN(siz, SE_MAX_BUF_NAME_SIZE) );
     strncpy( bufp->bufferName, buf_name, MIN(siz, SE_MAX_BUF_NAME_SIZE) );
     
     bufp->init( bufp );
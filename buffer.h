@@ -30,7 +30,25 @@ extern "C" {
 
 DEF_CLS(se_mark);
 
+/**
+ * content of a line. a chunk is owned by its line and by every published
+ * snapshot that contains it (refs), and is copied before being modified when
+ * it is shared, so readers of a snapshot always see immutable data.
+ * refs is only touched by the thread editing the buffer.
+ */
 DEF_CLS(se_chunk);
+struct se_chunk
+{
+    int refs;
+    se_off_t size;
+    se_off_t used;
+    gboolean fullLine; // line ended with '\n'
+    char data[0];
+};
+
+extern se_chunk* se_chunk_ref( se_chunk* );
+extern void se_chunk_unref( se_chunk* );
+
 DEF_CLS(se_line);
 struct se_line
 {
@@ -43,12 +61,16 @@ struct se_line
 };
 
 extern const char* se_line_getData( se_line* );
-extern int se_line_getLineLength( se_line* );
+extern se_off_t se_line_getLineLength( se_line* );
 
 #define SE_MAX_NAME_SIZE  1023
 #define SE_MAX_BUF_NAME_SIZE  ((SE_MAX_NAME_SIZE/4)-1)
 
 struct se_world;
+struct se_snapshot_domain;
+struct se_highlight;
+struct se_undo;
+struct regexp_entry_s;
 
 DEF_CLS(se_buffer);
 struct se_buffer
@@ -56,51 +78,65 @@ struct se_buffer
     se_buffer *nextBuffer;
 
     char bufferName[SE_MAX_NAME_SIZE+1];
-    char fileName[SE_MAX_BUF_NAME_SIZE+1];
+    char fileName[SE_MAX_NAME_SIZE+1];
     time_t fileTime;
     int modified;
+    int version;  // bumped by every modification
+    guint lastUsed; // tick of world when it was last current
+    // lines edited since damage was last taken, see se_buffer_take_damage
+    se_off_t damageFirst;  // -1 if none
+    se_off_t damageEnd;    // past last edited line, in current numbering
+    se_off_t damageDelta;  // lines added in between, negative if removed
     
-    int position;  // logical offset of cursor
-    int curLine;   // calculated from point
-    int curColumn; // calculated from point
+    se_off_t position;  // logical offset of cursor
+    se_off_t curLine;   // calculated from point
+    se_off_t curColumn; // calculated from point
 
-    int charCount;  // length of buffer in chars
-    int lineCount;  // total lines
+    se_off_t charCount;  // length of buffer in chars
+    se_off_t lineCount;  // total lines
     
     se_line *lines;
     se_mark *marks;
-    se_mode *modes;
+    se_mode *modes;      // minor modes, the first one binds keys first
     se_mode *majorMode;
+    // keymaps of modes and majorMode merged, what keys are dispatched with
+    se_keymap_cache keymaps;
 
     struct se_world *world;
+    // published versions for lock-free readers, NULL if never published
+    struct se_snapshot_domain *snapshots;
+    // matches of last search painted by views, NULL if none
+    struct se_highlight *highlight;
+    // how to take back last replaceAll, NULL if none
+    struct se_undo *undoEntry;
     
     int (*init)(se_buffer*);
     int (*release)(se_buffer*);
     
-    int (*setPoint)(se_buffer*, int);
-    int (*getPoint)(se_buffer*);
+    int (*setPoint)(se_buffer*, se_off_t);
+    se_off_t (*getPoint)(se_buffer*);
 
     int (*isModified)(se_buffer*);
     
     int (*getChar)(se_buffer*);
-    char* (*getStr)(se_buffer*, int max);
+    char* (*getStr)(se_buffer*, se_off_t max);
     const char* (*getBufferName)(se_buffer*);
     void (*setFileName)(se_buffer*, const char* file_name);
 
-    int (*getCharCount)(se_buffer*);
-    int (*getLineCount)(se_buffer*);    
-    int (*getLine)(se_buffer*);
+    se_off_t (*getCharCount)(se_buffer*);
+    se_off_t (*getLineCount)(se_buffer*);    
+    se_off_t (*getLine)(se_buffer*);
     se_line* (*getCurrentLine)(se_buffer*);
-    int (*getCurrentColumn)(se_buffer*);    
+    se_off_t (*getCurrentColumn)(se_buffer*);    
     
-    int (*forwardChar)(se_buffer*, int);
-    int (*forwardLine)(se_buffer*, int);
+    int (*forwardChar)(se_buffer*, se_off_t);
+    int (*forwardLine)(se_buffer*, se_off_t);
     int (*beginingOfLine)(se_buffer*);
     int (*endOfLine)(se_buffer*);
     
     // affects by narrowing, right now don't consider that
-    int (*bufferStart)(se_buffer*);
-    int (*bufferEnd)(se_buffer*);
+    se_off_t (*bufferStart)(se_buffer*);
+    se_off_t (*bufferEnd)(se_buffer*);
 
     int (*createMark)(se_buffer*, const char* name, int flags);
     void (*deleteMark)(se_buffer*, const char* name);
@@ -109,9 +145,9 @@ struct se_buffer
     // set point to the specified mark
     int (*pointToMark)(se_buffer*, const char* name);
     // get mark's position
-    int (*getMark)(se_buffer*, const char* name);
+    se_off_t (*getMark)(se_buffer*, const char* name);
     // set existed mark to pos
-    int (*setMark)(se_buffer*, const char* name, int pos);
+    int (*setMark)(se_buffer*, const char* name, se_off_t pos);
 
     // predicate point's position relative to mark `name`
     int (*pointAtMark)(se_buffer*, const char* name);
@@ -124,25 +160,52 @@ struct se_buffer
     int (*readFile)(se_buffer*); // clear and reread file into buffer
     int (*insertFile)(se_buffer*, const char* fileName);
 
-    // isFront: if true, mode it insert at the front of mode list
+    /**
+     * enable a mode registered in world as a minor mode of buffer. buffer gets
+     * its own copy of the mode, which init_proc (if not NULL) may set up.
+     * isFront: if true, mode it insert at the front of mode list
+     */
     int (*appendMode)(se_buffer*, const char* mode,
                       int (*init_proc)(se_mode*), int isFront );
     int (*deleteMode)(se_buffer*, const char* mode);
     // call mode->init()
     int (*invokeMode)(se_buffer*, const char* mode);
     int (*setMajorMode)(se_buffer*, const char* mode);
+    // effective keymap, built again only if modes or bindings changed
+    se_keymap* (*getKeymap)(se_buffer*);
     
     int (*insertChar)(se_buffer*, int c);
     int (*replaceChar)(se_buffer*, int c);
     int (*insertString)(se_buffer*, const char*);
     int (*replaceString)(se_buffer*, const char*);
-    int (*deleteChars)(se_buffer*, int count);
+    // chars before point if count is negative
+    int (*deleteChars)(se_buffer*, se_off_t count);
+    /**
+     * replace every match of re with str in one pass: matches are all found
+     * first, then lines holding them are rebuilt into fresh chunks and
+     * swapped in, so untouched lines are never copied. return number of
+     * matches replaced.
+     */
+    se_off_t (*replaceAll)(se_buffer*, struct regexp_entry_s* re, const char* str);
+    /**
+     * take back last replaceAll as a whole. other edits keep no undo yet, so
+     * it can only be done before anything else is edited, FALSE if not.
+     */
+    int (*undo)(se_buffer*);
     // delete region between point and mark
     int (*deleteRegion)(se_buffer*, const char* markName);
     int (*copyRegion)(se_buffer*, se_buffer* other, const char* markName);
 };
 
 extern se_buffer* se_buffer_create(struct se_world*, const char* buf_name);
+/**
+ * take lines edited since last call: lines [first, end) now in buffer replace
+ * lines [first, end - delta) that were there then, lines elsewhere are only
+ * renumbered. return FALSE if nothing is edited. it is meant for one reader
+ * (the highlight index), for others would miss what it took.
+ */
+extern gboolean se_buffer_take_damage( se_buffer*, se_off_t* first, se_off_t* end,
+                                       se_off_t* delta );
     
 #ifdef __cplusplus
 }
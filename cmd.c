@@ -19,21 +19,36 @@
 
 
 #include "cmd.h"
+#include "cmdreg.h"
 #include "editor.h"
+#include "search.h"
+#include "psearch.h"
+#include "occur.h"
+#include "highlight.h"
+#include "tindex.h"
+#include "fuzzy.h"
 
 se_command_args* se_command_args_create()
 {
     se_command_args *args = g_malloc0( sizeof(se_command_args) );
     args->composedStr = g_string_new("");
     args->universalArg = g_string_new("");
+    args->prefixKeys = g_string_new("");
     return args;
 }
 
-void se_command_args_destroy(se_command_args* args)
+void se_command_args_release(se_command_args* args)
 {
     g_assert( args );
     g_string_free( args->composedStr, TRUE );
     g_string_free( args->universalArg, TRUE );
+    g_string_free( args->prefixKeys, TRUE );
+}
+
+void se_command_args_destroy(se_command_args* args)
+{
+    g_assert( args );
+    se_command_args_release( args );
     g_free( args );
 }
 
@@ -43,6 +58,7 @@ se_command_args se_command_args_init()
     bzero( &args, sizeof args );
     args.composedStr = g_string_new("");
     args.universalArg = g_string_new("");
+    args.prefixKeys = g_string_new("");
     return args;
 }
 
@@ -50,8 +66,9 @@ void se_command_args_clear(se_command_args* args)
 {
     g_string_truncate( args->composedStr, 0 );
     g_string_truncate( args->universalArg, 0 );
+    g_string_truncate( args->prefixKeys, 0 );
     args->flags = 0;
-    args->keyseq = se_key_seq_null_init();
+    args->keymap = NULL;
     args->prefix_arg = 0;
 }
 
@@ -60,52 +77,113 @@ gboolean se_command_args_is_null(se_command_args* args)
     return (args->flags == 0) && (args->prefix_arg == 0);
 }
 
+char* se_command_args_echo(se_command_args* args)
+{
+    GString *echo = g_string_new( "" );
+    if ( args->flags & SE_UNIVERSAL_ARG )
+        g_string_append_printf( echo, "C-u%s%s", args->universalArg->len ? " ": "",
+                                args->universalArg->str );
+    if ( args->flags & SE_PREFIX_ARG && args->prefixKeys->len )
+        g_string_append_printf( echo, "%s%s", echo->len ? " ": "", args->prefixKeys->str );
+    return g_string_free( echo, !echo->len );
+}
+
+int se_command_echo_after(int ret, gboolean keys_echoed)
+{
+    if ( ret )
+        return SE_ECHO_NONE;
+    return keys_echoed ? SE_ECHO_NOW: SE_ECHO_LATER;
+}
+
 DEFINE_CMD(se_self_silent_command)
 {
     se_debug( "unprintable char, ignore" );
     return TRUE;
 }
 
+// repeat count a command is given, see se_command_takes_count(). it is
+// negative for C-u -N
+static se_off_t se_command_count( se_command_args* args )
+{
+    return args->prefix_arg ? args->prefix_arg: 1;
+}
+
+// for commands a negative count means nothing to, they do nothing then as
+// they would if run count times
+static se_off_t se_command_times( se_command_args* args )
+{
+    return MAX( se_command_count(args), 0 );
+}
+
+// insert count copies of str by one write
+static int se_insert_repeated( se_buffer* bufp, const char* str, se_off_t count )
+{
+    size_t len = strlen( str );
+    if ( count <= 0 )
+        return TRUE;
+    if ( count == 1 )
+        return bufp->insertString( bufp, str );
+    
+    GString *text = g_string_sized_new( len * count );
+    for (se_off_t i = 0; i < count; ++i)
+        g_string_append_len( text, str, len );
+    int ret = bufp->insertString( bufp, text->str );
+    g_string_free( text, TRUE );
+    return ret;
+}
+
 DEFINE_CMD(se_self_insert_command)
 {
+    g_assert( world->current );
     if ( args->flags & SE_IM_ARG ) {
-        return SAFE_CALL( world->current, insertString, args->composedStr->str );
-    } else {
+        return se_insert_repeated( world->current, args->composedStr->str,
+                                   se_command_times(args) );
+    } else if ( se_key_is_null(key) ) {
+        // run by name, no key typed to insert
+        return TRUE;
+    } else if ( se_command_times(args) == 1 ) {
         return SAFE_CALL( world->current, insertChar, key.ascii );
+    } else {
+        char str[2] = { key.ascii, 0 };
+        return se_insert_repeated( world->current, str, se_command_times(args) );
     }
 }
+SE_REGISTER_COUNTED_CMD(se_self_insert_command, "self-insert-command");
 
 //TODO: indent
 DEFINE_CMD(se_newline_and_indent_command)
 {
-    return SAFE_CALL( world->current, insertChar, '\n' );
+    g_assert( world->current );
+    return se_insert_repeated( world->current, "\n", se_command_times(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_newline_and_indent_command, "newline-and-indent");
 
 DEFINE_CMD(se_newline_command)
 {
-    return SAFE_CALL( world->current, insertChar, '\n' );
+    g_assert( world->current );
+    return se_insert_repeated( world->current, "\n", se_command_times(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_newline_command, "newline");
 
 DEFINE_CMD(se_indent_for_tab_command)
 {
-    for (int i = 0; i < 8; ++i) {
-        if ( !SAFE_CALL( world->current, insertChar, '\x20' ) )
-            return FALSE;
-    }
-    return TRUE;
+    g_assert( world->current );
+    return se_insert_repeated( world->current, "        ", se_command_times(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_indent_for_tab_command, "indent-for-tab-command");
 
 DEFINE_CMD(se_backspace_command)
 {
     //g_assert( key.ascii == XK_BackSpace );    
     return TRUE;
 }
+SE_REGISTER_CMD(se_backspace_command, "delete-backward-char");
 
 DEFINE_CMD(se_delete_forward_command)
 {
-    //TODO: check universalArg for count or backward delete
-    return SAFE_CALL( world->current, deleteChars, 1 );
+    return SAFE_CALL( world->current, deleteChars, se_command_count(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_delete_forward_command, "delete-char");
 
 DEFINE_CMD(se_universal_arg_command)
 {
@@ -118,7 +196,9 @@ DEFINE_CMD(se_second_dispatch_command)
 {
     se_debug("");
     args->flags |= SE_PREFIX_ARG;
-    args->keyseq.keys[args->keyseq.len++] = key;
+    if ( args->prefixKeys->len )
+        g_string_append_c( args->prefixKeys, ' ' );
+    se_key_append_string( args->prefixKeys, key );
     return FALSE;
 }
 
@@ -128,13 +208,23 @@ DEFINE_CMD(se_editor_quit_command)
     world->quit( world );
     return TRUE;
 }
+SE_REGISTER_CMD(se_editor_quit_command, "save-buffers-kill-emacs");
 
 DEFINE_CMD(se_kbd_quit_command)
 {
     se_debug("");
     se_command_args_clear( args );
+    if ( world->macro && !world->batch ) {
+        g_array_free( world->macro, TRUE );
+        world->macro = NULL;
+        se_msg( "Keyboard macro dropped" );
+    }
+    se_highlight_attach( world->current, NULL, FALSE, NULL );
+    if ( world->cancelSearch(world) )
+        se_msg( "Quit" );
     return TRUE;
 }
+SE_REGISTER_CMD(se_kbd_quit_command, "keyboard-quit");
 
 /* DEFINE_CMD(se_forward_char_command) */
 /* { */
@@ -145,47 +235,436 @@ DEFINE_CMD(se_kbd_quit_command)
 /*     return SAFE_CALL( world->current, forwardChar, 1 ); */
 /* } */
 
-CMD_TYPE se_forward_char_command = NULL;
+static DEFINE_CMD(se_forward_char_builtin_command)
+{
+    se_debug("");
+    return SAFE_CALL( world->current, forwardChar, se_command_count(args) );
+}
+
+// modes loaded at runtime (e.g. ccmode) may hook this
+CMD_TYPE se_forward_char_command = se_forward_char_builtin_command;
+
+// what keymaps compiled in bind, so a hook loaded later takes effect too
+DEFINE_CMD(se_forward_char_hooked_command)
+{
+    if ( se_forward_char_command == se_forward_char_builtin_command )
+        return se_forward_char_command( world, args, key );
+
+    // a hook knows nothing about counts, nor going backward
+    se_off_t count = se_command_times( args );
+    args->prefix_arg = 1;
+    int ret = TRUE;
+    for (se_off_t i = 0; i < count && ret; ++i)
+        ret = se_forward_char_command( world, args, key );
+    return ret;
+}
+SE_REGISTER_COUNTED_CMD(se_forward_char_hooked_command, "forward-char");
 
 DEFINE_CMD(se_backward_char_command)
 {
     se_debug("");
-    return SAFE_CALL( world->current, forwardChar, -1 );
+    return SAFE_CALL( world->current, forwardChar, -se_command_count(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_backward_char_command, "backward-char");
 
 DEFINE_CMD(se_backward_line_command)
 {
     se_debug("");
-    return SAFE_CALL( world->current, forwardLine, -1 );
+    return SAFE_CALL( world->current, forwardLine, -se_command_count(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_backward_line_command, "previous-line");
 
 DEFINE_CMD(se_forward_line_command)
 {
     se_debug("");
-    return SAFE_CALL( world->current, forwardLine, 1 );
+    return SAFE_CALL( world->current, forwardLine, se_command_count(args) );
 }
+SE_REGISTER_COUNTED_CMD(se_forward_line_command, "next-line");
 
 DEFINE_CMD(se_move_beginning_of_line_command)
 {
     se_debug("");
     return SAFE_CALL( world->current, beginingOfLine );
 }
+SE_REGISTER_CMD(se_move_beginning_of_line_command, "move-beginning-of-line");
 
 DEFINE_CMD(se_move_end_of_line_command)
 {
     se_debug("");
     return SAFE_CALL( world->current, endOfLine );
 }
+SE_REGISTER_CMD(se_move_end_of_line_command, "move-end-of-line");
+
+DEFINE_CMD(se_isearch_forward_command)
+{
+    se_debug("");
+    g_assert( !world->isearch );
+    world->isearch = se_isearch_create( world->current );
+    se_msg( "I-search: " );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_isearch_forward_command, "isearch-forward");
+
+DEFINE_CMD(se_isearch_forward_regexp_command)
+{
+    se_debug("");
+    g_assert( !world->isearch );
+    world->isearch = se_isearch_create_full( world->current, TRUE, FALSE );
+    se_msg( "Regexp I-search: " );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_isearch_forward_regexp_command, "isearch-forward-regexp");
+
+DEFINE_CMD(se_isearch_backward_regexp_command)
+{
+    se_debug("");
+    g_assert( !world->isearch );
+    world->isearch = se_isearch_create_full( world->current, TRUE, TRUE );
+    se_msg( "Regexp I-search backward: " );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_isearch_backward_regexp_command, "isearch-backward-regexp");
+
+// count matches of last isearch pattern in the whole buffer, in background
+DEFINE_CMD(se_count_matches_command)
+{
+    se_debug("");
+    if ( !world->lastSearch ) {
+        se_msg( "No previous search string" );
+        return TRUE;
+    }
+
+    world->cancelSearch( world );
+    se_buffer *bufp = world->current;
+    const char *error = NULL;
+    world->psearch = se_psearch_start( bufp, world->lastSearch->str, world->lastSearchRegexp,
+                                       bufp->getPoint(bufp), &error );
+    if ( !world->psearch ) {
+        se_msg( "Invalid search pattern: %s", error );
+        return TRUE;
+    }
+    world->psearchReported = -1;
+    world->psearchFirstReported = FALSE;
+    world->pollSearch( world );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_count_matches_command, "count-matches");
+
+// buffer visiting file, or NULL
+static se_buffer* se_find_file_buffer(se_world* world, const char* file_name)
+{
+    se_buffer *bufp = world->bufferList;
+    while ( bufp && strcmp(bufp->fileName, file_name) != 0 )
+        bufp = bufp->nextBuffer;
+    return bufp;
+}
+
+static void se_occur_last_search(se_world* world)
+{
+    const char *error = NULL;
+    // an old occur goes with its *occur* buffer
+    se_occur *occur = se_occur_start( world, world->lastSearch->str,
+                                      world->lastSearchRegexp, &error );
+    if ( !occur ) {
+        se_msg( "Invalid search pattern: %s", error );
+        return;
+    }
+    world->occur = occur;
+    world->pollSearch( world );
+}
+
+// list lines matching last isearch pattern in all buffers into *occur*
+DEFINE_CMD(se_occur_command)
+{
+    se_debug("");
+    if ( !world->lastSearch ) {
+        se_msg( "No previous search string" );
+        return TRUE;
+    }
+
+    world->cancelSearch( world );
+    se_occur_last_search( world );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_occur_command, "occur");
+
+/**
+ * open files of project with a match of last isearch pattern, shortlisted by
+ * the project index, and list their matches into *occur*. project is where
+ * the nearest index above file of current buffer is. index is brought up to
+ * date and searched in background, as reading a tree may take long.
+ */
+DEFINE_CMD(se_project_search_command)
+{
+    se_debug("");
+    if ( !world->lastSearch ) {
+        se_msg( "No previous search string" );
+        return TRUE;
+    }
+
+    // a bad pattern is told now, not after the tree is read
+    const char *error = NULL;
+    if ( world->lastSearchRegexp ) {
+        regexp_entry *re = regexp_compile( world->lastSearch->str, &error );
+        if ( !re ) {
+            se_msg( "Invalid search pattern: %s", error );
+            return TRUE;
+        }
+        regexp_free( re );
+    }
+
+    world->cancelSearch( world );
+    se_buffer *bufp = world->current;
+    char *dir = bufp->fileName[0] ? g_path_get_dirname( bufp->fileName ): g_get_current_dir();
+    char *root = se_tindex_find_root( dir );
+    g_free( dir );
+    world->projectSearch = se_tindex_job_start( root, world->lastSearch->str,
+                                                world->lastSearchRegexp );
+    g_free( root );
+    world->pollSearch( world );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_project_search_command, "project-search");
+
+DEFINE_CMD(se_occur_goto_command)
+{
+    se_debug("");
+    se_buffer *bufp = world->current;
+    se_occur_entry *entry = NULL;
+    if ( world->occur && world->occur->output == bufp )
+        entry = se_occur_entry_at( world->occur, bufp->getLine(bufp) );
+    if ( !entry ) {
+        se_msg( "No occurrence on this line" );
+        return TRUE;
+    }
+
+    se_buffer *target = entry->buffer;
+    world->bufferSetCurrent( world, target->getBufferName(target) );
+    target->setPoint( target, MIN(entry->offset, target->getCharCount(target)) );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_occur_goto_command, "occur-mode-goto-occurrence");
+
+static void se_replace_string_done(se_world* world, const se_prompt* pr)
+{
+    const char *replacement = pr->input->str;
+    se_buffer *bufp = world->current;
+    char *quoted = world->lastSearchRegexp ? NULL: regexp_quote( world->lastSearch->str );
+    const char *error = NULL;
+    regexp_entry *re = regexp_compile( quoted ? quoted: world->lastSearch->str, &error );
+    g_free( quoted );
+    if ( !re ) {
+        se_msg( "Invalid search pattern: %s", error );
+        return;
+    }
+
+    se_off_t nr_replaced = bufp->replaceAll( bufp, re, replacement );
+    regexp_free( re );
+    se_msg( "Replaced %lld occurrences", nr_replaced );
+}
+
+// replace every match of last isearch pattern in buffer at once
+DEFINE_CMD(se_replace_string_command)
+{
+    se_debug("");
+    if ( !world->lastSearch ) {
+        se_msg( "No previous search string" );
+        return TRUE;
+    }
+
+    char *prompt = g_strdup_printf( "Replace all \"%s\" with: ", world->lastSearch->str );
+    world->readString( world, prompt, NULL, se_replace_string_done );
+    g_free( prompt );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_replace_string_command, "replace-string");
+
+DEFINE_CMD(se_undo_command)
+{
+    se_debug("");
+    if ( !SAFE_CALL(world->current, undo) )
+        se_msg( "No further undo information" );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_undo_command, "undo");
+
+// most recently used first
+static gint se_compare_used(gconstpointer a, gconstpointer b)
+{
+    const se_buffer *x = *(se_buffer* const*)a, *y = *(se_buffer* const*)b;
+    return x->lastUsed > y->lastUsed ? -1: x->lastUsed < y->lastUsed;
+}
+
+// echo best matches along with input
+static void se_switch_buffer_changed(se_world* world, const char* input)
+{
+    se_fuzzy *fz = world->switcher;
+    int nr_matches = se_fuzzy_set_query( fz, input );
+    GString *shown = g_string_new( "" );
+    for (int i = 0; i < MIN(fz->matches->len, 8); ++i) {
+        se_fuzzy_match *m = &g_array_index( fz->matches, se_fuzzy_match, i );
+        g_string_append_printf( shown, "%s%s", i ? " | ": "", se_fuzzy_name(fz, m->id) );
+    }
+    se_msg( "Switch to: %s {%s}%s", input, shown->str, nr_matches > 8 ? " ...": "" );
+    g_string_free( shown, TRUE );
+}
+
+static void se_switch_buffer_done(se_world* world, const se_prompt* pr)
+{
+    const char *input = pr->input->str;
+    se_fuzzy *fz = world->switcher;
+    se_fuzzy_set_query( fz, input );
+    if ( !fz->matches->len ) {
+        se_msg( "No match" );
+        return;
+    }
+
+    int id = g_array_index( fz->matches, se_fuzzy_match, 0 ).id;
+    const char *file_name = se_fuzzy_value( fz, id );
+    if ( !file_name ) {
+        world->bufferSetCurrent( world, se_fuzzy_name(fz, id) );
+        return;
+    }
+    se_buffer *bufp = se_find_file_buffer( world, file_name );
+    if ( bufp )
+        world->bufferSetCurrent( world, bufp->getBufferName(bufp) );
+    else
+        world->loadFile( world, file_name );
+}
+
+/**
+ * switch to a buffer, or a file of project if it has an index, picked by
+ * fuzzy matching as name is typed. other buffers come first, most recently
+ * used first.
+ */
+DEFINE_CMD(se_switch_buffer_command)
+{
+    se_debug("");
+    if ( world->switcher )
+        se_fuzzy_free( world->switcher );
+    se_fuzzy *fz = world->switcher = se_fuzzy_new();
+
+    GPtrArray *buffers = g_ptr_array_new();
+    for (se_buffer *bufp = world->bufferList; bufp; bufp = bufp->nextBuffer) {
+        if ( bufp != world->current )
+            g_ptr_array_add( buffers, bufp );
+    }
+    g_ptr_array_sort( buffers, se_compare_used );
+    for (int i = 0; i < buffers->len; ++i) {
+        se_buffer *bufp = g_ptr_array_index( buffers, i );
+        se_fuzzy_add( fz, bufp->getBufferName(bufp), NULL );
+    }
+    g_ptr_array_free( buffers, TRUE );
+
+    // files are only listed by an index already there, updating may be slow
+    se_buffer *bufp = world->current;
+    char *dir = bufp->fileName[0] ? g_path_get_dirname( bufp->fileName ): g_get_current_dir();
+    char *root = se_tindex_find_root( dir );
+    se_tindex *idx = se_tindex_open( root );
+    if ( idx ) {
+        for (int i = 0; i < idx->header->nr_files; ++i) {
+            const char *name = se_tindex_file_name( idx, i );
+            char *file_name = g_build_filename( root, name, NULL );
+            if ( !se_find_file_buffer(world, file_name) )
+                se_fuzzy_add( fz, name, file_name );
+            g_free( file_name );
+        }
+        se_tindex_free( idx );
+    }
+    g_free( root );
+    g_free( dir );
+
+    world->readString( world, "Switch to: ", se_switch_buffer_changed, se_switch_buffer_done );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_switch_buffer_command, "switch-to-buffer");
+
+DEFINE_CMD(se_start_kbd_macro_command)
+{
+    se_debug("");
+    world->startMacro( world );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_start_kbd_macro_command, "start-kbd-macro");
+
+DEFINE_CMD(se_end_kbd_macro_command)
+{
+    se_debug("");
+    world->endMacro( world );
+    return TRUE;
+}
+SE_REGISTER_CMD(se_end_kbd_macro_command, "end-kbd-macro");
+
+DEFINE_CMD(se_call_last_kbd_macro_command)
+{
+    se_debug("");
+    world->executeMacro( world, se_command_times(args) );
+    return TRUE;
+}
+SE_REGISTER_COUNTED_CMD(se_call_last_kbd_macro_command, "call-last-kbd-macro");
+
+// echo commands starting with input along with it
+static void se_execute_extended_changed(se_world* world, const char* input)
+{
+    GString *shown = g_string_new( "" );
+    int nr_matches = 0;
+    size_t len = strlen( input );
+    for (int i = 0; i < se_command_registry_size(); ++i) {
+        const se_command_entry *entry = se_command_registry_entry( i );
+        if ( !entry || strncmp(entry->name, input, len) != 0 )
+            continue;
+        if ( nr_matches++ < 8 )
+            g_string_append_printf( shown, "%s%s", shown->len ? " | ": "", entry->name );
+    }
+    se_msg( "M-x %s {%s}%s", input, shown->str, nr_matches > 8 ? " ...": "" );
+    g_string_free( shown, TRUE );
+}
+
+static void se_execute_extended_done(se_world* world, const se_prompt* pr)
+{
+    const char *input = pr->input->str;
+    se_key_command_t cmd = se_command_lookup( input );
+    if ( !cmd ) {
+        se_msg( "[No match] %s", input );
+        return;
+    }
+
+    se_command_args args = se_command_args_init();
+    se_off_t nr_execution = pr->count;
+    if ( se_command_takes_count(cmd) ) {
+        args.prefix_arg = nr_execution;
+        nr_execution = 1;
+    }
+    for (se_off_t i = 0; i < nr_execution; ++i) {
+        if ( !cmd(world, &args, se_key_null_init()) )
+            break;
+    }
+    se_command_args_release( &args );
+}
+
+// read name of a command and run it, as if its keys were typed
+DEFINE_CMD(se_execute_extended_command)
+{
+    se_debug("");
+    // C-u count given to M-x goes to the command it reads
+    se_prompt *pr = world->readString( world, "M-x ", se_execute_extended_changed,
+                                       se_execute_extended_done );
+    pr->count = se_command_count( args );
+    return TRUE;
+}
+SE_REGISTER_COUNTED_CMD(se_execute_extended_command, "execute-extended-command");
 
 DEFINE_CMD(se_previous_buffer_command)
 {
     se_debug("");
     return world->bufferSetPrevious( world ) != NULL;
 }
+SE_REGISTER_CMD(se_previous_buffer_command, "previous-buffer");
 
 DEFINE_CMD(se_next_buffer_command)
 {
     se_debug("");
     return world->bufferSetNext( world ) != NULL;
 }
+SE_REGISTER_CMD(se_next_buffer_command, "next-buffer");
 
@@ -38,23 +38,41 @@ DEF_CLS(se_command_args);
 struct se_command_args
 {
     int flags;
-    int prefix_arg;
+    se_off_t prefix_arg; // repeat count of a command taking one, 0 means 1
     /**
      * SE_PREFIX_ARG set:
      *
-     * when a keybinding comes from a key seq, member keyseq records all keys
-     * current has been typed, and it certainly a prefix of a keybinding's seq.
+     * when a keybinding comes from a key seq, keymap is where the keys typed
+     * so far lead in the effective keymap of buffer, so the next key is one
+     * lookup there. it is only good while that keymap is still built with the
+     * same generation. prefixKeys is the keys typed so far, for messages.
      */
-    se_key_seq keyseq;
+    struct se_keymap *keymap;
+    unsigned int generation;
+    GString *prefixKeys;
     GString *composedStr; // this is valid when use a IM to input
     GString *universalArg; 
 };
 
 extern se_command_args* se_command_args_create();
 extern void se_command_args_destroy(se_command_args*);
+// free strings of args on stack or embedded, as from se_command_args_init()
+extern void se_command_args_release(se_command_args*);
 extern se_command_args se_command_args_init();
 extern void se_command_args_clear(se_command_args*);
 extern gboolean se_command_args_is_null(se_command_args*);
+// keys of a command typed so far, as Emacs echoes them, NULL if none.
+// free it after use
+extern char* se_command_args_echo(se_command_args*);
+
+enum {
+    SE_ECHO_NONE,   // command is complete, nothing is left to echo
+    SE_ECHO_NOW,    // keys were echoed already, so each one more is at once
+    SE_ECHO_LATER,  // echo keys once user pauses
+};
+// what a view does about echoing after dispatching a key returned ret, and
+// keys_echoed tells if keys of this command were echoed already
+extern int se_command_echo_after(int ret, gboolean keys_echoed);
     
 struct se_world;
 // return TRUE means exiting command dispatch loop
@@ -85,13 +103,30 @@ extern DECLARE_CMD(se_backward_line_command);
 extern DECLARE_CMD(se_move_end_of_line_command);
 extern DECLARE_CMD(se_move_beginning_of_line_command);
 
+extern DECLARE_CMD(se_isearch_forward_command);
+extern DECLARE_CMD(se_isearch_forward_regexp_command);
+extern DECLARE_CMD(se_isearch_backward_regexp_command);
+extern DECLARE_CMD(se_count_matches_command);
+extern DECLARE_CMD(se_occur_command);
+extern DECLARE_CMD(se_occur_goto_command);
+extern DECLARE_CMD(se_project_search_command);
+extern DECLARE_CMD(se_replace_string_command);
+extern DECLARE_CMD(se_undo_command);
+extern DECLARE_CMD(se_switch_buffer_command);
+extern DECLARE_CMD(se_start_kbd_macro_command);
+extern DECLARE_CMD(se_end_kbd_macro_command);
+extern DECLARE_CMD(se_call_last_kbd_macro_command);
+extern DECLARE_CMD(se_execute_extended_command);
+
 extern DECLARE_CMD(se_previous_buffer_command);
 extern DECLARE_CMD(se_next_buffer_command);
 
 #define DEFINE_CMD(cmd_name) int cmd_name(se_world* world, se_command_args* args, se_key key)
 
 typedef int (*CMD_TYPE)(struct se_world*, se_command_args*, se_key);
-extern CMD_TYPE se_forward_char_command SE_ATTR_RELOC SE_DYNAMIC;
+extern CMD_TYPE se_forward_char_command SE_DYNAMIC;
+// calls se_forward_char_command
+extern DECLARE_CMD(se_forward_char_hooked_command);
 
 #ifdef __cplusplus
 }
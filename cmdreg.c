@@ -0,0 +1,182 @@
+/**
+ * Command Registry - commands by name, for M-x
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "cmdreg.h"
+
+// defined by the linker around section editorcmds, weak if none is there
+extern const se_command_entry *const __start_editorcmds[] SE_DYNAMIC;
+extern const se_command_entry *const __stop_editorcmds[] SE_DYNAMIC;
+
+/**
+ * hash and displace: names go to buckets by hash with seed 0, then buckets
+ * are placed biggest first, each trying seeds until all its names hash into
+ * free slots. a bucket of one name takes any free slot, which is kept as
+ * -slot-1 instead of a seed.
+ */
+static const se_command_entry **se_command_slots = NULL;
+static int *se_command_seeds = NULL; // one per bucket
+static int se_nr_commands = 0;
+static GHashTable *se_counted_commands = NULL; // cmd -> its entry
+static gboolean se_command_registry_built = FALSE;
+
+static guint32 se_command_hash( guint32 seed, const char* name )
+{
+    guint32 h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (; *name; ++name)
+        h = (h ^ (guchar)*name) * 16777619u;
+    // fnv alone spreads close seeds poorly
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+// try seed for names of a bucket, they must go to distinct free slots
+static gboolean se_command_place( const se_command_entry** names, int nr, guint32 seed,
+                                  int* slots )
+{
+    for (int i = 0; i < nr; ++i) {
+        slots[i] = se_command_hash( seed, names[i]->name ) % se_nr_commands;
+        if ( se_command_slots[slots[i]] )
+            return FALSE;
+        for (int j = 0; j < i; ++j) {
+            if ( slots[j] == slots[i] )
+                return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+void se_command_registry_build()
+{
+    if ( se_command_registry_built )
+        return;
+    se_command_registry_built = TRUE;
+    
+    const se_command_entry *const *start = __start_editorcmds, *const *stop = __stop_editorcmds;
+    int nr = (start && stop) ? stop - start: 0;
+    se_nr_commands = nr;
+    se_counted_commands = g_hash_table_new( g_direct_hash, g_direct_equal );
+    for (int i = 0; i < nr; ++i) {
+        if ( start[i]->counted )
+            g_hash_table_insert( se_counted_commands, (gpointer)start[i]->cmd,
+                                 (gpointer)start[i] );
+    }
+    if ( !nr )
+        return;
+    
+    se_command_slots = g_malloc0( nr * sizeof(se_command_entry*) );
+    se_command_seeds = g_malloc0( nr * sizeof(int) );
+
+    // sort names by bucket, counting first
+    int *first = g_malloc0( (nr + 1) * sizeof(int) );
+    int *bucket_of = g_malloc( nr * sizeof(int) );
+    for (int i = 0; i < nr; ++i) {
+        bucket_of[i] = se_command_hash( 0, start[i]->name ) % nr;
+        first[bucket_of[i] + 1]++;
+    }
+    int max_size = 0;
+    for (int b = 0; b < nr; ++b) {
+        max_size = MAX( max_size, first[b+1] );
+        first[b+1] += first[b];
+    }
+    const se_command_entry **sorted = g_malloc( nr * sizeof(se_command_entry*) );
+    int *fill = g_malloc( nr * sizeof(int) );
+    memcpy( fill, first, nr * sizeof(int) );
+    for (int i = 0; i < nr; ++i)
+        sorted[fill[bucket_of[i]]++] = start[i];
+
+    int *slots = g_malloc( max_size * sizeof(int) );
+    int free_slot = 0;
+    for (int size = max_size; size > 0; --size) {
+        for (int b = 0; b < nr; ++b) {
+            const se_command_entry **names = sorted + first[b];
+            if ( first[b+1] - first[b] != size )
+                continue;
+
+            if ( size == 1 ) {
+                while ( se_command_slots[free_slot] )
+                    ++free_slot;
+                se_command_slots[free_slot] = names[0];
+                se_command_seeds[b] = -free_slot - 1;
+                continue;
+            }
+
+            // same names always collide, no seed would do
+            int nr_names = size;
+            for (int i = 1; i < nr_names; ++i) {
+                for (int j = 0; j < i; ++j) {
+                    if ( strcmp(names[i]->name, names[j]->name) == 0 ) {
+                        se_warn( "command %s registered twice", names[i]->name );
+                        names[i--] = names[--nr_names];
+                        break;
+                    }
+                }
+            }
+
+            guint32 seed = 1;
+            while ( !se_command_place(names, nr_names, seed, slots) )
+                ++seed;
+            for (int i = 0; i < nr_names; ++i)
+                se_command_slots[slots[i]] = names[i];
+            se_command_seeds[b] = seed;
+        }
+    }
+
+    g_free( slots );
+    g_free( fill );
+    g_free( sorted );
+    g_free( bucket_of );
+    g_free( first );
+    se_debug( "%d commands registered", nr );
+}
+
+se_key_command_t se_command_lookup( const char* name )
+{
+    g_assert( name );
+    se_command_registry_build();
+    if ( !se_nr_commands )
+        return NULL;
+
+    int seed = se_command_seeds[se_command_hash(0, name) % se_nr_commands];
+    int slot = seed < 0 ? -seed - 1: se_command_hash( seed, name ) % se_nr_commands;
+    const se_command_entry *entry = se_command_slots[slot];
+    return (entry && strcmp(entry->name, name) == 0) ? entry->cmd: NULL;
+}
+
+gboolean se_command_takes_count( se_key_command_t cmd )
+{
+    se_command_registry_build();
+    return g_hash_table_contains( se_counted_commands, (gconstpointer)cmd );
+}
+
+int se_command_registry_size()
+{
+    se_command_registry_build();
+    return se_nr_commands;
+}
+
+const se_command_entry* se_command_registry_entry( int i )
+{
+    se_command_registry_build();
+    g_assert( BETWEEN(i, 0, se_nr_commands - 1) );
+    return se_command_slots[i];
+}
@@ -0,0 +1,74 @@
+/**
+ * Command Registry - commands by name, for M-x
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * SE_REGISTER_CMD puts a pointer to an entry naming a command in section
+ * editorcmds of the object defining it. pointers, unlike entries, are never
+ * padded apart there. the linker gathers them between __start_editorcmds
+ * and __stop_editorcmds, and they are hashed by name once at startup into a
+ * minimal perfect hash, so a lookup is one or two hashes and a compare.
+ */
+
+#ifndef _semacs_cmdreg_h
+#define _semacs_cmdreg_h
+
+#include "cmd.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+DEF_CLS(se_command_entry);
+struct se_command_entry
+{
+    const char *name; // as in Emacs, e.g. "forward-char"
+    se_key_command_t cmd;
+    gboolean counted; // does repeat count itself, see se_command_takes_count()
+};
+
+#define SE_REGISTER_CMD_ENTRY(cmd_name, name, counted)                  \
+    static const se_command_entry se_command_entry_##cmd_name =         \
+    { name, cmd_name, counted };                                        \
+    static const se_command_entry *se_command_ref_##cmd_name SE_ATTR_RELOC = \
+    &se_command_entry_##cmd_name
+
+#define SE_REGISTER_CMD(cmd_name, name) SE_REGISTER_CMD_ENTRY(cmd_name, name, FALSE)
+// for a command doing its repeat count in one go, others are run count times
+#define SE_REGISTER_COUNTED_CMD(cmd_name, name) SE_REGISTER_CMD_ENTRY(cmd_name, name, TRUE)
+
+// done once, later calls do nothing
+extern void se_command_registry_build();
+// NULL if no command is registered as name
+extern se_key_command_t se_command_lookup(const char* name);
+/**
+ * if cmd does the repeat count of C-u itself, taking it from prefix_arg of
+ * args, so dispatching runs it once instead of count times
+ */
+extern gboolean se_command_takes_count(se_key_command_t cmd);
+// entries in no particular order, for completion. NULL where a name
+// registered twice was dropped
+extern int se_command_registry_size();
+extern const se_command_entry* se_command_registry_entry(int i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -19,12 +19,24 @@
 
 #include "buffer.h"
 #include "editor.h"
+#include "snapshot.h"
+#include "search.h"
+#include "psearch.h"
+#include "occur.h"
+#include "highlight.h"
+#include "fuzzy.h"
+#include "cmdreg.h"
+#include "tindex.h"
+
+#include <X11/keysym.h>
 
 #include <libgen.h>
 
 const char gFundamentalModeName[] = "Fundamental";
 const char gFundamentalModeMapName[] = "fundamental-mode-map";
 
+static void se_world_prompt_end(se_world* world);
+
 static se_modemap* se_world_init_fundamentalModeMap()
 {
     g_assert( !fundamentalModeMap );
@@ -36,29 +48,36 @@ static se_modemap* se_world_init_fundamentalModeMap()
 
 static int se_world_create_fundamentalMode(se_world* world)
 {
-    g_assert( !fundamentalMode );
-    fundamentalMode = se_mode_create( gFundamentalModeName,
-                                      se_world_init_fundamentalModeMap );
+    // it is shared by all worlds
+    if ( !fundamentalMode )
+        fundamentalMode = se_mode_create( gFundamentalModeName,
+                                          se_world_init_fundamentalModeMap );
     world->registerMode( world, fundamentalMode );
     return TRUE;
 }
 
+static se_modemap* se_world_init_occurModeMap()
+{
+    return se_modemap_builtin_create( "occur-mode-map", &se_occur_keymap );
+}
+
 void se_world_registerMode(se_world* world, se_mode* mode)
 {
     g_assert( world && mode );
     if ( !world->mode_hash ) {
         world->mode_hash = g_hash_table_new( g_str_hash, g_str_equal );
     }
-    g_hash_table_insert( world->mode_hash,
-                         strdup(gFundamentalModeName), fundamentalMode );
+    g_hash_table_insert( world->mode_hash, strdup(mode->modeName), mode );
 }
 
 static int se_world_init(se_world* world)
 {
     assert( world );
     assert( world->bufferList == NULL && world->current == NULL );
+    se_command_registry_build();
     se_world_create_fundamentalMode( world );
     g_assert( fundamentalMode );
+    world->registerMode( world, se_mode_create(SE_OCCUR_MODE_NAME, se_world_init_occurModeMap) );
 
     //FIXME: create two buffers
     const char init_str[] = "# 测试缓冲区，在这里试试emacs键绑定\n"
@@ -79,6 +98,25 @@ static int se_world_init(se_world* world)
 static int se_world_finish(se_world* world)
 {
     g_assert( world );
+    world->cancelSearch( world );
+    if ( world->occur ) {
+        se_occur_free( world->occur );
+        world->occur = NULL;
+    }
+    if ( world->prompt )
+        se_world_prompt_end( world );
+    if ( world->switcher ) {
+        se_fuzzy_free( world->switcher );
+        world->switcher = NULL;
+    }
+    if ( world->macro ) {
+        g_array_free( world->macro, TRUE );
+        world->macro = NULL;
+    }
+    if ( world->lastMacro ) {
+        g_array_free( world->lastMacro, TRUE );
+        world->lastMacro = NULL;
+    }
     if ( world->bufferList ) {
         while ( world->current ) {
             se_buffer* bufp = world->current;
@@ -158,20 +196,32 @@ static int se_world_bufferClear(se_world* world, const char* buf_name)
 
 static int se_world_bufferDelete(se_world* world, const char* buf_name)
 {
-    se_buffer *bufp = world->bufferList;
+    se_buffer *bufp = world->bufferList, *prev = NULL;
     while ( bufp ) {
         if ( strcmp(bufp->getBufferName(bufp), buf_name) == 0 ) {
-            if ( bufp == world->current )
-                world->current = bufp->nextBuffer;
-
-            if ( bufp == world->bufferList )
+            if ( world->psearch && world->psearch->buffer == bufp )
+                world->cancelSearch( world );
+            if ( world->occur && world->occur->output == bufp ) {
+                se_occur_free( world->occur );
+                world->occur = NULL;
+            } else if ( world->occur ) {
+                se_occur_forget_buffer( world->occur, bufp );
+            }
+            if ( prev )
+                prev->nextBuffer = bufp->nextBuffer;
+            else
                 world->bufferList = bufp->nextBuffer;
+
+            if ( bufp == world->current )
+                world->current = bufp->nextBuffer ? bufp->nextBuffer: world->bufferList;
             
+            se_highlight_attach( bufp, NULL, FALSE, NULL );
             bufp->release( bufp );
             g_free( bufp );
             return TRUE;
         }
 
+        prev = bufp;
         bufp = bufp->nextBuffer;
     }
     
@@ -188,6 +238,7 @@ static int se_world_bufferSetCurrent(se_world* world, const char* buf_name)
             //TODO: set modes etc
             return TRUE;
         }
+        bufp = bufp->nextBuffer;
     }
 
     se_debug( "can not find buf named [%s]", buf_name );
@@ -239,12 +290,239 @@ static char* se_world_bufferGetName(se_world* world)
 }
 
 
-static int se_world_dispatchCommand(se_world* world, se_command_args* args, se_key key)
+static void se_world_isearch_end(se_world* world)
+{
+    se_isearch *isearch = world->isearch;
+    if ( isearch->pattern->len ) {
+        if ( !world->lastSearch )
+            world->lastSearch = g_string_new( "" );
+        g_string_assign( world->lastSearch, isearch->pattern->str );
+        world->lastSearchRegexp = isearch->regexp;
+    }
+    se_isearch_free( world->isearch );
+    world->isearch = NULL;
+}
+
+/**
+ * feed key to active isearch, return TRUE if it is consumed. keys that isearch
+ * does not know end it and go on to be dispatched as usual.
+ */
+static gboolean se_world_isearch_key(se_world* world, se_key key)
+{
+    se_isearch *isearch = world->isearch;
+    if ( key.modifiers == 0 && BETWEEN(key.ascii, 0x20, 0x7e) ) {
+        se_isearch_add_char( isearch, key.ascii );
+        
+    } else if ( (key.modifiers & ~MetaDown) == ControlDown
+                && key.ascii == (isearch->backward ? 'r': 's') ) {
+        // C-s or C-M-s, C-r or C-M-r backward
+        se_isearch_repeat( isearch );
+        
+    } else if ( key.modifiers == 0 && key.ascii == XK_BackSpace ) {
+        se_isearch_delete_char( isearch );
+        
+    } else if ( key.modifiers == ControlDown && key.ascii == 'g' ) {
+        // abort and go back where it began
+        isearch->buffer->setPoint( isearch->buffer, isearch->origin );
+        se_highlight_attach( isearch->buffer, NULL, FALSE, NULL );
+        se_world_isearch_end( world );
+        return TRUE;
+        
+    } else {
+        se_world_isearch_end( world );
+        return key.modifiers == 0 && key.ascii == XK_Return;
+    }
+
+    // matches are painted as pattern is typed, and stay after search ends
+    se_highlight_attach( isearch->buffer, isearch->pattern->str, isearch->regexp, NULL );
+    se_msg( "%s%sI-search%s: %s%s%s%s", isearch->hit.failing ? "Failing ": "",
+            isearch->regexp ? (isearch->hit.failing ? "regexp ": "Regexp "): "",
+            isearch->backward ? " backward": "", isearch->pattern->str,
+            isearch->error ? " [": "", isearch->error ? isearch->error: "",
+            isearch->error ? "]": "" );
+    return TRUE;
+}
+
+static se_prompt* se_world_readString(se_world* world, const char* prompt,
+                                      se_prompt_changed changed, se_prompt_done done)
+{
+    g_assert( world && prompt && done && !world->prompt );
+    se_prompt *pr = g_malloc0( sizeof(se_prompt) );
+    pr->prompt = g_strdup( prompt );
+    pr->input = g_string_new( "" );
+    pr->changed = changed;
+    pr->done = done;
+    pr->count = 1;
+    world->prompt = pr;
+    if ( changed )
+        changed( world, "" );
+    else
+        se_msg( "%s", prompt );
+    return pr;
+}
+
+static void se_prompt_free(se_prompt* pr)
+{
+    g_free( pr->prompt );
+    g_string_free( pr->input, TRUE );
+    g_free( pr );
+}
+
+static void se_world_prompt_end(se_world* world)
+{
+    se_prompt *pr = world->prompt;
+    world->prompt = NULL;
+    se_prompt_free( pr );
+}
+
+// feed key to the line being read, every key is taken
+static void se_world_prompt_key(se_world* world, se_key key)
+{
+    se_prompt *pr = world->prompt;
+    if ( key.modifiers == 0 && BETWEEN(key.ascii, 0x20, 0x7e) ) {
+        g_string_append_c( pr->input, key.ascii );
+        
+    } else if ( key.modifiers == 0 && key.ascii == XK_BackSpace ) {
+        if ( pr->input->len )
+            g_string_truncate( pr->input, pr->input->len - 1 );
+        
+    } else if ( key.modifiers == ControlDown && key.ascii == 'g' ) {
+        se_world_prompt_end( world );
+        se_msg( "Quit" );
+        return;
+        
+    } else if ( key.modifiers == 0 && key.ascii == XK_Return ) {
+        // done may read another line
+        world->prompt = NULL;
+        pr->done( world, pr );
+        se_prompt_free( pr );
+        return;
+    }
+    
+    if ( pr->changed )
+        pr->changed( world, pr->input->str );
+    else
+        se_msg( "%s%s", pr->prompt, pr->input->str );
+}
+
+static int se_world_pollOccur(se_world* world)
+{
+    se_occur *occur = world->occur;
+    if ( !occur || !occur->pool )
+        return FALSE;
+
+    if ( !se_occur_poll(occur) ) {
+        se_msg( "Searching: %d matches in %d buffers so far", occur->nr_matches,
+                occur->nr_buffers );
+        return TRUE;
+    }
+    se_msg( "%d matches in %d buffers for \"%s\"", occur->nr_matches, occur->nr_buffers,
+            occur->pattern );
+    return FALSE;
+}
+
+// once project is searched, visit files having a match and list them in occur
+static int se_world_pollProject(se_world* world)
+{
+    se_tindex_job *job = world->projectSearch;
+    if ( !job )
+        return FALSE;
+    if ( !se_tindex_job_poll(job) ) {
+        se_msg( "Indexing %s...", job->root );
+        return TRUE;
+    }
+
+    world->projectSearch = NULL;
+    se_debug( "%d files reused, %d read, %d searched", job->nr_reused, job->nr_scanned,
+              job->nr_candidates );
+    if ( !job->hits ) {
+        se_msg( "Project index failed: %s", job->error );
+        se_tindex_job_free( job );
+        return FALSE;
+    }
+
+    for (char **hit = job->hits; *hit; ++hit) {
+        se_buffer *bufp = world->bufferList;
+        while ( bufp && strcmp(bufp->fileName, *hit) != 0 )
+            bufp = bufp->nextBuffer;
+        if ( !bufp )
+            world->loadFile( world, *hit );
+    }
+    const char *error = NULL;
+    se_occur *occur = se_occur_start( world, job->pattern, job->regexp, &error );
+    se_tindex_job_free( job );
+    if ( !occur ) {
+        se_msg( "Invalid search pattern: %s", error );
+        return FALSE;
+    }
+    world->occur = occur;
+    return TRUE;
+}
+
+static int se_world_pollSearch(se_world* world)
+{
+    int project_running = se_world_pollProject( world );
+    // both may run at once
+    int occur_running = se_world_pollOccur( world ) || project_running;
+    se_psearch *ps = world->psearch;
+    if ( !ps )
+        return occur_running;
+
+    gboolean finished = se_psearch_poll( ps );
+    se_psearch_hit first;
+    gboolean first_found = se_psearch_first_hit( ps, &first );
+    if ( finished || (int)ps->hits->len != world->psearchReported
+         || first_found != world->psearchFirstReported ) {
+        const char *state = finished ? "": "Searching: ";
+        const char *more = finished ? "": " so far";
+        if ( first_found )
+            se_msg( "%s%d matches%s, first after point on line %lld", state, ps->hits->len,
+                    more, se_snapshot_find_line(ps->snapshot, first.start) + 1 );
+        else if ( finished )
+            se_msg( "%d matches, none after point", ps->hits->len );
+        else
+            se_msg( "Searching: %d matches so far", ps->hits->len );
+        world->psearchReported = ps->hits->len;
+        world->psearchFirstReported = first_found;
+    }
+
+    if ( finished ) {
+        se_psearch_free( ps );
+        world->psearch = NULL;
+    }
+    return !finished || occur_running;
+}
+
+static int se_world_cancelSearch(se_world* world)
+{
+    gboolean running = FALSE;
+    if ( world->psearch ) {
+        se_psearch_free( world->psearch );
+        world->psearch = NULL;
+        running = TRUE;
+    }
+    if ( world->occur && world->occur->pool ) {
+        se_occur_cancel( world->occur );
+        running = TRUE;
+    }
+    if ( world->projectSearch ) {
+        se_tindex_job_free( world->projectSearch );
+        world->projectSearch = NULL;
+        running = TRUE;
+    }
+    return running;
+}
+
+static int se_world_dispatch_key(se_world* world, se_command_args* args, se_key key)
 {
+    if ( world->prompt ) {
+        se_world_prompt_key( world, key );
+        return TRUE;
+    }
+    if ( world->isearch && se_world_isearch_key(world, key) )
+        return TRUE;
+    
     se_buffer *bufp = world->current;
-    se_modemap *map = bufp->majorMode->modemap;
-    g_assert( map );
-    se_key_seq keyseq = se_key_seq_null_init();
     
     if ( args->flags & SE_IM_ARG ) {
         se_debug( "SE_IM_ARG set " );
@@ -253,39 +531,202 @@ static int se_world_dispatchCommand(se_world* world, se_command_args* args, se_k
 
     if ( args->flags & SE_UNIVERSAL_ARG ) {
         se_debug( "SE_UNIVERSAL_ARG set");
-        if ( BETWEEN(key.ascii, '0', '9') ) {
-            g_string_append_printf(args->universalArg, "%c", key.ascii);
+        // a '-' first makes count negative
+        if ( BETWEEN(key.ascii, '0', '9')
+             || (key.ascii == '-' && !key.modifiers && !args->universalArg->len) ) {
+            g_string_append_c( args->universalArg, key.ascii );
             return FALSE;
         }
         // else loop cmd according to universalArg
     }
 
-    if ( args->flags & SE_PREFIX_ARG )
-        keyseq = args->keyseq;
-    keyseq.keys[keyseq.len++] = key;
-
-    se_debug( "search keybinding for %s", se_key_seq_to_string(keyseq) );
-    se_key_command_t cmd = se_modemap_lookup_command_ex( map, keyseq );
-    if ( !cmd ) {
-        se_msg( "key seq [%s] is not binded", se_key_seq_to_string(keyseq) );
+    // go on from where the prefix typed so far leads, if bindings stay same
+    se_keymap *keymap = args->keymap;
+    if ( !(args->flags & SE_PREFIX_ARG) || !keymap
+         || !se_keymap_cache_is_valid(&bufp->keymaps, args->generation) ) {
+        if ( args->flags & SE_PREFIX_ARG )
+            se_debug( "keymap changed, prefix dropped" );
+        keymap = bufp->getKeymap( bufp );
+        g_string_truncate( args->prefixKeys, 0 );
+    }
+    args->keymap = NULL;
+
+    se_keymap_entry *entry = se_keymap_lookup( keymap, key );
+    if ( !entry ) {
+        char *rep = se_key_to_string( key );
+        se_msg( "key seq [%s%s%s] is not binded", args->prefixKeys->str,
+                args->prefixKeys->len ? " ": "", rep );
+        g_free( rep );
+        g_string_truncate( args->prefixKeys, 0 );
         return TRUE;
     }
-
-    int nr_execution = 1;
-    if ( args->flags & SE_UNIVERSAL_ARG && cmd != se_kbd_quit_command )
-        nr_execution = strtol( args->universalArg->str, NULL, 10 );
+    if ( entry->next ) {
+        args->keymap = entry->next;
+        args->generation = bufp->keymaps.generation;
+        return se_second_dispatch_command( world, args, key );
+    }
+    se_key_command_t cmd = entry->cmd;
+    g_string_truncate( args->prefixKeys, 0 );
+
+    se_off_t nr_execution = 1;
+    if ( args->flags & SE_UNIVERSAL_ARG && cmd != se_kbd_quit_command ) {
+        const char *digits = args->universalArg->str;
+        // C-u - alone is -1 as in Emacs
+        nr_execution = strcmp(digits, "-") == 0 ? -1: strtoll( digits, NULL, 10 );
+    }
     //TODO: if nr_execution == 0, it should mean something according to Emacs C-u
     nr_execution = nr_execution?:4;
-    se_debug("execute cmd %d times", nr_execution );
+    // repeat in one go if cmd can
+    if ( se_command_takes_count(cmd) ) {
+        args->prefix_arg = nr_execution;
+        nr_execution = 1;
+    }
+    se_debug("execute cmd %lld times", nr_execution );
 
     gboolean ret = TRUE;    
-    for (int i = 0; i < nr_execution; ++i) {
+    for (se_off_t i = 0; i < nr_execution; ++i) {
         if ( (ret = cmd( bufp->world, args, key)) == FALSE )
             break;
     }
+
+    // buffer a command leaves current is the most recently used
+    world->current->lastUsed = ++world->useTick;
+
+    // readers have versions published as they start, one nothing reads
+    // any more is let go instead of following every edit
+    if ( bufp->snapshots )
+        se_snapshot_drop_unused( bufp );
+    return ret;
+}
+
+static int se_world_dispatchCommand(se_world* world, se_command_args* args, se_key key)
+{
+    if ( world->macro && !world->batch )
+        g_array_append_val( world->macro, key );
+    int ret = se_world_dispatch_key( world, args, key );
+    // a macro ends with the last command done, not one half typed
+    if ( ret && world->macro )
+        world->macroMark = world->macro->len;
+    return ret;
+}
+
+// a plain key bound to self-insert
+static gboolean se_world_self_inserts(se_keymap* keymap, se_key key)
+{
+    if ( key.modifiers || !BETWEEN(key.ascii, 0x20, 0x7e) )
+        return FALSE;
+    se_keymap_entry *entry = se_keymap_lookup( keymap, key );
+    return entry && !entry->next && entry->cmd == se_self_insert_command;
+}
+
+static int se_world_dispatchKeys(se_world* world, se_command_args* args, const se_key* keys,
+                                 int nr)
+{
+    int ret = TRUE;
+    for (int i = 0; i < nr; ) {
+        se_buffer *bufp = world->current;
+        int run = 0;
+        // nothing may take keys before keymap, nor be half typed
+        if ( !world->prompt && !world->isearch && se_command_args_is_null(args) ) {
+            se_keymap *keymap = bufp->getKeymap( bufp );
+            while ( i + run < nr && se_world_self_inserts(keymap, keys[i+run]) )
+                ++run;
+        }
+        
+        if ( run < 2 ) {
+            if ( (ret = world->dispatchCommand(world, args, keys[i])) )
+                se_command_args_clear( args );
+            ++i;
+            continue;
+        }
+
+        se_debug( "insert %d keys at once", run );
+        // a burst of typing fits on stack
+        char small[256];
+        char *text = run < sizeof small ? small: g_malloc( run + 1 );
+        for (int j = 0; j < run; ++j)
+            text[j] = keys[i+j].ascii;
+        text[run] = '\0';
+        bufp->insertString( bufp, text );
+        if ( text != small )
+            g_free( text );
+
+        // as if each went through dispatchCommand
+        if ( world->macro && !world->batch ) {
+            g_array_append_vals( world->macro, keys + i, run );
+            world->macroMark = world->macro->len;
+        }
+        bufp->lastUsed = ++world->useTick;
+        if ( bufp->snapshots )
+            se_snapshot_drop_unused( bufp );
+        ret = TRUE;
+        i += run;
+    }
     return ret;
 }
 
+static int se_world_startMacro(se_world* world)
+{
+    if ( world->batch ) {
+        se_msg( "Can not define a macro while executing one" );
+        return FALSE;
+    }
+    if ( world->macro ) {
+        se_msg( "Already defining kbd macro" );
+        return FALSE;
+    }
+    world->macro = g_array_new( FALSE, FALSE, sizeof(se_key) );
+    world->macroMark = 0;
+    se_msg( "Defining kbd macro..." );
+    return TRUE;
+}
+
+static int se_world_endMacro(se_world* world)
+{
+    if ( !world->macro ) {
+        se_msg( "Not defining kbd macro" );
+        return FALSE;
+    }
+    // drop keys of the command ending it
+    g_array_set_size( world->macro, world->macroMark );
+    if ( world->lastMacro )
+        g_array_free( world->lastMacro, TRUE );
+    world->lastMacro = world->macro;
+    world->macro = NULL;
+    se_msg( "Keyboard macro defined" );
+    return TRUE;
+}
+
+/**
+ * replay last macro count times as if its keys were typed. nothing is
+ * published or drawn per command, edits pile up damage of buffers for views
+ * to take once the key that started it is done.
+ */
+static int se_world_executeMacro(se_world* world, se_off_t count)
+{
+    if ( !world->lastMacro ) {
+        se_msg( "No kbd macro has been defined" );
+        return FALSE;
+    }
+    if ( world->batch ) {
+        se_msg( "Can not execute a macro from itself" );
+        return FALSE;
+    }
+
+    GArray *keys = world->lastMacro;
+    se_command_args args = se_command_args_init();
+    world->batch++;
+    for (se_off_t n = 0; n < count; ++n) {
+        for (int i = 0; i < keys->len; ++i) {
+            if ( world->dispatchCommand(world, &args, g_array_index(keys, se_key, i)) )
+                se_command_args_clear( &args );
+        }
+    }
+    world->batch--;
+    se_command_args_release( &args );
+    return TRUE;
+}
+
 se_world* se_world_create()
 {
     se_world* world = g_malloc0( sizeof(se_world) );
@@ -310,6 +751,13 @@ se_world* se_world_create()
     world->registerMode = se_world_registerMode;
     
     world->dispatchCommand = se_world_dispatchCommand;
+    world->dispatchKeys = se_world_dispatchKeys;
+    world->pollSearch = se_world_pollSearch;
+    world->cancelSearch = se_world_cancelSearch;
+    world->readString = se_world_readString;
+    world->startMacro = se_world_startMacro;
+    world->endMacro = se_world_endMacro;
+    world->executeMacro = se_world_executeMacro;
     
     world->init( world );
     
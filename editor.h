@@ -25,11 +25,67 @@
 #include "modemap.h"
 #include "buffer.h"
 
+struct se_isearch;
+struct se_psearch;
+struct se_occur;
+struct se_tindex_job;
+
+// how often a view reports progress of a search running in background, in ms
+#define SE_SEARCH_POLL_INTERVAL  50
+// how long a half typed key sequence waits before views echo it, in ms
+#define SE_ECHO_KEYSTROKES_DELAY  1000
+
 DEF_CLS(se_world);
+
+/**
+ * a line read in echo area, it takes keys before any keymap. done gets the
+ * prompt with what is typed once Return is pressed, and is not called if C-g
+ * aborts. changed, if any, is called after each edit of input instead of
+ * echoing it, so it may show more along with it.
+ */
+DEF_CLS(se_prompt);
+typedef void (*se_prompt_done)(se_world*, const se_prompt* pr);
+typedef void (*se_prompt_changed)(se_world*, const char* input);
+struct se_prompt
+{
+    char *prompt;
+    GString *input;
+    se_prompt_changed changed;
+    se_prompt_done done;
+    se_off_t count; // C-u count of command reading it, 1 if none
+};
+
 struct se_world
 {
     se_buffer *bufferList;
     se_buffer *current;
+    guint useTick; // bumped by every command, see se_buffer.lastUsed
+
+    // incremental search in progress, it takes keys before any keymap
+    struct se_isearch *isearch;
+    // pattern of last isearch, NULL if none
+    GString *lastSearch;
+    gboolean lastSearchRegexp;
+
+    // search scanning current buffer with threads, C-g cancels it
+    struct se_psearch *psearch;
+    int psearchReported; // hits in last progress message, -1 before any
+    gboolean psearchFirstReported;
+    // last occur, lines of *occur* point back through it
+    struct se_occur *occur;
+    // project index updated and searched in a thread, files it finds go to occur
+    struct se_tindex_job *projectSearch;
+    se_prompt *prompt; // NULL if nothing is being read
+    // candidates of last buffer switching, matched as its prompt changes
+    struct se_fuzzy *switcher;
+
+    // keys of keyboard macro being recorded, NULL if not recording
+    GArray *macro;
+    guint macroMark; // keys up to end of last command done, where C-x ) cuts
+    GArray *lastMacro; // last macro recorded, NULL if none
+    // > 0 while a macro replays: keys are not recorded, and views redraw
+    // once after the key that started it
+    int batch;
 
     // mode name <-> mode obj
     se_mode_hash *mode_hash;
@@ -55,6 +111,21 @@ struct se_world
     void (*registerMode)(se_world*, se_mode*);
     
     int (*dispatchCommand)(se_world*, se_command_args*, se_key);
+    // keys of a burst drained from input at once, in order. a run of plain
+    // keys that self-insert goes in by one insertString, the rest are
+    // dispatched one by one. returns what dispatching of last key does
+    int (*dispatchKeys)(se_world*, se_command_args*, const se_key* keys, int nr);
+    // report progress of search in background, FALSE once none is running
+    int (*pollSearch)(se_world*);
+    int (*cancelSearch)(se_world*); // TRUE if something is stopped
+    // start reading a line in echo area, see se_prompt, which is returned
+    se_prompt* (*readString)(se_world*, const char* prompt, se_prompt_changed changed,
+                             se_prompt_done done);
+
+    // keyboard macro, keys are recorded as dispatched and replayed in batch
+    int (*startMacro)(se_world*);
+    int (*endMacro)(se_world*);
+    int (*executeMacro)(se_world*, se_off_t count);
 };
 
 
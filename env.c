@@ -43,8 +43,11 @@ se_env* se_env_init()
     env->root = RootWindow( env->display, env->screen );
     env->visual = DefaultVisual(env->display, env->screen);
     env->colormap = DefaultColormap(env->display, env->screen);
+    env->keyboard = se_keyboard_map_new( env->display );
 
     env->world = se_world_create();
+    env->context = g_main_context_default();
+    env->loop = g_main_loop_new( env->context, FALSE );
 
     SE_UNUSED char *mono_font_name = "Monaco-10:weight=normal:antialias=true";
     /* char *mono_font_name = "Monaco:pixelsize=15:foundry=unknown:weight=normal" */
@@ -69,11 +72,83 @@ void se_env_release(se_env* env)
 {
     if ( env ) {
         XCloseIM( env->xim );
+        se_keyboard_map_free( env->keyboard );
         XCloseDisplay( env->display );
+        g_main_loop_unref( env->loop );
         g_free( env );
     }
 }
 
+static guint se_env_attach( se_env* env, GSource* source, int priority, GSourceFunc func,
+                            gpointer data )
+{
+    g_source_set_priority( source, priority );
+    g_source_set_callback( source, func, data, NULL );
+    guint id = g_source_attach( source, env->context );
+    g_source_unref( source );
+    return id;
+}
+
+guint se_env_idle_add( se_env* env, int priority, GSourceFunc func, gpointer data )
+{
+    g_assert( env && func );
+    return se_env_attach( env, g_idle_source_new(), priority, func, data );
+}
+
+guint se_env_timeout_add( se_env* env, int priority, guint interval, GSourceFunc func,
+                          gpointer data )
+{
+    g_assert( env && func );
+    return se_env_attach( env, g_timeout_source_new(interval), priority, func, data );
+}
+
+void se_env_source_remove( se_env* env, guint id )
+{
+    g_assert( env );
+    GSource *source = g_main_context_find_source_by_id( env->context, id );
+    if ( source )
+        g_source_destroy( source );
+}
+
+static gboolean se_env_deferred_dispatch( GSource* source, GSourceFunc func, gpointer data )
+{
+    // sleeps till scheduled again
+    g_source_set_ready_time( source, -1 );
+    if ( func )
+        func( data );
+    return TRUE;
+}
+
+static GSourceFuncs se_env_deferred_funcs = {
+    NULL,
+    NULL,
+    se_env_deferred_dispatch,
+    NULL,
+};
+
+GSource* se_env_deferred_new( se_env* env, int priority, GSourceFunc func, gpointer data )
+{
+    g_assert( env && func );
+    GSource *source = g_source_new( &se_env_deferred_funcs, sizeof(GSource) );
+    g_source_set_ready_time( source, -1 );
+    g_source_set_priority( source, priority );
+    g_source_set_callback( source, func, data, NULL );
+    g_source_attach( source, env->context );
+    return source;
+}
+
+void se_env_deferred_schedule( GSource* source, guint delay )
+{
+    g_assert( source );
+    g_source_set_ready_time( source, delay ? g_get_monotonic_time() + delay * 1000: 0 );
+}
+
+void se_env_deferred_cancel( GSource* source )
+{
+    g_assert( source );
+    g_source_set_ready_time( source, -1 );
+}
+
 gboolean se_env_change_font( se_env* env, const char* name )
 {
     XftPattern* favourate_pat = XftNameParse( name );
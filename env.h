@@ -33,6 +33,12 @@ struct se_font
     int glyphAscent;
 };
 
+// priorities of work scheduled on main context of env, lower runs first.
+// input always goes before anything else that is ready
+#define SE_PRIORITY_INPUT       G_PRIORITY_DEFAULT
+#define SE_PRIORITY_REDISPLAY   (G_PRIORITY_HIGH_IDLE + 20)
+#define SE_PRIORITY_BACKGROUND  G_PRIORITY_DEFAULT_IDLE
+
 DEF_CLS(se_env);  // environment 
 struct se_env 
 {
@@ -49,8 +55,12 @@ struct se_env
     int glyphAscent;
 
     XIM xim;
+    se_keyboard_map *keyboard; // refreshed by views on MappingNotify
     se_world *world;
-    
+
+    // views run on it, polling X connection along with idles and timers
+    GMainContext *context;
+    GMainLoop *loop;
     gboolean exitLoop;
 
 };
@@ -64,6 +74,22 @@ extern void se_env_release(se_env* env);
 extern void se_env_quit(se_env* env);
 extern gboolean se_env_change_font( se_env* env, const char* name );
 
+// run func on main context, at priority, once nothing more urgent is ready.
+// it goes on being called while it returns TRUE. returns id of source
+extern guint se_env_idle_add( se_env* env, int priority, GSourceFunc func, gpointer data );
+// same, every interval ms
+extern guint se_env_timeout_add( se_env* env, int priority, guint interval, GSourceFunc func,
+                                 gpointer data );
+extern void se_env_source_remove( se_env* env, guint id );
+
+// a source made once and run again each time it is scheduled, so that work
+// done on every key allocates nothing. it runs at priority, delay ms after
+// it is scheduled; scheduling it again before that moves it
+extern GSource* se_env_deferred_new( se_env* env, int priority, GSourceFunc func,
+                                     gpointer data );
+extern void se_env_deferred_schedule( GSource* source, guint delay );
+extern void se_env_deferred_cancel( GSource* source );
+
     
 #ifdef __cplusplus
 }
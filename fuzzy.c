@@ -0,0 +1,534 @@
+/**
+ * Fuzzy - rank names by how well a query matches them
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "fuzzy.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SE_FUZZY_X86
+#endif
+
+// each matched char scores this, plus bonuses minus a gap penalty
+#define SE_FUZZY_SCORE_MATCH        16
+#define SE_FUZZY_BONUS_BOUNDARY     8   // starts a word or path component
+#define SE_FUZZY_BONUS_CONSECUTIVE  6   // right after the previous one
+#define SE_FUZZY_BONUS_BASENAME     2   // after the last '/'
+#define SE_FUZZY_MAX_GAP_PENALTY    8   // one per char skipped, up to this
+
+static guint64 se_fuzzy_char_mask( guchar c )
+{
+    if ( BETWEEN(c, 'a', 'z') )
+        return 1ULL << (c - 'a');
+    if ( BETWEEN(c, '0', '9') )
+        return 1ULL << (26 + c - '0');
+    return 1ULL << (36 + c % 28);
+}
+
+static guint64 se_fuzzy_mask( const char* folded, int len )
+{
+    guint64 mask = 0;
+    for (int i = 0; i < len; ++i)
+        mask |= se_fuzzy_char_mask( folded[i] );
+    return mask;
+}
+
+static gboolean se_fuzzy_is_boundary( const char* name, int i )
+{
+    if ( i == 0 )
+        return TRUE;
+    char prev = name[i-1], c = name[i];
+    switch ( prev ) {
+    case '/': case '_': case '-': case '.': case ' ':
+        return TRUE;
+    }
+    // camelCase
+    return BETWEEN(prev, 'a', 'z') && BETWEEN(c, 'A', 'Z');
+}
+
+static void se_fuzzy_shape_init( se_fuzzy_shape* shape, const char* name, int len )
+{
+    shape->len = len;
+    shape->base = len;
+    while ( shape->base > 0 && name[shape->base-1] != '/' )
+        --shape->base;
+    shape->bounds = shape->starts = 0;
+    for (int i = 0; i < len; ++i) {
+
+        if ( !se_fuzzy_is_boundary(name, i) )
+            continue;
+        if ( i < 64 )
+            shape->bounds |= 1ULL << i;
+        shape->starts |= se_fuzzy_char_mask( g_ascii_tolower(name[i]) );
+    }
+}
+
+/**
+ * where the shortest span ending at end starts. end is the first place
+ * where query is complete, so the rest of query is before it.
+ */
+static int se_fuzzy_span_start( const char* folded, const char* query, int qlen, int end )
+{
+    int start = end;
+    for (int j = qlen - 2; j >= 0; --j) {
+        while ( folded[--start] != query[j] )
+            ;
+    }
+    return start;
+}
+
+// score chars of query taken from left to right in span from start
+static int se_fuzzy_score_span( const char* name, const char* folded, const se_fuzzy_shape* shape,
+                                const char* query, int qlen, int start )
+{
+    int score = 0, last = -1;
+    for (int i = start, j = 0; j < qlen; ++i) {
+        if ( folded[i] != query[j] )
+            continue;
+        score += SE_FUZZY_SCORE_MATCH;
+        if ( i < 64 ? (shape->bounds >> i) & 1: se_fuzzy_is_boundary(name, i) )
+            score += SE_FUZZY_BONUS_BOUNDARY;
+        if ( i >= shape->base )
+            score += SE_FUZZY_BONUS_BASENAME;
+        if ( last >= 0 ) {
+            if ( i == last + 1 )
+                score += SE_FUZZY_BONUS_CONSECUTIVE;
+            else
+                score -= MIN( i - last - 1, SE_FUZZY_MAX_GAP_PENALTY );
+        }
+        last = i;
+        ++j;
+    }
+    return score;
+}
+
+/**
+ * no score of span from start to end can be higher: every char in it that
+ * is in query and starts a word is taken as matched, and chars skipped make
+ * one gap. exact if none are skipped.
+ */
+static int se_fuzzy_score_bound( const char* folded, const se_fuzzy_shape* shape, int qlen,
+                                 guint64 qmask, int start, int end )
+{
+    int bounds = qlen;
+    if ( end < 64 ) {
+        guint64 bits = (shape->bounds & ((2ULL << end) - 1)) >> start << start;
+        for (bounds = 0; bits && bounds < qlen; bits &= bits - 1)
+            bounds += (se_fuzzy_char_mask(folded[__builtin_ctzll(bits)]) & qmask) != 0;
+    }
+    int score = qlen * SE_FUZZY_SCORE_MATCH + bounds * SE_FUZZY_BONUS_BOUNDARY
+        + CLAMP( end - MAX(start, shape->base) + 1, 0, qlen ) * SE_FUZZY_BONUS_BASENAME;
+    int skipped = end - start + 1 - qlen;
+    if ( skipped == 0 )
+        return score + (qlen - 1) * SE_FUZZY_BONUS_CONSECUTIVE;
+    return score + (qlen - 2) * SE_FUZZY_BONUS_CONSECUTIVE - MIN( skipped, SE_FUZZY_MAX_GAP_PENALTY );
+}
+
+int se_fuzzy_score( const char* name, const char* query )
+{
+    g_assert( name && query );
+    char *folded = g_ascii_strdown( name, -1 );
+    char *q = g_ascii_strdown( query, -1 );
+    se_fuzzy_shape shape;
+    se_fuzzy_shape_init( &shape, name, strlen(name) );
+    int qlen = strlen( q ), score = 0;
+    if ( qlen > 0 ) {
+        const char *next = folded - 1;
+        for (int j = 0; j < qlen && next; ++j)
+            next = strchr( next + 1, q[j] );
+        score = !next ? -1: se_fuzzy_score_span( name, folded, &shape, q, qlen,
+                                                 se_fuzzy_span_start(folded, q, qlen, next - folded) );
+    }
+    g_free( q );
+    g_free( folded );
+    return score;
+}
+
+// positions of masks having every bit of q, into out. return their number
+static int se_fuzzy_prefilter_scalar( const guint64* masks, int n, guint64 q, int* out )
+{
+    int nr = 0;
+    for (int i = 0; i < n; ++i) {
+        out[nr] = i;
+        nr += (masks[i] & q) == q;
+    }
+    return nr;
+}
+
+#ifdef __SSE2__
+// two masks a time, a mask passes if both its halves do
+static int se_fuzzy_prefilter_sse2( const guint64* masks, int n, guint64 q, int* out )
+{
+    const __m128i qv = _mm_set1_epi64x( q );
+    int i = 0, nr = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128i m = _mm_loadu_si128( (const __m128i*)(masks + i) );
+        int bits = _mm_movemask_epi8( _mm_cmpeq_epi32(_mm_and_si128(m, qv), qv) );
+        if ( (bits & 0xff) == 0xff )
+            out[nr++] = i;
+        if ( (bits >> 8) == 0xff )
+            out[nr++] = i + 1;
+    }
+    int rest = se_fuzzy_prefilter_scalar( masks + i, n - i, q, out + nr );
+    for (int k = 0; k < rest; ++k)
+        out[nr + k] += i;
+    return nr + rest;
+}
+#endif
+
+#ifdef SE_FUZZY_X86
+// four masks a time
+__attribute__(( target("avx2") ))
+static int se_fuzzy_prefilter_avx2( const guint64* masks, int n, guint64 q, int* out )
+{
+    const __m256i qv = _mm256_set1_epi64x( q );
+    int i = 0, nr = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i m = _mm256_loadu_si256( (const __m256i*)(masks + i) );
+        __m256i eq = _mm256_cmpeq_epi64( _mm256_and_si256(m, qv), qv );
+        unsigned bits = _mm256_movemask_pd( _mm256_castsi256_pd(eq) );
+        while ( bits ) {
+            out[nr++] = i + __builtin_ctz( bits );
+            bits &= bits - 1;
+        }
+    }
+    int rest = se_fuzzy_prefilter_scalar( masks + i, n - i, q, out + nr );
+    for (int k = 0; k < rest; ++k)
+        out[nr + k] += i;
+    return nr + rest;
+}
+
+static int se_fuzzy_cpu_has_avx2()
+{
+    static int has_avx2 = -1;
+    if ( has_avx2 < 0 ) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+    }
+    return has_avx2;
+}
+#endif
+
+static int se_fuzzy_prefilter( const guint64* masks, int n, guint64 q, int* out )
+{
+#ifdef SE_FUZZY_X86
+    if ( se_fuzzy_cpu_has_avx2() )
+        return se_fuzzy_prefilter_avx2( masks, n, q, out );
+#endif
+#ifdef __SSE2__
+    return se_fuzzy_prefilter_sse2( masks, n, q, out );
+#else
+    return se_fuzzy_prefilter_scalar( masks, n, q, out );
+#endif
+}
+
+static se_fuzzy_level* se_fuzzy_level_new()
+{
+    se_fuzzy_level *level = g_malloc0( sizeof(se_fuzzy_level) );
+    level->ids = g_array_new( FALSE, FALSE, sizeof(int) );
+    level->masks = g_array_new( FALSE, FALSE, sizeof(guint64) );
+    level->ends = g_array_new( FALSE, FALSE, sizeof(int) );
+    return level;
+}
+
+static void se_fuzzy_level_free( se_fuzzy_level* level )
+{
+    g_array_free( level->ids, TRUE );
+    g_array_free( level->masks, TRUE );
+    g_array_free( level->ends, TRUE );
+    g_free( level );
+}
+
+// drop levels of query chars past len
+static void se_fuzzy_truncate( se_fuzzy* fz, int len )
+{
+    while ( fz->levels->len > len + 1 )
+        se_fuzzy_level_free( g_ptr_array_remove_index(fz->levels, fz->levels->len - 1) );
+    g_string_truncate( fz->query, len );
+}
+
+se_fuzzy* se_fuzzy_new()
+{
+    se_fuzzy *fz = g_malloc0( sizeof(se_fuzzy) );
+    fz->names = g_string_new( "" );
+    fz->folded = g_string_new( "" );
+    fz->values = g_string_new( "" );
+    fz->offsets = g_array_new( FALSE, FALSE, sizeof(guint32) );
+    fz->value_offsets = g_array_new( FALSE, FALSE, sizeof(guint32) );
+    fz->shapes = g_array_new( FALSE, FALSE, sizeof(se_fuzzy_shape) );
+    fz->query = g_string_new( "" );
+    fz->levels = g_ptr_array_new();
+    g_ptr_array_add( fz->levels, se_fuzzy_level_new() );
+    fz->matches = g_array_new( FALSE, FALSE, sizeof(se_fuzzy_match) );
+    return fz;
+}
+
+void se_fuzzy_free( se_fuzzy* fz )
+{
+    g_assert( fz );
+    se_fuzzy_truncate( fz, 0 );
+    se_fuzzy_level_free( g_ptr_array_index(fz->levels, 0) );
+    g_ptr_array_free( fz->levels, TRUE );
+    g_string_free( fz->names, TRUE );
+    g_string_free( fz->folded, TRUE );
+    g_string_free( fz->values, TRUE );
+    g_array_free( fz->offsets, TRUE );
+    g_array_free( fz->value_offsets, TRUE );
+    g_array_free( fz->shapes, TRUE );
+    g_string_free( fz->query, TRUE );
+    g_array_free( fz->matches, TRUE );
+    g_free( fz );
+}
+
+int se_fuzzy_add( se_fuzzy* fz, const char* name, const char* value )
+{
+    g_assert( fz && name );
+    int id = fz->nr_candidates++;
+    int len = strlen( name );
+    guint32 offset = fz->names->len;
+    g_array_append_val( fz->offsets, offset );
+    se_fuzzy_shape shape;
+    se_fuzzy_shape_init( &shape, name, len );
+    g_array_append_val( fz->shapes, shape );
+    g_string_append_len( fz->names, name, len + 1 );
+    char *folded = g_ascii_strdown( name, len );
+    g_string_append_len( fz->folded, folded, len + 1 );
+
+    guint32 value_offset = value ? fz->values->len: G_MAXUINT;
+    g_array_append_val( fz->value_offsets, value_offset );
+    if ( value )
+        g_string_append_len( fz->values, value, strlen(value) + 1 );
+
+    // every query has to be matched again
+    se_fuzzy_truncate( fz, 0 );
+    se_fuzzy_level *all = g_ptr_array_index( fz->levels, 0 );
+    guint64 mask = se_fuzzy_mask( folded, len );
+    g_array_append_val( all->ids, id );
+    g_array_append_val( all->masks, mask );
+    int end = -1;
+    g_array_append_val( all->ends, end );
+    g_free( folded );
+    return id;
+}
+
+const char* se_fuzzy_name( se_fuzzy* fz, int id )
+{
+    g_assert( fz && id >= 0 && id < fz->nr_candidates );
+    return fz->names->str + g_array_index( fz->offsets, guint32, id );
+}
+
+const char* se_fuzzy_value( se_fuzzy* fz, int id )
+{
+    g_assert( fz && id >= 0 && id < fz->nr_candidates );
+    guint32 offset = g_array_index( fz->value_offsets, guint32, id );
+    return offset == G_MAXUINT ? NULL: fz->values->str + offset;
+}
+
+static gboolean se_fuzzy_better( se_fuzzy* fz, const se_fuzzy_match* a, const se_fuzzy_match* b )
+{
+    if ( a->score != b->score )
+        return a->score > b->score;
+    int alen = g_array_index( fz->shapes, se_fuzzy_shape, a->id ).len;
+    int blen = g_array_index( fz->shapes, se_fuzzy_shape, b->id ).len;
+    if ( alen != blen )
+        return alen < blen;
+    return a->id < b->id;
+}
+
+// keep only the best SE_FUZZY_MAX_MATCHES, in order
+static void se_fuzzy_rank( se_fuzzy* fz, int id, int score )
+{
+    se_fuzzy_match m = { id, score };
+    GArray *matches = fz->matches;
+    int pos = 0, hi = matches->len;
+    while ( pos < hi ) {
+        int mid = (pos + hi) / 2;
+        if ( se_fuzzy_better(fz, &m, &g_array_index(matches, se_fuzzy_match, mid)) )
+            hi = mid;
+        else
+            pos = mid + 1;
+    }
+    if ( pos >= SE_FUZZY_MAX_MATCHES )
+        return;
+    g_array_insert_vals( matches, pos, &m, 1 );
+    if ( matches->len > SE_FUZZY_MAX_MATCHES )
+        g_array_set_size( matches, SE_FUZZY_MAX_MATCHES );
+}
+
+// query as ranking looks at it, and the worst of matches once they are full
+DEF_CLS(se_fuzzy_ranking);
+struct se_fuzzy_ranking
+{
+    const char *query;
+    int qlen;
+    guint64 mask;     // of chars of query
+    guint64 rest;     // of chars of query but the last
+    int rest_shared;  // chars of rest sharing a bit of it with another
+    se_fuzzy_match worst;
+    int worst_len;
+};
+
+static void se_fuzzy_ranking_init( se_fuzzy_ranking* rk, const char* query, int qlen )
+{
+    rk->query = query;
+    rk->qlen = qlen;
+    rk->mask = se_fuzzy_mask( query, qlen );
+    rk->rest = se_fuzzy_mask( query, qlen - 1 );
+    rk->rest_shared = qlen - 1 - __builtin_popcountll( rk->rest );
+    rk->worst.id = -1;
+    rk->worst.score = G_MININT;
+    rk->worst_len = 0;
+}
+
+// whether a match of candidate scoring at most bound may get in, as se_fuzzy_better tells
+static gboolean se_fuzzy_may_rank( const se_fuzzy_ranking* rk, int id, int len, int bound )
+{
+    if ( bound != rk->worst.score )
+        return bound > rk->worst.score;
+    if ( len != rk->worst_len )
+        return len < rk->worst_len;
+    return id < rk->worst.id;
+}
+
+/**
+ * whether candidate matching query up to end may get in, before looking for
+ * the rest of its span. the last char of query is at end, so what it gets is
+ * known, and chars of the rest may only start words if they do so
+ * somewhere.
+ */
+static inline gboolean se_fuzzy_may_get_in( const se_fuzzy_ranking* rk, int id, const char* folded,
+                                            const se_fuzzy_shape* shape, int end )
+{
+    int bound = SE_FUZZY_SCORE_MATCH;
+    if ( end >= 64 || (shape->bounds >> end) & 1 )
+        bound += SE_FUZZY_BONUS_BOUNDARY;
+    if ( end >= shape->base )
+        bound += SE_FUZZY_BONUS_BASENAME;
+    int qlen = rk->qlen;
+    if ( qlen > 1 ) {
+        int starts = __builtin_popcountll( shape->starts & rk->rest ) + rk->rest_shared;
+        bound += (qlen - 1) * SE_FUZZY_SCORE_MATCH + MIN( qlen - 1, starts ) * SE_FUZZY_BONUS_BOUNDARY
+            + CLAMP( end - shape->base, 0, qlen - 1 ) * SE_FUZZY_BONUS_BASENAME
+            + (qlen - 2) * SE_FUZZY_BONUS_CONSECUTIVE;
+        if ( folded[end-1] == rk->query[qlen-2] )
+            bound += SE_FUZZY_BONUS_CONSECUTIVE;
+        else
+            bound -= 1;
+    }
+    return se_fuzzy_may_rank( rk, id, shape->len, bound );
+}
+
+// rank candidate that may get in, scoring it only if its span may still
+static void se_fuzzy_consider( se_fuzzy* fz, se_fuzzy_ranking* rk, int id, const char* folded,
+                               const se_fuzzy_shape* shape, int end )
+{
+    int start = se_fuzzy_span_start( folded, rk->query, rk->qlen, end );
+    int bound = se_fuzzy_score_bound( folded, shape, rk->qlen, rk->mask, start, end );
+    if ( !se_fuzzy_may_rank(rk, id, shape->len, bound) )
+        return;
+    const char *name = fz->names->str + (folded - fz->folded->str);
+    se_fuzzy_rank( fz, id, se_fuzzy_score_span(name, folded, shape, rk->query, rk->qlen, start) );
+    if ( fz->matches->len == SE_FUZZY_MAX_MATCHES ) {
+        rk->worst = g_array_index( fz->matches, se_fuzzy_match, SE_FUZZY_MAX_MATCHES - 1 );
+        rk->worst_len = g_array_index( fz->shapes, se_fuzzy_shape, rk->worst.id ).len;
+    }
+}
+
+/**
+ * candidates of from matching query, into to. from matches all but the last
+ * char already, so only where that comes next after its match is looked for.
+ * those matching all of query are ranked while they are at hand.
+ */
+static void se_fuzzy_narrow( se_fuzzy* fz, se_fuzzy_level* from, se_fuzzy_level* to,
+                             const char* query, int qlen, gboolean rank )
+{
+    se_fuzzy_ranking rk;
+    se_fuzzy_ranking_init( &rk, query, qlen );
+    int *passed = g_new( int, from->ids->len + 1 );
+    int nr = se_fuzzy_prefilter( (const guint64*)from->masks->data, from->ids->len,
+                                 rk.mask, passed );
+    g_array_set_size( to->ids, nr );
+    g_array_set_size( to->masks, nr );
+    g_array_set_size( to->ends, nr );
+    int *ids = (int*)to->ids->data, *ends = (int*)to->ends->data;
+    guint64 *masks = (guint64*)to->masks->data;
+    const int *from_ids = (const int*)from->ids->data, *from_ends = (const int*)from->ends->data;
+    const guint64 *from_masks = (const guint64*)from->masks->data;
+    const guint32 *offsets = (const guint32*)fz->offsets->data;
+    const se_fuzzy_shape *shapes = (const se_fuzzy_shape*)fz->shapes->data;
+    int n = 0;
+    for (int k = 0; k < nr; ++k) {
+        int id = from_ids[passed[k]];
+        const char *folded = fz->folded->str + offsets[id];
+        int from_end = from_ends[passed[k]] + 1;
+        const char *next = memchr( folded + from_end, query[qlen-1], shapes[id].len - from_end );
+        if ( !next )
+            continue;
+        ids[n] = id;
+        ends[n] = next - folded;
+        masks[n] = from_masks[passed[k]];
+        if ( rank && se_fuzzy_may_get_in(&rk, id, folded, &shapes[id], ends[n]) )
+            se_fuzzy_consider( fz, &rk, id, folded, &shapes[id], ends[n] );
+        ++n;
+    }
+    g_array_set_size( to->ids, n );
+    g_array_set_size( to->masks, n );
+    g_array_set_size( to->ends, n );
+    g_free( passed );
+}
+
+int se_fuzzy_set_query( se_fuzzy* fz, const char* query )
+{
+    g_assert( fz && query );
+    char *q = g_ascii_strdown( query, -1 );
+    int qlen = strlen( q );
+    int common = 0;
+    while ( common < qlen && common < fz->query->len && q[common] == fz->query->str[common] )
+        ++common;
+    se_fuzzy_truncate( fz, common );
+
+    g_array_set_size( fz->matches, 0 );
+    for (int k = common; k < qlen; ++k) {
+        se_fuzzy_level *level = se_fuzzy_level_new();
+        se_fuzzy_narrow( fz, g_ptr_array_index(fz->levels, k), level, q, k + 1, k + 1 == qlen );
+        g_ptr_array_add( fz->levels, level );
+        g_string_append_c( fz->query, q[k] );
+    }
+
+    se_fuzzy_level *last = g_ptr_array_index( fz->levels, qlen );
+    if ( qlen == 0 ) {
+        // all match, in order they were added
+        for (int i = 0; i < MIN(last->ids->len, SE_FUZZY_MAX_MATCHES); ++i) {
+            se_fuzzy_match m = { g_array_index(last->ids, int, i), 0 };
+            g_array_append_val( fz->matches, m );
+        }
+    } else if ( common == qlen ) {
+        // nothing new to narrow, rank what was left before
+        se_fuzzy_ranking rk;
+        se_fuzzy_ranking_init( &rk, q, qlen );
+        for (int i = 0; i < last->ids->len; ++i) {
+            int id = g_array_index( last->ids, int, i ), end = g_array_index( last->ends, int, i );
+            const char *folded = fz->folded->str + g_array_index( fz->offsets, guint32, id );
+            const se_fuzzy_shape *shape = &g_array_index( fz->shapes, se_fuzzy_shape, id );
+            if ( se_fuzzy_may_get_in(&rk, id, folded, shape, end) )
+                se_fuzzy_consider( fz, &rk, id, folded, shape, end );
+        }
+    }
+    g_free( q );
+    return last->ids->len;
+}
@@ -0,0 +1,107 @@
+/**
+ * Fuzzy - rank names by how well a query matches them
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * fuzzy finding over many names, like buffers and files of a project. a name
+ * matches if query chars occur in it in order, ignoring case, and it scores
+ * higher the more of them are together or start words.
+ *
+ * candidates are packed in one array, each with a mask of chars it has, so
+ * most are dropped by a vector compare of masks before any scoring. those
+ * left for each prefix of query are kept, so typing one more char only looks
+ * at what was left, and only past where the rest of query was matched in
+ * each. deleting one goes back to what was left before. only those whose
+ * best possible score could put them among the best found so far are scored.
+ */
+
+#ifndef _semacs_fuzzy_h
+#define _semacs_fuzzy_h
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// best matches kept in order
+#define SE_FUZZY_MAX_MATCHES  64
+
+DEF_CLS(se_fuzzy_match);
+struct se_fuzzy_match
+{
+    int id;
+    int score;
+};
+
+// what scoring needs of a name besides its chars
+DEF_CLS(se_fuzzy_shape);
+struct se_fuzzy_shape
+{
+    int len;
+    int base;        // where last path component starts
+    guint64 bounds;  // bit i is set if char i starts a word, for first 64 chars
+    guint64 starts;  // mask of chars starting a word
+};
+
+DEF_CLS(se_fuzzy_level);
+struct se_fuzzy_level
+{
+    GArray *ids;    // candidates left for a prefix of query
+    GArray *masks;  // and their masks, packed for prefiltering
+    GArray *ends;   // and where query is first complete in each
+};
+
+DEF_CLS(se_fuzzy);
+struct se_fuzzy
+{
+    GString *names;   // back to back, NUL terminated
+    GString *folded;  // same in lower case
+    GString *values;  // same for values, empty if none
+    GArray *offsets;  // of name of each candidate
+    GArray *value_offsets;
+    GArray *shapes;   // se_fuzzy_shape of each candidate
+    int nr_candidates;
+
+    GString *query;
+    GPtrArray *levels;  // levels[k] for first k chars of query
+    GArray *matches;    // best first
+};
+
+extern se_fuzzy* se_fuzzy_new();
+extern void se_fuzzy_free( se_fuzzy* );
+// return id of new candidate, value is kept along for caller and may be NULL
+extern int se_fuzzy_add( se_fuzzy*, const char* name, const char* value );
+extern const char* se_fuzzy_name( se_fuzzy*, int id );
+// NULL if added without one
+extern const char* se_fuzzy_value( se_fuzzy*, int id );
+
+/**
+ * match candidates against query and return the number of matches, at most
+ * SE_FUZZY_MAX_MATCHES of them are in matches, best first. an empty query
+ * matches all, in order they were added.
+ */
+extern int se_fuzzy_set_query( se_fuzzy*, const char* query );
+// -1 if name does not match query, no prefiltering
+extern int se_fuzzy_score( const char* name, const char* query );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
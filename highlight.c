@@ -0,0 +1,204 @@
+/**
+ * Highlight - index of matches for redisplay
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "highlight.h"
+
+// free spans of lines [first, end)
+static void se_highlight_drop( se_highlight* hl, se_off_t first, se_off_t end )
+{
+    for (se_off_t i = first; i < end; ++i) {
+        GArray *spans = g_ptr_array_index( hl->lines, i );
+        if ( spans )
+            g_array_free( spans, TRUE );
+        g_ptr_array_index( hl->lines, i ) = NULL;
+    }
+}
+
+// lines [first, old_end) are replaced by [first, end) not scanned yet
+static void se_highlight_splice( se_highlight* hl, se_off_t first, se_off_t old_end,
+                                 se_off_t end )
+{
+    GPtrArray *lines = hl->lines;
+    se_highlight_drop( hl, first, old_end );
+    se_off_t nr_tail = lines->len - old_end;
+    if ( end > old_end )
+        g_ptr_array_set_size( lines, lines->len + (end - old_end) );
+    memmove( lines->pdata + end, lines->pdata + old_end, nr_tail * sizeof(gpointer) );
+    if ( end < old_end )
+        g_ptr_array_set_size( lines, lines->len - (old_end - end) );
+    for (se_off_t i = first; i < end; ++i)
+        g_ptr_array_index( lines, i ) = NULL;
+}
+
+/**
+ * index lines [first, end) anew. text matched reaches a window of lines
+ * beyond them if matches can span lines, so those running in or out of
+ * them are found.
+ */
+static void se_highlight_scan( se_highlight* hl, se_off_t first, se_off_t end )
+{
+    se_buffer *bufp = hl->buffer;
+    se_off_t nr_lines = bufp->getLineCount( bufp );
+    first = MAX( first, 0 );
+    end = MIN( end, nr_lines );
+    if ( hl->lines->len < end )
+        g_ptr_array_set_size( hl->lines, end );
+    if ( first >= end )
+        return;
+    se_highlight_drop( hl, first, end );
+    hl->nr_rescanned += end - first;
+
+    int window = hl->crossLines ? SE_HIGHLIGHT_WINDOW: 0;
+    se_off_t text_first = MAX( first - window, 0 );
+    se_off_t text_end = MIN( end + window, nr_lines );
+    se_line *lp = bufp->lines;
+    for (se_off_t i = 0; i < text_first; ++i)
+        lp = lp->next;
+    
+    // starts[i] is where line text_first + i begins in text
+    GString *text = g_string_new( "" );
+    se_off_t nr_text_lines = text_end - text_first;
+    se_off_t *starts = g_new( se_off_t, nr_text_lines + 1 );
+    for (se_off_t i = 0; i < nr_text_lines; ++i) {
+        starts[i] = text->len;
+        g_string_append_len( text, se_line_getData(lp), se_line_getLineLength(lp) );
+        lp = lp->next;
+    }
+    starts[nr_text_lines] = text->len;
+
+    se_off_t from = 0, start, match_end, line = 0;
+    while ( from <= text->len
+            && (start = regexp_search(hl->re, text->str, text->len, from, &match_end)) >= 0 ) {
+        from = match_end > start ? match_end: match_end + 1;
+        if ( match_end == start )
+            continue;  // nothing to paint
+
+        while ( starts[line+1] <= start )
+            ++line;
+        for (se_off_t l = line; l < nr_text_lines && starts[l] < match_end; ++l) {
+            se_off_t lineno = text_first + l;
+            if ( lineno < first || lineno >= end )
+                continue;
+            
+            // '\n' is not painted
+            se_off_t line_end = starts[l+1];
+            if ( line_end > starts[l] && text->str[line_end-1] == '\n' )
+                --line_end;
+            se_highlight_span span = {
+                MAX( start, starts[l] ) - starts[l],
+                MIN( match_end, line_end ) - starts[l],
+            };
+            if ( span.start >= span.end )
+                continue;
+            
+            GArray *spans = g_ptr_array_index( hl->lines, lineno );
+            if ( !spans ) {
+                spans = g_array_new( FALSE, FALSE, sizeof(se_highlight_span) );
+                g_ptr_array_index( hl->lines, lineno ) = spans;
+            }
+            g_array_append_val( spans, span );
+        }
+    }
+
+    g_free( starts );
+    g_string_free( text, TRUE );
+}
+
+gboolean se_highlight_attach( se_buffer* bufp, const char* pattern, gboolean regexp,
+                              const char** error )
+{
+    g_assert( bufp );
+    se_highlight *hl = bufp->highlight;
+    if ( hl && pattern && hl->regexp == regexp && strcmp(hl->pattern, pattern) == 0 )
+        return TRUE;
+    if ( hl ) {
+        se_highlight_free( hl );
+        bufp->highlight = NULL;
+    }
+    if ( !pattern || !*pattern )
+        return TRUE;
+
+    char *quoted = regexp ? NULL: regexp_quote( pattern );
+    regexp_entry *re = regexp_compile( regexp ? pattern: quoted, error );
+    g_free( quoted );
+    if ( !re )
+        return FALSE;
+
+    hl = g_malloc0( sizeof(se_highlight) );
+    hl->buffer = bufp;
+    hl->pattern = g_strdup( pattern );
+    hl->regexp = regexp;
+    hl->re = re;
+    hl->crossLines = regexp_matches_byte( re, '\n' );
+    hl->lines = g_ptr_array_new();
+    
+    // nothing is indexed yet, so edits so far are of no interest
+    se_off_t first, end, delta;
+    se_buffer_take_damage( bufp, &first, &end, &delta );
+    bufp->highlight = hl;
+    return TRUE;
+}
+
+void se_highlight_free( se_highlight* hl )
+{
+    g_assert( hl );
+    se_highlight_drop( hl, 0, hl->lines->len );
+    g_ptr_array_free( hl->lines, TRUE );
+    regexp_free( hl->re );
+    g_free( hl->pattern );
+    g_free( hl );
+}
+
+void se_highlight_update( se_highlight* hl, se_off_t nr_lines )
+{
+    g_assert( hl );
+    se_buffer *bufp = hl->buffer;
+    int window = hl->crossLines ? SE_HIGHLIGHT_WINDOW: 0;
+    hl->nr_rescanned = 0;
+
+    se_off_t first, end, delta;
+    if ( se_buffer_take_damage(bufp, &first, &end, &delta) && first < hl->lines->len ) {
+        se_off_t old_end = end - delta;
+        if ( old_end >= hl->lines->len ) {
+            // the rest is scanned below as far as it is wanted
+            first = MAX( first - window, 0 );
+            se_highlight_drop( hl, first, hl->lines->len );
+            g_ptr_array_set_size( hl->lines, first );
+        } else {
+            se_highlight_splice( hl, first, old_end, end );
+            se_highlight_scan( hl, first - window, end + window );
+        }
+    }
+
+    nr_lines = MIN( nr_lines, bufp->getLineCount(bufp) );
+    se_off_t indexed = hl->lines->len;
+    if ( indexed < nr_lines )
+        se_highlight_scan( hl, indexed, nr_lines );
+}
+
+const se_highlight_span* se_highlight_line_spans( se_highlight* hl, se_off_t line,
+                                                  int* nr_spans )
+{
+    g_assert( hl && nr_spans );
+    GArray *spans = NULL;
+    if ( line >= 0 && line < hl->lines->len )
+        spans = g_ptr_array_index( hl->lines, line );
+    *nr_spans = spans ? spans->len: 0;
+    return spans ? &g_array_index( spans, se_highlight_span, 0 ): NULL;
+}
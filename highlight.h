@@ -0,0 +1,84 @@
+/**
+ * Highlight - index of matches for redisplay
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * matches of a search pattern in a buffer, kept line by line so a view can
+ * paint them over rows it shows. index covers lines from top of buffer as
+ * far as a view needs, and after edits only lines touched since last update
+ * are rescanned, with a few lines around them for matches spanning lines.
+ */
+
+#ifndef _semacs_highlight_h
+#define _semacs_highlight_h
+
+#include "util.h"
+#include "buffer.h"
+#include "submatch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// lines rescanned on each side of edited ones if a match may contain '\n'
+#define SE_HIGHLIGHT_WINDOW  2
+
+// part of a match on one line, in byte columns
+DEF_CLS(se_highlight_span);
+struct se_highlight_span
+{
+    int start;
+    int end;
+};
+
+DEF_CLS(se_highlight);
+struct se_highlight
+{
+    se_buffer *buffer;
+    char *pattern;
+    gboolean regexp;
+    regexp_entry *re;
+    gboolean crossLines; // a match may contain '\n'
+    
+    GPtrArray *lines;  // GArray of spans of each line indexed, NULL if none
+    se_off_t nr_rescanned; // lines scanned by last update
+};
+
+/**
+ * start highlighting pattern in bufp, replacing what it had. an empty or
+ * NULL pattern just stops highlighting. return FALSE with *error set if
+ * regexp is not valid.
+ */
+extern gboolean se_highlight_attach( se_buffer* bufp, const char* pattern,
+                                     gboolean regexp, const char** error );
+extern void se_highlight_free( se_highlight* );
+
+/**
+ * bring index up to date with buffer for its first nr_lines lines. edits
+ * since last update are rescanned, and lines not indexed yet are scanned.
+ */
+extern void se_highlight_update( se_highlight*, se_off_t nr_lines );
+// spans of matches on an indexed line in column order, NULL if none
+extern const se_highlight_span* se_highlight_line_spans( se_highlight*, se_off_t line,
+                                                         int* nr_spans );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -23,28 +23,36 @@
 #include <regex.h>
 #include "submatch.h"
 
-char* se_key_to_string(se_key key)
+void se_key_append_string(GString* gstr, se_key key)
 {
     /* se_debug( "raw key: 0x%x", se_key_to_int(key) ); */
-    GString *gstr = g_string_new("");
+    gsize start = gstr->len;
 
-    if ( key.modifiers & ControlDown ) g_string_append_printf( gstr, "C-" );
-    if ( key.modifiers & MetaDown    ) g_string_append_printf( gstr, "M-" );
-    if ( key.modifiers & SuperDown   ) g_string_append_printf( gstr, "H-" );
-    if ( key.modifiers & ShiftDown   ) g_string_append_printf( gstr, "S-" );    
-    if ( key.modifiers & Button1Down ) g_string_append_printf( gstr, "B1-" );
-    if ( key.modifiers & Button2Down ) g_string_append_printf( gstr, "B2-" );
-    if ( key.modifiers & Button3Down ) g_string_append_printf( gstr, "B3-" );
+    if ( key.modifiers & ControlDown ) g_string_append( gstr, "C-" );
+    if ( key.modifiers & MetaDown    ) g_string_append( gstr, "M-" );
+    if ( key.modifiers & SuperDown   ) g_string_append( gstr, "H-" );
+    if ( key.modifiers & ShiftDown   ) g_string_append( gstr, "S-" );    
+    if ( key.modifiers & Button1Down ) g_string_append( gstr, "B1-" );
+    if ( key.modifiers & Button2Down ) g_string_append( gstr, "B2-" );
+    if ( key.modifiers & Button3Down ) g_string_append( gstr, "B3-" );
 
     if ( key.ascii == XK_Escape  )
-        g_string_append_printf( gstr, "Esc" );
-    else if (key.ascii == 0 )
-        g_string_printf( gstr, "(null)" );
-    else if ( BETWEEN(key.ascii, 0x20, 0x7e) )
-        g_string_append_printf( gstr, "%c", key.ascii );
-    else
-        g_string_append_printf( gstr, "%s", XKeysymToString(key.ascii) );
+        g_string_append( gstr, "Esc" );
+    else if (key.ascii == 0 ) {
+        g_string_truncate( gstr, start );
+        g_string_append( gstr, "(null)" );
+    } else if ( BETWEEN(key.ascii, 0x20, 0x7e) )
+        g_string_append_c( gstr, key.ascii );
+    else {
+        const char *name = XKeysymToString( key.ascii );
+        g_string_append( gstr, name ? name: "(null)" );
+    }
+}
 
+char* se_key_to_string(se_key key)
+{
+    GString *gstr = g_string_new("");
+    se_key_append_string( gstr, key );
     return g_string_free( gstr, FALSE );
 }
 
@@ -86,12 +94,12 @@ se_key se_key_from_string2( const char* rep )
     int nr_keywords = 6;
     trie_t* trie = trie_init_with_keywords( keywords, nr_keywords );
 
-    trie_match_result results[MAX_KEYWORDS];
+    trie_match_result results[ARRAY_LEN(keywords)];
     int nr_match = trie_match_ex( trie, rep, ARRAY_LEN(results), results );
-    trie_free( trie );
 
     if ( nr_match <= 0 ) {
         se_warn( "rep (%s) is not a valid key", rep );
+        trie_free( trie );
         return key;
     }
 
@@ -113,6 +121,8 @@ se_key se_key_from_string2( const char* rep )
             }
         }
     }
+    // results refer to keywords inside trie
+    trie_free( trie );
 
     ++last_prefix;
     if ( *last_prefix == 0 ) {
@@ -175,12 +185,12 @@ se_key se_key_from_string( const char* rep )
     int nr_keywords = 6;
     trie_t* trie = trie_init_with_keywords( keywords, nr_keywords );
 
-    trie_match_result results[MAX_KEYWORDS];
+    trie_match_result results[ARRAY_LEN(keywords)];
     int nr_match = trie_match_ex( trie, rep, ARRAY_LEN(results), results );
-    trie_free( trie );
 
     if ( nr_match <= 0 ) {
         se_warn( "rep (%s) is not a valid key", rep );
+        trie_free( trie );
         return key;
     }
 
@@ -203,6 +213,7 @@ se_key se_key_from_string( const char* rep )
             }
         }
     }
+    trie_free( trie );
 
     // special case: [Modifiers]-<minus>
     if ( last_prefix > rep && *(last_prefix-1) == '-' ) {
@@ -237,6 +248,118 @@ se_key se_key_from_keysym( KeySym keysym )
     return (se_key) { 0, keysym };
 }
 
+// keysyms of keys that only change others
+static const struct {
+    KeySym first, last;
+} se_modifier_keysyms[] = {
+    { XK_Shift_L, XK_Hyper_R },  // Shift, Control, Locks, Meta, Alt, Super, Hyper
+    { XK_ISO_Lock, XK_ISO_Last_Group_Lock },
+    { XK_Mode_switch, XK_Mode_switch },
+    { XK_Num_Lock, XK_Num_Lock },
+};
+
+int se_keysym_is_modifier( KeySym keysym )
+{
+    for (int i = 0; i < ARRAY_LEN(se_modifier_keysyms); ++i) {
+        if ( BETWEEN(keysym, se_modifier_keysyms[i].first, se_modifier_keysyms[i].last) )
+            return TRUE;
+    }
+    return FALSE;
+}
+
+se_key se_key_from_event( KeySym keysym, unsigned int state )
+{
+    se_key key = se_key_null_init();
+    if ( keysym == NoSymbol || se_keysym_is_modifier(keysym) )
+        return key;
+    
+    key.ascii = keysym;
+    if ( state & ControlMask )
+        key.modifiers |= ControlDown;
+    if ( state & ShiftMask )
+        key.modifiers |= ShiftDown;
+    if ( state & Mod1Mask )
+        key.modifiers |= MetaDown;
+    // this is no good, Mod4 can be map to other keysym
+    if ( state & Mod4Mask )
+        key.modifiers |= SuperDown;
+
+    // here Shift is not part of combination, only changes case of char
+    if ( key.modifiers == ShiftDown )
+        key.modifiers = 0;
+    return key;
+}
+
+se_keyboard_map* se_keyboard_map_new( Display* display )
+{
+    se_keyboard_map *map = g_malloc0( sizeof(se_keyboard_map) );
+    if ( display )
+        se_keyboard_map_refresh( map, display );
+    return map;
+}
+
+void se_keyboard_map_free( se_keyboard_map* map )
+{
+    if ( map ) {
+        g_free( map->keysyms );
+        g_free( map );
+    }
+}
+
+void se_keyboard_map_load( se_keyboard_map* map, int min_keycode, int nr_keycodes,
+                           int keysyms_per_keycode, const KeySym* keysyms )
+{
+    g_assert( map && nr_keycodes >= 0 && keysyms_per_keycode > 0 );
+    gsize size = sizeof(KeySym) * nr_keycodes * keysyms_per_keycode;
+    g_free( map->keysyms );
+    map->keysyms = g_malloc( size );
+    memcpy( map->keysyms, keysyms, size );
+    map->minKeycode = min_keycode;
+    map->nrKeycodes = nr_keycodes;
+    map->keysymsPerKeycode = keysyms_per_keycode;
+}
+
+void se_keyboard_map_refresh( se_keyboard_map* map, Display* display )
+{
+    g_assert( map && display );
+    int min_keycode, max_keycode, keysyms_per_keycode;
+    XDisplayKeycodes( display, &min_keycode, &max_keycode );
+    int nr_keycodes = max_keycode - min_keycode + 1;
+    KeySym *keysyms = XGetKeyboardMapping( display, min_keycode, nr_keycodes,
+                                           &keysyms_per_keycode );
+    if ( !keysyms ) {
+        se_warn( "can not get keyboard mapping" );
+        return;
+    }
+    se_keyboard_map_load( map, min_keycode, nr_keycodes, keysyms_per_keycode, keysyms );
+    XFree( keysyms );
+    se_debug( "keycodes %d-%d, %d keysyms each", min_keycode, max_keycode,
+              keysyms_per_keycode );
+}
+
+KeySym se_keyboard_map_lookup( const se_keyboard_map* map, KeyCode keycode, int level )
+{
+    g_assert( map && BETWEEN(level, 0, 1) );
+    if ( !map->keysyms || keycode < map->minKeycode
+         || keycode >= map->minKeycode + map->nrKeycodes )
+        return NoSymbol;
+
+    const KeySym *syms = map->keysyms + (keycode - map->minKeycode) * map->keysymsPerKeycode;
+    KeySym lower = syms[0];
+    KeySym upper = map->keysymsPerKeycode > 1 ? syms[1]: NoSymbol;
+    // a group of one keysym is both levels, a letter in its two cases
+    if ( upper == NoSymbol )
+        XConvertCase( syms[0], &lower, &upper );
+    return level ? upper: lower;
+}
+
+se_key se_keyboard_map_key( const se_keyboard_map* map, const XKeyEvent* kev )
+{
+    int level = (kev->state & (ShiftMask | LockMask)) ? 1: 0;
+    KeySym keysym = se_keyboard_map_lookup( map, kev->keycode, level );
+    return se_key_from_event( keysym, kev->state );
+}
+
 int se_key_is_control(se_key key)
 {
     return ( (key.ascii == 0) && key.modifiers > 0 );
@@ -360,7 +483,8 @@ char* se_key_seq_to_string( se_key_seq keyseq )
     
     GString *gstr = g_string_new( "" );
     for (int i = 0; i < MIN(keyseq.len, SE_MAX_KEY_SEQ_LEN); ++i) {
-        g_string_append_printf( gstr, "%s ", se_key_to_string(keyseq.keys[i]) );
+        se_key_append_string( gstr, keyseq.keys[i] );
+        g_string_append_c( gstr, ' ' );
     }
 
     if ( gstr->len > 0 && gstr->str[gstr->len-1] == ' ' )
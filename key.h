@@ -48,13 +48,47 @@ DEF_CLS(se_key);
 struct se_key
 {
     unsigned short  modifiers;
-    unsigned short ascii; // > 0 if se_key is a isprint, else -1
+    guint32 ascii; // char if isprint, else keysym, Unicode ones (0x1000000 + code) too
 };
 
 extern se_key se_key_null_init();
 extern char* se_key_to_string(se_key);
+// append what se_key_to_string gives to gstr, without a string of its own
+extern void se_key_append_string(GString* gstr, se_key);
 extern se_key se_key_from_string( const char* rep );
 extern se_key se_key_from_keysym( KeySym keysym );
+// key of a KeyPress with keysym and modifier state of event, null if
+// keysym is a modifier itself. allocates nothing, keys come through it
+extern se_key se_key_from_event( KeySym keysym, unsigned int state );
+extern int se_keysym_is_modifier( KeySym keysym );
+
+/**
+ * keysyms of every keycode, fetched from server at once by
+ * XGetKeyboardMapping, so key events are looked up here rather than by a
+ * call into Xlib each. it goes stale once keyboard is remapped, so refresh
+ * it on a MappingNotify of MappingKeyboard.
+ */
+DEF_CLS(se_keyboard_map);
+struct se_keyboard_map
+{
+    int minKeycode;
+    int nrKeycodes;
+    int keysymsPerKeycode;
+    KeySym *keysyms; // nrKeycodes rows of keysymsPerKeycode, as server gives them
+};
+
+// empty if display is NULL, till a table is loaded
+extern se_keyboard_map* se_keyboard_map_new( Display* display );
+extern void se_keyboard_map_free( se_keyboard_map* map );
+extern void se_keyboard_map_refresh( se_keyboard_map* map, Display* display );
+// copy of keysyms laid out as XGetKeyboardMapping returns them
+extern void se_keyboard_map_load( se_keyboard_map* map, int min_keycode, int nr_keycodes,
+                                  int keysyms_per_keycode, const KeySym* keysyms );
+// keysym of keycode in first group, level 0 plain or 1 shifted
+extern KeySym se_keyboard_map_lookup( const se_keyboard_map* map, KeyCode keycode, int level );
+// key of a KeyPress, shifted by Shift or Lock, as se_key_from_event() makes
+extern se_key se_keyboard_map_key( const se_keyboard_map* map, const XKeyEvent* kev );
+
 extern se_key se_keycode_to_sekey(KeyCode);
 extern int se_key_is_control(se_key);
 extern int se_key_is_null(se_key);
@@ -62,17 +96,15 @@ extern int se_key_is_only(se_key, unsigned short modifier);
 // this will compare both ascii and modifiers
 extern int se_key_is_equal(se_key key1, se_key key2);
 
-static inline int se_key_to_int(se_key sekey)
+// key as a number, ascii above modifiers, e.g. 0x78000f for C-M-S-H-x
+static inline guint64 se_key_to_int(se_key sekey)
 {
-    int ikey;
-    memmove( &ikey, &sekey, sizeof sekey );
-    return ikey;
+    return ((guint64)sekey.ascii << 16) | sekey.modifiers;
 }
     
-static inline se_key int_to_se_key(int ikey)
+static inline se_key int_to_se_key(guint64 ikey)
 {
-    se_key sekey;
-    memmove( &sekey, &ikey, sizeof sekey );
+    se_key sekey = { (unsigned short)(ikey & 0xffff), (guint32)(ikey >> 16) };
     return sekey;
 }
 
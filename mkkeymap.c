@@ -0,0 +1,327 @@
+/**
+ * mkkeymap - compile keybinding tables into static keymaps at build time
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * usage: mkkeymap keymaps.def keymaps.c
+ *
+ * bindings are parsed and laid out here exactly as se_keymap_merge() would
+ * do at runtime, and written as const initializers, so default keymaps are
+ * in the binary ready for lookup and building them costs nothing at startup.
+ */
+
+#include "modemap.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct mk_node_s mk_node;
+struct mk_node_s
+{
+    se_key key;
+    char *cmd;           // NULL for a prefix
+    GPtrArray *children; // of mk_node, NULL for a command
+};
+
+typedef struct mk_keymap_s
+{
+    char *name;
+    mk_node *root;
+} mk_keymap;
+
+static const char *mk_file = NULL;
+static int mk_line = 0;
+
+static void mk_die( const char* what, const char* detail )
+{
+    fprintf( stderr, "%s:%d: %s: %s\n", mk_file, mk_line, what, detail );
+    exit( 1 );
+}
+
+static mk_node* mk_node_new( se_key key )
+{
+    mk_node *node = g_malloc0( sizeof(mk_node) );
+    node->key = key;
+    node->children = g_ptr_array_new();
+    return node;
+}
+
+static void mk_node_free( mk_node* node )
+{
+    if ( node->children ) {
+        for (int i = 0; i < node->children->len; ++i)
+            mk_node_free( g_ptr_array_index(node->children, i) );
+        g_ptr_array_free( node->children, TRUE );
+    }
+    g_free( node->cmd );
+    g_free( node );
+}
+
+static mk_node* mk_node_copy( mk_node* node )
+{
+    mk_node *copy = g_malloc0( sizeof(mk_node) );
+    copy->key = node->key;
+    copy->cmd = g_strdup( node->cmd );
+    if ( node->children ) {
+        copy->children = g_ptr_array_new();
+        for (int i = 0; i < node->children->len; ++i)
+            g_ptr_array_add( copy->children,
+                             mk_node_copy(g_ptr_array_index(node->children, i)) );
+    }
+    return copy;
+}
+
+static mk_node* mk_node_child( mk_node* node, se_key key )
+{
+    for (int i = 0; i < node->children->len; ++i) {
+        mk_node *child = g_ptr_array_index( node->children, i );
+        if ( se_key_is_equal(child->key, key) )
+            return child;
+    }
+    return NULL;
+}
+
+// same as se_modemap_insert_keybinding_str(): a binding replaces what it runs into
+static void mk_bind( mk_node* root, se_key* keys, int nr_keys, const char* cmd )
+{
+    mk_node *node = root;
+    for (int i = 0; i < nr_keys; ++i) {
+        if ( !node->children ) {
+            g_free( node->cmd );
+            node->cmd = NULL;
+            node->children = g_ptr_array_new();
+        }
+        mk_node *child = mk_node_child( node, keys[i] );
+        if ( !child ) {
+            child = mk_node_new( keys[i] );
+            g_ptr_array_add( node->children, child );
+        }
+        node = child;
+    }
+    if ( node->children ) {
+        for (int i = 0; i < node->children->len; ++i)
+            mk_node_free( g_ptr_array_index(node->children, i) );
+        g_ptr_array_free( node->children, TRUE );
+        node->children = NULL;
+    }
+    g_free( node->cmd );
+    node->cmd = g_strdup( cmd );
+}
+
+static se_key mk_parse_key( const char* rep )
+{
+    se_key key = se_key_from_string( rep );
+    if ( se_key_is_null(key) )
+        mk_die( "bad key", rep );
+    return key;
+}
+
+static void mk_parse_line( mk_keymap* keymap, char* line )
+{
+    gchar **words = g_strsplit_set( line, " \t", -1 );
+    GPtrArray *tokens = g_ptr_array_new();
+    for (gchar **w = words; *w; ++w) {
+        if ( **w )
+            g_ptr_array_add( tokens, *w );
+    }
+    if ( tokens->len < 2 )
+        mk_die( "binding needs keys and a command", line );
+    const char *cmd = g_ptr_array_index( tokens, tokens->len - 1 );
+    
+    if ( strcmp(g_ptr_array_index(tokens, 0), "range") == 0 && tokens->len == 4 ) {
+        long first = strtol( g_ptr_array_index(tokens, 1), NULL, 0 );
+        long last = strtol( g_ptr_array_index(tokens, 2), NULL, 0 );
+        if ( first <= 0 || last < first || last >= SE_KEYMAP_NR_DIRECT )
+            mk_die( "bad range", line );
+        for (long c = first; c <= last; ++c) {
+            se_key key = se_key_null_init();
+            key.ascii = c;
+            mk_bind( keymap->root, &key, 1, cmd );
+        }
+    } else {
+        int nr_keys = tokens->len - 1;
+        se_key *keys = g_new( se_key, nr_keys );
+        for (int i = 0; i < nr_keys; ++i)
+            keys[i] = mk_parse_key( g_ptr_array_index(tokens, i) );
+        mk_bind( keymap->root, keys, nr_keys, cmd );
+        g_free( keys );
+    }
+    g_ptr_array_free( tokens, TRUE );
+    g_strfreev( words );
+}
+
+static GPtrArray* mk_parse( const char* file_name )
+{
+    gchar *content = NULL;
+    if ( !g_file_get_contents(file_name, &content, NULL, NULL) )
+        mk_die( "can not read", file_name );
+
+    GPtrArray *keymaps = g_ptr_array_new();
+    mk_keymap *keymap = NULL;
+    gchar **lines = g_strsplit( content, "\n", -1 );
+    for (mk_line = 1; lines[mk_line-1]; ++mk_line) {
+        char *line = g_strstrip( lines[mk_line-1] );
+        if ( !*line || *line == '#' )
+            continue;
+        
+        if ( *line != '[' ) {
+            if ( !keymap )
+                mk_die( "binding before any [keymap]", line );
+            mk_parse_line( keymap, line );
+            continue;
+        }
+
+        char *end = strchr( line, ']' );
+        if ( !end )
+            mk_die( "missing ]", line );
+        *end = 0;
+        gchar **names = g_strsplit( line + 1, ":", 2 );
+        keymap = g_malloc0( sizeof(mk_keymap) );
+        keymap->name = g_strdup( g_strstrip(names[0]) );
+        if ( names[1] ) {
+            const char *base = g_strstrip( names[1] );
+            mk_keymap *found = NULL;
+            for (int i = 0; i < keymaps->len; ++i) {
+                mk_keymap *k = g_ptr_array_index( keymaps, i );
+                if ( strcmp(k->name, base) == 0 )
+                    found = k;
+            }
+            if ( !found )
+                mk_die( "unknown base keymap", base );
+            keymap->root = mk_node_copy( found->root );
+        } else {
+            keymap->root = mk_node_new( se_key_null_init() );
+        }
+        g_strfreev( names );
+        g_ptr_array_add( keymaps, keymap );
+    }
+    g_strfreev( lines );
+    g_free( content );
+    return keymaps;
+}
+
+static void mk_write_entry( FILE* out, mk_node* node, const char* next )
+{
+    fprintf( out, "{ 0x%" G_GINT64_MODIFIER "x, %s, %s%s }", se_key_to_int(node->key),
+             node->cmd ? node->cmd: "NULL", next ? "(se_keymap*)&": "NULL",
+             next ? next: "" );
+}
+
+/**
+ * write keymap of children of node after keymaps of their children, which it
+ * refers to. return the name it is written as.
+ */
+static char* mk_write_keymap( FILE* out, mk_node* node, const char* name,
+                              int* nr_written, int is_root )
+{
+    GPtrArray *children = node->children;
+    char **nexts = g_new0( char*, children->len + 1 );
+    int nr_hashed = 0;
+    for (int i = 0; i < children->len; ++i) {
+        mk_node *child = g_ptr_array_index( children, i );
+        if ( child->children )
+            nexts[i] = mk_write_keymap( out, child, name, nr_written, FALSE );
+        if ( child->key.modifiers || child->key.ascii >= SE_KEYMAP_NR_DIRECT )
+            ++nr_hashed;
+    }
+
+    char *self = is_root ? g_strdup( name ): g_strdup_printf( "%s_%d", name, ++*nr_written );
+    // laid out as se_keymap_merge() does
+    int nr_slots = 0;
+    if ( nr_hashed ) {
+        nr_slots = 4;
+        while ( nr_slots < nr_hashed * 2 )
+            nr_slots *= 2;
+        int *owners = g_new( int, nr_slots );
+        for (int i = 0; i < nr_slots; ++i)
+            owners[i] = -1;
+        for (int i = 0; i < children->len; ++i) {
+            mk_node *child = g_ptr_array_index( children, i );
+            if ( !child->key.modifiers && child->key.ascii < SE_KEYMAP_NR_DIRECT )
+                continue;
+            guint mask = nr_slots - 1;
+            guint s = se_keymap_hash( se_key_to_int(child->key), mask );
+            while ( owners[s] >= 0 )
+                s = (s + 1) & mask;
+            owners[s] = i;
+        }
+        
+        fprintf( out, "static const se_keymap_entry %s_slots[%d] = {\n", self, nr_slots );
+        for (int s = 0; s < nr_slots; ++s) {
+            if ( owners[s] < 0 )
+                continue;
+            fprintf( out, "    [%d] = ", s );
+            mk_write_entry( out, g_ptr_array_index(children, owners[s]), nexts[owners[s]] );
+            fprintf( out, ",\n" );
+        }
+        fprintf( out, "};\n\n" );
+        g_free( owners );
+    }
+
+    fprintf( out, "%sconst se_keymap %s = {\n    {\n", is_root ? "": "static ", self );
+    for (int i = 0; i < children->len; ++i) {
+        mk_node *child = g_ptr_array_index( children, i );
+        if ( child->key.modifiers || child->key.ascii >= SE_KEYMAP_NR_DIRECT )
+            continue;
+        fprintf( out, "        [0x%02x] = ", child->key.ascii );
+        mk_write_entry( out, child, nexts[i] );
+        fprintf( out, ",\n" );
+    }
+    if ( nr_slots )
+        fprintf( out, "    },\n    (se_keymap_entry*)%s_slots, %d\n};\n\n", self, nr_slots );
+    else
+        fprintf( out, "    },\n    NULL, 0\n};\n\n" );
+
+    g_strfreev( nexts );
+    return self;
+}
+
+int main(int argc, char *argv[])
+{
+    if ( argc != 3 ) {
+        fprintf( stderr, "usage: %s keymaps.def keymaps.c\n", argv[0] );
+        return 2;
+    }
+    mk_file = argv[1];
+    GPtrArray *keymaps = mk_parse( argv[1] );
+    
+    char *tmp_name = g_strconcat( argv[2], ".tmp", NULL );
+    FILE *out = fopen( tmp_name, "w" );
+    if ( !out ) {
+        perror( tmp_name );
+        return 1;
+    }
+    fprintf( out, "/* generated by mkkeymap from %s, do not edit */\n\n", argv[1] );
+    fprintf( out, "#include \"modemap.h\"\n\n" );
+    for (int i = 0; i < keymaps->len; ++i) {
+        mk_keymap *keymap = g_ptr_array_index( keymaps, i );
+        int nr_written = 0;
+        g_free( mk_write_keymap(out, keymap->root, keymap->name, &nr_written, TRUE) );
+        mk_node_free( keymap->root );
+        g_free( keymap->name );
+        g_free( keymap );
+    }
+    g_ptr_array_free( keymaps, TRUE );
+    
+    if ( fclose(out) != 0 || rename(tmp_name, argv[2]) != 0 ) {
+        perror( argv[2] );
+        return 1;
+    }
+    g_free( tmp_name );
+    return 0;
+}
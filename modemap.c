@@ -31,9 +31,9 @@ struct se_modemap_data
     se_key_command_t cmd;  // Null of the node is a non-leaf node
 };
 
-static GNode* se_modemap_search_next_level(se_modemap *map, GNode *node, se_key key)
+static GNode* se_modemap_search_next_level(GNode *node, se_key key)
 {
-    g_assert( map && node );
+    g_assert( node );
    /* se_debug( "search for %s", se_key_to_string(key) ); */
     
     GNode *np = g_node_first_child ( node );
@@ -49,16 +49,230 @@ static GNode* se_modemap_search_next_level(se_modemap *map, GNode *node, se_key
     return NULL;
 }
 
+se_keymap_entry* se_keymap_lookup( se_keymap *keymap, se_key key )
+{
+    if ( key.modifiers == 0 && key.ascii < SE_KEYMAP_NR_DIRECT ) {
+        se_keymap_entry *entry = &keymap->direct[key.ascii];
+        return entry->cmd || entry->next ? entry: NULL;
+    }
+    if ( !keymap->nr_slots )
+        return NULL;
+    
+    guint64 ikey = se_key_to_int( key );
+    guint mask = keymap->nr_slots - 1;
+    for (guint i = se_keymap_hash(ikey, mask); ; i = (i + 1) & mask) {
+        se_keymap_entry *entry = &keymap->slots[i];
+        if ( !entry->cmd && !entry->next )
+            return NULL;
+        if ( entry->key == ikey )
+            return entry;
+    }
+}
+
+static void se_keymap_free( se_keymap* keymap )
+{
+    for (int i = 0; i < SE_KEYMAP_NR_DIRECT; ++i) {
+        if ( keymap->direct[i].next )
+            se_keymap_free( keymap->direct[i].next );
+    }
+    for (int i = 0; i < keymap->nr_slots; ++i) {
+        if ( keymap->slots[i].next )
+            se_keymap_free( keymap->slots[i].next );
+    }
+    g_free( keymap->slots );
+    g_free( keymap );
+}
+
+/**
+ * keymap of children of nodes, and of their children down the trees. nodes
+ * come in priority order: a key means what the first node having it binds it
+ * to, and if that is a prefix, keys following it are merged from all nodes
+ * where it is a prefix too.
+ */
+static se_keymap* se_keymap_merge( GNode** nodes, int nr_nodes )
+{
+    se_keymap *keymap = g_malloc0( sizeof(se_keymap) );
+    // children not shadowed by ones of nodes before
+    GPtrArray *children = g_ptr_array_new();
+    int nr_hashed = 0;
+    for (int n = 0; n < nr_nodes; ++n) {
+        for (GNode *np = g_node_first_child(nodes[n]); np; np = g_node_next_sibling(np)) {
+            se_modemap_data *data = np->data;
+            int shadowed = FALSE;
+            for (int m = 0; m < n && !shadowed; ++m)
+                shadowed = se_modemap_search_next_level( nodes[m], data->key ) != NULL;
+            if ( shadowed )
+                continue;
+            g_ptr_array_add( children, np );
+            if ( data->key.modifiers || data->key.ascii >= SE_KEYMAP_NR_DIRECT )
+                ++nr_hashed;
+        }
+    }
+    if ( nr_hashed ) {
+        keymap->nr_slots = 4;
+        while ( keymap->nr_slots < nr_hashed * 2 )
+            keymap->nr_slots *= 2;
+        keymap->slots = g_new0( se_keymap_entry, keymap->nr_slots );
+    }
+    
+    guint mask = keymap->nr_slots - 1;
+    GNode **prefixes = g_new( GNode*, nr_nodes );
+    for (int c = 0; c < children->len; ++c) {
+        GNode *np = g_ptr_array_index( children, c );
+        se_modemap_data *data = np->data;
+        se_keymap_entry *entry;
+        if ( data->key.modifiers == 0 && data->key.ascii < SE_KEYMAP_NR_DIRECT ) {
+            entry = &keymap->direct[data->key.ascii];
+        } else {
+            guint64 ikey = se_key_to_int( data->key );
+            guint i = se_keymap_hash( ikey, mask );
+            while ( keymap->slots[i].cmd || keymap->slots[i].next )
+                i = (i + 1) & mask;
+            entry = &keymap->slots[i];
+        }
+        entry->key = se_key_to_int( data->key );
+        if ( G_NODE_IS_LEAF(np) ) {
+            entry->cmd = data->cmd;
+            continue;
+        }
+        
+        int nr_prefixes = 0;
+        for (int n = 0; n < nr_nodes; ++n) {
+            GNode *prefix = se_modemap_search_next_level( nodes[n], data->key );
+            if ( prefix && !G_NODE_IS_LEAF(prefix) )
+                prefixes[nr_prefixes++] = prefix;
+        }
+        entry->next = se_keymap_merge( prefixes, nr_prefixes );
+    }
+    g_free( prefixes );
+    g_ptr_array_free( children, TRUE );
+    return keymap;
+}
+
+// never the same for two keymaps built
+static unsigned int se_keymap_stamp()
+{
+    static unsigned int nr_built = 0;
+    return ++nr_built;
+}
+
+// times bindings of any map changed, so caches know they are stale
+static unsigned int se_modemap_nr_changes = 0;
+
+static void se_modemap_thaw_keymap( GNode* node, const se_keymap* keymap );
+
+static void se_modemap_thaw_entry( GNode* node, const se_keymap_entry* entry )
+{
+    if ( !entry->cmd && !entry->next )
+        return;
+    se_modemap_data *data = g_malloc0( sizeof(se_modemap_data) );
+    data->key = int_to_se_key( entry->key );
+    data->cmd = entry->cmd;
+    GNode *np = g_node_append_data( node, data );
+    if ( entry->next )
+        se_modemap_thaw_keymap( np, entry->next );
+}
+
+static void se_modemap_thaw_keymap( GNode* node, const se_keymap* keymap )
+{
+    for (int i = 0; i < SE_KEYMAP_NR_DIRECT; ++i)
+        se_modemap_thaw_entry( node, &keymap->direct[i] );
+    for (int i = 0; i < keymap->nr_slots; ++i)
+        se_modemap_thaw_entry( node, &keymap->slots[i] );
+}
+
+// root of tree, with builtin bindings put in first if they are not yet
+static GNode* se_modemap_tree( se_modemap* map )
+{
+    if ( map->builtin && !map->thawed ) {
+        se_modemap_thaw_keymap( map->root, map->builtin );
+        map->thawed = TRUE;
+    }
+    return map->root;
+}
+
+se_keymap* se_modemap_compile( se_modemap *map )
+{
+    g_assert( map );
+    if ( !map->compiled ) {
+        GNode *root = se_modemap_tree( map );
+        map->compiled = se_keymap_merge( &root, 1 );
+    }
+    return map->compiled;
+}
+
+// bindings changed, compile again when next looked up
+static void se_modemap_invalidate( se_modemap* map )
+{
+    ++se_modemap_nr_changes;
+    if ( map->compiled ) {
+        if ( map->compiled != map->builtin )
+            se_keymap_free( map->compiled );
+        map->compiled = NULL;
+    }
+}
+
+int se_keymap_cache_is_valid( se_keymap_cache *cache, unsigned int generation )
+{
+    g_assert( cache );
+    return cache->keymap && cache->nr_changes == se_modemap_nr_changes
+        && cache->generation == generation;
+}
+
+se_keymap* se_keymap_cache_build( se_keymap_cache *cache, se_modemap **maps, int nr_maps )
+{
+    g_assert( cache );
+    se_keymap_cache_clear( cache );
+    if ( nr_maps == 1 ) {
+        cache->keymap = se_modemap_compile( maps[0] );
+    } else {
+        GNode **roots = g_new( GNode*, nr_maps + 1 );
+        for (int i = 0; i < nr_maps; ++i)
+            roots[i] = se_modemap_tree( maps[i] );
+        cache->keymap = se_keymap_merge( roots, nr_maps );
+        cache->owned = TRUE;
+        g_free( roots );
+    }
+    cache->generation = se_keymap_stamp();
+    cache->nr_changes = se_modemap_nr_changes;
+    return cache->keymap;
+}
+
+void se_keymap_cache_clear( se_keymap_cache *cache )
+{
+    g_assert( cache );
+    if ( cache->owned )
+        se_keymap_free( cache->keymap );
+    cache->keymap = NULL;
+    cache->owned = FALSE;
+}
+
+// entry of keyseq in compiled keymap, or NULL if it is not bound
+static se_keymap_entry* se_modemap_find_entry( se_modemap* map, se_key_seq keyseq )
+{
+    se_keymap *keymap = se_modemap_compile( map );
+    se_keymap_entry *entry = NULL;
+    for (int i = 0; i < keyseq.len; ++i) {
+        if ( !keymap )
+            return NULL;
+        entry = se_keymap_lookup( keymap, keyseq.keys[i] );
+        if ( !entry )
+            return NULL;
+        keymap = entry->next;
+    }
+    return entry;
+}
+
 static GNode* se_modemap_find_match_node(se_modemap* map, se_key_seq keyseq)
 {
     g_assert( map );
 
     int i = 0;
-    GNode *np = se_modemap_search_next_level(map, map->root, keyseq.keys[i++]);
+    GNode *np = se_modemap_search_next_level(se_modemap_tree(map), keyseq.keys[i++]);
     while ( np ) {
         if ( i == keyseq.len )
             break;
-        np = se_modemap_search_next_level(map, np, keyseq.keys[i++]);
+        np = se_modemap_search_next_level(np, keyseq.keys[i++]);
     }
 
     return np;
@@ -78,57 +292,20 @@ se_modemap* se_modemap_simple_create(const char* map_name )
 
 se_modemap* se_modemap_full_create(const char* map_name )
 {
-    g_assert( map_name && map_name[0] );
-    
-    se_modemap *map = se_modemap_simple_create( map_name );
-    for (int i = 0x20; i <= 0x7e; ++i) {
-        g_assert( isprint(i) );
-        se_key_command_t cmd = se_self_insert_command;
-        se_key_seq keyseq = {
-            1, {{0, i}}
-        };
-        se_modemap_insert_keybinding( map, keyseq, cmd );
-    }
-    /*
-     * XK_BackSpace                     0xff08
-     * XK_Tab                           0xff09
-     * XK_Return                        0xff0d
-     * XK_Scroll_Lock                   0xff14
-     * XK_Escape                        0xff1b
-     * XK_Delete                        0xffff
-     */    
-    se_modemap_insert_keybinding_str( map, "C-x C-c", se_editor_quit_command );
-    se_modemap_insert_keybinding_str( map, "C-u", se_universal_arg_command );    
-    se_modemap_insert_keybinding_str( map, "C-g", se_kbd_quit_command );
-    se_modemap_insert_keybinding_str( map, "C-j", se_newline_and_indent_command );
-    se_modemap_insert_keybinding_str( map, "C-i", se_indent_for_tab_command );
-    se_modemap_insert_keybinding_str( map, "Tab",
-                                      se_indent_for_tab_command );
-    se_modemap_insert_keybinding_str( map, "Return",
-                                      se_newline_command );
-    se_modemap_insert_keybinding_str( map, "BackSpace",
-                                      se_backspace_command );
-    se_modemap_insert_keybinding_str( map, "C-d",
-                                      se_delete_forward_command );
-    
-    se_modemap_insert_keybinding_str( map, "C-f", se_forward_char_command );
-    se_modemap_insert_keybinding_str( map, "C-b", se_backward_char_command );
-    se_modemap_insert_keybinding_str( map, "C-n", se_forward_line_command );
-    se_modemap_insert_keybinding_str( map, "C-p", se_backward_line_command );
-    
-    se_modemap_insert_keybinding_str( map, "C-a", se_move_beginning_of_line_command );
-    se_modemap_insert_keybinding_str( map, "C-e", se_move_end_of_line_command );
-    
-    se_modemap_insert_keybinding_str( map, "Home", se_move_beginning_of_line_command );
-    se_modemap_insert_keybinding_str( map, "End", se_move_end_of_line_command );
+    return se_modemap_builtin_create( map_name, &se_fundamental_keymap );
+}
 
-    se_modemap_insert_keybinding_str( map, "C--", se_previous_buffer_command );
-    se_modemap_insert_keybinding_str( map, "C-=", se_next_buffer_command );
-    
+se_modemap* se_modemap_builtin_create(const char* map_name, const se_keymap* builtin)
+{
+    g_assert( builtin );
+    se_modemap *map = se_modemap_simple_create( map_name );
+    map->builtin = builtin;
+    // nothing writes a compiled keymap, it is only looked up
+    map->compiled = (se_keymap*)builtin;
     return map;
 }
 
-se_key_command_t se_modemap_lookup_command_ex( se_modemap *map, se_key_seq keyseq )
+se_key_command_t se_modemap_lookup_command_tree( se_modemap *map, se_key_seq keyseq )
 {
     GNode *np = se_modemap_find_match_node( map, keyseq );
     if ( np ) {
@@ -142,27 +319,29 @@ se_key_command_t se_modemap_lookup_command_ex( se_modemap *map, se_key_seq keyse
     return NULL;    
 }
 
+se_key_command_t se_modemap_lookup_command_ex( se_modemap *map, se_key_seq keyseq )
+{
+    se_keymap_entry *entry = se_modemap_find_entry( map, keyseq );
+    if ( entry )
+        return entry->next ? se_second_dispatch_command: entry->cmd;
+    return NULL;    
+}
+
 se_key_command_t se_modemap_lookup_command( se_modemap *map, se_key key )
 {
-    GNode *np = se_modemap_search_next_level( map, map->root, key );
-    if ( np ) {
-        if ( G_NODE_IS_LEAF(np) ) {
-            se_modemap_data *data = np->data;
-            g_assert( data->cmd );            
-            return data->cmd;
-        }
-        return se_second_dispatch_command;        
-    }
+    g_assert( map );
+    se_keymap_entry *entry = se_keymap_lookup( se_modemap_compile(map), key );
+    if ( entry )
+        return entry->next ? se_second_dispatch_command: entry->cmd;
     return NULL;
 }
 
 se_key_command_t se_modemap_lookup_keybinding( se_modemap *map, se_key_seq keyseq )
 {
-    GNode *np = se_modemap_find_match_node( map, keyseq );
-    if ( np && G_NODE_IS_LEAF(np) ) {
-        se_modemap_data *data = np->data;
-        g_assert( data->cmd );
-        return data->cmd;
+    se_keymap_entry *entry = se_modemap_find_entry( map, keyseq );
+    if ( entry && !entry->next ) {
+        g_assert( entry->cmd );
+        return entry->cmd;
     }
 
     return NULL;
@@ -178,15 +357,7 @@ int se_modemap_keybinding_exists_str(se_modemap* map, const char* keys_rep)
 
 int se_modemap_keybinding_exists(se_modemap* map, se_key_seq keyseq)
 {
-    GNode *np = se_modemap_find_match_node( map, keyseq );
-    if ( np ) {
-        if ( G_NODE_IS_LEAF(np) ) {
-            se_modemap_data *data = np->data;
-            g_assert( data->cmd );
-            return TRUE;
-        }
-    }
-    return FALSE;
+    return se_modemap_lookup_keybinding( map, keyseq ) != NULL;
 }
 
 void se_modemap_insert_keybinding(se_modemap* map, se_key_seq keyseq,
@@ -207,28 +378,53 @@ static void se_delete_subtree( GNode *parent )
     }
 }
 
+/**
+ * like se_key_seq_from_string(), but a binding may be longer than a se_key_seq
+ * holds. g_free() the keys.
+ */
+static se_key* se_modemap_parse_keys( const char* keys_rep, int* nr_keys )
+{
+    if ( strlen(keys_rep) == 1 ) {
+        *nr_keys = 1;
+        se_key *keys = g_new( se_key, 1 );
+        keys[0] = se_key_from_string( keys_rep );
+        return keys;
+    }
+
+    gchar **key_reps = g_strsplit_set( keys_rep, " ", -1 );
+    se_key *keys = g_new( se_key, g_strv_length(key_reps) + 1 );
+    int n = 0;
+    for (gchar **repp = key_reps; *repp; ++repp) {
+        if ( **repp )
+            keys[n++] = se_key_from_string( *repp );
+    }
+    g_strfreev( key_reps );
+    *nr_keys = n;
+    return keys;
+}
+
 void se_modemap_insert_keybinding_str( se_modemap *map, const char* keys_rep,
                                    se_key_command_t cmd )
 {
     g_assert( map && keys_rep && cmd );
-    se_key_seq keyseq = se_key_seq_from_string( keys_rep );
-    if ( keyseq.len <= 0 ) {
+    int nr_keys = 0;
+    se_key *keys = se_modemap_parse_keys( keys_rep, &nr_keys );
+    if ( nr_keys <= 0 ) {
         se_warn( "bad key seq" );
+        g_free( keys );
         return;
     }
     
-    if ( se_modemap_keybinding_exists(map, keyseq) ) {
-        /* se_msg("remap an existed keybinding" ); */
-    }
+    GNode *node = se_modemap_tree( map );
+    se_modemap_invalidate( map );
 
-    GNode *node = map->root;
     int need_create_node = FALSE; // trace from which level we need to create nodes
-    for (int i = 0; i < keyseq.len; ++i) {
-        se_key key = keyseq.keys[i];
+    for (int i = 0; i < nr_keys; ++i) {
+        se_key key = keys[i];
         /* se_debug( "current key %s", se_key_to_string(key) ); */
         
         if ( !need_create_node ) {
-            GNode *key_node = se_modemap_search_next_level(map, node, key);
+            GNode *key_node = se_modemap_search_next_level(node, key);
             if ( !key_node ) {
                 need_create_node = TRUE;
                 --i;
@@ -243,7 +439,7 @@ void se_modemap_insert_keybinding_str( se_modemap *map, const char* keys_rep,
             g_assert( data );
             g_assert( se_key_is_equal(key, data->key) );
             
-            if ( i+1 == keyseq.len ) { // bind to a cmd
+            if ( i+1 == nr_keys ) { // bind to a cmd
                 if ( !G_NODE_IS_LEAF(key_node) )  {
                     // delete sub tree
                     /* se_debug( "delete sub tree" ); */
@@ -271,7 +467,7 @@ void se_modemap_insert_keybinding_str( se_modemap *map, const char* keys_rep,
             se_modemap_data *data = g_malloc0( sizeof(se_modemap_data) );
             data->key = key;
             GNode *key_node = g_node_append_data( node, data );
-            if ( i+1 == keyseq.len ) { // bind to a cmd
+            if ( i+1 == nr_keys ) { // bind to a cmd
                 /* se_debug( "leaf node (level %d) of key %s: bind cmd", */
                 /*           g_node_depth(key_node), se_key_to_string(data->key) ); */
                 data->cmd = cmd;
@@ -279,11 +475,13 @@ void se_modemap_insert_keybinding_str( se_modemap *map, const char* keys_rep,
             node = key_node;
         }
     }
+    g_free( keys );
 }
 
 void se_modemap_free(se_modemap* modemap)
 {
     g_assert( modemap );
+    se_modemap_invalidate( modemap );
     g_node_destroy( modemap->root );
 }
 
@@ -307,6 +505,8 @@ static int se_mode_bindMap(se_mode* modep, se_modemap* map)
         // clean up
     }
     modep->modemap = map;
+    // buffers having this mode look up keys in map from now on
+    ++se_modemap_nr_changes;
     return TRUE;
 }
 
@@ -30,6 +30,44 @@
 extern "C" {
 #endif
 
+/**
+ * compiled form of a modemap, what key dispatching looks up. keys without
+ * modifiers below SE_KEYMAP_NR_DIRECT (all printable ones) index an array,
+ * other keys are found in an open addressing table by se_key_to_int(). a
+ * prefix key leads to the keymap of keys following it.
+ */
+#define SE_KEYMAP_NR_DIRECT  0x80
+
+DEF_CLS(se_keymap);
+DEF_CLS(se_keymap_entry);
+struct se_keymap_entry
+{
+    guint64 key;           // se_key_to_int() of key
+    se_key_command_t cmd;  // NULL for a prefix
+    se_keymap *next;       // keys following a prefix, else NULL
+};
+
+struct se_keymap
+{
+    se_keymap_entry direct[SE_KEYMAP_NR_DIRECT]; // unbound if cmd and next are NULL
+    se_keymap_entry *slots; // unused if cmd and next are NULL
+    int nr_slots;           // a power of 2, at least twice the keys in slots
+};
+
+// first slot to probe for key in slots, mkkeymap lays out keymaps with it too
+static inline guint se_keymap_hash( guint64 ikey, guint mask )
+{
+    guint h = (guint)(ikey ^ (ikey >> 32)) * 0x9e3779b1u;
+    return (h ^ (h >> 16)) & mask;
+}
+
+/**
+ * default keymaps, compiled from keymaps.def by mkkeymap when building, so
+ * they are in the binary ready to use.
+ */
+extern const se_keymap se_fundamental_keymap;
+extern const se_keymap se_occur_keymap;
+
 DEF_CLS(se_modemap_data);
 DEF_CLS(se_modemap);
 struct se_modemap
@@ -39,10 +77,23 @@ struct se_modemap
      * key map to se_modemap_data, it's either a cmd, or a 2nd disptach table
      */
     GNode* root; // root store no key or cmd, the summary info
+    /**
+     * built from root by first lookup after it is changed, root is where
+     * bindings are made.
+     */
+    se_keymap *compiled;
+    /**
+     * compiled bindings the map starts with, or NULL. they are only put into
+     * root when a binding changes or the tree is walked.
+     */
+    const se_keymap *builtin;
+    int thawed;
 };
 
 extern se_modemap* se_modemap_simple_create(const char*);
+// has all default bindings of se_fundamental_keymap
 extern se_modemap* se_modemap_full_create(const char*);
+extern se_modemap* se_modemap_builtin_create(const char*, const se_keymap* builtin);
 extern void se_modemap_free(se_modemap*);
 extern void se_modemap_dump(se_modemap*);
 
@@ -59,6 +110,44 @@ extern se_key_command_t se_modemap_lookup_command_ex( se_modemap *map, se_key_se
  */
 extern se_key_command_t se_modemap_lookup_keybinding( se_modemap *map, se_key_seq );
 
+/**
+ * lookups above go through the compiled keymap, which is built here if the
+ * tree changed since last time
+ */
+extern se_keymap* se_modemap_compile( se_modemap *map );
+// entry of key in keymap, or NULL if it is not bound
+extern se_keymap_entry* se_keymap_lookup( se_keymap *keymap, se_key key );
+
+/**
+ * what keys mean where some maps are active: their keymaps merged in priority
+ * order, so looking up a key costs the same however many maps there are. it
+ * is built again only after maps change or bindings of any map change.
+ */
+DEF_CLS(se_keymap_cache);
+struct se_keymap_cache
+{
+    se_keymap *keymap;        // NULL until built
+    int owned;                // merged here, else compiled form of the only map
+    /**
+     * never the same for two keymaps built, so who keeps a keymap inside
+     * keymap knows if it is still there.
+     */
+    unsigned int generation;
+    unsigned int nr_changes;  // changes of bindings seen when built
+};
+
+// if keymap of cache is still built with generation and up to date
+extern int se_keymap_cache_is_valid( se_keymap_cache *cache, unsigned int generation );
+// maps come first in priority order
+extern se_keymap* se_keymap_cache_build( se_keymap_cache *cache, se_modemap **maps,
+                                         int nr_maps );
+extern void se_keymap_cache_clear( se_keymap_cache *cache );
+/**
+ * walk the tree itself, as lookups did before keymaps were compiled. for
+ * checking the compiled form, same result as se_modemap_lookup_command_ex().
+ */
+extern se_key_command_t se_modemap_lookup_command_tree( se_modemap *map, se_key_seq );
+
 extern void se_modemap_insert_keybinding_str(se_modemap*, const char*, se_key_command_t);
 extern void se_modemap_insert_keybinding(se_modemap*, se_key_seq, se_key_command_t);
 
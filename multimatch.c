@@ -29,6 +29,9 @@
 #include <strings.h>
 #include <assert.h>
 
+// texts shorter than 4 lanes of this are not worth cutting
+#define TRIE_DFA_LANE_MIN_LEN  4096
+
 static trie_node* trie_node_get_transfer_node( trie_node* node, int c );
 static void trie_node_add_transfer( trie_node* node,  trie_node* next );
 
@@ -41,6 +44,7 @@ static trie_node* trie_node_new( int state, int expect, trie_node* parent )
     node->trans = 0;
     node->trans_size = 0;
     node->accept = 0;  // default value
+    node->keyword = -1;
     return node;
 }
 
@@ -76,11 +80,22 @@ void trie_node_add_transfer( trie_node* node, trie_node* next )
     /* se_debug( "add transfer: %d -> %d\n", node->state, next->state ); */
 }
 
+static void trie_add_node( trie_t* trie, trie_node* node )
+{
+    if ( trie->nr_states >= trie->node_list_size ) {
+        trie->node_list_size = MAX( trie->node_list_size * 2, 16 );
+        trie->node_list = (trie_node**)realloc(
+            trie->node_list, sizeof(trie_node*) * trie->node_list_size );
+    }
+    trie->node_list[trie->nr_states++] = node;
+}
+
 trie_t* trie_init()
 {
     trie_t *trie = (trie_t*) malloc( sizeof(trie_t) );
     bzero( trie, sizeof(trie_t) );
-    trie->root = trie_node_new( trie->nr_states++, 0, 0 );
+    trie->root = trie_node_new( trie->nr_states, 0, 0 );
+    trie_add_node( trie, trie->root );
     return trie;
 }
 
@@ -89,16 +104,16 @@ trie_t* trie_add_keyword(trie_t* trie, const char* keyword)
     assert( trie );
     assert( trie->root );
 
-    if ( trie->nr_keywords >= MAX_KEYWORDS ) {
-        se_warn( "there is too many keywords\n");
-        return trie;
-    }
-    
     int len = strlen( keyword );
-    //TODO: check duplication
+    assert( len > 0 );
+    
+    if ( trie->nr_keywords >= trie->keywords_size ) {
+        trie->keywords_size = MAX( trie->keywords_size * 2, 16 );
+        trie->keywords = (char**)realloc(
+            trie->keywords, sizeof(char*) * trie->keywords_size );
+    }
     trie->keywords[trie->nr_keywords] = strndup( keyword, len+1 );
     trie->nr_keywords++;
-
     
     trie_node* cur_state = trie->root;
     assert( cur_state );
@@ -107,22 +122,20 @@ trie_t* trie_add_keyword(trie_t* trie, const char* keyword)
         trie_node* next_state = trie_node_get_transfer_node( cur_state, keyword[i] );
         if ( !next_state ) {
             // need to build new state
-            trie_node* next_state = trie_node_new(
-                trie->nr_states++, keyword[i], cur_state );
-            next_state->accept =  ( i == len - 1 );
-            
-            trie->node_list = (trie_node**)realloc(
-                trie->node_list, sizeof(trie_node*) * trie->nr_states );
-            trie->node_list[trie->nr_states-1] = next_state;
+            next_state = trie_node_new( trie->nr_states, keyword[i], cur_state );
+            trie_add_node( trie, next_state );
             /* se_debug( "new node: (%c, %d)\n", next_state->expect, next_state->state ); */
             
             trie_node_add_transfer( cur_state, next_state );
-            cur_state = next_state;
-            
-        } else {
-            /* se_debug( "node exists: (%c, %d)\n", next_state->expect, next_state->state ); */
-            cur_state = next_state;
         }
+        cur_state = next_state;
+    }
+
+    // keyword may be a prefix of one added before, and a duplicated one keeps
+    // the first id
+    if ( !cur_state->accept ) {
+        cur_state->accept = 1;
+        cur_state->keyword = trie->nr_keywords - 1;
     }
 
     return trie;
@@ -145,74 +158,53 @@ trie_node* trie_node_get_transfer_node( trie_node* node, int c )
     return 0;
 }
 
-static void _trie_calc_children_failure_func( trie_t* trie, GList* node_stack )
+/**
+ * failure function by breadth first traversal, with a plain array as queue:
+ * failure state of a node is always shallower, so it is done before the node.
+ */
+static void trie_calc_failure_func( trie_t* trie )
 {
-    GList* next_layer = 0;
-
-    int len = g_list_length( node_stack );
-    for ( int i = 0; i < len; ++i ) {
-        trie_node* next = g_list_nth( node_stack, i )->data;
-        for ( int j = 0; j < next->trans_size; ++j ) {
-            next_layer = g_list_append( next_layer, next->trans[j] );
-        }
+    int *fail = (int*) realloc( trie->node_failure_func, sizeof(int) * trie->nr_states );
+    int *queue = (int*) malloc( sizeof(int) * trie->nr_states );
+    int head = 0, tail = 0;
+
+    fail[0] = 0;
+    queue[tail++] = 0;
+    while ( head < tail ) {
+        trie_node *node = trie->node_list[ queue[head++] ];
+        for ( int i = 0; i < node->trans_size; ++i ) {
+            trie_node *next = node->trans[i];
+            queue[tail++] = next->state;
+            if ( node == trie->root ) {
+                fail[next->state] = 0;
+                continue;
+            }
 
-        trie_node* par_node = next->parent;
-        if ( par_node == trie->root ) {
-            trie->node_failure_func[next->state] = 0;
-            continue;
-        }
-        
-        int prev_matched = trie->node_failure_func[par_node->state];
-        /* se_debug( "prev_matched:%d\n", prev_matched ); */
-        
-        trie_node* succ = trie->node_list[prev_matched];
-        trie_node* succ_next = trie_node_get_transfer_node(succ, next->expect);
-
-        while( prev_matched && !succ_next ) {
-            prev_matched = trie->node_failure_func[prev_matched];
-            /* se_debug( "prev_matched:%d\n", prev_matched ); */
-            succ = trie->node_list[prev_matched];
-            succ_next = trie_node_get_transfer_node(succ, next->expect);
+            int prev_matched = fail[node->state];
+            trie_node *succ_next = trie_node_get_transfer_node(
+                trie->node_list[prev_matched], next->expect );
+            while ( prev_matched && !succ_next ) {
+                prev_matched = fail[prev_matched];
+                succ_next = trie_node_get_transfer_node(
+                    trie->node_list[prev_matched], next->expect );
+            }
+            fail[next->state] = succ_next ? succ_next->state : 0;
         }
-
-        if ( succ_next )
-            trie->node_failure_func[next->state] = succ_next->state;
-        else
-            trie->node_failure_func[next->state] = 0;
-        /* se_debug( "failure[%d] = %d\n", next->state, */
-        /*        trie->node_failure_func[next->state] ); */
     }
 
-    if ( next_layer ) {
-        _trie_calc_children_failure_func( trie, next_layer );
-        g_list_free( next_layer );
-    }
+    free( queue );
+    trie->node_failure_func = fail;
 }
 
 trie_t* trie_init_with_keywords(char** kws, int nr_kws )
 {
-    trie_t *trie = (trie_t*) malloc( sizeof(trie_t) );
-    bzero( trie, sizeof(trie_t) );
-    trie->root = trie_node_new( trie->nr_states, 0, 0 );
-
-    trie->node_list = (trie_node**) malloc( sizeof(trie_node*) );
-    trie->node_list[trie->nr_states++] = trie->root;
-
+    trie_t *trie = trie_init();
     for ( int i = 0; i < nr_kws; ++i ) {
         trie_add_keyword( trie, kws[i] );
     }
     
     // calculate failure function for new state
-    trie->node_failure_func = (int*) malloc( sizeof(int) * trie->nr_states );
-    trie->node_failure_func[0] = 0;
-    
-    GList* node_stack = NULL;
-    for ( int i = 0; i < trie->root->trans_size; ++i ) {
-        node_stack = g_list_append( node_stack, trie->root->trans[i] );
-    }
-    _trie_calc_children_failure_func( trie, node_stack );
-    g_list_free( node_stack );
-    
+    trie_calc_failure_func( trie );
     return trie;
 }
 
@@ -223,8 +215,10 @@ void trie_free( trie_t* trie)
     for ( int i = 0; i < trie->nr_keywords; ++i ) {
         free( trie->keywords[i] );
     }
+    free( trie->keywords );
     
     for ( int i = 0; i < trie->nr_states; ++i ) {
+        free( trie->node_list[i]->trans );
         trie_node_free( trie->node_list[i] );
     }
     free( trie->node_list );
@@ -232,20 +226,7 @@ void trie_free( trie_t* trie)
     free( trie->node_failure_func );
 
     bzero( trie, sizeof(trie_t) );
-}
-
-static char* trie_backtrack_get_matched( trie_node* node )
-{
-    char buf[128] = "";
-    trie_node* par = node;
-    while( par->state != 0 ) {
-        char part[128];
-        snprintf( part, sizeof part, "%c%s", par->expect, buf );
-        par = par->parent;
-        strcpy( buf, part );
-    }
-    
-    return strdup(buf);
+    free( trie );
 }
 
 static void _trie_dump(trie_t* trie)
@@ -267,6 +248,16 @@ static void _trie_dump(trie_t* trie)
     se_debug( "%s\n", val );
 }
 
+static trie_node* trie_next_state( trie_t* trie, trie_node* cur_state, int c )
+{
+    trie_node* next_state = trie_node_get_transfer_node( cur_state, c );
+    while ( !next_state && cur_state != trie->root ) {
+        cur_state = trie->node_list[ trie->node_failure_func[cur_state->state] ];
+        next_state = trie_node_get_transfer_node( cur_state, c );
+    }
+    return next_state ? next_state : trie->root;
+}
+
 int trie_match_ex(trie_t* trie, const char* str,
                   int nmatch, trie_match_result results[])
 {
@@ -277,21 +268,17 @@ int trie_match_ex(trie_t* trie, const char* str,
     trie_node* cur_state = trie->root;
     int nr_match = 0;
     
-    for ( int i = 0; i < len; ++i ) {
-        if ( nr_match >= nmatch )
-            break;
-        
-        trie_node* next_state = trie_node_get_transfer_node( cur_state, str[i] );
-        if ( next_state ) {
-            cur_state = next_state;
-            if ( cur_state->accept ) {
-                char* matched_kw = trie_backtrack_get_matched( cur_state );
-                results[nr_match++] = (trie_match_result) { matched_kw, i - strlen(matched_kw) };
-                /* msg( "matched: %s at %d\n", matched_kw, i - strlen(matched_kw) ); */
-                cur_state = trie->node_list[ trie->node_failure_func[cur_state->state] ];
+    for ( int i = 0; i < len && nr_match < nmatch; ++i ) {
+        cur_state = trie_next_state( trie, cur_state, str[i] );
+
+        // keywords ending here are this state and its failure states
+        for ( trie_node* out = cur_state; out != trie->root && nr_match < nmatch;
+              out = trie->node_list[ trie->node_failure_func[out->state] ] ) {
+            if ( out->accept ) {
+                const char* matched_kw = trie->keywords[out->keyword];
+                results[nr_match++] = (trie_match_result) {
+                    matched_kw, i + 1 - (int)strlen(matched_kw) };
             }
-        } else {
-            cur_state = trie->node_list[ trie->node_failure_func[cur_state->state] ];
         }
     }
 
@@ -308,20 +295,265 @@ int trie_match(trie_t* trie, const char* str)
     int nr_match = 0;
     
     for ( int i = 0; i < len; ++i ) {
-        trie_node* next_state = trie_node_get_transfer_node( cur_state, str[i] );
-        if ( next_state ) {
-            cur_state = next_state;
-            if ( cur_state->accept ) {
-                ++nr_match;
-                /* char* matched_kw = trie_backtrack_get_matched( cur_state ); */
-                /* msg( "matched: %s at %d\n", matched_kw, i - strlen(matched_kw) ); */
-                cur_state = trie->node_list[ trie->node_failure_func[cur_state->state] ];
+        cur_state = trie_next_state( trie, cur_state, str[i] );
+        for ( trie_node* out = cur_state; out != trie->root;
+              out = trie->node_list[ trie->node_failure_func[out->state] ] ) {
+            nr_match += out->accept;
+        }
+    }
+
+    return nr_match;
+}
+
+trie_dfa* trie_dfa_compile( trie_t* trie )
+{
+    assert( trie && trie->root );
+    
+    trie_dfa *dfa = (trie_dfa*) malloc( sizeof(trie_dfa) );
+    bzero( dfa, sizeof(trie_dfa) );
+
+    // bytes that never appear in keywords all behave the same
+    int nr_classes = 1;
+    for ( int i = 1; i < trie->nr_states; ++i ) {
+        unsigned char c = trie->node_list[i]->expect;
+        if ( !dfa->classes[c] )
+            dfa->classes[c] = nr_classes++;
+    }
+
+    const int n = trie->nr_states;
+    assert( (long long)n * nr_classes < (1LL<<31) );
+    dfa->nr_states = n;
+    dfa->nr_classes = nr_classes;
+
+    // build rows in trie's numbering first, breadth first so that failure
+    // state of every node is done before the node
+    int *delta = (int*) calloc( (size_t)n * nr_classes, sizeof(int) );
+    int *fail = (int*) malloc( n * sizeof(int) );
+    int *queue = (int*) malloc( n * sizeof(int) );
+    int head = 0, tail = 0;
+
+    fail[0] = 0;
+    queue[tail++] = 0;
+    while ( head < tail ) {
+        int u = queue[head++];
+        trie_node *node = trie->node_list[u];
+        int *row = delta + (size_t)u * nr_classes;
+        if ( u )
+            memcpy( row, delta + (size_t)fail[u] * nr_classes, nr_classes * sizeof(int) );
+        
+        for ( int i = 0; i < node->trans_size; ++i ) {
+            trie_node *child = node->trans[i];
+            int cls = dfa->classes[(unsigned char)child->expect];
+            fail[child->state] = u ? row[cls] : 0;
+            row[cls] = child->state;
+            queue[tail++] = child->state;
+        }
+    }
+    assert( tail == n );
+
+    // keywords reported at each state, by following failure chain
+    int *keyword_ids = (int*) malloc( n * sizeof(int) );
+    int *links = (int*) malloc( n * sizeof(int) );
+    int *nr_reports = (int*) malloc( n * sizeof(int) );
+    int nr_reporting = 0;
+    for ( int i = 0; i < n; ++i ) {
+        int u = queue[i];
+        keyword_ids[u] = trie->node_list[u]->keyword;
+        if ( u == 0 ) {
+            links[u] = -1;
+            nr_reports[u] = 0;
+            continue;
+        }
+        
+        int f = fail[u];
+        links[u] = keyword_ids[f] >= 0 ? f : links[f];
+        nr_reports[u] = (keyword_ids[u] >= 0) + nr_reports[f];
+        if ( nr_reports[u] )
+            nr_reporting++;
+    }
+
+    // renumber: reporting states first, then turn numbers into row offsets
+    int *renum = fail;
+    int next_reporting = 0, next_silent = nr_reporting;
+    for ( int i = 0; i < n; ++i ) {
+        int u = queue[i];
+        renum[u] = nr_reports[u] ? next_reporting++ : next_silent++;
+    }
+
+    dfa->delta = (int*) malloc( (size_t)n * nr_classes * sizeof(int) );
+    dfa->keyword_ids = (int*) malloc( n * sizeof(int) );
+    dfa->report_links = (int*) malloc( n * sizeof(int) );
+    dfa->nr_reports = (int*) malloc( n * sizeof(int) );
+    for ( int u = 0; u < n; ++u ) {
+        int v = renum[u];
+        int *row = delta + (size_t)u * nr_classes;
+        int *new_row = dfa->delta + (size_t)v * nr_classes;
+        for ( int c = 0; c < nr_classes; ++c )
+            new_row[c] = renum[row[c]] * nr_classes;
+
+        dfa->keyword_ids[v] = keyword_ids[u];
+        dfa->report_links[v] = links[u] < 0 ? -1 : renum[links[u]] * nr_classes;
+        dfa->nr_reports[v] = nr_reports[u];
+    }
+    dfa->start = renum[0] * nr_classes;
+    dfa->report_limit = nr_reporting * nr_classes;
+
+    dfa->nr_keywords = trie->nr_keywords;
+    dfa->keyword_lens = (int*) malloc( MAX(trie->nr_keywords, 1) * sizeof(int) );
+    dfa->max_len = 1;
+    for ( int i = 0; i < trie->nr_keywords; ++i ) {
+        dfa->keyword_lens[i] = strlen( trie->keywords[i] );
+        dfa->max_len = MAX( dfa->max_len, dfa->keyword_lens[i] );
+    }
+
+    free( delta );
+    free( fail );
+    free( queue );
+    free( keyword_ids );
+    free( links );
+    free( nr_reports );
+    return dfa;
+}
+
+void trie_dfa_free( trie_dfa* dfa )
+{
+    assert( dfa );
+    free( dfa->delta );
+    free( dfa->keyword_ids );
+    free( dfa->report_links );
+    free( dfa->nr_reports );
+    free( dfa->keyword_lens );
+    free( dfa );
+}
+
+// state after running over the longest keyword before from, any match
+// ending at or after from only depends on these bytes
+static int trie_dfa_state_at( trie_dfa* dfa, const char* str, long long from )
+{
+    int state = dfa->start;
+    for ( long long i = MAX(from - dfa->max_len + 1, 0); i < from; ++i )
+        state = dfa->delta[state + dfa->classes[(unsigned char)str[i]]];
+    return state;
+}
+
+static long long trie_dfa_match_range( trie_dfa* dfa, const char* str,
+                                       long long from, long long to )
+{
+    const int *delta = dfa->delta;
+    const unsigned short *classes = dfa->classes;
+    const int report_limit = dfa->report_limit;
+    int state = trie_dfa_state_at( dfa, str, from );
+    long long nr_match = 0;
+    
+    for ( long long i = from; i < to; ++i ) {
+        state = delta[state + classes[(unsigned char)str[i]]];
+        if ( state < report_limit )
+            nr_match += dfa->nr_reports[state / dfa->nr_classes];
+    }
+    return nr_match;
+}
+
+long long trie_dfa_match( trie_dfa* dfa, const char* str, long long len )
+{
+    assert( dfa && str );
+
+    // each byte costs a table lookup depending on the one before, so long
+    // texts are cut into 4 lanes which run interleaved, to keep several
+    // lookups in flight
+    if ( len < TRIE_DFA_LANE_MIN_LEN * 4 )
+        return trie_dfa_match_range( dfa, str, 0, len );
+
+    const int *delta = dfa->delta;
+    const unsigned short *classes = dfa->classes;
+    const int report_limit = dfa->report_limit;
+    const long long lane_len = len / 4;
+    long long nr_match = 0;
+    
+    const char *l0 = str, *l1 = l0 + lane_len, *l2 = l1 + lane_len, *l3 = l2 + lane_len;
+    int s0 = dfa->start;
+    int s1 = trie_dfa_state_at( dfa, str, lane_len );
+    int s2 = trie_dfa_state_at( dfa, str, lane_len * 2 );
+    int s3 = trie_dfa_state_at( dfa, str, lane_len * 3 );
+    
+    for ( long long i = 0; i < lane_len; ++i ) {
+        s0 = delta[s0 + classes[(unsigned char)l0[i]]];
+        s1 = delta[s1 + classes[(unsigned char)l1[i]]];
+        s2 = delta[s2 + classes[(unsigned char)l2[i]]];
+        s3 = delta[s3 + classes[(unsigned char)l3[i]]];
+        if ( __builtin_expect((s0 < report_limit) | (s1 < report_limit)
+                              | (s2 < report_limit) | (s3 < report_limit), 0) ) {
+            if ( s0 < report_limit )
+                nr_match += dfa->nr_reports[s0 / dfa->nr_classes];
+            if ( s1 < report_limit )
+                nr_match += dfa->nr_reports[s1 / dfa->nr_classes];
+            if ( s2 < report_limit )
+                nr_match += dfa->nr_reports[s2 / dfa->nr_classes];
+            if ( s3 < report_limit )
+                nr_match += dfa->nr_reports[s3 / dfa->nr_classes];
+        }
+    }
+
+    // whatever is left after the last lane
+    return nr_match + trie_dfa_match_range( dfa, str, lane_len * 4, len );
+}
+
+void trie_dfa_cursor_init( trie_dfa* dfa, trie_dfa_cursor* cur )
+{
+    assert( dfa && cur );
+    bzero( cur, sizeof(trie_dfa_cursor) );
+    cur->state = dfa->start;
+    cur->pending = -1;
+}
+
+void trie_dfa_cursor_feed( trie_dfa_cursor* cur, const char* str, long long len )
+{
+    assert( cur && cur->pos == cur->len );
+    cur->offset += cur->len;
+    cur->str = str;
+    cur->len = len;
+    cur->pos = 0;
+}
+
+int trie_dfa_match_ex( trie_dfa* dfa, trie_dfa_cursor* cur,
+                       trie_match_hit hits[], int nhits )
+{
+    assert( dfa && cur );
+    
+    const int *delta = dfa->delta;
+    const unsigned short *classes = dfa->classes;
+    const int report_limit = dfa->report_limit;
+    const char *str = cur->str;
+    int state = cur->state;
+    int pending = cur->pending;
+    long long pos = cur->pos;
+    int nr_match = 0;
+
+    while ( 1 ) {
+        // keywords ending at pos, which might be left over by last call
+        while ( pending >= 0 && nr_match < nhits ) {
+            int n = pending / dfa->nr_classes;
+            int id = dfa->keyword_ids[n];
+            if ( id >= 0 ) {
+                hits[nr_match++] = (trie_match_hit) {
+                    id, dfa->keyword_lens[id], cur->offset + pos };
+            }
+            pending = dfa->report_links[n];
+        }
+        if ( pending >= 0 || pos == cur->len )
+            break;
+
+        while ( pos < cur->len ) {
+            state = delta[state + classes[(unsigned char)str[pos++]]];
+            if ( state < report_limit ) {
+                pending = state;
+                break;
             }
-        } else {
-            cur_state = trie->node_list[ trie->node_failure_func[cur_state->state] ];
         }
     }
 
+    cur->state = state;
+    cur->pending = pending;
+    cur->pos = pos;
     return nr_match;
 }
 
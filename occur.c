@@ -0,0 +1,186 @@
+/**
+ * Occur - list lines matching a pattern in every buffer
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "occur.h"
+#include "editor.h"
+
+// most recently used first
+static gint se_occur_compare_used( gconstpointer a, gconstpointer b )
+{
+    const se_buffer *x = *(se_buffer* const*)a, *y = *(se_buffer* const*)b;
+    return x->lastUsed > y->lastUsed ? -1: x->lastUsed < y->lastUsed;
+}
+
+// append to output, keeping point where user is looking
+static void se_occur_output( se_occur* occur, const char* text )
+{
+    se_buffer *bufp = occur->output;
+    se_off_t point = bufp->getPoint( bufp );
+    bufp->setPoint( bufp, bufp->getCharCount(bufp) );
+    bufp->insertString( bufp, text );
+    bufp->setPoint( bufp, point );
+}
+
+static void se_occur_list( se_occur* occur, se_psearch* ps )
+{
+    if ( !ps->hits->len )
+        return;
+
+    se_snapshot *snap = ps->snapshot;
+    GString *text = g_string_new( "" );
+    g_string_append_printf( text, "%d matches for \"%s\" in buffer: %s\n", ps->hits->len,
+                            occur->pattern, ps->buffer->getBufferName(ps->buffer) );
+    se_occur_entry entry = { NULL, 0, 0 };
+    g_array_append_val( occur->entries, entry );
+
+    se_off_t last_line = -1;
+    for (int i = 0; i < ps->hits->len; ++i) {
+        se_psearch_hit *hit = &g_array_index( ps->hits, se_psearch_hit, i );
+        se_off_t line = se_snapshot_find_line( snap, hit->start );
+        // one entry for all matches on a line
+        if ( line < 0 || line == last_line )
+            continue;
+        last_line = line;
+
+        const char *data = se_snapshot_line_data( snap, line );
+        se_off_t len = se_snapshot_line_length( snap, line );
+        if ( len && data[len-1] == '\n' )
+            --len;
+        g_string_append_printf( text, "%7lld:", line + 1 );
+        g_string_append_len( text, data, len );
+        g_string_append_c( text, '\n' );
+
+        entry.buffer = ps->buffer;
+        entry.line = line + 1;
+        entry.offset = hit->start;
+        g_array_append_val( occur->entries, entry );
+    }
+    
+    se_occur_output( occur, text->str );
+    g_string_free( text, TRUE );
+    occur->nr_matches += ps->hits->len;
+    occur->nr_buffers++;
+}
+
+// wait for threads and let snapshots of buffers go
+static void se_occur_stop( se_occur* occur )
+{
+    if ( occur->pool ) {
+        g_thread_pool_free( occur->pool, TRUE, TRUE );
+        occur->pool = NULL;
+    }
+    for (int i = 0; i < occur->searches->len; ++i)
+        se_psearch_free( g_ptr_array_index(occur->searches, i) );
+    g_ptr_array_set_size( occur->searches, 0 );
+    occur->nr_listed = 0;
+}
+
+se_occur* se_occur_start( se_world* world, const char* pattern, gboolean regexp,
+                          const char** error )
+{
+    g_assert( world && pattern );
+    GPtrArray *buffers = g_ptr_array_new();
+    for (se_buffer *bufp = world->bufferList; bufp; bufp = bufp->nextBuffer) {
+        if ( strcmp(bufp->getBufferName(bufp), SE_OCCUR_BUFFER_NAME) != 0 )
+            g_ptr_array_add( buffers, bufp );
+    }
+    g_ptr_array_sort( buffers, se_occur_compare_used );
+
+    se_occur *occur = g_malloc0( sizeof(se_occur) );
+    occur->world = world;
+    occur->pattern = g_strdup( pattern );
+    occur->searches = g_ptr_array_new();
+    occur->entries = g_array_new( FALSE, FALSE, sizeof(se_occur_entry) );
+    occur->pool = se_psearch_pool_new( 0 );
+    for (int i = 0; i < buffers->len; ++i) {
+        se_psearch *ps = se_psearch_start_in( occur->pool, g_ptr_array_index(buffers, i),
+                                              pattern, regexp, 0, error );
+        if ( !ps ) {
+            g_ptr_array_free( buffers, TRUE );
+            se_occur_free( occur );
+            return NULL;
+        }
+        g_ptr_array_add( occur->searches, ps );
+    }
+    g_ptr_array_free( buffers, TRUE );
+
+    world->bufferDelete( world, SE_OCCUR_BUFFER_NAME );
+    world->bufferCreate( world, SE_OCCUR_BUFFER_NAME );
+    occur->output = world->current;
+    occur->output->setMajorMode( occur->output, SE_OCCUR_MODE_NAME );
+    return occur;
+}
+
+gboolean se_occur_poll( se_occur* occur )
+{
+    g_assert( occur );
+    if ( !occur->pool )
+        return TRUE;
+    
+    while ( occur->nr_listed < occur->searches->len ) {
+        se_psearch *ps = g_ptr_array_index( occur->searches, occur->nr_listed );
+        if ( !se_psearch_poll(ps) )
+            return FALSE;
+        se_occur_list( occur, ps );
+        occur->nr_listed++;
+    }
+    se_occur_stop( occur );
+    return TRUE;
+}
+
+void se_occur_cancel( se_occur* occur )
+{
+    g_assert( occur );
+    for (int i = 0; i < occur->searches->len; ++i)
+        se_psearch_cancel( g_ptr_array_index(occur->searches, i) );
+    se_occur_stop( occur );
+}
+
+void se_occur_forget_buffer( se_occur* occur, se_buffer* bufp )
+{
+    g_assert( occur && bufp );
+    // its snapshots are going too
+    if ( occur->pool )
+        se_occur_cancel( occur );
+    
+    for (int i = 0; i < occur->entries->len; ++i) {
+        se_occur_entry *entry = &g_array_index( occur->entries, se_occur_entry, i );
+        if ( entry->buffer == bufp )
+            entry->buffer = NULL;
+    }
+}
+
+void se_occur_free( se_occur* occur )
+{
+    g_assert( occur );
+    se_occur_cancel( occur );
+    g_ptr_array_free( occur->searches, TRUE );
+    g_array_free( occur->entries, TRUE );
+    g_free( occur->pattern );
+    g_free( occur );
+}
+
+se_occur_entry* se_occur_entry_at( se_occur* occur, se_off_t line )
+{
+    g_assert( occur );
+    if ( line < 0 || line >= occur->entries->len )
+        return NULL;
+    se_occur_entry *entry = &g_array_index( occur->entries, se_occur_entry, line );
+    return entry->buffer ? entry: NULL;
+}
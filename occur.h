@@ -0,0 +1,87 @@
+
+/**
+ * Occur - list lines matching a pattern in every buffer
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * occur searches every buffer of world at once, and lists lines with a match
+ * in an *occur* buffer, each pointing back to the buffer and line it comes
+ * from. searching of all buffers shares one pool of threads, most recently
+ * used buffers are queued first and listed first as they finish.
+ */
+
+#ifndef _semacs_occur_h
+#define _semacs_occur_h
+
+#include "util.h"
+#include "buffer.h"
+#include "psearch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_OCCUR_BUFFER_NAME  "*occur*"
+#define SE_OCCUR_MODE_NAME    "Occur"
+
+DEF_CLS(se_occur_entry);
+struct se_occur_entry
+{
+    se_buffer *buffer;  // NULL if line of *occur* is not a match
+    se_off_t line;      // 1-based
+    se_off_t offset;    // where first match on line starts
+};
+
+DEF_CLS(se_occur);
+struct se_occur
+{
+    struct se_world *world;
+    se_buffer *output;   // *occur*
+    char *pattern;
+    
+    GThreadPool *pool;   // NULL once searching is over
+    GPtrArray *searches; // one per buffer, most recently used first
+    int nr_listed;       // searches listed in output so far
+    
+    GArray *entries;     // one per line of output
+    int nr_matches;
+    int nr_buffers;      // buffers with some match
+};
+
+/**
+ * create *occur* (replacing an old one) as current buffer and start searching
+ * all other buffers in it. return NULL and set *error if pattern is invalid.
+ */
+extern se_occur* se_occur_start( struct se_world*, const char* pattern, gboolean regexp,
+                                 const char** error );
+// list buffers finished so far, return TRUE once searching is over
+extern gboolean se_occur_poll( se_occur* );
+// stop searching, lines listed so far stay
+extern void se_occur_cancel( se_occur* );
+// a buffer is going away, lines from it are no more pointing to it
+extern void se_occur_forget_buffer( se_occur*, se_buffer* );
+extern void se_occur_free( se_occur* );
+
+// entry of a 0-based line of output, NULL if it is not a match
+extern se_occur_entry* se_occur_entry_at( se_occur*, se_off_t line );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
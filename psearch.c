@@ -0,0 +1,502 @@
+/**
+ * Parallel search - scan one big buffer with a pool of threads
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "psearch.h"
+
+static gboolean se_psearch_cancelled( se_psearch* ps )
+{
+    return g_atomic_int_get( &ps->cancelled ) != 0;
+}
+
+// char at offset, or -1 out of text
+static int se_psearch_char_at( se_snapshot* snap, se_off_t offset )
+{
+    if ( offset < 0 || offset >= snap->charCount )
+        return -1;
+    se_off_t line = se_snapshot_find_line( snap, offset );
+    return (unsigned char)se_snapshot_line_data( snap, line )[offset - snap->offsets[line]];
+}
+
+// feed chars from from up to limit, return FALSE if cancelled
+static gboolean se_psearch_scan( se_psearch* ps, regexp_scan* scan,
+                                 se_off_t from, se_off_t limit )
+{
+    se_snapshot *snap = ps->snapshot;
+    if ( from >= limit )
+        return TRUE;
+
+    se_off_t line = se_snapshot_find_line( snap, from );
+    while ( from < limit ) {
+        if ( se_psearch_cancelled(ps) )
+            return FALSE;
+        se_off_t line_start = snap->offsets[line];
+        se_off_t line_end = MIN( line_start + se_snapshot_line_length(snap, line), limit );
+        const char *data = se_snapshot_line_data( snap, line ) + (from - line_start);
+        if ( regexp_scan_feed(scan, data, line_end - from) )
+            break;
+        from = line_end;
+        ++line;
+    }
+    return TRUE;
+}
+
+// same as above but backward, from limit down to from
+static gboolean se_psearch_scan_backward( se_psearch* ps, regexp_scan* scan,
+                                          se_off_t from, se_off_t limit )
+{
+    se_snapshot *snap = ps->snapshot;
+    if ( from >= limit )
+        return TRUE;
+
+    se_off_t line = se_snapshot_find_line( snap, limit - 1 );
+    while ( limit > from ) {
+        if ( se_psearch_cancelled(ps) )
+            return FALSE;
+        se_off_t line_start = MAX( snap->offsets[line], from );
+        const char *data = se_snapshot_line_data( snap, line ) + (line_start - snap->offsets[line]);
+        if ( regexp_scan_feed(scan, data, limit - line_start) )
+            break;
+        limit = line_start;
+        --line;
+    }
+    return TRUE;
+}
+
+/**
+ * find first match starting at or after from by looking at text up to limit
+ * only, bounded tells that any match wanted ends by limit. return its start
+ * (end in *end), -1 if there is none, or -2 if text up to limit does not
+ * tell or search is cancelled.
+ */
+static se_off_t se_psearch_forward( se_psearch* ps, regexp_entry* re, se_off_t from,
+                                    se_off_t limit, gboolean bounded, se_off_t* end )
+{
+    se_snapshot *snap = ps->snapshot;
+    int prev = se_psearch_char_at( snap, from - 1 );
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->forward, from, prev );
+    if ( !se_psearch_scan(ps, &scan, from, limit) )
+        return -2;
+    // a match found may still grow past limit
+    if ( !scan.done && !bounded && limit < snap->charCount )
+        return -2;
+    regexp_scan_finish( &scan, se_psearch_char_at(snap, limit) );
+    if ( scan.match < 0 )
+        return -1;
+
+    se_off_t match_end = scan.match;
+    regexp_scan_init( &scan, re->reverse, match_end, se_psearch_char_at(snap, match_end) );
+    if ( !se_psearch_scan_backward(ps, &scan, from, match_end) )
+        return -2;
+    regexp_scan_finish( &scan, prev );
+    g_assert( scan.match >= from );
+
+    *end = match_end;
+    return scan.match;
+}
+
+// searching on after a hit, an empty one is not found twice
+static se_off_t se_psearch_advance( se_psearch_hit hit )
+{
+    return hit.end > hit.start ? hit.end: hit.end + 1;
+}
+
+// how far a part has to be scanned to decide every match starting in it
+static se_off_t se_psearch_part_limit( se_psearch* ps, se_psearch_part* part,
+                                       gboolean* bounded )
+{
+    se_snapshot *snap = ps->snapshot;
+    *bounded = TRUE;
+    if ( part->end >= snap->charCount )
+        return snap->charCount;
+
+    if ( !ps->crossLines ) {
+        // matches end within the line they start
+        se_off_t line = se_snapshot_find_line( snap, part->end - 1 );
+        return snap->offsets[line] + se_snapshot_line_length( snap, line );
+    }
+    
+    if ( ps->patternLen > 0 )
+        return MIN( part->end + ps->patternLen - 1, snap->charCount );
+
+    *bounded = FALSE;
+    return MIN( part->end + ps->overlap, snap->charCount );
+}
+
+// runs in a thread of pool
+static void se_psearch_part_run( gpointer data, gpointer user_data )
+{
+    se_psearch_part *part = data;
+    se_psearch *ps = part->search;
+    regexp_entry *re = regexp_compile( ps->pattern, NULL );
+    g_assert( re );
+
+    gboolean bounded;
+    se_off_t limit = se_psearch_part_limit( ps, part, &bounded );
+    se_off_t from = part->start;
+    se_off_t resume = -1;
+    while ( resume < 0 ) {
+        if ( from >= part->end ) {
+            // last hit reaches into next part
+            resume = from;
+            break;
+        }
+        
+        se_psearch_hit hit;
+        hit.start = se_psearch_forward( ps, re, from, limit, bounded, &hit.end );
+        if ( hit.start == -2 ) {
+            resume = from;
+        } else if ( hit.start < 0 || hit.start >= part->end ) {
+            resume = part->end;
+        } else {
+            g_mutex_lock( &ps->lock );
+            g_array_append_val( part->hits, hit );
+            g_mutex_unlock( &ps->lock );
+            from = se_psearch_advance( hit );
+        }
+    }
+
+    g_mutex_lock( &ps->lock );
+    part->resume = resume;
+    part->done = TRUE;
+    g_mutex_unlock( &ps->lock );
+    regexp_free( re );
+}
+
+// index of hit starting at start, or -1
+static int se_psearch_find_hit( GArray* hits, se_off_t start )
+{
+    int lo = 0, hi = hits->len;
+    while ( lo < hi ) {
+        int mid = lo + (hi - lo) / 2;
+        if ( g_array_index(hits, se_psearch_hit, mid).start < start )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if ( lo < hits->len && g_array_index(hits, se_psearch_hit, lo).start == start )
+        return lo;
+    return -1;
+}
+
+/**
+ * search from next into pending, as se_psearch_forward() does, but feed text
+ * a piece at a time and give up for this poll once the budget is spent, to
+ * go on where it stopped next time. past limit, which is what a match
+ * starting in part needs when bounded, a long match is followed on. start of
+ * pending is -1 if no match starts before end of part. return FALSE if not
+ * done yet or cancelled.
+ */
+static gboolean se_psearch_rescan( se_psearch* ps, se_psearch_part* part, gint64 deadline )
+{
+    se_snapshot *snap = ps->snapshot;
+    se_off_t count = snap->charCount;
+    if ( ps->next > count ) {
+        ps->pending.start = -1;
+        return TRUE;
+    }
+    
+    gboolean bounded;
+    se_off_t limit = se_psearch_part_limit( ps, part, &bounded );
+    if ( ps->rescanned < 0 ) {
+        regexp_scan_init( &ps->rescan, ps->re->forward, ps->next,
+                          se_psearch_char_at(snap, ps->next - 1) );
+        ps->rescanned = ps->next;
+    }
+
+    for (gboolean fed = FALSE; ; fed = TRUE) {
+        if ( ps->rescanned >= limit ) {
+            if ( ps->rescan.done || bounded || limit >= count )
+                break;
+            // a match may still grow past limit
+            limit = MIN( ps->rescanned + ps->overlap, count );
+        }
+        // a piece at least each poll
+        if ( fed && g_get_monotonic_time() > deadline )
+            return FALSE;
+        se_off_t to = MIN( limit, ps->rescanned + ps->overlap );
+        if ( !se_psearch_scan(ps, &ps->rescan, ps->rescanned, to) )
+            return FALSE;
+        ps->rescanned = ps->rescan.done ? limit: to;
+    }
+
+    ps->rescanned = -1;
+    regexp_scan_finish( &ps->rescan, se_psearch_char_at(snap, limit) );
+    if ( ps->rescan.match < 0 ) {
+        ps->pending.start = -1;
+        return TRUE;
+    }
+
+    se_off_t match_end = ps->rescan.match;
+    regexp_scan scan;
+    regexp_scan_init( &scan, ps->re->reverse, match_end, se_psearch_char_at(snap, match_end) );
+    if ( !se_psearch_scan_backward(ps, &scan, ps->next, match_end) )
+        return FALSE;
+    regexp_scan_finish( &scan, se_psearch_char_at(snap, ps->next - 1) );
+    g_assert( scan.match >= ps->next );
+    ps->pending.start = scan.match;
+    ps->pending.end = match_end;
+    return TRUE;
+}
+
+/**
+ * append matches of a finished part which searching from buffer start finds.
+ * hits of a part are right from where it starts, so if searching comes in
+ * elsewhere, search on here until it finds the same match as the part did.
+ * return FALSE if cancelled, or if rescanning has to go on at next poll.
+ */
+static gboolean se_psearch_merge_part( se_psearch* ps, se_psearch_part* part,
+                                       gint64 deadline )
+{
+    if ( ps->next == part->start && ps->rescanned < 0 ) {
+        g_array_append_vals( ps->hits, part->hits->data, part->hits->len );
+        ps->next = part->resume;
+        ps->pending.start = -2;
+    }
+
+    while ( ps->next < part->end ) {
+        if ( ps->pending.start == -2 && !se_psearch_rescan(ps, part, deadline) )
+            return FALSE;
+        // none before next part, which has its hits right from its start
+        if ( ps->pending.start == -1 ) {
+            ps->next = part->end;
+            ps->pending.start = -2;
+            break;
+        }
+        // it is found by a later part then
+        if ( ps->pending.start >= part->end )
+            break;
+
+        int i = se_psearch_find_hit( part->hits, ps->pending.start );
+        if ( i >= 0 && g_array_index(part->hits, se_psearch_hit, i).end == ps->pending.end ) {
+            g_array_append_vals( ps->hits, &g_array_index(part->hits, se_psearch_hit, i),
+                                 part->hits->len - i );
+            ps->next = part->resume;
+        } else {
+            g_array_append_val( ps->hits, ps->pending );
+            ps->next = se_psearch_advance( ps->pending );
+        }
+        ps->pending.start = -2;
+    }
+    return TRUE;
+}
+
+gboolean se_psearch_poll( se_psearch* ps )
+{
+    g_assert( ps );
+    gint64 deadline = g_get_monotonic_time() + SE_PSEARCH_RESCAN_BUDGET * 1000;
+    while ( ps->nr_merged < ps->nr_parts ) {
+        if ( se_psearch_cancelled(ps) )
+            return TRUE;
+        
+        se_psearch_part *part = &ps->parts[ps->nr_merged];
+        g_mutex_lock( &ps->lock );
+        gboolean done = part->done;
+        g_mutex_unlock( &ps->lock );
+        if ( !done )
+            return FALSE;
+
+        // a finished part is not touched by its thread any more
+        if ( !se_psearch_merge_part(ps, part, deadline) )
+            return se_psearch_cancelled( ps );
+        ps->nr_merged++;
+    }
+    return TRUE;
+}
+
+gboolean se_psearch_first_hit( se_psearch* ps, se_psearch_hit* hit )
+{
+    g_assert( ps && hit );
+    gboolean found = FALSE;
+    g_mutex_lock( &ps->lock );
+    for (int i = ps->originPart; i < ps->nr_parts; ++i) {
+        se_psearch_part *part = &ps->parts[i];
+        if ( part->hits->len ) {
+            *hit = g_array_index( part->hits, se_psearch_hit, 0 );
+            found = TRUE;
+            break;
+        }
+        // searching from origin only goes on to next part if nothing is here
+        if ( !part->done || part->resume != part->end )
+            break;
+    }
+    g_mutex_unlock( &ps->lock );
+    return found;
+}
+
+void se_psearch_cancel( se_psearch* ps )
+{
+    g_assert( ps );
+    g_atomic_int_set( &ps->cancelled, 1 );
+}
+
+static gint se_psearch_compare_offset( gconstpointer a, gconstpointer b )
+{
+    se_off_t x = *(const se_off_t*)a, y = *(const se_off_t*)b;
+    return x < y ? -1: x > y;
+}
+
+// cut snapshot at line starts into about nr_parts parts, and at origin
+static void se_psearch_make_parts( se_psearch* ps, int nr_parts )
+{
+    se_snapshot *snap = ps->snapshot;
+    se_off_t count = snap->charCount;
+    GArray *bounds = g_array_new( FALSE, FALSE, sizeof(se_off_t) );
+    g_array_append_val( bounds, ps->origin );
+    for (int i = 0; i < nr_parts; ++i) {
+        se_off_t at = count / nr_parts * i;
+        if ( at > 0 )
+            at = snap->offsets[se_snapshot_find_line(snap, at)];
+        g_array_append_val( bounds, at );
+    }
+    g_array_sort( bounds, se_psearch_compare_offset );
+
+    ps->parts = g_new0( se_psearch_part, bounds->len );
+    for (int i = 0; i < bounds->len; ++i) {
+        se_off_t start = g_array_index( bounds, se_off_t, i );
+        if ( ps->nr_parts && start == ps->parts[ps->nr_parts - 1].start )
+            continue;
+        
+        se_psearch_part *part = &ps->parts[ps->nr_parts++];
+        part->search = ps;
+        part->start = start;
+        part->hits = g_array_new( FALSE, FALSE, sizeof(se_psearch_hit) );
+        if ( start == ps->origin )
+            ps->originPart = ps->nr_parts - 1;
+    }
+    
+    // an empty match at end of buffer belongs to the last part
+    for (int i = 0; i < ps->nr_parts; ++i)
+        ps->parts[i].end = i + 1 < ps->nr_parts ? ps->parts[i + 1].start: count + 1;
+    g_array_free( bounds, TRUE );
+}
+
+// compile pattern, pin buffer and cut it, nothing is queued yet
+static se_psearch* se_psearch_create( se_buffer* bufp, const char* pattern, gboolean regexp,
+                                      se_off_t origin, int nr_threads, se_off_t part_size,
+                                      const char** error )
+{
+    g_assert( bufp && pattern );
+    char *pat = regexp ? g_strdup( pattern ): regexp_quote( pattern );
+    regexp_entry *re = regexp_compile( pat, error );
+    if ( !re ) {
+        g_free( pat );
+        return NULL;
+    }
+
+    se_psearch *ps = g_malloc0( sizeof(se_psearch) );
+    ps->buffer = bufp;
+    ps->pattern = pat;
+    ps->re = re;
+    ps->crossLines = regexp_matches_byte( re, '\n' );
+    ps->patternLen = regexp ? -1: strlen( pattern );
+    g_mutex_init( &ps->lock );
+    ps->hits = g_array_new( FALSE, FALSE, sizeof(se_psearch_hit) );
+    ps->pending.start = -2;
+    ps->rescanned = -1;
+
+    // threads only see this version, editing goes on as they scan
+    se_snapshot_publish( bufp );
+    ps->snapshot = se_snapshot_acquire( bufp, &ps->pin );
+    if ( !ps->snapshot ) {
+        if ( error )
+            *error = "Too many searches running";
+        se_psearch_free( ps );
+        return NULL;
+    }
+    se_off_t count = ps->snapshot->charCount;
+    ps->origin = CLAMP( origin, 0, count );
+
+    se_off_t nr_parts;
+    if ( part_size > 0 ) {
+        nr_parts = count / part_size;
+    } else {
+        nr_parts = MIN( count / SE_PSEARCH_MIN_PART, nr_threads * SE_PSEARCH_PARTS_PER_THREAD );
+        part_size = count / MAX( nr_parts, 1 );
+    }
+    ps->overlap = MIN( part_size, SE_PSEARCH_OVERLAP );
+    se_psearch_make_parts( ps, MAX(nr_parts, 1) );
+    return ps;
+}
+
+// from origin on first, parts before it are only needed for merging
+static void se_psearch_queue( se_psearch* ps, GThreadPool* pool )
+{
+    for (int i = 0; i < ps->nr_parts; ++i) {
+        int part = (ps->originPart + i) % ps->nr_parts;
+        g_thread_pool_push( pool, &ps->parts[part], NULL );
+    }
+}
+
+GThreadPool* se_psearch_pool_new( int nr_threads )
+{
+    if ( nr_threads <= 0 )
+        nr_threads = g_get_num_processors();
+    return g_thread_pool_new( se_psearch_part_run, NULL, nr_threads, FALSE, NULL );
+}
+
+se_psearch* se_psearch_start( se_buffer* bufp, const char* pattern, gboolean regexp,
+                              se_off_t origin, const char** error )
+{
+    return se_psearch_start_full( bufp, pattern, regexp, origin, 0, 0, error );
+}
+
+se_psearch* se_psearch_start_full( se_buffer* bufp, const char* pattern, gboolean regexp,
+                                   se_off_t origin, int nr_threads, se_off_t part_size,
+                                   const char** error )
+{
+    if ( nr_threads <= 0 )
+        nr_threads = g_get_num_processors();
+    se_psearch *ps = se_psearch_create( bufp, pattern, regexp, origin,
+                                        nr_threads, part_size, error );
+    if ( ps ) {
+        ps->pool = se_psearch_pool_new( nr_threads );
+        se_psearch_queue( ps, ps->pool );
+    }
+    return ps;
+}
+
+se_psearch* se_psearch_start_in( GThreadPool* pool, se_buffer* bufp, const char* pattern,
+                                 gboolean regexp, se_off_t origin, const char** error )
+{
+    g_assert( pool );
+    se_psearch *ps = se_psearch_create( bufp, pattern, regexp, origin,
+                                        g_thread_pool_get_max_threads(pool), 0, error );
+    if ( ps )
+        se_psearch_queue( ps, pool );
+    return ps;
+}
+
+void se_psearch_free( se_psearch* ps )
+{
+    g_assert( ps );
+    se_psearch_cancel( ps );
+    if ( ps->pool )
+        g_thread_pool_free( ps->pool, TRUE, TRUE );
+    se_snapshot_release( &ps->pin );
+    
+    for (int i = 0; i < ps->nr_parts; ++i)
+        g_array_free( ps->parts[i].hits, TRUE );
+    g_free( ps->parts );
+    g_array_free( ps->hits, TRUE );
+    regexp_free( ps->re );
+    g_free( ps->pattern );
+    g_mutex_clear( &ps->lock );
+    g_free( ps );
+}
@@ -0,0 +1,156 @@
+
+/**
+ * Parallel search - scan one big buffer with a pool of threads
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * searching a huge buffer: the line range of a pinned snapshot is cut into
+ * parts which are scanned by a pool of threads at the same time. parts are
+ * merged back in buffer order by the editing thread, which also rescans where
+ * a match crossing the edge of a part makes the next part start elsewhere, so
+ * the result is exactly what searching again and again from buffer start
+ * would find.
+ *
+ * the part starting at origin is scanned first, so the first match after
+ * point shows up before the rest of the buffer is done.
+ */
+
+#ifndef _semacs_psearch_h
+#define _semacs_psearch_h
+
+#include "util.h"
+#include "buffer.h"
+#include "snapshot.h"
+#include "submatch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// buffers smaller than this are not cut any further
+#define SE_PSEARCH_MIN_PART   (1 << 20)
+// parts per thread, so a slow part does not keep the others waiting
+#define SE_PSEARCH_PARTS_PER_THREAD  4
+/**
+ * how far past its end a part is scanned for a match starting in it, when
+ * the pattern can match '\n' and its length is not known. the editing thread
+ * finishes the rest while merging. smaller parts scan at most their size.
+ */
+#define SE_PSEARCH_OVERLAP    (1 << 16)
+/**
+ * most time in ms one poll spends rescanning where a match crossed the edge
+ * of a part, a rescan going further goes on at next poll.
+ */
+#define SE_PSEARCH_RESCAN_BUDGET  10
+
+DEF_CLS(se_psearch_hit);
+struct se_psearch_hit
+{
+    se_off_t start;
+    se_off_t end;
+};
+
+struct se_psearch;
+
+DEF_CLS(se_psearch_part);
+struct se_psearch_part
+{
+    struct se_psearch *search;
+    se_off_t start;     // matches starting in [start, end) belong to this part
+    se_off_t end;
+    GArray *hits;       // found so far, guarded by lock of search
+    /**
+     * where searching goes on after last hit, end if it has to go on from
+     * there. if it is before end, the part gave up on a long match and the
+     * editing thread searches on from here.
+     */
+    se_off_t resume;
+    int done;
+};
+
+DEF_CLS(se_psearch);
+struct se_psearch
+{
+    se_buffer *buffer;
+    se_snapshot_pin pin;
+    se_snapshot *snapshot; // content searched, pinned until freed
+    char *pattern;         // in regexp syntax, literals are quoted
+    gboolean crossLines;   // if a match can contain '\n'
+    int patternLen;        // length of match if literal, or -1
+    se_off_t overlap;
+    se_off_t origin;
+
+    regexp_entry *re;      // of the editing thread, each part compiles its own
+    GThreadPool *pool;     // NULL if parts are queued in a pool of caller
+    GMutex lock;
+    int cancelled;
+
+    se_psearch_part *parts; // in buffer order
+    int nr_parts;
+    int originPart;        // the one starting at origin
+
+    // below are only touched by the editing thread
+    GArray *hits;          // merged in buffer order
+    int nr_merged;         // parts merged into hits
+    se_off_t next;         // where searching from buffer start would go on
+    se_psearch_hit pending; // result of searching from next, start -1 if none
+    regexp_scan rescan;    // searching from next, carried over polls
+    se_off_t rescanned;    // text fed to rescan ends here, -1 if none going on
+};
+
+/**
+ * editing thread: start searching buffer for pattern, which is a regexp if
+ * regexp is set. return NULL and set *error if pattern is not valid.
+ */
+extern se_psearch* se_psearch_start( se_buffer*, const char* pattern, gboolean regexp,
+                                     se_off_t origin, const char** error );
+/**
+ * nr_threads <= 0 takes the number of processors, and part_size <= 0 cuts
+ * buffer by the number of threads.
+ */
+extern se_psearch* se_psearch_start_full( se_buffer*, const char* pattern, gboolean regexp,
+                                          se_off_t origin, int nr_threads, se_off_t part_size,
+                                          const char** error );
+// a pool parts of several searches can share, see se_psearch_start_in()
+extern GThreadPool* se_psearch_pool_new( int nr_threads );
+/**
+ * queue parts into pool of caller instead of a pool of its own. such a
+ * search must be freed after the pool is, so none of its parts is left queued.
+ */
+extern se_psearch* se_psearch_start_in( GThreadPool*, se_buffer*, const char* pattern,
+                                        gboolean regexp, se_off_t origin, const char** error );
+/**
+ * editing thread: merge parts finished so far into hits, return TRUE once
+ * the whole buffer is searched or the search is cancelled.
+ */
+extern gboolean se_psearch_poll( se_psearch* );
+/**
+ * first match at or after origin, FALSE if it is not known yet or there is
+ * none. it does not wait for parts before origin to be merged.
+ */
+extern gboolean se_psearch_first_hit( se_psearch*, se_psearch_hit* hit );
+// any thread: stop searching as soon as possible, hits found so far are kept
+extern void se_psearch_cancel( se_psearch* );
+// wait for parts being scanned to stop, then free all
+extern void se_psearch_free( se_psearch* );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -21,12 +21,32 @@
 
 #include "qview.h"
 #include "editor.h"
+#include "occur.h"
+#include "highlight.h"
 
 #include <QX11Info>
 
+// keyboard mapping shared by views, for as long as app runs. MappingNotify
+// goes to no widget, so it is caught by filter of event dispatcher
+static se_keyboard_map *se_qview_keyboard = NULL;
+static QAbstractEventDispatcher::EventFilter se_qview_next_filter = NULL;
+
+static bool se_qview_event_filter( void *message )
+{
+    XEvent *ev = (XEvent*)message;
+    if ( ev->type == MappingNotify && ev->xmapping.request == MappingKeyboard )
+        se_keyboard_map_refresh( se_qview_keyboard, QX11Info::display() );
+    return se_qview_next_filter ? se_qview_next_filter( message ): false;
+}
+
 SEView::SEView()
 {
     _world = se_world_create();
+    if ( !se_qview_keyboard ) {
+        se_qview_keyboard = se_keyboard_map_new( QX11Info::display() );
+        se_qview_next_filter = QAbstractEventDispatcher::instance()->setEventFilter(
+            se_qview_event_filter );
+    }
     
     setFont( QFont( "Monaco", 11 ) ) ;
     QFontMetrics fm = fontMetrics();
@@ -40,6 +60,9 @@ SEView::SEView()
     _cmdArgs = se_command_args_init();
     
     _composingState = SE_IM_NORMAL;
+    _searchTimer = 0;
+    _echoTimer = 0;
+    _keysEchoed = false;
     setAttribute( Qt::WA_InputMethodEnabled );
 }
 
@@ -98,93 +121,73 @@ void SEView::inputMethodEvent( QInputMethodEvent *event )
     }
 }
 
-static se_key se_key_event_process( Display *display, XKeyEvent kev )
+// show keys of a command typed so far
+void SEView::echoKeys()
 {
-    int index = 0;
-    int mask = 0;
-    
-    if ( kev.state & ShiftMask ) {
-        mask = 0x01;
-    }
-    if ( kev.state & LockMask ) {
-        mask |= 0x02;
-    }
-    if ( mask ) index = 1;
-    
-    KeySym key_sym = XKeycodeToKeysym( display, kev.keycode, index );
-    if ( key_sym == NoSymbol ) {
-        se_debug( "NoSymbol for keycode %d", kev.keycode );
-    }
-
-    se_key sekey = se_key_null_init();
-    char *key_str = XKeysymToString( key_sym );
-
-    // FIXME: this is a simplified version, since KeySym actually follow latin-1
-    // except for some terminal control keys
-    if ( g_str_has_prefix(key_str, "Alt")
-         || g_str_has_prefix(key_str, "Meta")
-         || g_str_has_prefix(key_str, "Super")
-         || g_str_has_prefix(key_str, "Control")
-         || g_str_has_prefix(key_str, "Shift") ) {
-        return sekey;
-    }
-    sekey.ascii = key_sym;
-    
-    if ( kev.state & ControlMask ) {
-        sekey.modifiers |= ControlDown;
-    }
-    if ( kev.state & ShiftMask ) {
-        sekey.modifiers |= ShiftDown;
-    }
-    if ( kev.state & Mod1Mask ) {
-        sekey.modifiers |= MetaDown;
-    }
-
-    if ( kev.state & Mod4Mask ) {
-        // this is no good, Mod4 can be map to other keysym
-        sekey.modifiers |= SuperDown;
-    }
-
-    if ( sekey.modifiers == ShiftDown ) { // here Shift is not part of combination
-                                        // only change case of char
-        sekey.modifiers = 0;
-    }
-    
-    se_debug( "sekey(%s): %s", key_str, se_key_to_string(sekey) );
-    return sekey;
-}
-
-se_key SEView::se_delayed_wait_key()
-{
-    se_debug( "waiting for a key..." );
-    XEvent ev;
-    while ( XCheckWindowEvent( QX11Info::display(), this->winId(),
-                               KeyPressMask, &ev ) == False ) {
-        usleep( 100 );
-    }
-
-    se_debug( "wait for a key done" );
-    return se_key_event_process( QX11Info::display(), ev.xkey );
+    char *echo = se_command_args_echo( &_cmdArgs );
+    if ( echo )
+        se_msg( "%s-", echo );
+    g_free( echo );
+    _keysEchoed = true;
 }
 
 void SEView::dispatchCommand( se_key sekey )
 {
-    if ( _world->dispatchCommand( _world, &_cmdArgs, sekey ) ) {
+    if ( _echoTimer ) {
+        killTimer( _echoTimer );
+        _echoTimer = 0;
+    }
+    
+    int ret = _world->dispatchCommand( _world, &_cmdArgs, sekey );
+    if ( ret ) {
         qDebug() << "cmd finished";
         se_command_args_clear( &_cmdArgs );
+        if ( (_world->psearch || (_world->occur && _world->occur->pool)
+              || _world->projectSearch) && !_searchTimer )
+            _searchTimer = startTimer( SE_SEARCH_POLL_INTERVAL );
         _composingState = SE_IM_NORMAL;
         
         if ( _world->current->isModified(_world->current) ) {
             se_debug("pending update");
             _world->current->modified = FALSE;
-            updateViewContent();
-            return;
         }
     }
 
+    // rest of a key seq comes as events, echoed if they are slow
+    switch ( se_command_echo_after(ret, _keysEchoed) ) {
+    case SE_ECHO_NONE:
+        _keysEchoed = false;
+        break;
+    case SE_ECHO_NOW:
+        echoKeys();
+        break;
+    case SE_ECHO_LATER:
+        _echoTimer = startTimer( SE_ECHO_KEYSTROKES_DELAY );
+        break;
+    }
     updateViewContent();
-    // not complete key seq, continue ...
+}
 
+void SEView::timerEvent( QTimerEvent * event )
+{
+    if ( event->timerId() == _echoTimer ) {
+        killTimer( _echoTimer );
+        _echoTimer = 0;
+        echoKeys();
+        return;
+    }
+    if ( event->timerId() != _searchTimer )
+        return;
+    
+    if ( !_world->pollSearch(_world) ) {
+        killTimer( _searchTimer );
+        _searchTimer = 0;
+    }
+    // *occur* fills up as buffers are searched
+    if ( _world->current->isModified(_world->current) ) {
+        _world->current->modified = FALSE;
+        updateViewContent();
+    }
 }
 
 void SEView::keyPressEvent( QKeyEvent * event )
@@ -195,7 +198,7 @@ void SEView::keyPressEvent( QKeyEvent * event )
     XKeyEvent kev = _cachedEvent.xkey;
     se_key sekey = se_key_null_init();
         
-    sekey = se_key_event_process( QX11Info::display(), kev );
+    sekey = se_keyboard_map_key( se_qview_keyboard, &kev );
     //qDebug() << se_key_to_string( sekey );
     if ( se_key_is_null(sekey) ) {
         return;
@@ -219,19 +222,22 @@ void SEView::updateViewContent()
 
     //FIXME: this is slow algo just as a demo, change it later
     se_line* lp = cur_buf->lines;
-    int nr_lines = cur_buf->getLineCount( cur_buf );
+    int nr_lines = (int)MIN( cur_buf->getLineCount( cur_buf ), SE_MAX_ROWS );
     se_debug( "paint rect: rows: %d", nr_lines );
     
     for (int r = 0; r < qMin(_rows, nr_lines); ++r) {
         const char* buf = se_line_getData( lp );
-        int cols = se_line_getLineLength( lp );
+        se_off_t cols = MIN( se_line_getLineLength( lp ), SE_MAX_COLUMNS-1 );
         if ( buf[cols-1] == '\n' ) cols--;
-        memcpy( (_content + r*SE_MAX_ROWS), buf, cols );
-        *(_content + r*SE_MAX_ROWS+cols) = '\0';
+        memcpy( (_content + r*SE_MAX_COLUMNS), buf, cols );
+        *(_content + r*SE_MAX_COLUMNS+cols) = '\0';
         /* se_debug( "draw No.%d: [%s]", r, buf ); */
         lp = lp->next;
     }
 
+    // only edited lines are matched again
+    if ( cur_buf->highlight )
+        se_highlight_update( cur_buf->highlight, qMin(_rows, nr_lines) );
     update();
 }
 
@@ -274,6 +280,23 @@ void SEView::drawBufferPoint( QPainter *p )
 
 }
 
+void SEView::drawHighlights( QPainter *p, int row )
+{
+    se_buffer *cur_buf = _world->current;
+    if ( !cur_buf->highlight )
+        return;
+
+    QColor clr( 0xff, 0xe0, 0x40, 0xff );
+    int nr_spans = 0;
+    const se_highlight_span *spans = se_highlight_line_spans( cur_buf->highlight, row,
+                                                              &nr_spans );
+    for (int i = 0; i < nr_spans && spans[i].start < _columns; ++i) {
+        int end = qMin( spans[i].end, _columns );
+        p->fillRect( spans[i].start * _glyphMaxWidth, row * _glyphMaxHeight,
+                     (end - spans[i].start) * _glyphMaxWidth, _glyphMaxHeight, clr );
+    }
+}
+
 void SEView::drawTextUtf8( QPainter *p, se_cursor cur, const char* utf8, int utf8_len )
 {
     se_position cur_pos = (se_position){ cur.column * _glyphMaxWidth,
@@ -298,14 +321,15 @@ void SEView::paintEvent( QPaintEvent * event )
     QPainter p;
     p.begin( this );
     
-    int nr_lines = cur_buf->getLineCount( cur_buf );
+    int nr_lines = (int)MIN( cur_buf->getLineCount( cur_buf ), SE_MAX_ROWS );
     se_debug( "repaint buf %s [%d, %d]", cur_buf->getBufferName(cur_buf),
               _columns, MIN(_rows, nr_lines) );    
 
     _cursor = (se_cursor){ 0, 0 };
     for (int r = 0; r < MIN(_rows, nr_lines); ++r) {
-        char *data = _content + r*SE_MAX_ROWS;
+        char *data = _content + r*SE_MAX_COLUMNS;
         int data_len = strlen( data );
+        drawHighlights( &p, r );
         drawTextUtf8( &p, _cursor, data, MIN(data_len, _columns) );
         _cursor = (se_cursor){0, _cursor.row + 1};
     }
@@ -38,6 +38,7 @@ protected:
 	void keyReleaseEvent( QKeyEvent * event );
     void resizeEvent( QResizeEvent * event );
     void inputMethodEvent( QInputMethodEvent * event );
+    void timerEvent( QTimerEvent * event );
     
 private:
     int _columns; // viewable width in cols
@@ -57,6 +58,10 @@ private:
     se_command_args _cmdArgs;
     
     se_world *_world;
+    int _searchTimer; // polls search running in background, 0 if none
+    // echoes keys of a command half typed once user pauses, 0 if none
+    int _echoTimer;
+    bool _keysEchoed;
 
     enum {
         SE_IM_NORMAL,
@@ -66,11 +71,12 @@ private:
     int _composingState;
     QString _composedText;
     
-    se_key se_delayed_wait_key();
+    void echoKeys();
     void updateViewContent(); // update data in view area
     void updateSize();
     void drawTextUtf8( QPainter *, se_cursor, const char*, int utf8_len );
     void drawBufferPoint( QPainter *p );
+    void drawHighlights( QPainter *p, int row ); // matches on row
     void dispatchCommand( se_key sekey );
     
 };
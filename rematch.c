@@ -0,0 +1,1104 @@
+/**
+ * Lazy DFA regular expressions - used to search a buffer by a pattern
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "util.h"
+#include "submatch.h"
+
+#include <ctype.h>
+
+/**
+ * bounded repeats are expanded into copies of their sub expression, so size
+ * of program is limited as well as count of a repeat
+ */
+#define REGEXP_MAX_REPEAT      1000
+#define REGEXP_MAX_INSTS       (1 << 16)
+// memory states of one DFA may take, then they are all dropped and rebuilt
+#define REGEXP_DFA_CACHE_SIZE  (1 << 21)
+#define REGEXP_DFA_SPECIAL     (1 << 30)
+
+enum {
+    REGEXP_NODE_EMPTY,
+    REGEXP_NODE_SET,
+    REGEXP_NODE_BOL,
+    REGEXP_NODE_EOL,
+    REGEXP_NODE_CAT,
+    REGEXP_NODE_ALT,
+    REGEXP_NODE_REPEAT,
+};
+
+typedef struct regexp_node_s
+{
+    int type;
+    int left, right; // children, sub expression of a repeat is left
+    int set;
+    int min, max;    // repeat count, max is -1 if unbounded
+    int greedy;
+} regexp_node;
+
+typedef struct regexp_parser_s
+{
+    const char *p;
+    const char *error;
+    regexp_node *nodes;
+    int nr_nodes;
+    int nodes_size;
+    guint32 (*sets)[8];
+    int nr_sets;
+    int sets_size;
+} regexp_parser;
+
+enum {
+    REGEXP_OP_BYTE,   // consume a byte of set
+    REGEXP_OP_SPLIT,  // go on at out, and at out1 with lower priority
+    REGEXP_OP_JMP,
+    REGEXP_OP_BOL,    // go on if previous byte is '\n' or text begins
+    REGEXP_OP_EOL,    // go on if next byte is '\n' or text ends
+    REGEXP_OP_MATCH,
+};
+
+typedef struct regexp_inst_s
+{
+    int op;
+    int out;
+    int out1;
+    int set;
+} regexp_inst;
+
+struct regexp_prog_s
+{
+    regexp_inst *insts;
+    int nr_insts;
+    int insts_size;
+};
+
+enum {
+    REGEXP_DSTATE_MATCH   = 0x01, // a match ends just before the byte led here
+    REGEXP_DSTATE_DEAD    = 0x02, // no thread is left, scanning can stop
+    REGEXP_DSTATE_AT_BOL  = 0x04, // byte led here is '\n', or text begins
+    REGEXP_DSTATE_MATCHED = 0x08, // a match is found, no new thread may start
+};
+
+/**
+ * a DFA state is the list of NFA threads alive, in priority order. EOL is
+ * kept in it unresolved until next byte is known.
+ */
+typedef struct regexp_dstate_s
+{
+    guint hash;
+    int flags;
+    int nr_insts;
+    int insts[];
+} regexp_dstate;
+
+struct regexp_dfa_s
+{
+    regexp_entry *re;
+    regexp_prog *prog;
+    int reverse;     // consumes text backward
+    int anchored;    // threads only start where scanning begins
+    int longest;     // keep threads of lower priority after a match
+    int earliest;    // scanning is done at first match
+    substr_entry *prefix; // skip ahead to it while in start state
+
+    GHashTable *index;   // regexp_dstate -> state
+    regexp_dstate **states;
+    int nr_states;
+    int states_size;
+    int stride;          // nr_classes + 1, last column is end of text
+    /**
+     * row of next state by [row + class], where row is state * stride and is
+     * tagged by REGEXP_DFA_SPECIAL if state has MATCH or DEAD. -1 if not built
+     */
+    int *delta;
+    unsigned char *state_flags; // MATCH and DEAD of each state, for scanning
+    int start[2];        // start state by AT_BOL, -1 if not built
+    size_t mem;
+    size_t cache_size;
+    int nr_flushes;
+
+    // scratch space to build states
+    int *stack;
+    int *list;
+    guint *marks;
+    guint mark_gen;
+    regexp_dstate *key;
+};
+
+static inline void regexp_set_add( guint32* set, int c )
+{
+    set[c >> 5] |= 1u << (c & 31);
+}
+
+static inline int regexp_set_has( const guint32* set, int c )
+{
+    return (set[c >> 5] >> (c & 31)) & 1;
+}
+
+static int regexp_new_node( regexp_parser* ps, int type )
+{
+    if ( ps->nr_nodes == ps->nodes_size ) {
+        ps->nodes_size = MAX( 16, ps->nodes_size * 2 );
+        ps->nodes = g_renew( regexp_node, ps->nodes, ps->nodes_size );
+    }
+    regexp_node *np = &ps->nodes[ps->nr_nodes];
+    bzero( np, sizeof(regexp_node) );
+    np->type = type;
+    np->left = np->right = -1;
+    return ps->nr_nodes++;
+}
+
+static int regexp_new_set( regexp_parser* ps )
+{
+    if ( ps->nr_sets == ps->sets_size ) {
+        ps->sets_size = MAX( 16, ps->sets_size * 2 );
+        ps->sets = g_realloc( ps->sets, ps->sets_size * sizeof(ps->sets[0]) );
+    }
+    bzero( ps->sets[ps->nr_sets], sizeof(ps->sets[0]) );
+    return ps->nr_sets++;
+}
+
+static int regexp_new_binary( regexp_parser* ps, int type, int left, int right )
+{
+    int n = regexp_new_node( ps, type );
+    ps->nodes[n].left = left;
+    ps->nodes[n].right = right;
+    return n;
+}
+
+static int regexp_new_literal( regexp_parser* ps, int c )
+{
+    int n = regexp_new_node( ps, REGEXP_NODE_SET );
+    ps->nodes[n].set = regexp_new_set( ps );
+    regexp_set_add( ps->sets[ps->nodes[n].set], c );
+    return n;
+}
+
+static int regexp_is_newline( int c )
+{
+    return c == '\n';
+}
+
+static int regexp_is_word( int c )
+{
+    return isalnum( c );
+}
+
+static int regexp_is_space( int c )
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// set of bytes for which pred is TRUE, or FALSE if negate
+static int regexp_new_class( regexp_parser* ps, int (*pred)(int), int negate )
+{
+    int n = regexp_new_node( ps, REGEXP_NODE_SET );
+    int set = ps->nodes[n].set = regexp_new_set( ps );
+    for (int c = 0; c < 256; ++c) {
+        if ( (c < 0x80 && pred(c)) != negate )
+            regexp_set_add( ps->sets[set], c );
+    }
+    return n;
+}
+
+static int regexp_is_blank( int c ) { return c == ' ' || c == '\t'; }
+static int regexp_is_word_class( int c ) { return isalnum( c ) || c == '_'; }
+
+static const struct {
+    const char *name;
+    int (*pred)(int);
+} regexp_char_classes[] = {
+    { "alpha", isalpha }, { "digit", isdigit }, { "alnum", isalnum },
+    { "upper", isupper }, { "lower", islower }, { "space", regexp_is_space },
+    { "punct", ispunct }, { "xdigit", isxdigit }, { "cntrl", iscntrl },
+    { "print", isprint }, { "graph", isgraph }, { "blank", regexp_is_blank },
+    { "word", regexp_is_word_class },
+};
+
+static int regexp_parse_bracket( regexp_parser* ps )
+{
+    const char *p = ps->p + 1;
+    int n = regexp_new_node( ps, REGEXP_NODE_SET );
+    int set = ps->nodes[n].set = regexp_new_set( ps );
+    int negate = *p == '^';
+    if ( negate )
+        ++p;
+
+    // ']' right after '[' or '[^' is taken literally
+    for (int first = 1; first || *p != ']'; first = 0) {
+        if ( *p == 0 ) {
+            ps->error = "Unmatched [ or [^";
+            return n;
+        }
+        
+        if ( p[0] == '[' && p[1] == ':' ) {
+            const char *name = p + 2, *close = strstr( name, ":]" );
+            int i = 0;
+            for (; close && i < ARRAY_LEN(regexp_char_classes); ++i) {
+                if ( strlen(regexp_char_classes[i].name) == close - name
+                     && strncmp(regexp_char_classes[i].name, name, close - name) == 0 )
+                    break;
+            }
+            if ( !close || i == ARRAY_LEN(regexp_char_classes) ) {
+                ps->error = "Invalid character class name";
+                return n;
+            }
+            for (int c = 0; c < 0x80; ++c) {
+                if ( regexp_char_classes[i].pred(c) )
+                    regexp_set_add( ps->sets[set], c );
+            }
+            p = close + 2;
+            continue;
+        }
+
+        int lo = (unsigned char)*p++, hi = lo;
+        if ( p[0] == '-' && p[1] && p[1] != ']' ) {
+            hi = (unsigned char)p[1];
+            p += 2;
+        }
+        // a reversed range is empty, as in Emacs
+        for (int c = lo; c <= hi; ++c)
+            regexp_set_add( ps->sets[set], c );
+    }
+
+    if ( negate ) {
+        for (int i = 0; i < 8; ++i)
+            ps->sets[set][i] = ~ps->sets[set][i];
+    }
+    ps->p = p + 1;
+    return n;
+}
+
+static int regexp_parse_alt( regexp_parser* ps, int depth );
+
+// at_start is TRUE at beginning of pattern, or right after \( \| or ^ there
+static int regexp_parse_atom( regexp_parser* ps, int at_start, int depth )
+{
+    const char *p = ps->p;
+    switch ( *p ) {
+    case '.': 
+        ps->p++;
+        return regexp_new_class( ps, regexp_is_newline, TRUE );
+        
+    case '[':
+        return regexp_parse_bracket( ps );
+        
+    case '$':
+        // only special at end of pattern, or right before \) or \|
+        if ( p[1] == 0 || (p[1] == '\\' && (p[2] == ')' || p[2] == '|')) ) {
+            ps->p++;
+            return regexp_new_node( ps, REGEXP_NODE_EOL );
+        }
+        break;
+
+    case '*': case '+': case '?':
+        // nothing to repeat, so taken literally
+        g_assert( at_start );
+        break;
+
+    case '\\':
+        ps->p += 2;
+        switch ( p[1] ) {
+        case 0:
+            ps->error = "Trailing backslash";
+            return regexp_new_node( ps, REGEXP_NODE_EMPTY );
+            
+        case '(': {
+            if ( ps->p[0] == '?' && ps->p[1] == ':' )
+                ps->p += 2;
+            int sub = regexp_parse_alt( ps, depth + 1 );
+            if ( !ps->error ) {
+                if ( ps->p[0] == '\\' && ps->p[1] == ')' )
+                    ps->p += 2;
+                else
+                    ps->error = "Unmatched ( or \\(";
+            }
+            return sub;
+        }
+            
+        case 'w': case 'W':
+            return regexp_new_class( ps, regexp_is_word, p[1] == 'W' );
+
+        case 's': case 'S':
+            ps->p++;
+            if ( p[2] == '-' || p[2] == ' ' )
+                return regexp_new_class( ps, regexp_is_space, p[1] == 'S' );
+            if ( p[2] == 'w' )
+                return regexp_new_class( ps, regexp_is_word, p[1] == 'S' );
+            ps->error = "Invalid syntax designator";
+            return regexp_new_node( ps, REGEXP_NODE_EMPTY );
+
+        case 'b': case 'B': case '<': case '>': case '_': case '`': case '\'':
+            ps->error = "Boundary assertions are not supported";
+            return regexp_new_node( ps, REGEXP_NODE_EMPTY );
+            
+        case '1': case '2': case '3': case '4': case '5':
+        case '6': case '7': case '8': case '9':
+            ps->error = "Back references are not supported";
+            return regexp_new_node( ps, REGEXP_NODE_EMPTY );
+
+        default:
+            return regexp_new_literal( ps, (unsigned char)p[1] );
+        }
+    }
+
+    ps->p++;
+    return regexp_new_literal( ps, (unsigned char)*p );
+}
+
+// parse \{m,n\} after its \{
+static int regexp_parse_count( regexp_parser* ps, int* min, int* max )
+{
+    char *end;
+    *min = 0;
+    *max = -1;
+    if ( isdigit(*ps->p) ) {
+        *min = *max = strtol( ps->p, &end, 10 );
+        ps->p = end;
+    }
+    if ( *ps->p == ',' ) {
+        ps->p++;
+        *max = -1;
+        if ( isdigit(*ps->p) ) {
+            *max = strtol( ps->p, &end, 10 );
+            ps->p = end;
+        }
+    }
+    
+    if ( ps->p[0] != '\\' || ps->p[1] != '}' || *min > REGEXP_MAX_REPEAT
+         || *max > REGEXP_MAX_REPEAT || (*max >= 0 && *max < *min) ) {
+        ps->error = "Invalid content of \\{\\}";
+        return FALSE;
+    }
+    ps->p += 2;
+    return TRUE;
+}
+
+static int regexp_parse_repeat( regexp_parser* ps, int at_start, int depth )
+{
+    int n = regexp_parse_atom( ps, at_start, depth );
+    while ( !ps->error ) {
+        int min, max, greedy = TRUE;
+        const char *p = ps->p;
+        if ( *p == '*' || *p == '+' || *p == '?' ) {
+            min = *p == '+';
+            max = *p == '?' ? 1: -1;
+            ps->p++;
+            if ( *ps->p == '?' ) {
+                greedy = FALSE;
+                ps->p++;
+            }
+            
+        } else if ( p[0] == '\\' && p[1] == '{' ) {
+            ps->p += 2;
+            if ( !regexp_parse_count(ps, &min, &max) )
+                break;
+            
+        } else
+            break;
+
+        int r = regexp_new_node( ps, REGEXP_NODE_REPEAT );
+        ps->nodes[r].left = n;
+        ps->nodes[r].min = min;
+        ps->nodes[r].max = max;
+        ps->nodes[r].greedy = greedy;
+        n = r;
+    }
+    return n;
+}
+
+static int regexp_parse_cat( regexp_parser* ps, int depth )
+{
+    int n = -1;
+    int at_start = TRUE;
+    while ( !ps->error && *ps->p ) {
+        const char *p = ps->p;
+        if ( p[0] == '\\' && (p[1] == '|' || p[1] == ')') )
+            break;
+
+        int atom;
+        if ( at_start && *p == '^' ) {
+            ps->p++;
+            atom = regexp_new_node( ps, REGEXP_NODE_BOL );
+        } else {
+            atom = regexp_parse_repeat( ps, at_start, depth );
+            at_start = FALSE;
+        }
+        n = n < 0 ? atom: regexp_new_binary( ps, REGEXP_NODE_CAT, n, atom );
+    }
+    
+    return n < 0 ? regexp_new_node( ps, REGEXP_NODE_EMPTY ): n;
+}
+
+static int regexp_parse_alt( regexp_parser* ps, int depth )
+{
+    int n = regexp_parse_cat( ps, depth );
+    while ( !ps->error && ps->p[0] == '\\' && ps->p[1] == '|' ) {
+        ps->p += 2;
+        int right = regexp_parse_cat( ps, depth );
+        n = regexp_new_binary( ps, REGEXP_NODE_ALT, n, right );
+    }
+    
+    if ( !ps->error && depth == 0 && *ps->p )
+        ps->error = "Unmatched ) or \\)";
+    return n;
+}
+
+// append literal every match of node n starts with, return FALSE where it stops
+static int regexp_literal_prefix( regexp_parser* ps, int n, GString* prefix )
+{
+    regexp_node *np = &ps->nodes[n];
+    switch ( np->type ) {
+    case REGEXP_NODE_EMPTY:
+        return TRUE;
+
+    case REGEXP_NODE_SET: {
+        int c = -1;
+        for (int i = 0; i < 256; ++i) {
+            if ( regexp_set_has(ps->sets[np->set], i) ) {
+                if ( c >= 0 )
+                    return FALSE;
+                c = i;
+            }
+        }
+        if ( c < 0 )
+            return FALSE;
+        g_string_append_c( prefix, c );
+        return TRUE;
+    }
+
+    case REGEXP_NODE_CAT:
+        return regexp_literal_prefix( ps, np->left, prefix )
+            && regexp_literal_prefix( ps, np->right, prefix );
+
+    case REGEXP_NODE_REPEAT:
+        if ( np->min > 0 )
+            regexp_literal_prefix( ps, np->left, prefix );
+        return FALSE;
+
+    default:
+        return FALSE;
+    }
+}
+
+static int regexp_prog_add( regexp_prog* prog, int op )
+{
+    if ( prog->nr_insts == prog->insts_size ) {
+        prog->insts_size = MAX( 16, prog->insts_size * 2 );
+        prog->insts = g_renew( regexp_inst, prog->insts, prog->insts_size );
+    }
+    regexp_inst *ip = &prog->insts[prog->nr_insts];
+    ip->op = op;
+    ip->out = prog->nr_insts + 1;
+    ip->out1 = -1;
+    ip->set = -1;
+    return prog->nr_insts++;
+}
+
+static void regexp_prog_branch( regexp_prog* prog, int split, int go, int skip, int greedy )
+{
+    prog->insts[split].out = greedy ? go: skip;
+    prog->insts[split].out1 = greedy ? skip: go;
+}
+
+/**
+ * lay out node n so that it goes on to the instruction after it. reversed
+ * program consumes text backward, so concatenation is reversed, and ^ and $
+ * trade places.
+ */
+static void regexp_emit( regexp_prog* prog, regexp_parser* ps, int n, int reverse )
+{
+    if ( prog->nr_insts > REGEXP_MAX_INSTS )
+        return;
+    
+    regexp_node *np = &ps->nodes[n];
+    switch ( np->type ) {
+    case REGEXP_NODE_EMPTY:
+        break;
+
+    case REGEXP_NODE_SET: {
+        int pc = regexp_prog_add( prog, REGEXP_OP_BYTE );
+        prog->insts[pc].set = np->set;
+        break;
+    }
+
+    case REGEXP_NODE_BOL:
+    case REGEXP_NODE_EOL:
+        regexp_prog_add( prog, (np->type == REGEXP_NODE_BOL) != reverse
+                         ? REGEXP_OP_BOL: REGEXP_OP_EOL );
+        break;
+
+    case REGEXP_NODE_CAT:
+        regexp_emit( prog, ps, reverse ? np->right: np->left, reverse );
+        regexp_emit( prog, ps, reverse ? np->left: np->right, reverse );
+        break;
+
+    case REGEXP_NODE_ALT: {
+        int split = regexp_prog_add( prog, REGEXP_OP_SPLIT );
+        regexp_emit( prog, ps, np->left, reverse );
+        int jmp = regexp_prog_add( prog, REGEXP_OP_JMP );
+        regexp_prog_branch( prog, split, split + 1, prog->nr_insts, TRUE );
+        regexp_emit( prog, ps, np->right, reverse );
+        prog->insts[jmp].out = prog->nr_insts;
+        break;
+    }
+
+    case REGEXP_NODE_REPEAT: {
+        int min = np->min, max = np->max, greedy = np->greedy, sub = np->left;
+        for (int i = 0; i < min; ++i)
+            regexp_emit( prog, ps, sub, reverse );
+
+        if ( max < 0 ) {
+            int split = regexp_prog_add( prog, REGEXP_OP_SPLIT );
+            regexp_emit( prog, ps, sub, reverse );
+            int jmp = regexp_prog_add( prog, REGEXP_OP_JMP );
+            prog->insts[jmp].out = split;
+            regexp_prog_branch( prog, split, split + 1, prog->nr_insts, greedy );
+            
+        } else if ( max > min ) {
+            // x\{0,2\} is (x(x)?)?, every split skips to the end
+            int *splits = g_new( int, max - min );
+            for (int i = 0; i < max - min; ++i) {
+                splits[i] = regexp_prog_add( prog, REGEXP_OP_SPLIT );
+                regexp_emit( prog, ps, sub, reverse );
+            }
+            for (int i = 0; i < max - min; ++i)
+                regexp_prog_branch( prog, splits[i], splits[i] + 1, prog->nr_insts, greedy );
+            g_free( splits );
+        }
+        break;
+    }
+    }
+}
+
+static regexp_prog* regexp_prog_compile( regexp_parser* ps, int root, int reverse )
+{
+    regexp_prog *prog = g_malloc0( sizeof(regexp_prog) );
+    regexp_emit( prog, ps, root, reverse );
+    regexp_prog_add( prog, REGEXP_OP_MATCH );
+    return prog;
+}
+
+static void regexp_prog_free( regexp_prog* prog )
+{
+    g_free( prog->insts );
+    g_free( prog );
+}
+
+// bytes which no set tells apart fall in one class, '\n' is always alone
+static void regexp_compute_classes( regexp_entry* re )
+{
+    re->nr_classes = 0;
+    for (int c = 0; c < 256; ++c) {
+        int split = c == 0 || c == '\n' || c == '\n' + 1;
+        for (int i = 0; !split && i < re->nr_sets; ++i)
+            split = regexp_set_has( re->sets[i], c ) != regexp_set_has( re->sets[i], c - 1 );
+        if ( split )
+            re->class_rep[re->nr_classes++] = c;
+        re->classes[c] = re->nr_classes - 1;
+    }
+}
+
+static guint regexp_dstate_hash( gconstpointer key )
+{
+    return ((const regexp_dstate*)key)->hash;
+}
+
+static gboolean regexp_dstate_equal( gconstpointer a, gconstpointer b )
+{
+    const regexp_dstate *s1 = a, *s2 = b;
+    return s1->hash == s2->hash && s1->flags == s2->flags && s1->nr_insts == s2->nr_insts
+        && memcmp( s1->insts, s2->insts, s1->nr_insts * sizeof(int) ) == 0;
+}
+
+static regexp_dfa* regexp_dfa_new( regexp_entry* re, regexp_prog* prog, int reverse,
+                                   int anchored, int longest, int earliest )
+{
+    regexp_dfa *dfa = g_malloc0( sizeof(regexp_dfa) );
+    dfa->re = re;
+    dfa->prog = prog;
+    dfa->reverse = reverse;
+    dfa->anchored = anchored;
+    dfa->longest = longest;
+    dfa->earliest = earliest;
+    dfa->index = g_hash_table_new_full( regexp_dstate_hash, regexp_dstate_equal,
+                                        g_free, NULL );
+    dfa->stride = re->nr_classes + 1;
+    dfa->start[0] = dfa->start[1] = -1;
+    dfa->cache_size = REGEXP_DFA_CACHE_SIZE;
+
+    // every instruction is pushed by at most two others
+    dfa->stack = g_new( int, 2 * prog->nr_insts + 1 );
+    dfa->list = g_new( int, prog->nr_insts );
+    dfa->marks = g_new0( guint, prog->nr_insts );
+    dfa->key = g_malloc( sizeof(regexp_dstate) + prog->nr_insts * sizeof(int) );
+    return dfa;
+}
+
+static void regexp_dfa_free( regexp_dfa* dfa )
+{
+    g_hash_table_destroy( dfa->index );
+    g_free( dfa->states );
+    g_free( dfa->delta );
+    g_free( dfa->state_flags );
+    g_free( dfa->stack );
+    g_free( dfa->list );
+    g_free( dfa->marks );
+    g_free( dfa->key );
+    g_free( dfa );
+}
+
+// drop all states, scanning goes on from the next state built
+static void regexp_dfa_flush( regexp_dfa* dfa )
+{
+    g_hash_table_remove_all( dfa->index );
+    dfa->nr_states = 0;
+    dfa->mem = 0;
+    dfa->start[0] = dfa->start[1] = -1;
+    dfa->nr_flushes++;
+}
+
+static void regexp_dfa_new_marks( regexp_dfa* dfa )
+{
+    if ( ++dfa->mark_gen == 0 ) {
+        bzero( dfa->marks, dfa->prog->nr_insts * sizeof(guint) );
+        dfa->mark_gen = 1;
+    }
+}
+
+/**
+ * append threads reachable from pc without consuming a byte to list in
+ * priority order, skipping those already marked. EOL is kept for later if
+ * next byte is not known yet.
+ */
+static void regexp_dfa_closure( regexp_dfa* dfa, int pc, int at_bol, int at_eol,
+                                int* list, int* n )
+{
+    regexp_inst *insts = dfa->prog->insts;
+    int *stack = dfa->stack, top = 0;
+    stack[top++] = pc;
+    while ( top ) {
+        pc = stack[--top];
+        if ( dfa->marks[pc] == dfa->mark_gen )
+            continue;
+        dfa->marks[pc] = dfa->mark_gen;
+        
+        regexp_inst *ip = &insts[pc];
+        switch ( ip->op ) {
+        case REGEXP_OP_JMP:
+            stack[top++] = ip->out;
+            break;
+        case REGEXP_OP_SPLIT:
+            stack[top++] = ip->out1;
+            stack[top++] = ip->out;
+            break;
+        case REGEXP_OP_BOL:
+            if ( at_bol )
+                stack[top++] = ip->out;
+            break;
+        case REGEXP_OP_EOL:
+            if ( at_eol == TRUE )
+                stack[top++] = ip->out;
+            else if ( at_eol < 0 )
+                list[(*n)++] = pc;
+            break;
+        default:
+            list[(*n)++] = pc;
+            break;
+        }
+    }
+}
+
+// return state of threads in dfa->key, building it if it is new
+static int regexp_dfa_intern( regexp_dfa* dfa, int flags, int n )
+{
+    regexp_dstate *key = dfa->key;
+    key->flags = flags;
+    key->nr_insts = n;
+    guint hash = flags * 0x9e3779b1u;
+    for (int i = 0; i < n; ++i)
+        hash = (hash ^ key->insts[i]) * 0x01000193u;
+    key->hash = hash;
+
+    gpointer value;
+    if ( g_hash_table_lookup_extended(dfa->index, key, NULL, &value) )
+        return GPOINTER_TO_INT( value );
+
+    size_t size = sizeof(regexp_dstate) + n * sizeof(int);
+    size_t cost = size + dfa->stride * sizeof(int) + 4 * sizeof(gpointer);
+    if ( dfa->nr_states && dfa->mem + cost > dfa->cache_size )
+        regexp_dfa_flush( dfa );
+    
+    if ( dfa->nr_states == dfa->states_size ) {
+        dfa->states_size = MAX( 16, dfa->states_size * 2 );
+        dfa->states = g_renew( regexp_dstate*, dfa->states, dfa->states_size );
+        dfa->delta = g_renew( int, dfa->delta, dfa->states_size * dfa->stride );
+        dfa->state_flags = g_renew( unsigned char, dfa->state_flags, dfa->states_size );
+    }
+
+    int state = dfa->nr_states++;
+    regexp_dstate *ds = g_malloc( size );
+    memcpy( ds, key, size );
+    dfa->states[state] = ds;
+    memset( dfa->delta + state * dfa->stride, 0xff, dfa->stride * sizeof(int) );
+    dfa->state_flags[state] = flags & (REGEXP_DSTATE_MATCH | REGEXP_DSTATE_DEAD);
+    g_hash_table_insert( dfa->index, ds, GINT_TO_POINTER(state) );
+    dfa->mem += cost;
+    return state;
+}
+
+static int regexp_dfa_start( regexp_dfa* dfa, int at_bol )
+{
+    if ( dfa->start[at_bol] < 0 ) {
+        int n = 0;
+        regexp_dfa_new_marks( dfa );
+        regexp_dfa_closure( dfa, 0, at_bol, -1, dfa->key->insts, &n );
+        int flags = at_bol ? REGEXP_DSTATE_AT_BOL: 0;
+        if ( n == 0 && dfa->anchored )
+            flags |= REGEXP_DSTATE_DEAD;
+        int state = regexp_dfa_intern( dfa, flags, n );
+        dfa->start[at_bol] = state;
+    }
+    return dfa->start[at_bol];
+}
+
+/**
+ * build the state state goes to by a byte of class cls, or by end of text if
+ * cls is nr_classes
+ */
+static int regexp_dfa_build( regexp_dfa* dfa, int state, int cls )
+{
+    regexp_dstate *ds = dfa->states[state];
+    regexp_inst *insts = dfa->prog->insts;
+    int eot = cls == dfa->re->nr_classes;
+    int c = eot ? -1: dfa->re->class_rep[cls];
+    int flags = ds->flags & REGEXP_DSTATE_MATCHED;
+    int *list = dfa->list, n = 0;
+
+    // EOL left in threads is decided by the byte now known
+    regexp_dfa_new_marks( dfa );
+    for (int i = 0; i < ds->nr_insts; ++i)
+        regexp_dfa_closure( dfa, ds->insts[i], ds->flags & REGEXP_DSTATE_AT_BOL,
+                            eot || c == '\n', list, &n );
+
+    for (int i = 0; i < n; ++i) {
+        if ( insts[list[i]].op != REGEXP_OP_MATCH )
+            continue;
+        flags |= REGEXP_DSTATE_MATCH;
+        if ( !dfa->longest ) {
+            // threads of lower priority and any match starting later lose
+            flags |= REGEXP_DSTATE_MATCHED;
+            n = i;
+            break;
+        }
+    }
+
+    int *next = dfa->key->insts, m = 0;
+    if ( !eot ) {
+        int at_bol = c == '\n';
+        regexp_dfa_new_marks( dfa );
+        for (int i = 0; i < n; ++i) {
+            regexp_inst *ip = &insts[list[i]];
+            if ( ip->op == REGEXP_OP_BYTE && regexp_set_has(dfa->re->sets[ip->set], c) )
+                regexp_dfa_closure( dfa, ip->out, at_bol, -1, next, &m );
+        }
+        if ( !dfa->anchored && !(flags & REGEXP_DSTATE_MATCHED) )
+            regexp_dfa_closure( dfa, 0, at_bol, -1, next, &m );
+        if ( at_bol )
+            flags |= REGEXP_DSTATE_AT_BOL;
+    }
+
+    if ( m == 0 && (eot || dfa->anchored || (flags & REGEXP_DSTATE_MATCHED)) )
+        flags |= REGEXP_DSTATE_DEAD;
+    return regexp_dfa_intern( dfa, flags, m );
+}
+
+// offset of row of state, tagged if scanning has to look at it
+static inline int regexp_dfa_row( regexp_dfa* dfa, int state )
+{
+    return state * dfa->stride | (dfa->state_flags[state] ? REGEXP_DFA_SPECIAL: 0);
+}
+
+static inline int regexp_dfa_start_row( regexp_dfa* dfa, int at_bol )
+{
+    return dfa->start[at_bol] < 0 ? -1: dfa->start[at_bol] * dfa->stride;
+}
+
+// return tagged row of next state from untagged row by class cls
+static int regexp_dfa_next( regexp_dfa* dfa, int row, int cls )
+{
+    int next = dfa->delta[row + cls];
+    if ( next < 0 ) {
+        int nr_flushes = dfa->nr_flushes;
+        next = regexp_dfa_row( dfa, regexp_dfa_build(dfa, row / dfa->stride, cls) );
+        // nowhere to remember it if state is gone with a flush
+        if ( nr_flushes == dfa->nr_flushes )
+            dfa->delta[row + cls] = next;
+    }
+    return next;
+}
+
+void regexp_scan_init( regexp_scan* scan, regexp_dfa* dfa, long long offset, int prev )
+{
+    assert( scan && dfa );
+    int state = regexp_dfa_start( dfa, prev < 0 || prev == '\n' );
+    scan->dfa = dfa;
+    scan->offset = offset;
+    scan->match = -1;
+    scan->state = state * dfa->stride;
+    scan->done = (dfa->state_flags[state] & REGEXP_DSTATE_DEAD) != 0;
+}
+
+int regexp_scan_feed( regexp_scan* scan, const char* str, long long len )
+{
+    assert( scan && (str || !len) );
+    regexp_dfa *dfa = scan->dfa;
+    if ( scan->done )
+        return TRUE;
+
+    const unsigned char *s = (const unsigned char*)str;
+    const unsigned char *classes = dfa->re->classes;
+    int state = scan->state;
+    int flags = 0;
+    
+    /**
+     * rows are looked up back to back, anything else is done only when a
+     * tagged or unbuilt one comes up
+     */
+    if ( dfa->reverse ) {
+        long long pos = len;
+        while ( pos > 0 ) {
+            int cls = classes[s[--pos]];
+            int next = dfa->delta[state + cls];
+            if ( (unsigned)next >= REGEXP_DFA_SPECIAL ) {
+                next = regexp_dfa_next( dfa, state, cls ) & ~REGEXP_DFA_SPECIAL;
+                flags = dfa->state_flags[next / dfa->stride];
+                if ( flags & REGEXP_DSTATE_MATCH ) {
+                    scan->match = scan->offset - len + pos + 1;
+                    if ( dfa->earliest )
+                        flags |= REGEXP_DSTATE_DEAD;
+                }
+                if ( flags & REGEXP_DSTATE_DEAD ) {
+                    state = next;
+                    break;
+                }
+            }
+            state = next;
+        }
+        scan->offset -= len;
+        
+    } else {
+        // nothing can happen before prefix, so skip to where it is
+        long long tail = dfa->prefix ? len - dfa->prefix->len + 1: 0;
+        int start0 = regexp_dfa_start_row( dfa, 0 );
+        int start1 = regexp_dfa_start_row( dfa, 1 );
+        long long pos = 0;
+        while ( pos < len ) {
+            if ( pos < tail && (state == start0 || state == start1) ) {
+                long long skip = substr_search( dfa->prefix, str + pos, len - pos );
+                if ( skip < 0 ) {
+                    pos = tail;
+                    continue;
+                }
+                pos += skip;
+            }
+            
+            int cls = classes[s[pos++]];
+            int next = dfa->delta[state + cls];
+            if ( (unsigned)next >= REGEXP_DFA_SPECIAL ) {
+                next = regexp_dfa_next( dfa, state, cls ) & ~REGEXP_DFA_SPECIAL;
+                flags = dfa->state_flags[next / dfa->stride];
+                if ( flags & REGEXP_DSTATE_MATCH ) {
+                    scan->match = scan->offset + pos - 1;
+                    if ( dfa->earliest )
+                        flags |= REGEXP_DSTATE_DEAD;
+                }
+                if ( flags & REGEXP_DSTATE_DEAD ) {
+                    state = next;
+                    break;
+                }
+                // the cache may have been flushed
+                start0 = regexp_dfa_start_row( dfa, 0 );
+                start1 = regexp_dfa_start_row( dfa, 1 );
+            }
+            state = next;
+        }
+        scan->offset += len;
+    }
+
+    scan->state = state;
+    scan->done = (flags & REGEXP_DSTATE_DEAD) != 0;
+    return scan->done;
+}
+
+void regexp_scan_finish( regexp_scan* scan, int next )
+{
+    assert( scan );
+    if ( scan->done )
+        return;
+
+    regexp_dfa *dfa = scan->dfa;
+    int cls = next < 0 ? dfa->re->nr_classes: dfa->re->classes[next];
+    int state = regexp_dfa_next( dfa, scan->state, cls ) & ~REGEXP_DFA_SPECIAL;
+    if ( dfa->state_flags[state / dfa->stride] & REGEXP_DSTATE_MATCH )
+        scan->match = scan->offset;
+    scan->state = state;
+    scan->done = TRUE;
+}
+
+regexp_entry* regexp_compile( const char* pat, const char** error )
+{
+    assert( pat );
+    regexp_parser ps;
+    bzero( &ps, sizeof ps );
+    ps.p = pat;
+    int root = regexp_parse_alt( &ps, 0 );
+
+    regexp_entry *re = NULL;
+    if ( !ps.error ) {
+        re = g_malloc0( sizeof(regexp_entry) );
+        re->pat = g_strdup( pat );
+        GString *prefix = g_string_new( "" );
+        regexp_literal_prefix( &ps, root, prefix );
+        if ( prefix->len )
+            re->prefix = substr_init( prefix->str, prefix->len );
+        g_string_free( prefix, TRUE );
+        
+        re->sets = ps.sets;
+        re->nr_sets = ps.nr_sets;
+        ps.sets = NULL;
+        regexp_compute_classes( re );
+        re->prog = regexp_prog_compile( &ps, root, FALSE );
+        re->rprog = regexp_prog_compile( &ps, root, TRUE );
+        if ( re->prog->nr_insts > REGEXP_MAX_INSTS ) {
+            ps.error = "Regular expression too big";
+            regexp_free( re );
+            re = NULL;
+        }
+    }
+
+    if ( re ) {
+        re->forward = regexp_dfa_new( re, re->prog, FALSE, FALSE, FALSE, FALSE );
+        re->forward->prefix = re->prefix;
+        re->reverse = regexp_dfa_new( re, re->rprog, TRUE, TRUE, TRUE, FALSE );
+        re->backward = regexp_dfa_new( re, re->rprog, TRUE, FALSE, TRUE, TRUE );
+        re->anchored = regexp_dfa_new( re, re->prog, FALSE, TRUE, FALSE, FALSE );
+    }
+
+    if ( error )
+        *error = ps.error;
+    g_free( ps.nodes );
+    g_free( ps.sets );
+    return re;
+}
+
+void regexp_free( regexp_entry* re )
+{
+    assert( re );
+    if ( re->forward ) {
+        regexp_dfa_free( re->forward );
+        regexp_dfa_free( re->reverse );
+        regexp_dfa_free( re->backward );
+        regexp_dfa_free( re->anchored );
+    }
+    if ( re->prefix )
+        substr_free( re->prefix );
+    regexp_prog_free( re->prog );
+    regexp_prog_free( re->rprog );
+    g_free( re->sets );
+    g_free( re->pat );
+    g_free( re );
+}
+
+void regexp_set_cache_size( regexp_entry* re, size_t size )
+{
+    assert( re );
+    re->forward->cache_size = re->reverse->cache_size = size;
+    re->backward->cache_size = re->anchored->cache_size = size;
+}
+
+int regexp_matches_byte( regexp_entry* re, int c )
+{
+    assert( re );
+    for (int i = 0; i < re->nr_sets; ++i) {
+        if ( regexp_set_has(re->sets[i], c) )
+            return 1;
+    }
+    return 0;
+}
+
+char* regexp_quote( const char* str )
+{
+    assert( str );
+    GString *pat = g_string_new( "" );
+    for (const char *p = str; *p; ++p) {
+        if ( strchr(".[*+?^$\\", *p) )
+            g_string_append_c( pat, '\\' );
+        g_string_append_c( pat, *p );
+    }
+    return g_string_free( pat, FALSE );
+}
+
+long long regexp_search( regexp_entry* re, const char* str, long long len,
+                         long long from, long long* end )
+{
+    assert( re && from >= 0 && from <= len );
+    int prev = from > 0 ? (unsigned char)str[from-1]: -1;
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->forward, from, prev );
+    regexp_scan_feed( &scan, str + from, len - from );
+    regexp_scan_finish( &scan, -1 );
+    if ( scan.match < 0 )
+        return -1;
+
+    // the leftmost match is the longest one ending there
+    long long match_end = scan.match;
+    regexp_scan_init( &scan, re->reverse, match_end,
+                      match_end < len ? (unsigned char)str[match_end]: -1 );
+    regexp_scan_feed( &scan, str + from, match_end - from );
+    regexp_scan_finish( &scan, prev );
+    assert( scan.match >= from );
+    
+    if ( end )
+        *end = match_end;
+    return scan.match;
+}
+
+long long regexp_search_backward( regexp_entry* re, const char* str, long long len,
+                                  long long limit, long long* end )
+{
+    assert( re && limit >= 0 && limit <= len );
+    int next = limit < len ? (unsigned char)str[limit]: -1;
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->backward, limit, next );
+    regexp_scan_feed( &scan, str, limit );
+    regexp_scan_finish( &scan, -1 );
+    if ( scan.match < 0 )
+        return -1;
+
+    long long match_start = scan.match;
+    regexp_scan_init( &scan, re->anchored, match_start,
+                      match_start > 0 ? (unsigned char)str[match_start-1]: -1 );
+    regexp_scan_feed( &scan, str + match_start, limit - match_start );
+    regexp_scan_finish( &scan, next );
+    assert( scan.match >= match_start );
+
+    if ( end )
+        *end = scan.match;
+    return match_start;
+}
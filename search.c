@@ -0,0 +1,397 @@
+/**
+ * Buffer Search Impl - 
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "search.h"
+
+// walk cur from the line it is on to the one containing offset
+static void se_search_cursor_seek( se_buffer* bufp, se_search_cursor* cur, se_off_t offset )
+{
+    se_off_t count = bufp->getCharCount( bufp );
+    if ( offset >= count ) {
+        cur->line = NULL;
+        cur->lineStart = count;
+        return;
+    }
+    
+    if ( !cur->line ) {
+        cur->line = bufp->lines->previous;
+        cur->lineStart = count - se_line_getLineLength( cur->line );
+    }
+    while ( offset < cur->lineStart ) {
+        cur->line = cur->line->previous;
+        cur->lineStart -= se_line_getLineLength( cur->line );
+    }
+    while ( offset >= cur->lineStart + se_line_getLineLength(cur->line) ) {
+        cur->lineStart += se_line_getLineLength( cur->line );
+        cur->line = cur->line->next;
+    }
+}
+
+// char at offset, or -1 out of buffer
+static int se_search_char_at( se_buffer* bufp, se_search_cursor cur, se_off_t offset )
+{
+    if ( offset < 0 || offset >= bufp->getCharCount(bufp) )
+        return -1;
+    se_search_cursor_seek( bufp, &cur, offset );
+    return (unsigned char)se_line_getData( cur.line )[offset - cur.lineStart];
+}
+
+void se_search_cursor_at( se_buffer* bufp, se_off_t offset, se_search_cursor* cur )
+{
+    g_assert( bufp && cur );
+    cur->line = NULL;
+    cur->lineStart = bufp->getCharCount( bufp );
+    if ( !bufp->lines || offset >= cur->lineStart )
+        return;
+
+    // searching mostly starts near point
+    cur->line = bufp->getCurrentLine( bufp );
+    cur->lineStart = bufp->getPoint( bufp ) - bufp->getCurrentColumn( bufp );
+    if ( !cur->line ) {
+        cur->line = bufp->lines;
+        cur->lineStart = 0;
+    }
+    se_search_cursor_seek( bufp, cur, offset );
+}
+
+se_off_t se_search_forward( se_buffer* bufp, kmp_entry* kmp, se_off_t from,
+                            se_search_cursor* cur, se_off_t* end )
+{
+    g_assert( bufp && kmp && cur );
+    if ( !cur->line )
+        return -1;
+    g_assert( from >= cur->lineStart );
+
+    // without a '\n' inside, pattern never spans lines, and each line can be
+    // scanned on its own by the faster literal search
+    substr_entry *substr = NULL;
+    if ( !memchr(kmp->pat, '\n', kmp->len - 1) )
+        substr = substr_init( kmp->pat, kmp->len );
+
+    se_line *lp = cur->line;
+    se_off_t line_start = cur->lineStart;
+    se_off_t match_start = -1;
+    int state = 0;
+    do {
+        se_off_t len = se_line_getLineLength( lp );
+        se_off_t skip = MAX( from - line_start, 0 );
+        if ( skip < len ) {
+            const char *data = se_line_getData( lp ) + skip;
+            if ( substr ) {
+                se_off_t pos = substr_search( substr, data, len - skip );
+                if ( pos >= 0 ) 
+                    match_start = line_start + skip + pos;
+                
+            } else {
+                se_off_t pos = kmp_feed( kmp, &state, data, len - skip );
+                if ( pos >= 0 )
+                    match_start = line_start + skip + pos - kmp->len;
+            }
+        }
+
+        if ( match_start >= 0 )
+            break;
+        line_start += len;
+        lp = lp->next;
+    } while ( lp != bufp->lines );
+
+    if ( substr )
+        substr_free( substr );
+    if ( match_start < 0 )
+        return -1;
+    
+    // match may begin on a previous line
+    while ( match_start < line_start ) {
+        lp = lp->previous;
+        line_start -= se_line_getLineLength( lp );
+    }
+    
+    cur->line = lp;
+    cur->lineStart = line_start;
+    if ( end )
+        *end = match_start + kmp->len;
+    return match_start;
+}
+
+// feed chars from from up to limit, stop early once scan is done
+static void se_search_regexp_scan( se_buffer* bufp, regexp_scan* scan, se_search_cursor* cur,
+                                   se_off_t from, se_off_t limit )
+{
+    while ( from < limit ) {
+        se_search_cursor_seek( bufp, cur, from );
+        se_off_t line_end = MIN( cur->lineStart + se_line_getLineLength(cur->line), limit );
+        const char *data = se_line_getData( cur->line ) + (from - cur->lineStart);
+        if ( regexp_scan_feed(scan, data, line_end - from) )
+            break;
+        from = line_end;
+    }
+}
+
+// same as above but backward, from limit down to from
+static void se_search_regexp_scan_backward( se_buffer* bufp, regexp_scan* scan,
+                                            se_search_cursor* cur, se_off_t from,
+                                            se_off_t limit )
+{
+    while ( limit > from ) {
+        se_search_cursor_seek( bufp, cur, limit - 1 );
+        se_off_t line_start = MAX( cur->lineStart, from );
+        const char *data = se_line_getData( cur->line ) + (line_start - cur->lineStart);
+        if ( regexp_scan_feed(scan, data, limit - line_start) )
+            break;
+        limit = line_start;
+    }
+}
+
+se_off_t se_search_regexp_forward( se_buffer* bufp, regexp_entry* re, se_off_t from,
+                                   se_search_cursor* cur, se_off_t* end )
+{
+    g_assert( bufp && re && cur );
+    se_off_t count = bufp->getCharCount( bufp );
+    if ( from > count )
+        return -1;
+
+    se_search_cursor pos = *cur;
+    int prev = se_search_char_at( bufp, pos, from - 1 );
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->forward, from, prev );
+    se_search_regexp_scan( bufp, &scan, &pos, from, count );
+    regexp_scan_finish( &scan, -1 );
+    if ( scan.match < 0 )
+        return -1;
+
+    se_off_t match_end = scan.match;
+    regexp_scan_init( &scan, re->reverse, match_end, se_search_char_at(bufp, pos, match_end) );
+    se_search_regexp_scan_backward( bufp, &scan, &pos, from, match_end );
+    regexp_scan_finish( &scan, prev );
+    g_assert( scan.match >= from );
+
+    se_search_cursor_seek( bufp, &pos, scan.match );
+    *cur = pos;
+    if ( end )
+        *end = match_end;
+    return scan.match;
+}
+
+se_off_t se_search_regexp_match( se_buffer* bufp, regexp_entry* re, se_off_t start,
+                                 se_off_t limit, se_search_cursor* cur )
+{
+    g_assert( bufp && re && cur && start <= limit );
+    se_search_cursor pos = *cur;
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->anchored, start, se_search_char_at(bufp, pos, start - 1) );
+    se_search_regexp_scan( bufp, &scan, &pos, start, limit );
+    regexp_scan_finish( &scan, se_search_char_at(bufp, pos, limit) );
+    return scan.match;
+}
+
+se_off_t se_search_regexp_backward( se_buffer* bufp, regexp_entry* re, se_off_t limit,
+                                    se_search_cursor* cur, se_off_t* end )
+{
+    g_assert( bufp && re && cur );
+    if ( limit < 0 || limit > bufp->getCharCount(bufp) )
+        return -1;
+
+    se_search_cursor pos = *cur;
+    regexp_scan scan;
+    regexp_scan_init( &scan, re->backward, limit, se_search_char_at(bufp, pos, limit) );
+    se_search_regexp_scan_backward( bufp, &scan, &pos, 0, limit );
+    regexp_scan_finish( &scan, -1 );
+    if ( scan.match < 0 )
+        return -1;
+
+    se_off_t match_start = scan.match;
+    se_search_cursor_seek( bufp, &pos, match_start );
+    se_off_t match_end = se_search_regexp_match( bufp, re, match_start, limit, &pos );
+    g_assert( match_end >= match_start );
+
+    *cur = pos;
+    if ( end )
+        *end = match_end;
+    return match_start;
+}
+
+se_isearch* se_isearch_create( se_buffer* bufp )
+{
+    return se_isearch_create_full( bufp, FALSE, FALSE );
+}
+
+se_isearch* se_isearch_create_full( se_buffer* bufp, gboolean regexp, gboolean backward )
+{
+    g_assert( bufp && (regexp || !backward) );
+    se_isearch *isearch = g_malloc0( sizeof(se_isearch) );
+    isearch->buffer = bufp;
+    isearch->regexp = regexp;
+    isearch->backward = backward;
+    isearch->origin = bufp->getPoint( bufp );
+    isearch->pattern = g_string_new( "" );
+    isearch->history = g_array_new( FALSE, FALSE, sizeof(se_isearch_hit) );
+
+    isearch->hit.start = isearch->hit.end = isearch->origin;
+    se_search_cursor_at( bufp, isearch->origin, &isearch->hit.cursor );
+    return isearch;
+}
+
+void se_isearch_free( se_isearch* isearch )
+{
+    g_assert( isearch );
+    if ( isearch->kmp )
+        kmp_free( isearch->kmp );
+    if ( isearch->re )
+        regexp_free( isearch->re );
+    g_string_free( isearch->pattern, TRUE );
+    g_array_free( isearch->history, TRUE );
+    g_free( isearch );
+}
+
+static void se_isearch_update_pattern( se_isearch* isearch )
+{
+    if ( isearch->kmp ) {
+        kmp_free( isearch->kmp );
+        isearch->kmp = NULL;
+    }
+    if ( isearch->re ) {
+        regexp_free( isearch->re );
+        isearch->re = NULL;
+    }
+    isearch->error = NULL;
+
+    if ( !isearch->pattern->len )
+        return;
+    if ( isearch->regexp )
+        isearch->re = regexp_compile( isearch->pattern->str, &isearch->error );
+    else
+        isearch->kmp = kmp_init( isearch->pattern->str );
+}
+
+static void se_isearch_push( se_isearch* isearch )
+{
+    isearch->hit.patternLen = isearch->pattern->len;
+    g_array_append_val( isearch->history, isearch->hit );
+}
+
+static void se_isearch_set_point( se_isearch* isearch )
+{
+    se_buffer *bufp = isearch->buffer;
+    bufp->setPoint( bufp, isearch->backward ? isearch->hit.start: isearch->hit.end );
+}
+
+// from is where to go on searching, or the limit if backward
+static gboolean se_isearch_search( se_isearch* isearch, se_off_t from,
+                                   se_search_cursor cur )
+{
+    se_buffer *bufp = isearch->buffer;
+    se_off_t start, end = -1;
+    if ( !isearch->regexp )
+        start = se_search_forward( bufp, isearch->kmp, from, &cur, &end );
+    else if ( isearch->backward )
+        start = se_search_regexp_backward( bufp, isearch->re, from, &cur, &end );
+    else
+        start = se_search_regexp_forward( bufp, isearch->re, from, &cur, &end );
+    
+    if ( start < 0 ) {
+        isearch->hit.failing = TRUE;
+        return FALSE;
+    }
+
+    isearch->hit.start = start;
+    isearch->hit.end = end;
+    isearch->hit.failing = FALSE;
+    isearch->hit.cursor = cur;
+    se_isearch_set_point( isearch );
+    return TRUE;
+}
+
+gboolean se_isearch_add_char( se_isearch* isearch, int c )
+{
+    g_assert( isearch && c > 0 );
+    se_isearch_push( isearch );
+    g_string_append_c( isearch->pattern, c );
+    se_isearch_update_pattern( isearch );
+
+    if ( !isearch->regexp ) {
+        // a longer pattern can't be found where the shorter one was not
+        if ( isearch->hit.failing )
+            return FALSE;
+        return se_isearch_search( isearch, isearch->hit.start, isearch->hit.cursor );
+    }
+
+    // a regexp may match more as it grows (think of a\|), so search again
+    // even if failing, but an incomplete one is left until it is complete
+    if ( !isearch->re )
+        return FALSE;
+
+    if ( isearch->backward ) {
+        // stay if it can be extended where last hit starts
+        se_off_t end = se_search_regexp_match( isearch->buffer, isearch->re,
+                                               isearch->hit.start, isearch->origin,
+                                               &isearch->hit.cursor );
+        if ( end >= 0 ) {
+            isearch->hit.end = end;
+            isearch->hit.failing = FALSE;
+            se_isearch_set_point( isearch );
+            return TRUE;
+        }
+    }
+    return se_isearch_search( isearch, isearch->hit.start, isearch->hit.cursor );
+}
+
+gboolean se_isearch_repeat( se_isearch* isearch )
+{
+    g_assert( isearch );
+    if ( !isearch->kmp && !isearch->re )
+        return FALSE;
+    
+    se_isearch_push( isearch );
+    if ( isearch->hit.failing ) {
+        // wrap around
+        se_buffer *bufp = isearch->buffer;
+        se_search_cursor cur = { bufp->lines, 0 };
+        if ( !isearch->backward )
+            return se_isearch_search( isearch, 0, cur );
+        se_search_cursor_at( bufp, bufp->getCharCount(bufp), &cur );
+        return se_isearch_search( isearch, cur.lineStart, cur );
+    }
+
+    // an empty hit would be found again right where it is
+    int skip = isearch->hit.start == isearch->hit.end;
+    if ( isearch->backward )
+        return se_isearch_search( isearch, isearch->hit.start - skip, isearch->hit.cursor );
+
+    // continue from end of last hit
+    return se_isearch_search( isearch, isearch->hit.end + skip, isearch->hit.cursor );
+}
+
+gboolean se_isearch_delete_char( se_isearch* isearch )
+{
+    g_assert( isearch );
+    if ( isearch->history->len == 0 )
+        return FALSE;
+
+    guint last = isearch->history->len - 1;
+    isearch->hit = g_array_index( isearch->history, se_isearch_hit, last );
+    g_array_remove_index( isearch->history, last );
+
+    if ( isearch->hit.patternLen != isearch->pattern->len ) {
+        g_string_truncate( isearch->pattern, isearch->hit.patternLen );
+        se_isearch_update_pattern( isearch );
+    }
+    
+    se_isearch_set_point( isearch );
+    return !isearch->hit.failing;
+}
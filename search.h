@@ -0,0 +1,125 @@
+
+/**
+ * Buffer Search - 
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _semacs_search_h
+#define _semacs_search_h
+
+#include "util.h"
+#include "buffer.h"
+#include "submatch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * searching goes through line chunks one by one and carries matcher state
+ * across them, so a match can span lines and buffer is never copied into a
+ * contiguous string.
+ */
+DEF_CLS(se_search_cursor);
+struct se_search_cursor
+{
+    se_line *line;       // NULL if at end of buffer
+    se_off_t lineStart;  // buffer offset of first char of line
+};
+
+// place cursor on the line containing offset
+extern void se_search_cursor_at( se_buffer*, se_off_t offset, se_search_cursor* );
+
+/**
+ * find first match of kmp which starts at or after from, and return its start
+ * offset (end offset in *end), or -1 if none. cur must be on the line
+ * containing from, and is left on the line where the match starts.
+ */
+extern se_off_t se_search_forward( se_buffer*, kmp_entry*, se_off_t from,
+                                   se_search_cursor* cur, se_off_t* end );
+
+/**
+ * regexp counterpart of above, cur can be on any line. a forward scan finds
+ * where the leftmost match ends, and a reverse one from there where it starts.
+ */
+extern se_off_t se_search_regexp_forward( se_buffer*, regexp_entry*, se_off_t from,
+                                          se_search_cursor* cur, se_off_t* end );
+/**
+ * find the match which starts last before limit and does not end after it,
+ * return its start offset (end offset in *end) or -1. cur can be on any line,
+ * and is left on the line where the match starts.
+ */
+extern se_off_t se_search_regexp_backward( se_buffer*, regexp_entry*, se_off_t limit,
+                                           se_search_cursor* cur, se_off_t* end );
+/**
+ * return end of the match starting right at start and ending before limit,
+ * or -1 if there is none
+ */
+extern se_off_t se_search_regexp_match( se_buffer*, regexp_entry*, se_off_t start,
+                                        se_off_t limit, se_search_cursor* cur );
+
+DEF_CLS(se_isearch_hit);
+struct se_isearch_hit
+{
+    se_off_t start;
+    se_off_t end;
+    gboolean failing;
+    se_search_cursor cursor;  // line of start
+    gsize patternLen;         // length of pattern when pushed into history
+};
+
+/**
+ * incremental search: every char added resumes from last hit instead of
+ * rescanning from origin, since a longer pattern can not match earlier.
+ * searching backward is only done with regexp, and leaves point at start of
+ * hit instead of end.
+ */
+DEF_CLS(se_isearch);
+struct se_isearch
+{
+    se_buffer *buffer;
+    se_off_t origin;  // point when search started
+    gboolean regexp;
+    gboolean backward;
+    GString *pattern;
+    kmp_entry *kmp;   // NULL while pattern is empty
+    regexp_entry *re; // for regexp, NULL while pattern is empty or invalid
+    const char *error; // why pattern is not a valid regexp
+
+    se_isearch_hit hit;  // last hit, or where search resumes if failing
+    GArray *history;     // hits before each char added or search repeated
+};
+
+extern se_isearch* se_isearch_create( se_buffer* );
+extern se_isearch* se_isearch_create_full( se_buffer*, gboolean regexp, gboolean backward );
+extern void se_isearch_free( se_isearch* );
+
+/**
+ * each of these returns FALSE if no match is found, and point is left at end
+ * of last successful match
+ */
+extern gboolean se_isearch_add_char( se_isearch*, int c );
+extern gboolean se_isearch_repeat( se_isearch* );
+// undo last add_char or repeat
+extern gboolean se_isearch_delete_char( se_isearch* );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
@@ -0,0 +1,241 @@
+/**
+ * Vectorized substring search - used to find a literal keyword in a large text
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "util.h"
+#include "submatch.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SUBSTR_X86
+#endif
+
+/**
+ * long patterns skip ahead by Horspool's bad char rule. the vector filters
+ * stay ahead of it on log-like text, so with them Horspool is only worth it
+ * for much longer patterns, and never against AVX2 (see bench_semacs).
+ */
+#define SUBSTR_HORSPOOL_MIN_LEN       32
+#define SUBSTR_HORSPOOL_MIN_LEN_SSE2  256
+
+static int substr_cpu_has_avx2()
+{
+#ifdef SUBSTR_X86
+    static int has_avx2 = -1;
+    if ( has_avx2 < 0 ) {
+        __builtin_cpu_init();
+        has_avx2 = __builtin_cpu_supports( "avx2" ) ? 1 : 0;
+    }
+    return has_avx2;
+#else
+    return 0;
+#endif
+}
+
+static substr_strategy substr_pick_strategy( int len, substr_strategy strategy )
+{
+    if ( strategy == SUBSTR_AUTO ) {
+        if ( len == 1 )
+            return SUBSTR_MEMCHR;
+        if ( substr_cpu_has_avx2() )
+            return SUBSTR_AVX2;
+#ifdef __SSE2__
+        return len >= SUBSTR_HORSPOOL_MIN_LEN_SSE2 ? SUBSTR_HORSPOOL : SUBSTR_SSE2;
+#else
+        return len >= SUBSTR_HORSPOOL_MIN_LEN ? SUBSTR_HORSPOOL : SUBSTR_SCALAR;
+#endif
+    }
+
+    // vector filters check first and last byte as two separate positions
+    if ( len == 1 && (strategy == SUBSTR_SSE2 || strategy == SUBSTR_AVX2) )
+        return SUBSTR_MEMCHR;
+
+    // fall back to what this machine can do
+    if ( strategy == SUBSTR_AVX2 && !substr_cpu_has_avx2() )
+        strategy = SUBSTR_SSE2;
+#ifndef __SSE2__
+    if ( strategy == SUBSTR_SSE2 )
+        strategy = SUBSTR_SCALAR;
+#endif
+    return strategy;
+}
+
+substr_entry* substr_init_with_strategy( const char* pat, int len, substr_strategy strategy )
+{
+    assert( pat && len > 0 );
+    
+    substr_entry *substr = (substr_entry*) malloc( sizeof(substr_entry) );
+    substr->pat = (char*) malloc( len + 1 );
+    memcpy( substr->pat, pat, len );
+    substr->pat[len] = 0;
+    substr->len = len;
+    substr->strategy = substr_pick_strategy( len, strategy );
+
+    for (int i = 0; i < 256; ++i)
+        substr->shift[i] = len;
+    for (int i = 0; i < len - 1; ++i)
+        substr->shift[(unsigned char)pat[i]] = len - 1 - i;
+    
+    return substr;
+}
+
+substr_entry* substr_init( const char* pat, int len )
+{
+    return substr_init_with_strategy( pat, len, SUBSTR_AUTO );
+}
+
+void substr_free( substr_entry* substr )
+{
+    assert( substr );
+    free( substr->pat );
+    free( substr );
+}
+
+/**
+ * find candidates by first byte with memchr, and rule most of them out by
+ * last byte before comparing the whole pattern
+ */
+static long long substr_search_scalar( substr_entry* substr, const char* str, long long len )
+{
+    const int k = substr->len;
+    if ( len < k )
+        return -1;
+    
+    const char *sp = str;
+    const char *endp = str + len - k + 1; // past the last possible start
+    while ( sp < endp ) {
+        sp = memchr( sp, substr->pat[0], endp - sp );
+        if ( !sp )
+            return -1;
+        
+        if ( sp[k-1] == substr->pat[k-1]
+             && memcmp(sp + 1, substr->pat + 1, k - 1) == 0 )
+            return sp - str;
+        ++sp;
+    }
+    return -1;
+}
+
+#ifdef __SSE2__
+/**
+ * compare first and last byte of pattern with 16 positions at once, and only
+ * check the middle of those where both are equal
+ */
+static long long substr_search_sse2( substr_entry* substr, const char* str, long long len )
+{
+    const int k = substr->len;
+    const __m128i first = _mm_set1_epi8( substr->pat[0] );
+    const __m128i last = _mm_set1_epi8( substr->pat[k-1] );
+    
+    long long i = 0;
+    for (; i + k - 1 + 16 <= len; i += 16) {
+        __m128i block_first = _mm_loadu_si128( (const __m128i*)(str + i) );
+        __m128i block_last = _mm_loadu_si128( (const __m128i*)(str + i + k - 1) );
+        unsigned mask = _mm_movemask_epi8(
+            _mm_and_si128( _mm_cmpeq_epi8(first, block_first),
+                           _mm_cmpeq_epi8(last, block_last) ) );
+        
+        while ( mask ) {
+            int bit = __builtin_ctz( mask );
+            if ( memcmp(str + i + bit + 1, substr->pat + 1, k - 2) == 0 )
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    long long rest = substr_search_scalar( substr, str + i, len - i );
+    return rest < 0 ? -1 : i + rest;
+}
+#endif
+
+#ifdef SUBSTR_X86
+// same as sse2 version, 32 positions at once
+__attribute__(( target("avx2") ))
+static long long substr_search_avx2( substr_entry* substr, const char* str, long long len )
+{
+    const int k = substr->len;
+    const __m256i first = _mm256_set1_epi8( substr->pat[0] );
+    const __m256i last = _mm256_set1_epi8( substr->pat[k-1] );
+    
+    long long i = 0;
+    for (; i + k - 1 + 32 <= len; i += 32) {
+        __m256i block_first = _mm256_loadu_si256( (const __m256i*)(str + i) );
+        __m256i block_last = _mm256_loadu_si256( (const __m256i*)(str + i + k - 1) );
+        unsigned mask = _mm256_movemask_epi8(
+            _mm256_and_si256( _mm256_cmpeq_epi8(first, block_first),
+                              _mm256_cmpeq_epi8(last, block_last) ) );
+        
+        while ( mask ) {
+            int bit = __builtin_ctz( mask );
+            if ( memcmp(str + i + bit + 1, substr->pat + 1, k - 2) == 0 )
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    long long rest = substr_search_scalar( substr, str + i, len - i );
+    return rest < 0 ? -1 : i + rest;
+}
+#endif
+
+static long long substr_search_horspool( substr_entry* substr, const char* str, long long len )
+{
+    const int k = substr->len;
+    const unsigned char last = substr->pat[k-1];
+    
+    long long i = 0;
+    while ( i + k <= len ) {
+        unsigned char c = str[i + k - 1];
+        if ( c == last && memcmp(str + i, substr->pat, k - 1) == 0 )
+            return i;
+        i += substr->shift[c];
+    }
+    return -1;
+}
+
+long long substr_search( substr_entry* substr, const char* str, long long len )
+{
+    assert( substr && str );
+    
+    switch ( substr->strategy ) {
+    case SUBSTR_MEMCHR: {
+        const char *sp = memchr( str, substr->pat[0], len );
+        return sp ? sp - str : -1;
+    }
+        
+#ifdef __SSE2__
+    case SUBSTR_SSE2:
+        return substr_search_sse2( substr, str, len );
+#endif
+        
+#ifdef SUBSTR_X86
+    case SUBSTR_AVX2:
+        return substr_search_avx2( substr, str, len );
+#endif
+
+    case SUBSTR_HORSPOOL:
+        return substr_search_horspool( substr, str, len );
+        
+    default:
+        return substr_search_scalar( substr, str, len );
+    }
+}
@@ -35,38 +35,18 @@ kmp_entry* kmp_init( const char * pat )
     int len = strlen( pat );
     assert( len > 0 );
 
-    kmp->next = (int*) malloc( len * sizeof(int) );
+    // next[i] is the length of the longest proper border of pat[0..i)
+    kmp->next = (int*) malloc( (len+1) * sizeof(int) );
     kmp->pat = (char*) malloc( len + 1);
     strncpy( kmp->pat, pat, len+1 );
     kmp->len = len;
     
     kmp->next[0] = -1;
-    if ( len == 2 ) {
-        kmp->next[1] = 0;
-        
-    } else {  // len > 2
-        kmp->next[1] = 0;
-        int idx = 2;
-        while ( idx < len ) {
-            int cnt = kmp->next[ idx-1 ];
-            if ( pat[idx-1] == pat[cnt] ) {
-                kmp->next[idx] = cnt+1;
-                /* se_debug( "pat[%d] == pat[%d]\n", idx-1, kmp->next[idx] ); */
-                
-            } else {
-                /* se_debug( "backtrack for %d\n", idx ); */
-                
-                while ( pat[idx-1] != pat[cnt] && cnt > 0 ) {
-                    cnt = kmp->next[cnt];
-                }
-                if ( cnt <= 0 ) 
-                    kmp->next[idx] = cnt;
-                else
-                    kmp->next[idx] = cnt+1;
-            }
-            /* se_debug( "cal next[%d] = %d\n", idx, kmp->next[idx] ); */
-            ++idx;
-        }
+    int cnt = -1;
+    for (int idx = 0; idx < len; ++idx) {
+        while ( cnt >= 0 && pat[cnt] != pat[idx] )
+            cnt = kmp->next[cnt];
+        kmp->next[idx+1] = ++cnt;
     }
     
 #ifdef SE_DEBUG
@@ -98,43 +78,43 @@ void kmp_free( kmp_entry* kmp )
     free( kmp );
 }
 
-int kmp_match( kmp_entry* kmp, const char* str )
+long long kmp_feed( kmp_entry* kmp, int* state, const char* str, long long len )
 {
-    assert( str );
-    
-    int pat_idx = 0, str_idx = 0;
-    int str_len = strlen( str );
-    assert ( str_len );
+    assert( kmp && state );
+
+    int pat_idx = *state;
+    if ( pat_idx == kmp->len ) {
+        // resume after a full match, overlapped matches are allowed
+        pat_idx = kmp->next[pat_idx];
+    }
     
-    while ( str_idx < str_len ) {
-        
-        if ( str[str_idx] == kmp->pat[pat_idx] ) {
-            ++str_idx;
-            ++pat_idx;
-        } else {
-            /* se_debug( "mismatch: str_idx:%d, pat_idx: %d\n", str_idx, pat_idx ); */
-            
-            int cnt = kmp->next[ pat_idx ];
-            if ( cnt <= 0 ) {
-                ++str_idx;
-                pat_idx = 0;
-                /* se_debug( "move str_idx: %d, reset pat idx to 0\n", str_idx ); */
-                
-            } else {
-                pat_idx = cnt;
-                /* se_debug( "move pat_idx to %d\n", pat_idx ); */
-            }
-        }
+    for (long long str_idx = 0; str_idx < len; ++str_idx) {
+        while ( pat_idx >= 0 && kmp->pat[pat_idx] != str[str_idx] )
+            pat_idx = kmp->next[ pat_idx ];
 
-        if ( pat_idx == kmp->len ) {
-            /* se_debug( "matched at %d\n", str_idx - kmp->len + 1 ); */
-            return str_idx - kmp->len + 1;
+        if ( ++pat_idx == kmp->len ) {
+            *state = pat_idx;
+            return str_idx + 1;
         }
-        
     }
+
+    *state = pat_idx;
     return -1;
 }
 
+int kmp_match( kmp_entry* kmp, const char* str )
+{
+    assert( str );
+    
+    int state = 0;
+    long long end = kmp_feed( kmp, &state, str, strlen(str) );
+    if ( end < 0 )
+        return -1;
+
+    /* se_debug( "matched at %d\n", end - kmp->len + 1 ); */
+    return end - kmp->len + 1;
+}
+
 void kmp_verify( kmp_entry* kmp, const char* origin, int match_idx )
 {
     if ( match_idx < 0 )
@@ -0,0 +1,192 @@
+/**
+ * Buffer Snapshots Impl - 
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "snapshot.h"
+
+static se_snapshot* se_snapshot_create( se_buffer* bufp )
+{
+    se_snapshot *snap = g_malloc0( sizeof(se_snapshot) );
+    snap->version = bufp->version;
+    snap->charCount = bufp->getCharCount( bufp );
+
+    se_line *lp = bufp->lines;
+    if ( !lp )
+        return snap;
+
+    se_off_t nr_lines = 0;
+    do {
+        nr_lines++;
+        lp = lp->next;
+    } while ( lp != bufp->lines );
+
+    snap->nrLines = nr_lines;
+    snap->offsets = g_malloc( nr_lines * sizeof(se_off_t) );
+    snap->chunks = g_malloc( nr_lines * sizeof(se_chunk*) );
+
+    se_off_t offset = 0;
+    for ( se_off_t i = 0; i < nr_lines; ++i, lp = lp->next ) {
+        snap->offsets[i] = offset;
+        snap->chunks[i] = se_chunk_ref( lp->content );
+        offset += lp->content->used;
+    }
+    g_assert( offset == snap->charCount );
+    return snap;
+}
+
+static void se_snapshot_free( se_snapshot* snap )
+{
+    for ( se_off_t i = 0; i < snap->nrLines; ++i )
+        se_chunk_unref( snap->chunks[i] );
+    g_free( snap->chunks );
+    g_free( snap->offsets );
+    g_free( snap );
+}
+
+// make snap the latest version, NULL for none, and retire the one it replaces
+static void se_snapshot_replace_current( se_snapshot_domain* domain, se_snapshot* snap )
+{
+    se_snapshot *old = domain->current;
+    g_atomic_pointer_set( &domain->current, snap );
+
+    // readers announcing this epoch or later can not see old any more
+    int epoch = g_atomic_int_add( &domain->epoch, 1 ) + 1;
+    if ( old ) {
+        old->retireEpoch = epoch;
+        old->retireNext = domain->retired;
+        domain->retired = old;
+    }
+}
+
+se_snapshot* se_snapshot_publish( se_buffer* bufp )
+{
+    g_assert( bufp );
+    se_snapshot_domain *domain = bufp->snapshots;
+    if ( !domain ) {
+        domain = g_malloc0( sizeof(se_snapshot_domain) );
+        domain->epoch = 1;
+        bufp->snapshots = domain;
+    }
+
+    se_snapshot *old = domain->current;
+    if ( old && old->version == bufp->version )
+        return old;
+
+    se_snapshot *snap = se_snapshot_create( bufp );
+    se_snapshot_replace_current( domain, snap );
+    se_snapshot_reclaim( bufp );
+    return snap;
+}
+
+void se_snapshot_drop_unused( se_buffer* bufp )
+{
+    se_snapshot_domain *domain = bufp->snapshots;
+    if ( !domain || (!domain->current && !domain->retired) )
+        return;
+
+    // claimed slots count too, they may be about to load current
+    for ( int i = 0; i < SE_MAX_SNAPSHOT_READERS; ++i ) {
+        if ( g_atomic_int_get(&domain->readers[i]) != 0 ) {
+            se_snapshot_reclaim( bufp );
+            return;
+        }
+    }
+
+    if ( domain->current )
+        se_snapshot_replace_current( domain, NULL );
+    se_snapshot_reclaim( bufp );
+}
+
+void se_snapshot_reclaim( se_buffer* bufp )
+{
+    se_snapshot_domain *domain = bufp->snapshots;
+    if ( !domain || !domain->retired )
+        return;
+
+    // a claimed but unannounced slot will announce an epoch not older than now
+    int oldest = g_atomic_int_get( &domain->epoch );
+    for ( int i = 0; i < SE_MAX_SNAPSHOT_READERS; ++i ) {
+        int e = g_atomic_int_get( &domain->readers[i] );
+        if ( e > 0 && e < oldest )
+            oldest = e;
+    }
+
+    se_snapshot **snapp = &domain->retired;
+    while ( *snapp ) {
+        se_snapshot *snap = *snapp;
+        if ( snap->retireEpoch <= oldest ) {
+            *snapp = snap->retireNext;
+            se_snapshot_free( snap );
+        } else
+            snapp = &snap->retireNext;
+    }
+}
+
+se_snapshot* se_snapshot_acquire( se_buffer* bufp, se_snapshot_pin* pin )
+{
+    g_assert( bufp && pin );
+    se_snapshot_domain *domain = bufp->snapshots;
+    pin->domain = domain;
+    pin->slot = -1;
+    if ( !domain )
+        return NULL;
+
+    for ( int i = 0; i < SE_MAX_SNAPSHOT_READERS; ++i ) {
+        if ( g_atomic_int_compare_and_exchange(&domain->readers[i], 0, -1) ) {
+            pin->slot = i;
+            break;
+        }
+    }
+
+    if ( pin->slot < 0 ) {
+        se_warn( "too many snapshot readers" );
+        return NULL;
+    }
+
+    // announce before loading current, so writer won't free what we'll load
+    int epoch = g_atomic_int_get( &domain->epoch );
+    g_atomic_int_set( &domain->readers[pin->slot], epoch );
+    return g_atomic_pointer_get( &domain->current );
+}
+
+void se_snapshot_release( se_snapshot_pin* pin )
+{
+    g_assert( pin );
+    if ( !pin->domain || pin->slot < 0 )
+        return;
+
+    g_atomic_int_set( &pin->domain->readers[pin->slot], 0 );
+    pin->slot = -1;
+}
+
+se_off_t se_snapshot_find_line( se_snapshot* snap, se_off_t offset )
+{
+    g_assert( snap );
+    if ( snap->nrLines == 0 )
+        return -1;
+
+    se_off_t lo = 0, hi = snap->nrLines - 1;
+    while ( lo < hi ) {
+        se_off_t mid = lo + (hi - lo + 1) / 2;
+        if ( snap->offsets[mid] <= offset )
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return lo;
+}
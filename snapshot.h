@@ -0,0 +1,117 @@
+
+/**
+ * Buffer Snapshots - 
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * the editing (UI) thread publishes immutable versions of a buffer, and any
+ * other thread pins the latest one and traverses it without locking while the
+ * buffer keeps changing.
+ *
+ * a replaced version is retired with the epoch of its replacement, and is
+ * reclaimed by the editing thread once every reader pinned in an earlier epoch
+ * has gone. the editing thread never waits for readers.
+ */
+
+#ifndef _semacs_snapshot_h
+#define _semacs_snapshot_h
+
+#include "util.h"
+#include "buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// most readers that can pin versions of one buffer at the same time
+#define SE_MAX_SNAPSHOT_READERS  64
+
+DEF_CLS(se_snapshot);
+struct se_snapshot
+{
+    se_snapshot *retireNext;
+    int retireEpoch;
+
+    int version;         // se_buffer.version this is taken from
+    se_off_t charCount;
+    se_off_t nrLines;    // number of chunks
+    se_off_t *offsets;   // buffer offset of first char of each line
+    se_chunk **chunks;
+};
+
+DEF_CLS(se_snapshot_domain);
+struct se_snapshot_domain
+{
+    se_snapshot *current; // latest published version
+    int epoch;            // starts from 1, bumped by every publish
+    /**
+     * epoch in which a reader pinned, 0 if the slot is free and -1 if it is
+     * claimed but not pinned yet
+     */
+    int readers[SE_MAX_SNAPSHOT_READERS];
+    se_snapshot *retired; // only accessed by the editing thread
+};
+
+DEF_CLS(se_snapshot_pin);
+struct se_snapshot_pin
+{
+    se_snapshot_domain *domain;
+    int slot;
+};
+
+/**
+ * editing thread only: publish current content of buffer if it has changed
+ * since last time, and reclaim retired versions no one can see any more.
+ * versions are published on demand, right before a reader is handed one
+ */
+extern se_snapshot* se_snapshot_publish( se_buffer* );
+extern void se_snapshot_reclaim( se_buffer* );
+/**
+ * editing thread only: once no reader is pinned, retire the latest version
+ * too, so chunks of a buffer nothing reads are not held, and reclaim. cheap
+ * enough to be called after every command
+ */
+extern void se_snapshot_drop_unused( se_buffer* );
+
+/**
+ * any thread: pin the latest published version, return NULL if the buffer has
+ * not been published since it was last unused or too many readers are active.
+ * the version stays valid until released.
+ */
+extern se_snapshot* se_snapshot_acquire( se_buffer*, se_snapshot_pin* );
+extern void se_snapshot_release( se_snapshot_pin* );
+
+// index of line which contains offset
+extern se_off_t se_snapshot_find_line( se_snapshot*, se_off_t offset );
+
+static inline const char* se_snapshot_line_data( se_snapshot* snap, se_off_t line )
+{
+    return snap->chunks[line]->data;
+}
+
+static inline se_off_t se_snapshot_line_length( se_snapshot* snap, se_off_t line )
+{
+    return snap->chunks[line]->used;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
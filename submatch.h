@@ -49,8 +49,50 @@ typedef struct kmp_next_s
 extern kmp_entry* kmp_init( const char * pat );
 extern void kmp_free( kmp_entry* kmp );
 extern int kmp_match( kmp_entry* kmp, const char* str );
+/**
+ * streaming match: str may be fed piece by piece, *state (0 at start) carries
+ * how many chars of pattern are matched so far. returns the offset in str
+ * just past the first match ended in it, or -1 if none. feed the rest of str
+ * with the same state to look for next match.
+ */
+extern long long kmp_feed( kmp_entry* kmp, int* state, const char* str, long long len );
 extern void kmp_verify( kmp_entry* kmp, const char* origin, int match_idx );
 
+/**
+ * literal substring search for large texts. strategy is picked by pattern
+ * length and cpu: memchr for a single byte, a first/last byte filter (with
+ * SSE2/AVX2 if possible), and Horspool for long patterns when the filter
+ * can't be vectorized wide enough.
+ * KMP above stays as the reference implementation.
+ */
+typedef enum {
+    SUBSTR_AUTO = 0,
+    SUBSTR_MEMCHR,    // single byte pattern
+    SUBSTR_SCALAR,    // memchr for first byte, then check last byte
+    SUBSTR_SSE2,      // first and last byte filter, 16 positions a time
+    SUBSTR_AVX2,      // first and last byte filter, 32 positions a time
+    SUBSTR_HORSPOOL,  // bad char skipping for long patterns
+} substr_strategy;
+
+typedef struct substr_entry_s
+{
+    int len;
+    char *pat;
+    substr_strategy strategy;  // never SUBSTR_AUTO
+    int shift[256];            // Horspool's bad char shifts
+} substr_entry;
+
+// pat may contain any byte including '\0', hence len
+extern substr_entry* substr_init( const char* pat, int len );
+// strategies this cpu can not run fall back to slower ones
+extern substr_entry* substr_init_with_strategy( const char* pat, int len,
+                                                substr_strategy strategy );
+extern void substr_free( substr_entry* substr );
+/**
+ * return 0-based offset of first occurrence of pattern in str, or -1 if none.
+ * str need not be NUL-terminated.
+ */
+extern long long substr_search( substr_entry* substr, const char* str, long long len );
 
 /**
  * Aho Corasick Algo structs
@@ -62,14 +104,13 @@ typedef struct trie_node_struct
     int expect;  // char that makes state go here
     int state;
     int accept;  // bool value - true if a keyword is met
+    int keyword; // id (order of adding) of keyword ending here, -1 if none
     
     struct trie_node_struct* parent;
     struct trie_node_struct** trans;
     int trans_size;
 } trie_node;
 
-#define MAX_KEYWORDS 16
-
 /**
  * trie struct
  */
@@ -77,10 +118,12 @@ typedef struct trie_struct
 {
     int nr_states;
     trie_node** node_list; // this used to locate node by state efficiently
+    int node_list_size;
     int* node_failure_func;
     
-    char* keywords[MAX_KEYWORDS];
+    char** keywords;
     int nr_keywords;
+    int keywords_size;
 
     /**
      * root node of trie tree
@@ -103,12 +146,164 @@ DEF_CLS(trie_match_result);
 struct trie_match_result
 {
     const char* keyword;  // do not free, internal reference of kw
-    int position;
+    int position;         // where keyword starts
 };
 
 extern int trie_match_ex(trie_t* trie, const char* str,
                          int nmatch, trie_match_result results[]);
 
+/**
+ * trie compiled into a dense DFA: every state has a row of next states, one
+ * per byte class, with failure transitions already folded in, so matching
+ * takes one table lookup per byte and never follows failure links.
+ */
+typedef struct trie_dfa_struct
+{
+    int nr_states;
+    int nr_classes;
+    unsigned short classes[256]; // byte -> class, 0 for bytes in no keyword
+    /**
+     * next state by [state + class]. a state is the offset of its row, and
+     * states which report keywords come first, so a single compare
+     * (state < report_limit) tells if there is anything to report.
+     */
+    int* delta;
+    int start;
+    int report_limit;
+
+    // below are indexed by state / nr_classes
+    int* keyword_ids;  // keyword ending here, or -1
+    int* report_links; // next state on failure chain reporting a keyword, or -1
+    int* nr_reports;   // number of keywords ending here, suffixes included
+
+    int* keyword_lens;
+    int nr_keywords;
+    int max_len;
+} trie_dfa;
+
+/**
+ * trie only needs keywords added, compiling computes failure transitions
+ * itself, so trie_init() + trie_add_keyword() is enough.
+ */
+extern trie_dfa* trie_dfa_compile( trie_t* trie );
+extern void trie_dfa_free( trie_dfa* dfa );
+// number of occurrences of all keywords in str, overlapped ones included
+extern long long trie_dfa_match( trie_dfa* dfa, const char* str, long long len );
+
+typedef struct trie_match_hit_s
+{
+    int keyword;   // id, i.e. order keyword is added in
+    int len;
+    long long end; // offset just past the last char of match
+} trie_match_hit;
+
+/**
+ * matching position of trie_dfa_match_ex, text may come in pieces and matches
+ * are reported in offsets of the whole text.
+ */
+typedef struct trie_dfa_cursor_s
+{
+    const char* str;    // piece being matched
+    long long len;
+    long long pos;      // next byte in str to match
+    long long offset;   // offset of str in whole text
+    int state;
+    int pending;        // state whose keywords are not all reported, or -1
+} trie_dfa_cursor;
+
+extern void trie_dfa_cursor_init( trie_dfa* dfa, trie_dfa_cursor* cur );
+// go on with next piece, previous one should have been matched through
+extern void trie_dfa_cursor_feed( trie_dfa_cursor* cur, const char* str, long long len );
+/**
+ * report matches into hits without any allocation, and return the number of
+ * them. it stops once hits is full, and goes on from there when called again,
+ * so the piece is done only when it returns less than nhits.
+ */
+extern int trie_dfa_match_ex( trie_dfa* dfa, trie_dfa_cursor* cur,
+                              trie_match_hit hits[], int nhits );
+
+/**
+ * regular expressions, matched by DFAs whose states are only built when
+ * scanning first needs them and are kept in a bounded cache. matching time
+ * is linear in the text whatever the pattern is, and text can be fed in
+ * pieces in either direction, so a buffer is scanned chunk by chunk.
+ *
+ * syntax is Emacs': . [...] [^...] [:class:] ^ $ * + ? *? +? ?? \{m,n\}
+ * \| \( \) \(?: \) \w \W \s- \S- and \ quoting. back references and word
+ * boundaries can't be done by a DFA and are rejected. like a backtracking
+ * matcher, the leftmost match is taken, and among those starting there the
+ * one with the highest priority (greedy or not, first alternative first).
+ */
+typedef struct regexp_prog_s regexp_prog;
+typedef struct regexp_dfa_s regexp_dfa;
+
+typedef struct regexp_entry_s
+{
+    char *pat;
+    guint32 (*sets)[8];           // byte sets, one bit per byte
+    int nr_sets;
+    unsigned char classes[256];   // byte -> class, bytes in one class match alike
+    unsigned char class_rep[256]; // a byte of each class
+    int nr_classes;
+    substr_entry *prefix;         // literal every match starts with, or NULL
+
+    regexp_prog *prog;            // forward program
+    regexp_prog *rprog;           // program of the reversed pattern
+
+    regexp_dfa *forward;   // unanchored, finds where leftmost match ends
+    regexp_dfa *reverse;   // anchored at that end, finds where it starts
+    regexp_dfa *backward;  // reversed unanchored, finds last start before a limit
+    regexp_dfa *anchored;  // anchored at that start, finds where it ends
+} regexp_entry;
+
+// return NULL and set *error to a static message if pat is not valid
+extern regexp_entry* regexp_compile( const char* pat, const char** error );
+extern void regexp_free( regexp_entry* re );
+// memory each DFA may take for its states before its cache is flushed
+extern void regexp_set_cache_size( regexp_entry* re, size_t size );
+
+// if some match of re may contain byte c
+extern int regexp_matches_byte( regexp_entry* re, int c );
+// pattern matching str literally, g_free() it
+extern char* regexp_quote( const char* str );
+
+/**
+ * return start of first match beginning at or after from, and its end in
+ * *end, or -1 if none.
+ */
+extern long long regexp_search( regexp_entry* re, const char* str, long long len,
+                                long long from, long long* end );
+/**
+ * return start of the match which starts last and does not end after limit,
+ * or -1 if none. text after limit is only looked at by $.
+ */
+extern long long regexp_search_backward( regexp_entry* re, const char* str, long long len,
+                                         long long limit, long long* end );
+
+/**
+ * a scan runs one of the DFAs of an entry over text fed piece by piece, in
+ * the direction of the DFA: reverse ones take each piece from its last byte
+ * to its first. only one scan may run on a DFA at a time.
+ */
+typedef struct regexp_scan_s
+{
+    regexp_dfa *dfa;
+    int state;
+    long long offset; // text offset where next piece begins (ends if reverse)
+    long long match;  // where last match found ends (starts if reverse), or -1
+    int done;         // nothing more can be found
+} regexp_scan;
+
+/**
+ * prev is the byte just before offset in scanning direction, and -1 if
+ * offset is at the edge of text.
+ */
+extern void regexp_scan_init( regexp_scan* scan, regexp_dfa* dfa,
+                              long long offset, int prev );
+// return TRUE once scanning is done, later pieces are ignored
+extern int regexp_scan_feed( regexp_scan* scan, const char* str, long long len );
+// end scanning, next is the byte past the last piece or -1 at edge of text
+extern void regexp_scan_finish( regexp_scan* scan, int next );
 
 #ifdef __cplusplus
 }
@@ -4,6 +4,18 @@
 #include "key.h"
 #include "cmd.h"
 #include "modemap.h"
+#include "snapshot.h"
+#include "cmdreg.h"
+#include "search.h"
+#include "psearch.h"
+#include "occur.h"
+#include "highlight.h"
+#include "tindex.h"
+#include "fuzzy.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void test_glib_funcs()
 {
@@ -26,6 +38,16 @@ void test_key_constructors()
         
     key = se_key_from_string( "T" );
     g_assert( strcmp("T", se_key_to_string(key)) == 0 );
+
+    // keys of events, modifiers pressed alone make none
+    g_assert( se_key_is_equal(se_key_from_event(XK_x, ControlMask | Mod1Mask),
+                              se_key_from_string("C-M-x")) );
+    g_assert( se_key_is_equal(se_key_from_event(XK_X, ShiftMask), se_key_from_string("X")) );
+    g_assert( se_key_is_equal(se_key_from_event(XK_Return, 0), se_key_from_string("Return")) );
+    g_assert( se_key_is_null(se_key_from_event(XK_Control_L, ControlMask)) );
+    g_assert( se_key_is_null(se_key_from_event(XK_Caps_Lock, 0)) );
+    g_assert( se_key_is_null(se_key_from_event(XK_ISO_Level3_Shift, 0)) );
+    g_assert( se_key_is_null(se_key_from_event(NoSymbol, 0)) );
     
     se_key_seq keyseq = se_key_seq_from_string( "C-M-a" );
     g_assert( strcmp( "C-M-a", se_key_seq_to_string(keyseq)) == 0
@@ -64,6 +86,54 @@ void test_key_constructors()
     g_assert( strcmp(se_key_to_string(se_key_from_string("C-M--")), "C-M--") == 0 );    
 }
 
+// keys of events looked up in a table of keysyms, as server would give it
+void test_keyboard_map()
+{
+    const KeySym keysyms[] = {
+        XK_a, XK_A,             // 8
+        XK_1, XK_exclam,        // 9
+        XK_Return, NoSymbol,    // 10
+        XK_b, NoSymbol,         // 11, letter alone stands for both cases
+        0x10020ac, NoSymbol,    // 12, U+20AC EURO SIGN
+    };
+    se_keyboard_map *map = se_keyboard_map_new( NULL );
+    g_assert( se_keyboard_map_lookup(map, 8, 0) == NoSymbol );
+    se_keyboard_map_load( map, 8, ARRAY_LEN(keysyms) / 2, 2, keysyms );
+
+    g_assert( se_keyboard_map_lookup(map, 8, 0) == XK_a );
+    g_assert( se_keyboard_map_lookup(map, 8, 1) == XK_A );
+    g_assert( se_keyboard_map_lookup(map, 9, 1) == XK_exclam );
+    g_assert( se_keyboard_map_lookup(map, 10, 1) == XK_Return );
+    g_assert( se_keyboard_map_lookup(map, 11, 1) == XK_B );
+    g_assert( se_keyboard_map_lookup(map, 7, 0) == NoSymbol );
+    g_assert( se_keyboard_map_lookup(map, 13, 0) == NoSymbol );
+
+    XKeyEvent kev = { 0 };
+    kev.type = KeyPress;
+    kev.keycode = 8;
+    kev.state = ControlMask;
+    g_assert( se_key_is_equal(se_keyboard_map_key(map, &kev), se_key_from_string("C-a")) );
+    kev.state = LockMask;
+    g_assert( se_key_is_equal(se_keyboard_map_key(map, &kev), se_key_from_string("A")) );
+
+    // keysyms above 0xffff are kept whole, and bound like any other key
+    kev.keycode = 12;
+    kev.state = 0;
+    se_key key = se_keyboard_map_key( map, &kev );
+    g_assert( key.ascii == 0x10020ac );
+    g_assert( se_key_is_equal(key, se_key_from_string("U20AC")) );
+    g_assert( se_key_is_equal(key, int_to_se_key(se_key_to_int(key))) );
+    g_assert( se_key_to_int(key) == 0x10020ac0000ULL );
+
+    se_modemap *modemap = se_modemap_full_create( "unicodeMap" );
+    se_modemap_insert_keybinding_str( modemap, "U20AC", se_self_silent_command );
+    g_assert( se_keymap_lookup(se_modemap_compile(modemap), key)->cmd == se_self_silent_command );
+    key.ascii = 0x20ac;
+    g_assert( se_keymap_lookup(se_modemap_compile(modemap), key) == NULL );
+    se_modemap_free( modemap );
+    se_keyboard_map_free( map );
+}
+
 void test_keyseq_constructors()
 {
 
@@ -223,18 +293,1885 @@ void test_modemap4()
     se_modemap_free( map );
 }
 
+// compiled keymap finds what walking the tree does, as bindings change
+void test_modemap_compiled()
+{
+    se_modemap *map = se_modemap_full_create( "testMap" );
+    const char *keys[] = {
+        "a", "x", "~", "C-x", "C-c", "M-s", "C-M-s", "Return", "BackSpace", "Tab",
+        "C-a", "M-%", "Home", "F1",
+    };
+    const se_key_command_t cmds[] = {
+        se_self_silent_command, se_self_insert_command, se_undo_command,
+    };
+    GRand *rand = g_rand_new_with_seed( 39 );
+    for (int round = 0; round < 200; ++round) {
+        char rep[64] = "";
+        int len = g_rand_int_range( rand, 1, 4 );
+        for (int i = 0; i < len; ++i) {
+            strcat( rep, i ? " ": "" );
+            strcat( rep, keys[g_rand_int_range(rand, 0, ARRAY_LEN(keys))] );
+        }
+        se_modemap_insert_keybinding_str( map, rep, cmds[g_rand_int_range(rand, 0, 3)] );
+        g_assert( map->compiled == NULL );
+        
+        for (int q = 0; q < 50; ++q) {
+            se_key_seq keyseq = se_key_seq_null_init();
+            int qlen = g_rand_int_range( rand, 1, 4 );
+            for (int i = 0; i < qlen; ++i)
+                keyseq.keys[keyseq.len++] =
+                    se_key_from_string( keys[g_rand_int_range(rand, 0, ARRAY_LEN(keys))] );
+            g_assert( se_modemap_lookup_command_ex(map, keyseq)
+                      == se_modemap_lookup_command_tree(map, keyseq) );
+        }
+    }
+    g_rand_free( rand );
+
+    // plain printable keys never go to the table
+    se_keymap *keymap = se_modemap_compile( map );
+    for (int i = 0; i < keymap->nr_slots; ++i) {
+        se_key key = int_to_se_key( keymap->slots[i].key );
+        g_assert( !(keymap->slots[i].cmd || keymap->slots[i].next)
+                  || key.modifiers || key.ascii >= SE_KEYMAP_NR_DIRECT );
+    }
+    se_modemap_free( map );
+}
+
+// default keymaps come compiled in, and are only put in tree when needed
+void test_modemap_builtin()
+{
+    se_modemap *map = se_modemap_full_create( "testMap" );
+    g_assert( map->compiled == &se_fundamental_keymap );
+    g_assert( g_node_n_children(map->root) == 0 );
+    g_assert( se_modemap_lookup_command_ex(map, se_key_seq_from_string("C-x C-c"))
+              == se_editor_quit_command );
+    g_assert( g_node_n_children(map->root) == 0 );
+
+    // laid out as compiling at runtime would do: what tree says is found
+    const char *reps[] = {
+        "a", "~", " ", "C-x C-c", "C-x b", "C-x u", "C-x", "M-s p", "M-s", "C-M-r",
+        "Home", "End", "Return", "BackSpace", "C--", "C-=", "C-f", "M-%", "C-c", "M-s x",
+    };
+    for (int i = 0; i < ARRAY_LEN(reps); ++i) {
+        se_key_seq keyseq = se_key_seq_from_string( reps[i] );
+        se_key_command_t cmd = se_modemap_lookup_command_ex( map, keyseq );
+        g_assert( cmd == se_modemap_lookup_command_tree(map, keyseq) );
+        g_assert( (cmd != NULL) == (i < 18) );
+    }
+    g_assert( map->compiled == &se_fundamental_keymap );
+    g_assert( g_node_n_children(map->root) > 0x7e - 0x20 );
+
+    // rebinding compiles tree, which has all bindings builtin
+    se_modemap_insert_keybinding_str( map, "C-x C-c", se_self_silent_command );
+    g_assert( map->compiled == NULL );
+    g_assert( se_modemap_lookup_keybinding(map, se_key_seq_from_string("C-x C-c"))
+              == se_self_silent_command );
+    g_assert( map->compiled && map->compiled != &se_fundamental_keymap );
+    g_assert( se_modemap_lookup_keybinding(map, se_key_seq_from_string("M-s o"))
+              == se_occur_command );
+    g_assert( se_modemap_lookup_command(map, se_key_from_string("z")) == se_self_insert_command );
+    se_modemap_free( map );
+
+    // a keymap may start from another one
+    map = se_modemap_builtin_create( "testOccurMap", &se_occur_keymap );
+    g_assert( se_modemap_lookup_command(map, se_key_from_string("Return")) == se_occur_goto_command );
+    g_assert( se_modemap_lookup_command(map, se_key_from_string("q")) == se_self_insert_command );
+    g_assert( se_modemap_keybinding_exists_str(map, "C-x b") );
+    se_modemap_free( map );
+}
+
+static int test_nr_prefix_runs = 0;
+static DEFINE_CMD(test_prefix_command)
+{
+    ++test_nr_prefix_runs;
+    return TRUE;
+}
+
+// longer than a se_key_seq holds
+static const char test_long_binding[] = "C-c a b c d e f g h i j k l";
+
+static se_modemap* test_init_prefixModeMap()
+{
+    se_modemap *map = se_modemap_full_create( "prefix-test-map" );
+    se_modemap_insert_keybinding_str( map, test_long_binding, test_prefix_command );
+    se_modemap_insert_keybinding_str( map, "C-c a x", test_prefix_command );
+    return map;
+}
+
+// each key of a prefix steps from where the previous one leads
+void test_modemap_prefix_dispatch()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->registerMode( world, se_mode_create("prefix-test-mode", test_init_prefixModeMap) );
+    world->current->setMajorMode( world->current, "prefix-test-mode" );
+    se_modemap *map = world->current->majorMode->modemap;
+
+    se_command_args args = se_command_args_init();
+    gchar **reps = g_strsplit( test_long_binding, " ", -1 );
+    int nr_keys = g_strv_length( reps );
+    g_assert_cmpint( nr_keys, >, SE_MAX_KEY_SEQ_LEN );
+    for (int round = 0; round < 2; ++round) {
+        for (int i = 0; i < nr_keys; ++i) {
+            int ret = world->dispatchCommand( world, &args, se_key_from_string(reps[i]) );
+            g_assert( ret == (i+1 == nr_keys) );
+            g_assert( (args.keymap != NULL) == (i+1 < nr_keys) );
+        }
+        g_assert_cmpint( test_nr_prefix_runs, ==, round + 1 );
+        se_command_args_clear( &args );
+    }
+    g_assert_cmpstr( args.prefixKeys->str, ==, "" );
+
+    // an unbound key ends the prefix
+    world->dispatchCommand( world, &args, se_key_from_string("C-c") );
+    world->dispatchCommand( world, &args, se_key_from_string("a") );
+    g_assert_cmpstr( args.prefixKeys->str, ==, "C-c a" );
+    char *echo = se_command_args_echo( &args );
+    g_assert_cmpstr( echo, ==, "C-c a" );
+    g_free( echo );
+    g_assert( world->dispatchCommand(world, &args, se_key_from_string("y")) );
+    g_assert( !args.keymap && !args.prefixKeys->len );
+    se_command_args_clear( &args );
+    g_assert( !se_command_args_echo(&args) );
+    args.flags |= SE_UNIVERSAL_ARG;
+    g_string_assign( args.universalArg, "12" );
+    echo = se_command_args_echo( &args );
+    g_assert_cmpstr( echo, ==, "C-u 12" );
+    g_free( echo );
+    se_command_args_clear( &args );
+
+    // a complete command leaves no echo pending, whether keys were echoed
+    int ret = world->dispatchCommand( world, &args, se_key_from_string("z") );
+    g_assert_cmpint( se_command_echo_after(ret, FALSE), ==, SE_ECHO_NONE );
+    ret = world->dispatchCommand( world, &args, se_key_from_string("C-c") );
+    g_assert_cmpint( se_command_echo_after(ret, FALSE), ==, SE_ECHO_LATER );
+    ret = world->dispatchCommand( world, &args, se_key_from_string("a") );
+    g_assert_cmpint( se_command_echo_after(ret, TRUE), ==, SE_ECHO_NOW );
+    ret = world->dispatchCommand( world, &args, se_key_from_string("y") );
+    g_assert_cmpint( se_command_echo_after(ret, TRUE), ==, SE_ECHO_NONE );
+    se_command_args_clear( &args );
+
+    // bindings changed while typing a prefix, keys start over from top
+    world->dispatchCommand( world, &args, se_key_from_string("C-c") );
+    world->dispatchCommand( world, &args, se_key_from_string("a") );
+    se_modemap_insert_keybinding_str( map, "x", test_prefix_command );
+    g_assert( world->dispatchCommand(world, &args, se_key_from_string("x")) );
+    g_assert_cmpint( test_nr_prefix_runs, ==, 3 );
+    se_command_args_clear( &args );
+    world->dispatchCommand( world, &args, se_key_from_string("C-c") );
+    world->dispatchCommand( world, &args, se_key_from_string("a") );
+    g_assert( world->dispatchCommand(world, &args, se_key_from_string("x")) );
+    g_assert_cmpint( test_nr_prefix_runs, ==, 4 );
+    
+    g_strfreev( reps );
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+static int test_nr_minor_runs = 0;
+static DEFINE_CMD(test_minor_command)
+{
+    ++test_nr_minor_runs;
+    return TRUE;
+}
+
+static se_modemap* test_init_minorAMap()
+{
+    se_modemap *map = se_modemap_full_create( "minor-a-map" );
+    se_modemap_insert_keybinding_str( map, "C-c a", test_prefix_command );
+    se_modemap_insert_keybinding_str( map, "C-x z", test_prefix_command );
+    se_modemap_insert_keybinding_str( map, "C-f", test_prefix_command );
+    return map;
+}
+
+static se_modemap* test_init_minorBMap()
+{
+    se_modemap *map = se_modemap_full_create( "minor-b-map" );
+    se_modemap_insert_keybinding_str( map, "C-c a", test_minor_command );
+    se_modemap_insert_keybinding_str( map, "C-c b", test_minor_command );
+    // a command shadows prefix of maps after
+    se_modemap_insert_keybinding_str( map, "C-x", test_minor_command );
+    return map;
+}
+
+// what keys of rep mean in keymap, as se_modemap_lookup_command_ex() tells
+static se_key_command_t test_keymap_command( se_keymap* keymap, const char* rep )
+{
+    se_key_seq keyseq = se_key_seq_from_string( rep );
+    se_keymap_entry *entry = NULL;
+    for (int i = 0; i < keyseq.len; ++i) {
+        if ( !keymap || !(entry = se_keymap_lookup(keymap, keyseq.keys[i])) )
+            return NULL;
+        keymap = entry->next;
+    }
+    return entry->next ? se_second_dispatch_command: entry->cmd;
+}
+
+// keymaps of minor modes and major mode merge into one, by priority
+void test_modemap_minor_modes()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->registerMode( world, se_mode_create("minor-a", test_init_minorAMap) );
+    world->registerMode( world, se_mode_create("minor-b", test_init_minorBMap) );
+    se_buffer *bufp = world->current;
+    
+    // a buffer of major mode only shares its compiled keymap
+    se_keymap *keymap = bufp->getKeymap( bufp );
+    g_assert( keymap == se_modemap_compile(bufp->majorMode->modemap) );
+    g_assert( !bufp->appendMode(bufp, "no-such-mode", NULL, FALSE) );
+
+    g_assert( bufp->appendMode(bufp, "minor-a", NULL, FALSE) );
+    keymap = bufp->getKeymap( bufp );
+    unsigned int generation = bufp->keymaps.generation;
+    g_assert( test_keymap_command(keymap, "C-c a") == test_prefix_command );
+    g_assert( test_keymap_command(keymap, "C-f") == test_prefix_command );
+    // keys after a prefix merge from all maps
+    g_assert( test_keymap_command(keymap, "C-x z") == test_prefix_command );
+    g_assert( test_keymap_command(keymap, "C-x b") == se_switch_buffer_command );
+    g_assert( test_keymap_command(keymap, "C-x C-c") == se_editor_quit_command );
+    g_assert( test_keymap_command(keymap, "a") == se_self_insert_command );
+    // nothing changed, nothing built
+    g_assert( bufp->getKeymap(bufp) == keymap && bufp->keymaps.generation == generation );
+
+    g_assert( bufp->appendMode(bufp, "minor-b", NULL, TRUE) );
+    keymap = bufp->getKeymap( bufp );
+    g_assert( bufp->keymaps.generation != generation );
+    g_assert( test_keymap_command(keymap, "C-c a") == test_minor_command );
+    g_assert( test_keymap_command(keymap, "C-c b") == test_minor_command );
+    g_assert( test_keymap_command(keymap, "C-x") == test_minor_command );
+    g_assert( test_keymap_command(keymap, "C-x z") == NULL );
+
+    se_command_args args = se_command_args_init();
+    world->dispatchCommand( world, &args, se_key_from_string("C-c") );
+    g_assert( world->dispatchCommand(world, &args, se_key_from_string("a")) );
+    g_assert_cmpint( test_nr_minor_runs, ==, 1 );
+    se_command_args_clear( &args );
+    
+    // binding in a map of a mode takes effect in merged keymap
+    generation = bufp->keymaps.generation;
+    se_mode *modep = bufp->modes;
+    g_assert_cmpstr( modep->modeName, ==, "minor-b" );
+    se_modemap_insert_keybinding_str( modep->modemap, "C-c c", test_minor_command );
+    keymap = bufp->getKeymap( bufp );
+    g_assert( bufp->keymaps.generation != generation );
+    g_assert( test_keymap_command(keymap, "C-c c") == test_minor_command );
+
+    g_assert( bufp->deleteMode(bufp, "minor-b") );
+    g_assert( !bufp->deleteMode(bufp, "minor-b") );
+    keymap = bufp->getKeymap( bufp );
+    g_assert( test_keymap_command(keymap, "C-c a") == test_prefix_command );
+    g_assert( test_keymap_command(keymap, "C-x z") == test_prefix_command );
+    world->dispatchCommand( world, &args, se_key_from_string("C-x") );
+    g_assert( world->dispatchCommand(world, &args, se_key_from_string("z")) );
+    g_assert_cmpint( test_nr_prefix_runs, ==, 5 );
+    
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+static char* test_create_tmp_file( const char* content, gsize len )
+{
+    char *file_name = g_build_filename( g_get_tmp_dir(), "semacs-test-XXXXXX", NULL );
+    int fd = g_mkstemp( file_name );
+    g_assert( fd >= 0 );
+    g_assert( write(fd, content, len) == len );
+    close( fd );
+    return file_name;
+}
+
+void test_buffer_read_file()
+{
+    // the last line has no trailing '\n', and '\0' is a plain char
+    const char content[] = "line1\nline two\na\0b\nlast";
+    char *file_name = test_create_tmp_file( content, sizeof content - 1 );
+    
+    se_buffer *bufp = se_buffer_create( NULL, "readfile" );
+    bufp->setFileName( bufp, file_name );
+    g_assert( bufp->readFile(bufp) );
+    unlink( file_name );
+    g_free( file_name );
+
+    g_assert( bufp->getCharCount(bufp) == sizeof content - 1 );
+    g_assert( bufp->getLineCount(bufp) == 4 );
+    g_assert( bufp->getLine(bufp) == 3 );
+    g_assert( bufp->getCurrentColumn(bufp) == 4 );
+
+    bufp->forwardLine( bufp, -2 );
+    g_assert( bufp->getLine(bufp) == 1 );
+    g_assert( bufp->getCurrentColumn(bufp) == 4 );
+
+    bufp->setPoint( bufp, 15 );
+    g_assert( bufp->getLine(bufp) == 2 );
+    g_assert( bufp->getCurrentColumn(bufp) == 0 );
+    bufp->endOfLine( bufp );
+    g_assert( bufp->getCurrentColumn(bufp) == 3 );
+}
+
+// a file failing to read leaves buffer as it was
+void test_buffer_read_file_error()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    const char *names[] = { g_get_tmp_dir(), "/proc/self/mem" };
+    for (int i = 0; i < ARRAY_LEN(names); ++i) {
+        se_buffer *bufp = se_buffer_create( NULL, "readerror" );
+        bufp->insertString( bufp, "kept\nas is" );
+        int version = bufp->version;
+        
+        bufp->setFileName( bufp, names[i] );
+        g_assert( !bufp->readFile(bufp) );
+        g_assert( bufp->version == version );
+        g_assert( bufp->getCharCount(bufp) == 10 );
+        g_assert( bufp->getLineCount(bufp) == 2 );
+        g_assert( bufp->lines->previous == bufp->lines->next );
+        g_assert( strncmp(se_line_getData(bufp->lines), "kept\n", 5) == 0 );
+    }
+    g_log_set_always_fatal( fatal );
+}
+
+void test_buffer_huge_file()
+{
+    if ( !g_test_slow() ) {
+        g_test_skip( "needs a 5G sparse file, run with -m slow" );
+        return;
+    }
+    
+    const se_off_t giga = (se_off_t)1 << 30;
+    const int nr_lines = 5;
+
+    // every line is 1G long and nl-ended, holes are read back as '\0'
+    char *file_name = g_build_filename( g_get_tmp_dir(), "semacs-huge-XXXXXX", NULL );
+    int fd = g_mkstemp( file_name );
+    g_assert( fd >= 0 );
+    g_assert( ftruncate(fd, giga * nr_lines) == 0 );
+    for (int i = 1; i <= nr_lines; ++i) {
+        g_assert( pwrite(fd, "\n", 1, giga * i - 1) == 1 );
+    }
+    close( fd );
+
+    se_buffer *bufp = se_buffer_create( NULL, "huge" );
+    bufp->setFileName( bufp, file_name );
+    g_assert( bufp->readFile(bufp) );
+    unlink( file_name );
+    g_free( file_name );
+
+    g_assert( bufp->getCharCount(bufp) == giga * nr_lines );
+    g_assert( bufp->getLineCount(bufp) == nr_lines );
+    g_assert( bufp->getPoint(bufp) == giga * nr_lines );
+
+    // navigation
+    bufp->setPoint( bufp, 3*giga + 10 );
+    g_assert( bufp->getLine(bufp) == 3 );
+    g_assert( bufp->getCurrentColumn(bufp) == 10 );
+    bufp->endOfLine( bufp );
+    g_assert( bufp->getPoint(bufp) == 4*giga - 1 );
+    bufp->beginingOfLine( bufp );
+    g_assert( bufp->getPoint(bufp) == 3*giga );
+    bufp->forwardLine( bufp, -1 );
+    g_assert( bufp->getPoint(bufp) == 2*giga );
+    bufp->forwardChar( bufp, giga + 1 );
+    g_assert( bufp->getLine(bufp) == 3 );
+    g_assert( bufp->getCurrentColumn(bufp) == 1 );
+
+    // edits
+    bufp->insertChar( bufp, 'x' );
+    g_assert( bufp->getCharCount(bufp) == giga * nr_lines + 1 );
+    g_assert( bufp->getPoint(bufp) == 3*giga + 2 );
+    bufp->forwardChar( bufp, -1 );
+    bufp->deleteChars( bufp, 1 );
+    g_assert( bufp->getCharCount(bufp) == giga * nr_lines );
+    g_assert( bufp->getPoint(bufp) == 3*giga + 1 );
+}
+
+static char* test_snapshot_content( se_snapshot* snap )
+{
+    GString *str = g_string_new( "" );
+    for (se_off_t i = 0; i < snap->nrLines; ++i) {
+        g_string_append_len( str, se_snapshot_line_data(snap, i),
+                             se_snapshot_line_length(snap, i) );
+    }
+    return g_string_free( str, FALSE );
+}
+
+void test_snapshot_isolation()
+{
+    se_buffer *bufp = se_buffer_create( NULL, "snapshot" );
+    bufp->insertString( bufp, "hello\nworld\n" );
+
+    se_snapshot_pin pin;
+    g_assert( se_snapshot_acquire(bufp, &pin) == NULL );
+    g_assert( se_snapshot_publish(bufp) == se_snapshot_publish(bufp) );
+
+    se_snapshot *snap = se_snapshot_acquire( bufp, &pin );
+    g_assert( snap && snap->nrLines == 2 && snap->charCount == 12 );
+    g_assert( se_snapshot_find_line(snap, 0) == 0 );
+    g_assert( se_snapshot_find_line(snap, 5) == 0 );
+    g_assert( se_snapshot_find_line(snap, 6) == 1 );
+    g_assert( se_snapshot_find_line(snap, 11) == 1 );
+
+    // edits copy shared chunks instead of touching them
+    bufp->setPoint( bufp, 0 );
+    bufp->insertString( bufp, "oh, " );
+    bufp->forwardLine( bufp, 1 );
+    bufp->beginingOfLine( bufp );
+    bufp->deleteChars( bufp, 6 );
+    se_snapshot *snap2 = se_snapshot_publish( bufp );
+    g_assert( snap2 != snap && snap2->nrLines == 1 );
+
+    char *old_str = test_snapshot_content( snap );
+    char *new_str = test_snapshot_content( snap2 );
+    g_assert_cmpstr( old_str, ==, "hello\nworld\n" );
+    g_assert_cmpstr( new_str, ==, "oh, hello\n" );
+    g_free( old_str );
+    g_free( new_str );
+
+    // pinned version survives publishing, and is reclaimed after release
+    g_assert( bufp->snapshots->retired == snap );
+    se_snapshot_release( &pin );
+    se_snapshot_reclaim( bufp );
+    g_assert( bufp->snapshots->retired == NULL );
+}
+
+typedef struct test_snapshot_reader_s
+{
+    se_buffer *bufp;
+    int stop;
+    int nr_reads;
+} test_snapshot_reader;
+
+static gpointer test_snapshot_reader_func( gpointer data )
+{
+    test_snapshot_reader *reader = data;
+    while ( !g_atomic_int_get(&reader->stop) ) {
+        se_snapshot_pin pin;
+        se_snapshot *snap = se_snapshot_acquire( reader->bufp, &pin );
+        g_assert( snap );
+
+        se_off_t count = 0;
+        for (se_off_t i = 0; i < snap->nrLines; ++i) {
+            const char *data = se_snapshot_line_data( snap, i );
+            se_off_t len = se_snapshot_line_length( snap, i );
+            g_assert( snap->offsets[i] == count );
+            // only the last line may go without '\n', and no line holds more
+            g_assert( data[len-1] == '\n' || i == snap->nrLines-1 );
+            g_assert( memchr(data, '\n', len-1) == NULL );
+            count += len;
+        }
+        g_assert( count == snap->charCount );
+
+        se_snapshot_release( &pin );
+        g_atomic_int_inc( &reader->nr_reads );
+    }
+    return NULL;
+}
+
+void test_snapshot_concurrent_readers()
+{
+    const int nr_readers = 4;
+    se_buffer *bufp = se_buffer_create( NULL, "snapshot-mt" );
+    bufp->insertString( bufp, "start\n" );
+    se_snapshot_publish( bufp );
+
+    test_snapshot_reader reader = { bufp, 0, 0 };
+    GThread *threads[nr_readers];
+    for (int i = 0; i < nr_readers; ++i)
+        threads[i] = g_thread_new( "reader", test_snapshot_reader_func, &reader );
+
+    // writer never blocks on readers
+    for (int i = 0; i < 5000; ++i) {
+        if ( i % 7 == 0 )
+            bufp->insertChar( bufp, '\n' );
+        else
+            bufp->insertChar( bufp, 'a' + i % 26 );
+        if ( i % 3 == 0 ) {
+            bufp->setPoint( bufp, bufp->getPoint(bufp) / 2 );
+            bufp->deleteChars( bufp, 1 );
+            bufp->setPoint( bufp, bufp->getCharCount(bufp) );
+        }
+        se_snapshot_publish( bufp );
+    }
+
+    g_atomic_int_set( &reader.stop, 1 );
+    for (int i = 0; i < nr_readers; ++i)
+        g_thread_join( threads[i] );
+    g_assert( reader.nr_reads > 0 );
+
+    se_snapshot_reclaim( bufp );
+    g_assert( bufp->snapshots->retired == NULL );
+}
+
+void test_kmp_match()
+{
+    const char *pats[] = { "a", "ab", "aab", "abab", "ababaa", "xyxyyxyxyxx", "aaaa" };
+    GRand *rand = g_rand_new_with_seed( 28 );
+    char str[64];
+    for (int n = 0; n < 2000; ++n) {
+        int len = g_rand_int_range( rand, 1, sizeof str );
+        for (int i = 0; i < len; ++i) {
+            str[i] = g_rand_int_range( rand, 0, 3 ) ? 'a' + g_rand_int_range(rand, 0, 2)
+                : 'x' + g_rand_int_range(rand, 0, 2);
+        }
+        str[len] = 0;
+
+        for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+            kmp_entry *kmp = kmp_init( pats[p] );
+            const char *found = strstr( str, pats[p] );
+            g_assert_cmpint( kmp_match(kmp, str), ==, found ? found - str + 1 : -1 );
+
+            // feeding byte by byte finds the same matches, overlapped ones too
+            int state = 0;
+            const char *sp = str;
+            for (int i = 0; i < len; ++i) {
+                if ( kmp_feed(kmp, &state, str+i, 1) == 1 ) {
+                    found = strstr( sp, pats[p] );
+                    g_assert( found && found - str + kmp->len == i + 1 );
+                    sp = found + 1;
+                }
+            }
+            g_assert( strstr(sp, pats[p]) == NULL );
+            kmp_free( kmp );
+        }
+    }
+    g_rand_free( rand );
+}
+
+void test_search_across_lines()
+{
+    se_buffer *bufp = se_buffer_create( NULL, "search" );
+    bufp->insertString( bufp, "foo\nbar\nfoo\nbar baz\n" );
+
+    kmp_entry *kmp = kmp_init( "o\nbar" );
+    se_search_cursor cur;
+    se_off_t end = 0;
+    se_search_cursor_at( bufp, 0, &cur );
+    g_assert( se_search_forward(bufp, kmp, 0, &cur, &end) == 2 );
+    g_assert( end == 7 && cur.lineStart == 0 );
+
+    g_assert( se_search_forward(bufp, kmp, 3, &cur, &end) == 10 );
+    g_assert( end == 15 && cur.lineStart == 8 );
+    g_assert( se_search_forward(bufp, kmp, 11, &cur, &end) == -1 );
+    kmp_free( kmp );
+
+    kmp = kmp_init( "baz\n" );
+    se_search_cursor_at( bufp, 5, &cur );
+    g_assert( cur.lineStart == 4 );
+    g_assert( se_search_forward(bufp, kmp, 5, &cur, &end) == 16 );
+    g_assert( end == bufp->getCharCount(bufp) );
+    kmp_free( kmp );
+}
+
+void test_isearch()
+{
+    se_buffer *bufp = se_buffer_create( NULL, "isearch" );
+    bufp->insertString( bufp, "abc\nabd\nab\nd abd" );
+    bufp->setPoint( bufp, 1 );
+
+    se_isearch *isearch = se_isearch_create( bufp );
+    g_assert( se_isearch_add_char(isearch, 'a') );
+    g_assert( isearch->hit.start == 4 && bufp->getPoint(bufp) == 5 );
+    g_assert( se_isearch_add_char(isearch, 'b') );
+    g_assert( isearch->hit.start == 4 );
+    g_assert( se_isearch_add_char(isearch, 'd') );
+    g_assert( isearch->hit.start == 4 && bufp->getPoint(bufp) == 7 );
+
+    g_assert( se_isearch_repeat(isearch) );
+    g_assert( isearch->hit.start == 13 );
+    g_assert( !se_isearch_repeat(isearch) );
+    g_assert( bufp->getPoint(bufp) == 16 );
+
+    // wrapping around
+    g_assert( se_isearch_repeat(isearch) );
+    g_assert( isearch->hit.start == 4 );
+
+    // deleting undoes repeats first
+    g_assert( !se_isearch_delete_char(isearch) );
+    g_assert( se_isearch_delete_char(isearch) );
+    g_assert( isearch->hit.start == 13 );
+    g_assert( se_isearch_delete_char(isearch) );
+    g_assert( isearch->hit.start == 4 && bufp->getPoint(bufp) == 7 );
+    g_assert_cmpstr( isearch->pattern->str, ==, "abd" );
+
+    // pattern spans lines
+    g_assert( se_isearch_delete_char(isearch) );
+    g_assert( se_isearch_add_char(isearch, '\n') );
+    g_assert( se_isearch_add_char(isearch, 'd') );
+    g_assert( isearch->hit.start == 8 && bufp->getPoint(bufp) == 12 );
+    g_assert( !se_isearch_add_char(isearch, 'x') );
+    g_assert( !se_isearch_add_char(isearch, 'y') );
+    g_assert( bufp->getPoint(bufp) == 12 );
+    g_assert( !se_isearch_delete_char(isearch) );
+    g_assert( se_isearch_delete_char(isearch) );
+    g_assert_cmpstr( isearch->pattern->str, ==, "ab\nd" );
+
+    se_isearch_free( isearch );
+}
+
+void test_substr_search()
+{
+    const substr_strategy strategies[] = {
+        SUBSTR_AUTO, SUBSTR_SCALAR, SUBSTR_SSE2, SUBSTR_AVX2, SUBSTR_HORSPOOL
+    };
+    GRand *rand = g_rand_new_with_seed( 29 );
+    char str[300], pat[80];
+    for (int n = 0; n < 3000; ++n) {
+        int len = g_rand_int_range( rand, 1, sizeof str );
+        for (int i = 0; i < len; ++i)
+            str[i] = 'a' + g_rand_int_range( rand, 0, n % 2 ? 2 : 4 );
+        str[len] = 0;
+
+        // take pattern from str mostly, so it is found near anywhere
+        int pat_len = g_rand_int_range( rand, 1, MIN(len, (int)sizeof pat - 1) + 1 );
+        int pos = g_rand_int_range( rand, 0, len - pat_len + 1 );
+        memcpy( pat, str + pos, pat_len );
+        if ( n % 3 == 0 )
+            pat[g_rand_int_range(rand, 0, pat_len)] = 'e';
+        pat[pat_len] = 0;
+
+        // KMP is the reference
+        kmp_entry *kmp = kmp_init( pat );
+        int expect = kmp_match( kmp, str );
+        expect = expect < 0 ? -1 : expect - 1;
+        kmp_free( kmp );
+
+        for (int s = 0; s < ARRAY_LEN(strategies); ++s) {
+            substr_entry *substr = substr_init_with_strategy( pat, pat_len, strategies[s] );
+            g_assert_cmpint( substr_search(substr, str, len), ==, expect );
+            substr_free( substr );
+        }
+    }
+    g_rand_free( rand );
+
+    // not limited by NUL
+    substr_entry *substr = substr_init( "b\0c", 3 );
+    g_assert( substr_search(substr, "aab\0b\0cd", 8) == 4 );
+    substr_free( substr );
+}
+
+static long long test_count_occurrences( const char* str, const char* pat )
+{
+    long long nr = 0;
+    for (const char *sp = str; (sp = strstr(sp, pat)) != NULL; ++sp)
+        ++nr;
+    return nr;
+}
+
+void test_trie_dfa()
+{
+    GRand *rand = g_rand_new_with_seed( 30 );
+    for (int n = 0; n < 300; ++n) {
+        // far beyond the old 16 keywords cap, duplicates and prefixes included
+        int nr_keywords = g_rand_int_range( rand, 1, 100 );
+        char keywords[100][8];
+        trie_t *trie = trie_init();
+        for (int i = 0; i < nr_keywords; ++i) {
+            int len = g_rand_int_range( rand, 1, 6 );
+            for (int j = 0; j < len; ++j)
+                keywords[i][j] = 'a' + g_rand_int_range( rand, 0, 3 );
+            keywords[i][len] = 0;
+            trie_add_keyword( trie, keywords[i] );
+        }
+
+        // long ones are cut into lanes, matches across lane borders count
+        static char str[20000];
+        int len = n % 10 ? g_rand_int_range( rand, 0, 200 )
+            : g_rand_int_range( rand, 16384, sizeof str );
+        for (int i = 0; i < len; ++i)
+            str[i] = 'a' + g_rand_int_range( rand, 0, 5 );
+        str[len] = 0;
+
+        long long expect = 0;
+        for (int i = 0; i < nr_keywords; ++i) {
+            gboolean dup = FALSE;
+            for (int j = 0; j < i && !dup; ++j)
+                dup = strcmp( keywords[i], keywords[j] ) == 0;
+            if ( !dup )
+                expect += test_count_occurrences( str, keywords[i] );
+        }
+
+        trie_dfa *dfa = trie_dfa_compile( trie );
+        g_assert_cmpint( trie_dfa_match(dfa, str, len), ==, expect );
+        trie_dfa_free( dfa );
+        trie_free( trie );
+    }
+    g_rand_free( rand );
+}
+
+static gint test_hit_cmp( gconstpointer a, gconstpointer b )
+{
+    const trie_match_hit *h1 = a, *h2 = b;
+    if ( h1->end != h2->end )
+        return h1->end < h2->end ? -1 : 1;
+    return h1->keyword - h2->keyword;
+}
+
+void test_trie_match_hits()
+{
+    GRand *rand = g_rand_new_with_seed( 31 );
+    for (int n = 0; n < 300; ++n) {
+        int nr_keywords = g_rand_int_range( rand, 1, 30 );
+        char *keywords[30];
+        for (int i = 0; i < nr_keywords; ++i) {
+            int len = g_rand_int_range( rand, 1, 5 );
+            keywords[i] = g_malloc( len + 1 );
+            for (int j = 0; j < len; ++j)
+                keywords[i][j] = 'a' + g_rand_int_range( rand, 0, 3 );
+            keywords[i][len] = 0;
+        }
+
+        char str[300];
+        int len = g_rand_int_range( rand, 1, sizeof str );
+        for (int i = 0; i < len; ++i)
+            str[i] = 'a' + g_rand_int_range( rand, 0, 4 );
+        str[len] = 0;
+
+        // every occurrence of every distinct keyword
+        GArray *expect = g_array_new( FALSE, FALSE, sizeof(trie_match_hit) );
+        for (int i = 0; i < nr_keywords; ++i) {
+            gboolean dup = FALSE;
+            for (int j = 0; j < i && !dup; ++j)
+                dup = strcmp( keywords[i], keywords[j] ) == 0;
+            if ( dup )
+                continue;
+            int kw_len = strlen( keywords[i] );
+            for (const char *sp = str; (sp = strstr(sp, keywords[i])) != NULL; ++sp) {
+                trie_match_hit hit = { i, kw_len, sp - str + kw_len };
+                g_array_append_val( expect, hit );
+            }
+        }
+        g_array_sort( expect, test_hit_cmp );
+
+        // tiny hits buffer and text fed in pieces
+        trie_t *trie = trie_init_with_keywords( keywords, nr_keywords );
+        trie_dfa *dfa = trie_dfa_compile( trie );
+        trie_dfa_cursor cur;
+        trie_dfa_cursor_init( dfa, &cur );
+        GArray *got = g_array_new( FALSE, FALSE, sizeof(trie_match_hit) );
+        for (int from = 0; from < len; ) {
+            int piece = g_rand_int_range( rand, 1, 50 );
+            piece = MIN( piece, len - from );
+            trie_dfa_cursor_feed( &cur, str + from, piece );
+            trie_match_hit hits[3];
+            int nr;
+            do {
+                nr = trie_dfa_match_ex( dfa, &cur, hits, ARRAY_LEN(hits) );
+                g_array_append_vals( got, hits, nr );
+            } while ( nr == ARRAY_LEN(hits) );
+            from += piece;
+        }
+        g_array_sort( got, test_hit_cmp );
+
+        g_assert_cmpint( got->len, ==, expect->len );
+        for (int i = 0; i < got->len; ++i) {
+            trie_match_hit *h1 = &g_array_index( got, trie_match_hit, i );
+            trie_match_hit *h2 = &g_array_index( expect, trie_match_hit, i );
+            g_assert( h1->end == h2->end && h1->len == h2->len );
+            g_assert_cmpstr( keywords[h1->keyword], ==, keywords[h2->keyword] );
+        }
+
+        // the trie matcher agrees, with start positions
+        trie_match_result results[600];
+        int nr_results = trie_match_ex( trie, str, ARRAY_LEN(results), results );
+        g_assert_cmpint( nr_results, ==, expect->len );
+        g_assert_cmpint( trie_match(trie, str), ==, expect->len );
+        for (int i = 0; i < nr_results; ++i) {
+            g_assert( strncmp(str + results[i].position, results[i].keyword,
+                              strlen(results[i].keyword)) == 0 );
+        }
+
+        g_array_free( got, TRUE );
+        g_array_free( expect, TRUE );
+        trie_dfa_free( dfa );
+        trie_free( trie );
+        for (int i = 0; i < nr_keywords; ++i)
+            g_free( keywords[i] );
+    }
+    g_rand_free( rand );
+}
+
+void test_regexp_search()
+{
+    const struct {
+        const char *pat, *str;
+        int start, end;
+    } cases[] = {
+        { "b+", "aabbbc", 2, 5 },
+        { "b+?", "aabbbc", 2, 3 },
+        { "a\\|ab", "xab", 1, 2 },
+        { "\\(ab\\|a\\)c", "xabc", 1, 4 },
+        { "x*", "abc", 0, 0 },
+        { "^b", "ab\nbc", 3, 4 },
+        { "a$", "ab\nca\n", 4, 5 },
+        { "[^a-c]\\{2,3\\}", "abxyzwv", 2, 5 },
+        { "[[:digit:]]+\\s-\\w", "ab 12 x", 3, 7 },
+        { "\\(?:ab\\)*c", "abab ababc", 5, 10 },
+        { "a.c", "a\nc abc", 4, 7 },
+        { "*a", "b*a", 1, 3 },
+        { "z", "abc", -1, -1 },
+    };
+    for (int i = 0; i < ARRAY_LEN(cases); ++i) {
+        regexp_entry *re = regexp_compile( cases[i].pat, NULL );
+        g_assert( re );
+        long long end = -1;
+        long long start = regexp_search( re, cases[i].str, strlen(cases[i].str), 0, &end );
+        g_assert_cmpint( start, ==, cases[i].start );
+        if ( start >= 0 )
+            g_assert_cmpint( end, ==, cases[i].end );
+        regexp_free( re );
+    }
+
+    const char *error = NULL;
+    g_assert( !regexp_compile("a\\(b", &error) && error );
+    g_assert( !regexp_compile("a\\)", &error) && error );
+    g_assert( !regexp_compile("[a", &error) && error );
+    g_assert( !regexp_compile("\\(a\\)\\1", &error) && error );
+
+    // a match can't end after limit, but $ still sees what is there
+    regexp_entry *re = regexp_compile( "ab*$", NULL );
+    const char *str = "abb\nabbx";
+    long long end = -1;
+    g_assert( regexp_search_backward(re, str, strlen(str), 7, &end) == 0 );
+    g_assert( end == 3 );
+    g_assert( regexp_search_backward(re, str, strlen(str), 2, &end) == -1 );
+    regexp_free( re );
+
+    // exponential for a backtracking matcher
+    GString *text = g_string_new( "" );
+    for (int i = 0; i < 100000; ++i)
+        g_string_append_c( text, 'a' );
+    re = regexp_compile( "\\(a*\\)*b", NULL );
+    g_assert( regexp_search(re, text->str, text->len, 0, NULL) == -1 );
+    regexp_free( re );
+    re = regexp_compile( "\\(a?\\)\\{30\\}a\\{30\\}$", NULL );
+    g_assert( regexp_search(re, text->str, 30, 0, &end) == 0 && end == 30 );
+    regexp_free( re );
+
+    // states are rebuilt as the cache keeps getting flushed
+    re = regexp_compile( "a[ab]\\{12\\}c", NULL );
+    regexp_set_cache_size( re, 1024 );
+    GRand *rand = g_rand_new_with_seed( 32 );
+    g_string_truncate( text, 0 );
+    for (int i = 0; i < 20000; ++i)
+        g_string_append_c( text, "abbc"[g_rand_int_range(rand, 0, 4)] );
+    g_string_append( text, "aababbabaabac" );
+    long long start = regexp_search( re, text->str, text->len, 0, &end );
+    g_assert( start >= 0 && end - start == 14 );
+    g_assert( text->str[start] == 'a' && text->str[end-1] == 'c' );
+    for (int i = start + 1; i < end - 1; ++i)
+        g_assert( text->str[i] == 'a' || text->str[i] == 'b' );
+    g_assert( re->forward != NULL );
+    regexp_free( re );
+    g_rand_free( rand );
+    g_string_free( text, TRUE );
+}
+
+void test_regexp_buffer()
+{
+    se_buffer *bufp = se_buffer_create( NULL, "regexp" );
+    GString *text = g_string_new( "" );
+    GRand *rand = g_rand_new_with_seed( 32 );
+    for (int i = 0; i < 3000; ++i)
+        g_string_append_c( text, "abcab\n"[g_rand_int_range(rand, 0, 6)] );
+    bufp->insertString( bufp, text->str );
+    g_assert( bufp->getCharCount(bufp) == text->len );
+
+    // matches spanning lines are found chunk by chunk as in the flat text
+    const char *pats[] = { "b\na", "^ab*$", "c[^c]*c", "\\(ab\\|ba\\)\\{2\\}", "a\nb*\n?c" };
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        regexp_entry *re = regexp_compile( pats[p], NULL );
+        for (int n = 0; n < 50; ++n) {
+            se_off_t from = g_rand_int_range( rand, 0, text->len + 1 );
+            se_search_cursor cur;
+            se_search_cursor_at( bufp, from, &cur );
+            se_off_t end = -1;
+            long long expect_end = -1;
+            long long expect = regexp_search( re, text->str, text->len, from, &expect_end );
+            g_assert_cmpint( se_search_regexp_forward(bufp, re, from, &cur, &end), ==, expect );
+            if ( expect >= 0 ) {
+                g_assert_cmpint( end, ==, expect_end );
+                g_assert( cur.line && expect >= cur.lineStart );
+                g_assert( expect < cur.lineStart + se_line_getLineLength(cur.line) );
+            }
+
+            se_search_cursor_at( bufp, 0, &cur );
+            expect = regexp_search_backward( re, text->str, text->len, from, &expect_end );
+            g_assert_cmpint( se_search_regexp_backward(bufp, re, from, &cur, &end), ==, expect );
+            if ( expect >= 0 )
+                g_assert_cmpint( end, ==, expect_end );
+        }
+        regexp_free( re );
+    }
+    g_rand_free( rand );
+    g_string_free( text, TRUE );
+
+    bufp = se_buffer_create( NULL, "isearch-regexp" );
+    bufp->insertString( bufp, "ab1\nab22\nx333" );
+    se_isearch *isearch = se_isearch_create_full( bufp, TRUE, TRUE );
+    // nothing is searched until pattern is complete
+    const char *keys = "[0-9";
+    for (const char *kp = keys; *kp; ++kp)
+        g_assert( !se_isearch_add_char(isearch, *kp) );
+    g_assert( isearch->error && bufp->getPoint(bufp) == 13 );
+    g_assert( se_isearch_add_char(isearch, ']') );
+    g_assert( se_isearch_add_char(isearch, '+') );
+    g_assert( isearch->hit.start == 12 && isearch->hit.end == 13 );
+    g_assert( se_isearch_repeat(isearch) );
+    g_assert( isearch->hit.start == 11 && bufp->getPoint(bufp) == 11 );
+    g_assert( se_isearch_repeat(isearch) );
+    g_assert( se_isearch_repeat(isearch) );
+    g_assert( isearch->hit.start == 7 && isearch->hit.end == 8 );
+    g_assert( se_isearch_delete_char(isearch) );
+    g_assert( isearch->hit.start == 10 );
+    se_isearch_free( isearch );
+}
+
+// run search to the end, and check hits against searching flat text again and again
+static void test_psearch_check( se_psearch* ps, const char* text, long long len, regexp_entry* re )
+{
+    while ( !se_psearch_poll(ps) )
+        g_usleep( 1000 );
+
+    int nr_hits = 0;
+    long long from = 0, end;
+    long long start;
+    while ( from <= len && (start = regexp_search(re, text, len, from, &end)) >= 0 ) {
+        g_assert_cmpint( nr_hits, <, ps->hits->len );
+        se_psearch_hit *hit = &g_array_index( ps->hits, se_psearch_hit, nr_hits++ );
+        g_assert_cmpint( hit->start, ==, start );
+        g_assert_cmpint( hit->end, ==, end );
+        from = end > start ? end: end + 1;
+    }
+    g_assert_cmpint( nr_hits, ==, ps->hits->len );
+
+    se_psearch_hit first;
+    start = regexp_search( re, text, len, ps->origin, &end );
+    g_assert( se_psearch_first_hit(ps, &first) == (start >= 0) );
+    if ( start >= 0 )
+        g_assert( first.start == start && first.end == end );
+}
+
+void test_parallel_search()
+{
+    se_buffer *bufp = se_buffer_create( NULL, "psearch" );
+    GString *text = g_string_new( "" );
+    GRand *rand = g_rand_new_with_seed( 33 );
+    for (int i = 0; i < 20000; ++i)
+        g_string_append_c( text, "abcab\n"[g_rand_int_range(rand, 0, 6)] );
+    bufp->insertString( bufp, text->str );
+
+    // parts down to a few lines, so lots of matches cross their edges
+    const struct {
+        const char *pat;
+        gboolean regexp;
+    } pats[] = {
+        { "ca", FALSE }, { "b\na", FALSE }, { "^ab*$", TRUE }, { "b*", TRUE },
+        { "c[^c]*c", TRUE }, { "a\nb*\n?c", TRUE }, { "\\(ab\\|ba\\)\\{2\\}", TRUE },
+    };
+    const se_off_t part_sizes[] = { 16, 100, 3000, 0 };
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        char *pat = pats[p].regexp ? g_strdup( pats[p].pat ): regexp_quote( pats[p].pat );
+        regexp_entry *re = regexp_compile( pat, NULL );
+        for (int s = 0; s < ARRAY_LEN(part_sizes); ++s) {
+            se_off_t origin = g_rand_int_range( rand, 0, text->len + 1 );
+            se_psearch *ps = se_psearch_start_full( bufp, pats[p].pat, pats[p].regexp, origin,
+                                                    1 + s % 3, part_sizes[s], NULL );
+            g_assert( ps && ps->origin == origin );
+            test_psearch_check( ps, text->str, text->len, re );
+            se_psearch_free( ps );
+        }
+        regexp_free( re );
+        g_free( pat );
+    }
+
+    // buffer changing as threads scan does not matter
+    regexp_entry *re = regexp_compile( "ab", NULL );
+    se_psearch *ps = se_psearch_start_full( bufp, "ab", FALSE, 0, 4, 64, NULL );
+    bufp->setPoint( bufp, 0 );
+    bufp->insertString( bufp, "abab\n" );
+    test_psearch_check( ps, text->str, text->len, re );
+    se_psearch_free( ps );
+    regexp_free( re );
+
+    const char *error = NULL;
+    g_assert( !se_psearch_start(bufp, "a\\(", TRUE, 0, &error) && error );
+
+    // cancelled search stops, what is merged so far stays
+    ps = se_psearch_start_full( bufp, "a", FALSE, 0, 2, 16, NULL );
+    se_psearch_cancel( ps );
+    g_assert( se_psearch_poll(ps) );
+    se_psearch_free( ps );
+    
+    g_rand_free( rand );
+    g_string_free( text, TRUE );
+}
+
+void test_occur()
+{
+    // world warns that there is no readme.txt to load here
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "occur-a" );
+    se_buffer *a = world->current;
+    a->insertString( a, "qzx1 one\nnothing\nqzx2 and qzx1\n" );
+    world->bufferCreate( world, "occur-b" );
+    se_buffer *b = world->current;
+    b->insertString( b, "none\nlast qzx2" );
+    // b is used after a
+    a->lastUsed = ++world->useTick;
+    b->lastUsed = ++world->useTick;
+
+    world->lastSearch = g_string_new( "qzx[12]" );
+    world->lastSearchRegexp = TRUE;
+    se_command_args args = se_command_args_init();
+    se_occur_command( world, &args, se_key_null_init() );
+    while ( world->pollSearch(world) )
+        g_usleep( 100 );
+
+    // one line per matching line after a header per buffer, most recent first
+    se_occur *occur = world->occur;
+    g_assert( occur && !occur->pool && world->current == occur->output );
+    g_assert( occur->nr_matches == 4 && occur->nr_buffers == 2 );
+    g_assert( occur->entries->len == 5 );
+    g_assert( !se_occur_entry_at(occur, 0) && !se_occur_entry_at(occur, 2) );
+    const struct { se_buffer *buffer; se_off_t line, offset; } expects[] = {
+        { b, 2, 10 }, { a, 1, 0 }, { a, 3, 17 },
+    };
+    const int rows[] = { 1, 3, 4 };
+    for (int i = 0; i < ARRAY_LEN(expects); ++i) {
+        se_occur_entry *entry = se_occur_entry_at( occur, rows[i] );
+        g_assert( entry && entry->buffer == expects[i].buffer );
+        g_assert( entry->line == expects[i].line && entry->offset == expects[i].offset );
+    }
+    g_assert( !se_occur_entry_at(occur, 5) );
+
+    // Return on a line visits the match
+    se_buffer *output = occur->output;
+    output->bufferStart( output );
+    for (int i = 0; i < 3; ++i)
+        output->forwardLine( output, 1 );
+    se_occur_goto_command( world, &args, se_key_null_init() );
+    g_assert( world->current == a && a->getPoint(a) == 0 );
+
+    // lines of a deleted buffer lead nowhere
+    world->bufferDelete( world, "occur-a" );
+    g_assert( !se_occur_entry_at(occur, 3) && se_occur_entry_at(occur, 1) );
+
+    // deleting the output lets the occur go
+    world->bufferDelete( world, SE_OCCUR_BUFFER_NAME );
+    g_assert( !world->occur );
+
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+static char* test_buffer_text( se_buffer* bufp )
+{
+    GString *str = g_string_new( "" );
+    se_line *lp = bufp->lines;
+    for (se_off_t i = 0; i < bufp->lineCount; ++i) {
+        g_string_append_len( str, se_line_getData(lp), se_line_getLineLength(lp) );
+        lp = lp->next;
+    }
+    return g_string_free( str, FALSE );
+}
+
+// index kept up with edits is the same as one built from scratch
+static void test_highlight_check( se_buffer* bufp )
+{
+    se_highlight *hl = bufp->highlight;
+    se_highlight_update( hl, bufp->lineCount );
+    g_assert( hl->lines->len == bufp->lineCount );
+
+    char *text = test_buffer_text( bufp );
+    se_buffer *fresh = se_buffer_create( NULL, "highlight-fresh" );
+    fresh->insertString( fresh, text );
+    g_assert( se_highlight_attach(fresh, hl->pattern, hl->regexp, NULL) );
+    se_highlight_update( fresh->highlight, fresh->lineCount );
+    g_assert( fresh->lineCount == bufp->lineCount );
+
+    for (se_off_t i = 0; i < bufp->lineCount; ++i) {
+        int nr, nr_fresh;
+        const se_highlight_span *spans = se_highlight_line_spans( hl, i, &nr );
+        const se_highlight_span *expect = se_highlight_line_spans( fresh->highlight, i, &nr_fresh );
+        g_assert_cmpint( nr, ==, nr_fresh );
+        g_assert( !nr || memcmp(spans, expect, nr * sizeof *spans) == 0 );
+    }
+    se_highlight_attach( fresh, NULL, FALSE, NULL );
+    g_free( text );
+}
+
+void test_highlight()
+{
+    GRand *rand = g_rand_new_with_seed( 35 );
+    const struct { const char *pat; gboolean regexp; } pats[] = {
+        { "ab", FALSE }, { "b\nc", TRUE }, { "a+c*$", TRUE },
+    };
+    for (int p = 0; p < ARRAY_LEN(pats); ++p) {
+        se_buffer *bufp = se_buffer_create( NULL, "highlight" );
+        GString *text = g_string_new( "" );
+        for (int i = 0; i < 2000; ++i)
+            g_string_append_c( text, "abc\n"[g_rand_int_range(rand, 0, 4)] );
+        g_string_append_c( text, '\n' );
+        bufp->insertString( bufp, text->str );
+        g_assert( se_highlight_attach(bufp, pats[p].pat, pats[p].regexp, NULL) );
+        se_highlight *hl = bufp->highlight;
+        
+        // first rows only, as a view asks for them
+        se_highlight_update( hl, 10 );
+        g_assert( hl->lines->len == 10 && hl->nr_rescanned == 10 );
+
+        // an edit far down costs a few lines, not the whole buffer
+        test_highlight_check( bufp );
+        bufp->setPoint( bufp, text->len / 2 );
+        bufp->insertString( bufp, "ab" );
+        se_highlight_update( hl, bufp->lineCount );
+        g_assert( hl->nr_rescanned <= 1 + 2 * SE_HIGHLIGHT_WINDOW );
+        se_highlight_update( hl, bufp->lineCount );
+        g_assert( hl->nr_rescanned == 0 );
+
+        for (int round = 0; round < 200; ++round) {
+            int nr_edits = g_rand_int_range( rand, 1, 4 );
+            for (int e = 0; e < nr_edits; ++e) {
+                bufp->setPoint( bufp, g_rand_int_range(rand, 0, bufp->getCharCount(bufp) + 1) );
+                if ( g_rand_int_range(rand, 0, 2) ) {
+                    char str[5] = "";
+                    for (int i = g_rand_int_range(rand, 1, 5); i > 0; --i)
+                        str[i-1] = "abc\n"[g_rand_int_range(rand, 0, 4)];
+                    bufp->insertString( bufp, str );
+                } else {
+                    bufp->deleteChars( bufp, g_rand_int_range(rand, 1, 4) );
+                }
+            }
+            test_highlight_check( bufp );
+        }
+        
+        se_highlight_attach( bufp, NULL, FALSE, NULL );
+        g_assert( !bufp->highlight );
+        g_string_free( text, TRUE );
+    }
+    g_rand_free( rand );
+}
+
+// what replaceAll should leave, by matching the whole text at once
+static char* test_replace_expect( const char* text, regexp_entry* re, const char* str,
+                                  int* nr_replaced )
+{
+    GString *out = g_string_new( "" );
+    long long len = strlen( text ), from = 0, pos = 0, start, end;
+    *nr_replaced = 0;
+    while ( from <= len && (start = regexp_search(re, text, len, from, &end)) >= 0 ) {
+        g_string_append_len( out, text + pos, start - pos );
+        g_string_append( out, str );
+        pos = end;
+        from = end > start ? end: end + 1;
+        ++*nr_replaced;
+    }
+    g_string_append( out, text + pos );
+    return g_string_free( out, FALSE );
+}
+
+static void test_replace_check_lines( se_buffer* bufp, const char* text )
+{
+    char *content = test_buffer_text( bufp );
+    g_assert_cmpstr( content, ==, text );
+    g_free( content );
+
+    se_off_t nr_lines = 0;
+    if ( bufp->lines ) {
+        se_line *lp = bufp->lines;
+        do {
+            // only the last line may lack its '\n'
+            g_assert( lp->content->fullLine || lp->next == bufp->lines );
+            g_assert( lp->next->previous == lp );
+            ++nr_lines;
+            lp = lp->next;
+        } while ( lp != bufp->lines );
+    }
+    g_assert( nr_lines == bufp->lineCount );
+    g_assert( bufp->charCount == strlen(text) );
+    se_snapshot_publish( bufp );
+}
+
+void test_replace_all()
+{
+    const struct { const char *pat, *str; } cases[] = {
+        { "ab", "xyz" },
+        { "b", "" },
+        { "\n", " " },        // lines join
+        { "c", "\n" },        // and split
+        { "b\nc", "-" },
+        { "^", "> " },         // empty matches
+        { "^a*c\n", "" },     // whole lines go
+        { "[abc\n]+", "" },   // everything goes
+    };
+    GRand *rand = g_rand_new_with_seed( 36 );
+    for (int c = 0; c < ARRAY_LEN(cases); ++c) {
+        GString *text = g_string_new( "" );
+        for (int i = 0; i < 3000; ++i)
+            g_string_append_c( text, "abcc\n"[g_rand_int_range(rand, 0, 5)] );
+        se_buffer *bufp = se_buffer_create( NULL, "replace" );
+        bufp->insertString( bufp, text->str );
+        bufp->setPoint( bufp, 100 );
+
+        regexp_entry *re = regexp_compile( cases[c].pat, NULL );
+        int nr_expect;
+        char *expect = test_replace_expect( text->str, re, cases[c].str, &nr_expect );
+        int version = bufp->version;
+        g_assert_cmpint( bufp->replaceAll(bufp, re, cases[c].str), ==, nr_expect );
+        g_assert( bufp->version == version + 1 );
+        test_replace_check_lines( bufp, expect );
+
+        // one undo takes all of it back
+        g_assert( bufp->undo(bufp) );
+        test_replace_check_lines( bufp, text->str );
+        g_assert( bufp->getPoint(bufp) == 100 );
+        g_assert( !bufp->undo(bufp) );
+
+        // no undo once buffer is edited after
+        g_assert( bufp->replaceAll(bufp, re, cases[c].str) == nr_expect );
+        if ( bufp->lines ) {
+            bufp->setPoint( bufp, 0 );
+            bufp->insertString( bufp, "a" );
+            // and lines it kept are freed right away
+            g_assert( !bufp->undoEntry );
+            g_assert( !bufp->undo(bufp) );
+        }
+        
+        regexp_free( re );
+        g_free( expect );
+        g_string_free( text, TRUE );
+    }
+    g_rand_free( rand );
+}
+
+static void test_tindex_write( const char* root, const char* name, const char* text, gsize len )
+{
+    char *path = g_build_filename( root, name, NULL );
+    char *dir = g_path_get_dirname( path );
+    mkdir( dir, 0700 );
+    g_assert( g_file_set_contents(path, text, len, NULL) );
+    g_free( dir );
+    g_free( path );
+}
+
+static void test_tindex_remove( const char* path )
+{
+    GDir *dir = g_dir_open( path, 0, NULL );
+    if ( dir ) {
+        const char *base;
+        while ( (base = g_dir_read_name(dir)) ) {
+            char *child = g_build_filename( path, base, NULL );
+            test_tindex_remove( child );
+            g_free( child );
+        }
+        g_dir_close( dir );
+        g_assert( rmdir(path) == 0 );
+    } else
+        g_assert( unlink(path) == 0 );
+}
+
+// names under root, joined by ' '
+static char* test_tindex_names( const char* root, char** files )
+{
+    GString *names = g_string_new( "" );
+    for (int i = 0; files[i]; ++i) {
+        g_assert( g_str_has_prefix(files[i], root) );
+        g_string_append_printf( names, "%s%s", i ? " ": "", files[i] + strlen(root) + 1 );
+    }
+    g_strfreev( files );
+    return g_string_free( names, FALSE );
+}
+
+static char* test_tindex_query( se_tindex* idx, const char* pattern, gboolean regexp,
+                                gboolean search )
+{
+    char **files = search ? se_tindex_search( idx, pattern, regexp, NULL, NULL )
+        : se_tindex_candidates( idx, pattern, regexp, NULL );
+    return test_tindex_names( idx->root, files );
+}
+
+void test_tindex()
+{
+    char *root = g_dir_make_tmp( "semacs-tindex-XXXXXX", NULL );
+    test_tindex_write( root, "a.c", "hello world\n", 12 );
+    test_tindex_write( root, "sub/b.txt", "world peace\n", 12 );
+    test_tindex_write( root, ".hidden/c", "hello\n", 6 );
+    test_tindex_write( root, "bin", "hello\0world", 11 );
+
+    g_assert( !se_tindex_open(root) );
+    se_tindex *idx = se_tindex_update( root, NULL );
+    g_assert( idx->header->nr_files == 3 );
+    g_assert( idx->nr_reused == 0 && idx->nr_scanned == 3 );
+    g_assert_cmpstr( se_tindex_file_name(idx, 0), ==, "a.c" );
+    
+    const struct { const char *pat; gboolean regexp, search; const char *files; } cases[] = {
+        { "hello", FALSE, FALSE, "a.c" },
+        { "world", FALSE, FALSE, "a.c sub/b.txt" },
+        { "d\npe", FALSE, FALSE, "" },
+        { "lo", FALSE, FALSE, "a.c sub/b.txt" },    // too short to narrow
+        { "hel+o", TRUE, FALSE, "a.c" },           // narrowed by its prefix
+        { "h.llo", TRUE, FALSE, "a.c sub/b.txt" },
+        { "peace\\|xyz", TRUE, FALSE, "a.c sub/b.txt" },
+        { "worl[d]", TRUE, FALSE, "a.c sub/b.txt" },
+        { "worlds", FALSE, FALSE, "" },
+        { "o w", FALSE, TRUE, "a.c" },
+        { "hel+o", TRUE, TRUE, "a.c" },
+        { "e.ce$", TRUE, TRUE, "sub/b.txt" },
+    };
+    for (int i = 0; i < ARRAY_LEN(cases); ++i) {
+        char *files = test_tindex_query( idx, cases[i].pat, cases[i].regexp, cases[i].search );
+        g_assert_cmpstr( files, ==, cases[i].files );
+        g_free( files );
+    }
+    se_tindex_free( idx );
+
+    // a file that can't be read is left out, and read once it can be
+    if ( geteuid() != 0 ) {
+        char *locked = g_build_filename( root, "locked", NULL );
+        test_tindex_write( root, "locked", "hello\n", 6 );
+        chmod( locked, 0 );
+        idx = se_tindex_update( root, NULL );
+        se_tindex_free( idx );
+        idx = se_tindex_update( root, NULL );
+        g_assert( idx->nr_scanned == 1 );
+        char *files = test_tindex_query( idx, "hello", FALSE, FALSE );
+        g_assert_cmpstr( files, ==, "a.c" );
+        g_free( files );
+        se_tindex_free( idx );
+        chmod( locked, 0644 );
+        idx = se_tindex_update( root, NULL );
+        files = test_tindex_query( idx, "hello", FALSE, FALSE );
+        g_assert_cmpstr( files, ==, "a.c locked" );
+        g_free( files );
+        se_tindex_free( idx );
+        unlink( locked );
+        g_free( locked );
+    }
+
+    // from a subdirectory the index above is found
+    char *sub = g_build_filename( root, "sub", NULL );
+    char *found = se_tindex_find_root( sub );
+    g_assert_cmpstr( found, ==, root );
+    g_free( found );
+    g_free( sub );
+
+    // only changed and new files are read again
+    test_tindex_write( root, "sub/b.txt", "hello there\n", 12 );
+    test_tindex_write( root, "sub/d", "hello again\n", 12 );
+    char *gone = g_build_filename( root, "a.c", NULL );
+    unlink( gone );
+    g_free( gone );
+    idx = se_tindex_update( root, NULL );
+    g_assert( idx->header->nr_files == 3 );
+    g_assert( idx->nr_reused == 1 );
+    char *files = test_tindex_query( idx, "hello", FALSE, FALSE );
+    g_assert_cmpstr( files, ==, "sub/b.txt sub/d" );
+    g_free( files );
+    se_tindex_free( idx );
+
+    // random trees, updated in place or built afresh, shortlist the same
+    GRand *rand = g_rand_new_with_seed( 37 );
+    for (int round = 0; round < 4; ++round) {
+        for (int f = 0; f < 20; ++f) {
+            if ( g_rand_int_range(rand, 0, 3) )
+                continue;
+            char name[32], text[200];
+            snprintf( name, sizeof name, "r%d/f%d", f % 3, f );
+            int len = g_rand_int_range( rand, 0, sizeof text );
+            for (int i = 0; i < len; ++i)
+                text[i] = "abcd\n"[g_rand_int_range(rand, 0, 5)];
+            test_tindex_write( root, name, text, len );
+        }
+        idx = se_tindex_update( root, NULL );
+        char *path = g_build_filename( root, SE_TINDEX_FILE_NAME, NULL );
+        unlink( path );
+        g_free( path );
+        se_tindex *fresh = se_tindex_update( root, NULL );
+        g_assert( fresh->nr_reused == 0 );
+        g_assert( idx->header->nr_files == fresh->header->nr_files );
+        
+        for (int q = 0; q < 50; ++q) {
+            char pat[8];
+            int len = g_rand_int_range( rand, 3, sizeof pat );
+            for (int i = 0; i < len; ++i)
+                pat[i] = "abcd"[g_rand_int_range(rand, 0, 4)];
+            pat[len] = 0;
+            char *expect = test_tindex_query( fresh, pat, FALSE, FALSE );
+            char *got = test_tindex_query( idx, pat, FALSE, FALSE );
+            g_assert_cmpstr( got, ==, expect );
+            g_free( got );
+            g_free( expect );
+
+            // a match is never left out of the shortlist
+            char **hits = se_tindex_search( idx, pat, FALSE, NULL, NULL );
+            char **candidates = se_tindex_candidates( idx, pat, FALSE, NULL );
+            for (int h = 0, c = 0; hits[h]; ++h, ++c) {
+                while ( candidates[c] && strcmp(candidates[c], hits[h]) != 0 )
+                    ++c;
+                g_assert( candidates[c] );
+            }
+            g_strfreev( candidates );
+            g_strfreev( hits );
+        }
+        se_tindex_free( fresh );
+        se_tindex_free( idx );
+    }
+    g_rand_free( rand );
+    
+    test_tindex_remove( root );
+    g_free( root );
+}
+
+// M-s p reads tree in background, files found are visited and listed in occur
+void test_project_search()
+{
+    char *root = g_dir_make_tmp( "semacs-project-XXXXXX", NULL );
+    test_tindex_write( root, "a.c", "a needle here\n", 14 );
+    test_tindex_write( root, "b.txt", "nothing\n", 8 );
+    test_tindex_write( root, "sub/c.h", "needle\n", 7 );
+
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    char *start = g_build_filename( root, "b.txt", NULL );
+    world->loadFile( world, start );
+    g_free( start );
+    world->lastSearch = g_string_new( "needle" );
+    world->lastSearchRegexp = FALSE;
+    se_command_args args = se_command_args_init();
+
+    // a job dropped goes on by itself
+    se_project_search_command( world, &args, se_key_null_init() );
+    world->cancelSearch( world );
+    g_assert( !world->projectSearch );
+
+    se_project_search_command( world, &args, se_key_null_init() );
+    while ( world->pollSearch(world) )
+        g_usleep( 100 );
+    se_occur *occur = world->occur;
+    g_assert( occur && !world->projectSearch );
+    g_assert( occur->nr_matches == 2 && occur->nr_buffers == 2 );
+
+    se_command_args_release( &args );
+    se_world_free( world );
+    test_tindex_remove( root );
+    g_free( root );
+}
+
+static se_fuzzy* test_fuzzy_cmp_ctx;
+
+static gint test_fuzzy_compare( gconstpointer a, gconstpointer b )
+{
+    const se_fuzzy_match *x = a, *y = b;
+    if ( x->score != y->score )
+        return y->score - x->score;
+    int xlen = strlen( se_fuzzy_name(test_fuzzy_cmp_ctx, x->id) );
+    int ylen = strlen( se_fuzzy_name(test_fuzzy_cmp_ctx, y->id) );
+    return xlen != ylen ? xlen - ylen: x->id - y->id;
+}
+
+// score every candidate from scratch, and compare with what query left
+static void test_fuzzy_check( se_fuzzy* fz, const char* query, int nr_matches )
+{
+    GArray *expect = g_array_new( FALSE, FALSE, sizeof(se_fuzzy_match) );
+    for (int id = 0; id < fz->nr_candidates; ++id) {
+        se_fuzzy_match m = { id, se_fuzzy_score(se_fuzzy_name(fz, id), query) };
+        if ( m.score >= 0 )
+            g_array_append_val( expect, m );
+    }
+    if ( query[0] ) {
+        test_fuzzy_cmp_ctx = fz;
+        g_array_sort( expect, test_fuzzy_compare );
+    }
+    g_assert_cmpint( nr_matches, ==, expect->len );
+    g_assert_cmpint( fz->matches->len, ==, MIN(expect->len, SE_FUZZY_MAX_MATCHES) );
+    for (int i = 0; i < fz->matches->len; ++i) {
+        se_fuzzy_match *m = &g_array_index( fz->matches, se_fuzzy_match, i );
+        se_fuzzy_match *e = &g_array_index( expect, se_fuzzy_match, i );
+        g_assert( m->id == e->id && m->score == e->score );
+    }
+    g_array_free( expect, TRUE );
+}
+
+void test_fuzzy()
+{
+    g_assert( se_fuzzy_score("buffer.c", "xyz") < 0 );
+    g_assert( se_fuzzy_score("buffer.c", "") == 0 );
+    g_assert( se_fuzzy_score("Buffer.c", "bUF") == se_fuzzy_score("buffer.c", "buf") );
+    // words starting with query chars win, then chars together, then basename
+    g_assert( se_fuzzy_score("src/buffer.c", "buf") > se_fuzzy_score("src/abuffer.c", "buf") );
+    g_assert( se_fuzzy_score("fuzzyBuffer", "fb") > se_fuzzy_score("fuzzybuffer", "fb") );
+    g_assert( se_fuzzy_score("a/buffer", "buf") > se_fuzzy_score("a/bxuxf", "buf") );
+    g_assert( se_fuzzy_score("buf/a", "buf") < se_fuzzy_score("a/buf", "buf") );
+
+    se_fuzzy *fz = se_fuzzy_new();
+    const char *names[] = { "src/abuffer.cc", "src/buffer.c", "README", "bench/fuzzy.c" };
+    for (int i = 0; i < ARRAY_LEN(names); ++i)
+        g_assert( se_fuzzy_add(fz, names[i], i == 1 ? "/src/buffer.c": NULL) == i );
+    g_assert_cmpstr( se_fuzzy_value(fz, 1), ==, "/src/buffer.c" );
+    g_assert( !se_fuzzy_value(fz, 0) );
+    g_assert( se_fuzzy_set_query(fz, "buf") == 2 );
+    g_assert( g_array_index(fz->matches, se_fuzzy_match, 0).id == 1 );
+    g_assert( se_fuzzy_set_query(fz, "") == 4 );
+    g_assert( g_array_index(fz->matches, se_fuzzy_match, 3).id == 3 );
+    se_fuzzy_free( fz );
+
+    // typing and deleting narrows and widens as matching afresh does
+    GRand *rand = g_rand_new_with_seed( 38 );
+    fz = se_fuzzy_new();
+    // some long enough to have chars past what masks of bounds hold
+    for (int i = 0; i < 3000; ++i) {
+        char name[80];
+        int len = g_rand_int_range( rand, 1, sizeof name );
+        for (int k = 0; k < len; ++k)
+            name[k] = "abcdeABC/_.x"[g_rand_int_range(rand, 0, 12)];
+        name[len] = 0;
+        se_fuzzy_add( fz, name, NULL );
+    }
+    GString *query = g_string_new( "" );
+    for (int step = 0; step < 300; ++step) {
+        int what = g_rand_int_range( rand, 0, 10 );
+        if ( what < 3 && query->len )
+            g_string_truncate( query, g_rand_int_range(rand, 0, query->len) );
+        else if ( what < 4 )
+            g_string_assign( query, "" );
+        else if ( query->len < 6 )
+            g_string_append_c( query, "abcdeAB/_."[g_rand_int_range(rand, 0, 10)] );
+        test_fuzzy_check( fz, query->str, se_fuzzy_set_query(fz, query->str) );
+    }
+    g_string_free( query, TRUE );
+    se_fuzzy_free( fz );
+    g_rand_free( rand );
+}
+
+void test_switch_buffer()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "switch-alpha.c" );
+    world->bufferCreate( world, "switch-beta.h" );
+    world->bufferCreate( world, "switch-gamma.c" );
+
+    se_command_args args = se_command_args_init();
+    se_switch_buffer_command( world, &args, se_key_null_init() );
+    g_assert( world->prompt && world->switcher );
+    // current buffer is not offered
+    for (int id = 0; id < world->switcher->nr_candidates; ++id)
+        g_assert_cmpstr( se_fuzzy_name(world->switcher, id), !=, "switch-gamma.c" );
+    
+    const char *keys[] = { "s", "w", "b", "h", "BackSpace", "Return" };
+    for (int i = 0; i < ARRAY_LEN(keys); ++i) {
+        se_key key = se_key_from_string( keys[i] );
+        world->dispatchCommand( world, &args, key );
+    }
+    g_assert( !world->prompt );
+    g_assert_cmpstr( world->current->getBufferName(world->current), ==, "switch-beta.h" );
+    
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+// deleting a range at once leaves what deleting char by char would
+void test_buffer_delete_chars()
+{
+    GRand *rand = g_rand_new_with_seed( 43 );
+    for (int round = 0; round < 400; ++round) {
+        GString *text = g_string_new( "" );
+        int len = g_rand_int_range( rand, 1, 40 );
+        for (int i = 0; i < len; ++i)
+            g_string_append_c( text, "ab\n"[g_rand_int_range(rand, 0, 3)] );
+        
+        se_buffer *bufp = se_buffer_create( NULL, "delete" );
+        bufp->insertString( bufp, text->str );
+        int point = g_rand_int_range( rand, 0, len + 1 );
+        int count = g_rand_int_range( rand, 1, len + 2 );
+        bufp->setPoint( bufp, point );
+        se_off_t line = bufp->getLine( bufp ), col = bufp->getCurrentColumn( bufp );
+        g_assert( bufp->deleteChars(bufp, count) );
+        
+        g_string_erase( text, point, MIN(count, len - point) );
+        int nr_lines = 0;
+        for (int i = 0; i < text->len; ++i)
+            nr_lines += text->str[i] == '\n';
+        if ( text->len && text->str[text->len-1] != '\n' )
+            ++nr_lines;
+
+        char *got = bufp->lines ? test_buffer_text( bufp ): g_strdup( "" );
+        g_assert_cmpstr( got, ==, text->str );
+        g_assert_cmpint( bufp->getCharCount(bufp), ==, text->len );
+        g_assert_cmpint( bufp->getLineCount(bufp), ==, nr_lines );
+        g_assert_cmpint( bufp->getPoint(bufp), ==, point );
+        if ( bufp->lines ) {
+            bufp->setPoint( bufp, point );
+            g_assert_cmpint( bufp->getLine(bufp), ==, line );
+            g_assert_cmpint( bufp->getCurrentColumn(bufp), ==, col );
+        }
+        g_free( got );
+        bufp->release( bufp );
+        g_free( bufp );
+        g_string_free( text, TRUE );
+    }
+    g_rand_free( rand );
+}
+
+static void test_dispatch_keys( se_world* world, se_command_args* args, const char* keys )
+{
+    gchar **reps = g_strsplit( keys, " ", -1 );
+    for (gchar **rep = reps; *rep; ++rep) {
+        if ( world->dispatchCommand(world, args, se_key_from_string(*rep)) )
+            se_command_args_clear( args );
+    }
+    g_strfreev( reps );
+}
+
+// C-u count goes to commands taking it, which do it in one go
+void test_buffer_repeat_count()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "repeat" );
+    se_buffer *bufp = world->current;
+    bufp->setMajorMode( bufp, "Fundamental" );
+    se_command_args args = se_command_args_init();
+
+    g_assert( se_command_takes_count(se_self_insert_command) );
+    g_assert( !se_command_takes_count(se_undo_command) );
+    g_assert( se_command_takes_count(se_command_lookup("next-line")) );
+
+    int version = bufp->version;
+    test_dispatch_keys( world, &args, "C-u 1 0 0 0 0 0 a" );
+    g_assert( bufp->version == version + 1 );
+    g_assert_cmpint( bufp->getCharCount(bufp), ==, 100000 );
+    g_assert_cmpint( bufp->getLineCount(bufp), ==, 1 );
+
+    test_dispatch_keys( world, &args, "C-u 3 Return C-u b" );
+    g_assert_cmpint( bufp->getLineCount(bufp), ==, 4 );
+    g_assert_cmpint( bufp->getCurrentColumn(bufp), ==, 4 );
+
+    // lines are moved at once, keeping column
+    test_dispatch_keys( world, &args, "C-u 3 C-p" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 0 );
+    g_assert_cmpint( bufp->getCurrentColumn(bufp), ==, 4 );
+    test_dispatch_keys( world, &args, "C-u 9 C-n" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 3 );
+    g_assert_cmpint( bufp->getCurrentColumn(bufp), ==, 4 );
+    test_dispatch_keys( world, &args, "C-u 2 C-b C-u 3 C-p" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 0 );
+    g_assert_cmpint( bufp->getCurrentColumn(bufp), ==, 2 );
+
+    // chars across lines go as one range
+    test_dispatch_keys( world, &args, "C-u 9 9 9 9 9 C-d" );
+    char *text = test_buffer_text( bufp );
+    g_assert_cmpstr( text, ==, "aa\n\nbbbb" );
+    g_free( text );
+    test_dispatch_keys( world, &args, "C-u 3 C-d" );
+    text = test_buffer_text( bufp );
+    g_assert_cmpstr( text, ==, "aabbb" );
+    g_free( text );
+    g_assert_cmpint( bufp->getLineCount(bufp), ==, 1 );
+    g_assert_cmpint( bufp->getPoint(bufp), ==, 2 );
+
+    // negative counts go backward, and insert nothing
+    test_dispatch_keys( world, &args, "C-u - 1 C-d C-u - 3 a" );
+    text = test_buffer_text( bufp );
+    g_assert_cmpstr( text, ==, "abbb" );
+    g_free( text );
+    g_assert_cmpint( bufp->getPoint(bufp), ==, 1 );
+    test_dispatch_keys( world, &args, "C-u 3 Return C-u - 2 C-n" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 1 );
+    test_dispatch_keys( world, &args, "C-u - C-n" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 0 );
+
+    // counts past 32 bits are kept whole
+    test_dispatch_keys( world, &args, "C-u 3 0 0 0 0 0 0 0 0 0 C-f" );
+    g_assert_cmpint( bufp->getPoint(bufp), ==, bufp->getCharCount(bufp) );
+    
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+// keys recorded replay in batch, and snapshots don't follow edits
+void test_keyboard_macro()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "macro" );
+    se_buffer *bufp = world->current;
+    bufp->setMajorMode( bufp, "Fundamental" );
+    se_command_args args = se_command_args_init();
+
+    for (int i = 0; i < 500; ++i)
+        bufp->insertString( bufp, "x\n" );
+    bufp->setPoint( bufp, 0 );
+    se_snapshot_pin pin;
+    se_snapshot_publish( bufp );
+    se_snapshot *snap = se_snapshot_acquire( bufp, &pin );
+    int epoch = bufp->snapshots->epoch;
+
+    test_dispatch_keys( world, &args, "C-x ( C-a C-u 2 - C-n C-x )" );
+    g_assert( !world->macro && world->lastMacro );
+    // C-x ) is not part of it
+    g_assert_cmpint( world->lastMacro->len, ==, 5 );
+
+    test_dispatch_keys( world, &args, "C-u 4 9 9 C-x e" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 500 );
+    // edits publish nothing, reader keeps its version
+    g_assert_cmpint( bufp->snapshots->epoch, ==, epoch );
+    g_assert( bufp->snapshots->current == snap && snap->version != bufp->version );
+    // and once it is gone, so is the version
+    se_snapshot_release( &pin );
+    test_dispatch_keys( world, &args, "C-f" );
+    g_assert( !bufp->snapshots->current && !bufp->snapshots->retired );
+    test_dispatch_keys( world, &args, "C-b" );
+    char *text = test_buffer_text( bufp );
+    for (int i = 0; i < 500; ++i)
+        g_assert( strncmp(text + i*4, "--x\n", 4) == 0 );
+    g_free( text );
+
+    // C-g drops one being recorded, last one stays
+    GArray *last = world->lastMacro;
+    test_dispatch_keys( world, &args, "C-x ( a C-g" );
+    g_assert( !world->macro && world->lastMacro == last );
+
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+static int test_dispatch_burst( se_world* world, se_command_args* args, const char* keys )
+{
+    gchar **reps = g_strsplit( keys, " ", -1 );
+    int nr = g_strv_length( reps );
+    se_key *burst = g_new( se_key, nr );
+    for (int i = 0; i < nr; ++i)
+        burst[i] = se_key_from_string( reps[i] );
+    int ret = world->dispatchKeys( world, args, burst, nr );
+    g_free( burst );
+    g_strfreev( reps );
+    return ret;
+}
+
+// plain keys of a burst go in at once, the rest as typed one by one
+void test_dispatch_burst_keys()
+{
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "burst" );
+    se_buffer *bufp = world->current;
+    bufp->setMajorMode( bufp, "Fundamental" );
+    se_command_args args = se_command_args_init();
+
+    int version = bufp->version;
+    g_assert( test_dispatch_burst(world, &args, "a b c d e f") );
+    g_assert( bufp->version == version + 1 );
+    g_assert( test_dispatch_burst(world, &args, "x C-a y z Return C-u 3 q r s") );
+    char *text = test_buffer_text( bufp );
+    g_assert_cmpstr( text, ==, "yz\nqqqrsabcdefx" );
+    g_free( text );
+
+    // a prefix left half typed is kept for keys coming later, and keys
+    // are recorded as typed
+    g_assert( !test_dispatch_burst(world, &args, "a C-x") );
+    g_assert( test_dispatch_burst(world, &args, "( k l m C-x )") );
+    g_assert_cmpint( world->lastMacro->len, ==, 3 );
+    test_dispatch_burst( world, &args, "C-x e" );
+    text = test_buffer_text( bufp );
+    g_assert_cmpstr( text, ==, "yz\nqqqrsaklmklmabcdefx" );
+    g_free( text );
+
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
+// every command put in section editorcmds is found by its name
+void test_command_registry()
+{
+    int nr = se_command_registry_size();
+    g_assert_cmpint( nr, >=, 29 );
+    for (int i = 0; i < nr; ++i) {
+        const se_command_entry *entry = se_command_registry_entry( i );
+        g_assert( entry );
+        g_assert( se_command_lookup(entry->name) == entry->cmd );
+    }
+    g_assert( se_command_lookup("forward-char") == se_forward_char_hooked_command );
+    g_assert( se_command_lookup("undo") == se_undo_command );
+    g_assert( se_command_lookup("forward-cha") == NULL );
+    g_assert( se_command_lookup("") == NULL );
+
+    GLogLevelFlags fatal = g_log_set_always_fatal( G_LOG_FATAL_MASK | G_LOG_LEVEL_CRITICAL );
+    se_world *world = se_world_create();
+    g_log_set_always_fatal( fatal );
+    world->bufferCreate( world, "registry" );
+    se_buffer *bufp = world->current;
+    bufp->setMajorMode( bufp, "Fundamental" );
+    bufp->insertString( bufp, "a\nb\nc\nd\n" );
+    bufp->setPoint( bufp, 0 );
+    se_command_args args = se_command_args_init();
+
+    test_dispatch_keys( world, &args, "M-x n e x t - l i n e Return" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 1 );
+    // C-u count goes to the command read
+    test_dispatch_keys( world, &args, "C-u 2 M-x n e x t - l i n e Return" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 3 );
+    test_dispatch_keys( world, &args, "M-x n o - s u c h Return" );
+    g_assert( !world->prompt );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 3 );
+    // and stays with the M-x it was given to
+    test_dispatch_keys( world, &args, "C-u 3 M-x C-g M-x p r e v i o u s - l i n e Return" );
+    g_assert_cmpint( bufp->getLine(bufp), ==, 2 );
+
+    se_command_args_release( &args );
+    se_world_free( world );
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init( &argc, &argv, NULL );
 
     g_test_add_func( "/semacs/glib", test_glib_funcs );
     g_test_add_func( "/semacs/keys/cntr",  test_key_constructors );
+    g_test_add_func( "/semacs/keys/keyboard-map",  test_keyboard_map );
     g_test_add_func( "/semacs/keyseqs/cntr",  test_keyseq_constructors );
     g_test_add_func( "/semacs/keyseqs/cntr2",  test_keyseq_constructors2 );    
     g_test_add_func( "/semacs/modemap/simple/1", test_modemap1 );
     g_test_add_func( "/semacs/modemap/simple/2", test_modemap2 );
     g_test_add_func( "/semacs/modemap/simple/rebinding", test_modemap3 );
     g_test_add_func( "/semacs/modemap/compound", test_modemap4 );
+    g_test_add_func( "/semacs/modemap/compiled", test_modemap_compiled );
+    g_test_add_func( "/semacs/modemap/builtin", test_modemap_builtin );
+    g_test_add_func( "/semacs/modemap/prefix-dispatch", test_modemap_prefix_dispatch );
+    g_test_add_func( "/semacs/modemap/minor-modes", test_modemap_minor_modes );
+    g_test_add_func( "/semacs/buffer/readfile", test_buffer_read_file );
+    g_test_add_func( "/semacs/buffer/readfile-error", test_buffer_read_file_error );
+    g_test_add_func( "/semacs/buffer/huge", test_buffer_huge_file );
+    g_test_add_func( "/semacs/buffer/delete-chars", test_buffer_delete_chars );
+    g_test_add_func( "/semacs/buffer/repeat-count", test_buffer_repeat_count );
+    g_test_add_func( "/semacs/buffer/keyboard-macro", test_keyboard_macro );
+    g_test_add_func( "/semacs/commands/burst", test_dispatch_burst_keys );
+    g_test_add_func( "/semacs/commands/registry", test_command_registry );
+    g_test_add_func( "/semacs/snapshot/isolation", test_snapshot_isolation );
+    g_test_add_func( "/semacs/snapshot/readers", test_snapshot_concurrent_readers );
+    g_test_add_func( "/semacs/search/kmp", test_kmp_match );
+    g_test_add_func( "/semacs/search/substr", test_substr_search );
+    g_test_add_func( "/semacs/search/lines", test_search_across_lines );
+    g_test_add_func( "/semacs/search/ac-dfa", test_trie_dfa );
+    g_test_add_func( "/semacs/search/ac-hits", test_trie_match_hits );
+    g_test_add_func( "/semacs/search/isearch", test_isearch );
+    g_test_add_func( "/semacs/search/regexp", test_regexp_search );
+    g_test_add_func( "/semacs/search/regexp-buffer", test_regexp_buffer );
+    g_test_add_func( "/semacs/search/parallel", test_parallel_search );
+    g_test_add_func( "/semacs/search/occur", test_occur );
+    g_test_add_func( "/semacs/search/highlight", test_highlight );
+    g_test_add_func( "/semacs/search/replace-all", test_replace_all );
+    g_test_add_func( "/semacs/search/trigram-index", test_tindex );
+    g_test_add_func( "/semacs/search/project", test_project_search );
+    g_test_add_func( "/semacs/switch/fuzzy", test_fuzzy );
+    g_test_add_func( "/semacs/switch/buffer", test_switch_buffer );
     
     g_test_run();
     
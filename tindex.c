@@ -0,0 +1,604 @@
+/**
+ * Trigram index - shortlist files of a project for searching
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "tindex.h"
+
+#include <sys/stat.h>
+
+DEF_CLS(se_tindex_entry);
+struct se_tindex_entry
+{
+    char *name;
+    gint64 mtime;
+    gint64 size;
+    guint32 flags;
+};
+
+#define SE_TRIGRAM(p)  (((guint32)(guchar)(p)[0] << 16) | ((guchar)(p)[1] << 8) | (guchar)(p)[2])
+
+static void se_tindex_put_varint( GByteArray* out, guint32 v )
+{
+    guint8 buf[5];
+    int n = 0;
+    while ( v >= 0x80 ) {
+        buf[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[n++] = v;
+    g_byte_array_append( out, buf, n );
+}
+
+static const guchar* se_tindex_get_varint( const guchar* p, guint32* v )
+{
+    guint32 r = 0;
+    int shift = 0;
+    while ( *p & 0x80 ) {
+        r |= (guint32)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    *v = r | ((guint32)*p++ << shift);
+    return p;
+}
+
+// file ids of a posting list, into ids which holds t->nr_files of them
+static void se_tindex_decode( se_tindex* idx, const se_tindex_trigram* t, guint32* ids )
+{
+    const guchar *p = idx->postings + t->postings;
+    guint32 id = 0, gap;
+    for (guint32 i = 0; i < t->nr_files; ++i) {
+        p = se_tindex_get_varint( p, &gap );
+        id += gap;
+        ids[i] = id;
+    }
+}
+
+static const se_tindex_trigram* se_tindex_lookup( se_tindex* idx, guint32 trigram )
+{
+    int lo = 0, hi = idx->header->nr_trigrams;
+    while ( lo < hi ) {
+        int mid = (lo + hi) / 2;
+        if ( idx->trigrams[mid].trigram < trigram )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if ( lo < idx->header->nr_trigrams && idx->trigrams[lo].trigram == trigram )
+        return &idx->trigrams[lo];
+    return NULL;
+}
+
+// id of file by name, or -1
+static int se_tindex_find_file( se_tindex* idx, const char* name )
+{
+    int lo = 0, hi = idx->header->nr_files;
+    while ( lo < hi ) {
+        int mid = (lo + hi) / 2;
+        int cmp = strcmp( idx->names + idx->files[mid].name, name );
+        if ( cmp == 0 )
+            return mid;
+        if ( cmp < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return -1;
+}
+
+static char* se_tindex_path( const char* root )
+{
+    return g_build_filename( root, SE_TINDEX_FILE_NAME, NULL );
+}
+
+se_tindex* se_tindex_open( const char* root )
+{
+    g_assert( root );
+    char *path = se_tindex_path( root );
+    GMappedFile *map = g_mapped_file_new( path, FALSE, NULL );
+    g_free( path );
+    if ( !map )
+        return NULL;
+
+    const char *data = g_mapped_file_get_contents( map );
+    gsize size = g_mapped_file_get_length( map );
+    const se_tindex_header *hdr = (const se_tindex_header*)data;
+    if ( size < sizeof(se_tindex_header) || memcmp(hdr->magic, SE_TINDEX_MAGIC, 8) != 0
+         || hdr->size != size
+         || hdr->files + (guint64)hdr->nr_files * sizeof(se_tindex_file) > hdr->names
+         || hdr->names > hdr->trigrams
+         || hdr->trigrams + (guint64)hdr->nr_trigrams * sizeof(se_tindex_trigram) > hdr->postings
+         || hdr->postings > size ) {
+        se_debug( "bad index of %s", root );
+        g_mapped_file_unref( map );
+        return NULL;
+    }
+
+    se_tindex *idx = g_malloc0( sizeof(se_tindex) );
+    idx->root = g_strdup( root );
+    idx->map = map;
+    idx->header = hdr;
+    idx->files = (const se_tindex_file*)(data + hdr->files);
+    idx->names = data + hdr->names;
+    idx->trigrams = (const se_tindex_trigram*)(data + hdr->trigrams);
+    idx->postings = (const guchar*)(data + hdr->postings);
+    return idx;
+}
+
+void se_tindex_free( se_tindex* idx )
+{
+    g_assert( idx );
+    g_mapped_file_unref( idx->map );
+    g_free( idx->root );
+    g_free( idx );
+}
+
+char* se_tindex_find_root( const char* dir )
+{
+    g_assert( dir );
+    char *root = g_strdup( dir );
+    for (;;) {
+        char *path = se_tindex_path( root );
+        gboolean found = g_file_test( path, G_FILE_TEST_IS_REGULAR );
+        g_free( path );
+        if ( found )
+            return root;
+        
+        char *parent = g_path_get_dirname( root );
+        gboolean top = strcmp( parent, root ) == 0;
+        g_free( root );
+        root = parent;
+        if ( top )
+            break;
+    }
+    g_free( root );
+    return g_strdup( dir );
+}
+
+const char* se_tindex_file_name( se_tindex* idx, int id )
+{
+    g_assert( idx && id >= 0 && id < idx->header->nr_files );
+    return idx->names + idx->files[id].name;
+}
+
+// regular files under dir, symbolic links are not followed
+static void se_tindex_walk( const char* root, const char* dir, GArray* entries )
+{
+    char *path = g_build_filename( root, dir, NULL );
+    GDir *gdir = g_dir_open( path, 0, NULL );
+    g_free( path );
+    if ( !gdir )
+        return;
+
+    const char *base;
+    while ( (base = g_dir_read_name(gdir)) ) {
+        if ( base[0] == '.' )
+            continue;
+        char *name = dir[0] ? g_build_filename( dir, base, NULL ): g_strdup( base );
+        char *full = g_build_filename( root, name, NULL );
+        struct stat st;
+        int ret = lstat( full, &st );
+        if ( ret == 0 && S_ISDIR(st.st_mode) ) {
+            se_tindex_walk( root, name, entries );
+            g_free( name );
+        } else if ( ret == 0 && S_ISREG(st.st_mode) ) {
+            gint64 mtime = (gint64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            se_tindex_entry entry = { name, mtime, st.st_size, 0 };
+            g_array_append_val( entries, entry );
+        } else
+            g_free( name );
+        g_free( full );
+    }
+    g_dir_close( gdir );
+}
+
+static gint se_tindex_compare_entry( gconstpointer a, gconstpointer b )
+{
+    return strcmp( ((const se_tindex_entry*)a)->name, ((const se_tindex_entry*)b)->name );
+}
+
+static int se_tindex_compare_pair( const void* a, const void* b )
+{
+    guint64 x = *(const guint64*)a, y = *(const guint64*)b;
+    return x < y ? -1: x > y;
+}
+
+// (trigram, id) pairs of every distinct trigram in text
+static void se_tindex_add_text( GArray* pairs, guint32 id, const char* text, gsize len,
+                                guint32* seen )
+{
+    guint start = pairs->len;
+    for (gsize i = 0; i + 2 < len; ++i) {
+        guint32 t = SE_TRIGRAM( text + i );
+        if ( seen[t >> 5] & (1u << (t & 31)) )
+            continue;
+        seen[t >> 5] |= 1u << (t & 31);
+        guint64 pair = ((guint64)t << 32) | id;
+        g_array_append_val( pairs, pair );
+    }
+    // clear only what this file set
+    for (guint i = start; i < pairs->len; ++i) {
+        guint32 t = g_array_index( pairs, guint64, i ) >> 32;
+        seen[t >> 5] = 0;
+    }
+}
+
+// merge two sorted arrays of pairs, both are freed
+static GArray* se_tindex_merge( GArray* a, GArray* b )
+{
+    GArray *out = g_array_sized_new( FALSE, FALSE, sizeof(guint64), a->len + b->len );
+    const guint64 *x = (const guint64*)a->data, *y = (const guint64*)b->data;
+    guint i = 0, j = 0;
+    while ( i < a->len && j < b->len ) {
+        if ( x[i] < y[j] )
+            g_array_append_val( out, x[i++] );
+        else
+            g_array_append_val( out, y[j++] );
+    }
+    g_array_append_vals( out, x + i, a->len - i );
+    g_array_append_vals( out, y + j, b->len - j );
+    g_array_free( a, TRUE );
+    g_array_free( b, TRUE );
+    return out;
+}
+
+static void se_tindex_free_entries( GArray* entries )
+{
+    for (int i = 0; i < entries->len; ++i)
+        g_free( g_array_index(entries, se_tindex_entry, i).name );
+    g_array_free( entries, TRUE );
+}
+
+static void se_tindex_align( GByteArray* out )
+{
+    static const guint8 zeros[8];
+    if ( out->len % 8 )
+        g_byte_array_append( out, zeros, 8 - out->len % 8 );
+}
+
+static GByteArray* se_tindex_write( GArray* entries, GArray* pairs )
+{
+    GByteArray *out = g_byte_array_new();
+    se_tindex_header hdr;
+    memset( &hdr, 0, sizeof hdr );
+    memcpy( hdr.magic, SE_TINDEX_MAGIC, 8 );
+    hdr.nr_files = entries->len;
+    g_byte_array_append( out, (const guint8*)&hdr, sizeof hdr );
+
+    hdr.files = out->len;
+    guint32 name = 0;
+    for (int i = 0; i < entries->len; ++i) {
+        se_tindex_entry *entry = &g_array_index( entries, se_tindex_entry, i );
+        se_tindex_file file = { entry->mtime, entry->size, name, entry->flags };
+        g_byte_array_append( out, (const guint8*)&file, sizeof file );
+        name += strlen( entry->name ) + 1;
+    }
+    hdr.names = out->len;
+    for (int i = 0; i < entries->len; ++i) {
+        se_tindex_entry *entry = &g_array_index( entries, se_tindex_entry, i );
+        g_byte_array_append( out, (const guint8*)entry->name, strlen(entry->name) + 1 );
+    }
+    se_tindex_align( out );
+
+    // pairs are sorted, so each trigram's ids come together and in order
+    GByteArray *postings = g_byte_array_new();
+    hdr.trigrams = out->len;
+    for (guint i = 0; i < pairs->len; ) {
+        guint32 t = g_array_index( pairs, guint64, i ) >> 32;
+        se_tindex_trigram trigram = { t, 0, postings->len };
+        guint32 last = 0;
+        for (; i < pairs->len && (g_array_index(pairs, guint64, i) >> 32) == t; ++i) {
+            guint32 id = (guint32)g_array_index( pairs, guint64, i );
+            se_tindex_put_varint( postings, id - last );
+            last = id;
+            trigram.nr_files++;
+        }
+        g_byte_array_append( out, (const guint8*)&trigram, sizeof trigram );
+        hdr.nr_trigrams++;
+    }
+    hdr.postings = out->len;
+    g_byte_array_append( out, postings->data, postings->len );
+    g_byte_array_free( postings, TRUE );
+
+    hdr.size = out->len;
+    memcpy( out->data, &hdr, sizeof hdr );
+    return out;
+}
+
+se_tindex* se_tindex_update( const char* root, const char** error )
+{
+    g_assert( root );
+    GArray *entries = g_array_new( FALSE, FALSE, sizeof(se_tindex_entry) );
+    se_tindex_walk( root, "", entries );
+    g_array_sort( entries, se_tindex_compare_entry );
+
+    se_tindex *old = se_tindex_open( root );
+    int nr_old = old ? old->header->nr_files: 0;
+    gint32 *old_to_new = g_new( gint32, nr_old + 1 );
+    for (int i = 0; i < nr_old; ++i)
+        old_to_new[i] = -1;
+
+    GArray *pairs = g_array_new( FALSE, FALSE, sizeof(guint64) );
+    GArray *scans = g_array_new( FALSE, FALSE, sizeof(int) );
+    for (int i = 0; i < entries->len; ++i) {
+        se_tindex_entry *entry = &g_array_index( entries, se_tindex_entry, i );
+        int id = old ? se_tindex_find_file( old, entry->name ): -1;
+        if ( id >= 0 && old->files[id].mtime == entry->mtime
+             && old->files[id].size == entry->size
+             && !(old->files[id].flags & SE_TINDEX_UNREADABLE) ) {
+            old_to_new[id] = i;
+            entry->flags = old->files[id].flags;
+        } else
+            g_array_append_val( scans, i );
+    }
+
+    int nr_reused = 0;
+    for (int i = 0; i < nr_old; ++i)
+        nr_reused += old_to_new[i] >= 0;
+    if ( old && nr_reused == nr_old && entries->len == nr_old ) {
+        // nothing changed, the old one is as good
+        g_free( old_to_new );
+        g_array_free( scans, TRUE );
+        g_array_free( pairs, TRUE );
+        se_tindex_free_entries( entries );
+        old->nr_reused = nr_reused;
+        old->nr_scanned = 0;
+        return old;
+    }
+
+    /**
+     * unchanged files keep their trigrams, read back from old posting lists.
+     * files are sorted by name in both indexes, so ids keep their order and
+     * these pairs come out sorted.
+     */
+    if ( old ) {
+        guint32 *ids = g_new( guint32, nr_old + 1 );
+        for (guint32 t = 0; t < old->header->nr_trigrams; ++t) {
+            const se_tindex_trigram *trigram = &old->trigrams[t];
+            se_tindex_decode( old, trigram, ids );
+            for (guint32 i = 0; i < trigram->nr_files; ++i) {
+                if ( ids[i] < nr_old && old_to_new[ids[i]] >= 0 ) {
+                    guint64 pair = ((guint64)trigram->trigram << 32) | old_to_new[ids[i]];
+                    g_array_append_val( pairs, pair );
+                }
+            }
+        }
+        g_free( ids );
+        se_tindex_free( old );
+    }
+    g_free( old_to_new );
+
+    GArray *fresh = g_array_new( FALSE, FALSE, sizeof(guint64) );
+    guint32 *seen = g_new0( guint32, (1 << 24) / 32 );
+    for (int i = 0; i < scans->len; ++i) {
+        int id = g_array_index( scans, int, i );
+        se_tindex_entry *entry = &g_array_index( entries, se_tindex_entry, id );
+        if ( entry->size > SE_TINDEX_MAX_FILE ) {
+            entry->flags = SE_TINDEX_UNINDEXED;
+            continue;
+        }
+        
+        char *full = g_build_filename( root, entry->name, NULL );
+        char *text = NULL;
+        gsize len = 0;
+        if ( g_file_get_contents(full, &text, &len, NULL) ) {
+            if ( memchr(text, 0, len) )
+                entry->flags = SE_TINDEX_BINARY;
+            else
+                se_tindex_add_text( fresh, id, text, len, seen );
+            g_free( text );
+        } else
+            entry->flags = SE_TINDEX_UNREADABLE;
+        g_free( full );
+    }
+    g_free( seen );
+    qsort( fresh->data, fresh->len, sizeof(guint64), se_tindex_compare_pair );
+    pairs = se_tindex_merge( pairs, fresh );
+
+    GByteArray *out = se_tindex_write( entries, pairs );
+    char *path = se_tindex_path( root );
+    gboolean written = g_file_set_contents( path, (const gchar*)out->data, out->len, NULL );
+    g_free( path );
+    g_byte_array_free( out, TRUE );
+    int nr_scanned = scans->len;
+    g_array_free( scans, TRUE );
+    g_array_free( pairs, TRUE );
+    se_tindex_free_entries( entries );
+
+    se_tindex *idx = written ? se_tindex_open( root ): NULL;
+    if ( !idx ) {
+        if ( error )
+            *error = "can not write index";
+        return NULL;
+    }
+    idx->nr_reused = nr_reused;
+    idx->nr_scanned = nr_scanned;
+    return idx;
+}
+
+static gint se_tindex_compare_size( gconstpointer a, gconstpointer b )
+{
+    const se_tindex_trigram *x = *(const se_tindex_trigram* const*)a;
+    const se_tindex_trigram *y = *(const se_tindex_trigram* const*)b;
+    return x->nr_files < y->nr_files ? -1: x->nr_files > y->nr_files;
+}
+
+// mark files having every trigram of literal in candidate
+static void se_tindex_intersect( se_tindex* idx, const char* literal, int len,
+                                 gboolean* candidate )
+{
+    int nr_files = idx->header->nr_files;
+    GPtrArray *lists = g_ptr_array_new();
+    for (int i = 0; i + 2 < len; ++i) {
+        const se_tindex_trigram *t = se_tindex_lookup( idx, SE_TRIGRAM(literal + i) );
+        if ( !t ) {
+            g_ptr_array_free( lists, TRUE );
+            return;
+        }
+        g_ptr_array_add( lists, (gpointer)t );
+    }
+    // shortest list first, so the rest only narrow a few ids
+    g_ptr_array_sort( lists, se_tindex_compare_size );
+
+    guint32 *ids = g_new( guint32, nr_files + 1 );
+    guint32 *other = g_new( guint32, nr_files + 1 );
+    const se_tindex_trigram *first = g_ptr_array_index( lists, 0 );
+    se_tindex_decode( idx, first, ids );
+    guint32 nr = first->nr_files;
+    for (int l = 1; l < lists->len && nr; ++l) {
+        const se_tindex_trigram *t = g_ptr_array_index( lists, l );
+        se_tindex_decode( idx, t, other );
+        guint32 n = 0, j = 0;
+        for (guint32 i = 0; i < nr; ++i) {
+            while ( j < t->nr_files && other[j] < ids[i] )
+                ++j;
+            if ( j < t->nr_files && other[j] == ids[i] )
+                ids[n++] = ids[i];
+        }
+        nr = n;
+    }
+    for (guint32 i = 0; i < nr; ++i) {
+        if ( ids[i] < nr_files )
+            candidate[ids[i]] = TRUE;
+    }
+    g_free( other );
+    g_free( ids );
+    g_ptr_array_free( lists, TRUE );
+}
+
+char** se_tindex_candidates( se_tindex* idx, const char* pattern, gboolean regexp,
+                             const char** error )
+{
+    g_assert( idx && pattern );
+    const char *literal = pattern;
+    int len = strlen( pattern );
+    regexp_entry *re = NULL;
+    if ( regexp ) {
+        re = regexp_compile( pattern, error );
+        if ( !re )
+            return NULL;
+        literal = re->prefix ? re->prefix->pat: "";
+        len = re->prefix ? re->prefix->len: 0;
+    }
+
+    int nr_files = idx->header->nr_files;
+    gboolean *candidate = g_new0( gboolean, nr_files + 1 );
+    if ( len < 3 ) {
+        for (int i = 0; i < nr_files; ++i)
+            candidate[i] = TRUE;
+    } else
+        se_tindex_intersect( idx, literal, len, candidate );
+    if ( re )
+        regexp_free( re );
+
+    GPtrArray *names = g_ptr_array_new();
+    for (int i = 0; i < nr_files; ++i) {
+        const se_tindex_file *file = &idx->files[i];
+        if ( file->flags & (SE_TINDEX_BINARY | SE_TINDEX_UNREADABLE) )
+            continue;
+        if ( candidate[i] || (file->flags & SE_TINDEX_UNINDEXED) )
+            g_ptr_array_add( names, g_build_filename(idx->root, idx->names + file->name, NULL) );
+    }
+    g_ptr_array_add( names, NULL );
+    g_free( candidate );
+    return (char**)g_ptr_array_free( names, FALSE );
+}
+
+char** se_tindex_search( se_tindex* idx, const char* pattern, gboolean regexp,
+                         int* nr_candidates, const char** error )
+{
+    char **candidates = se_tindex_candidates( idx, pattern, regexp, error );
+    if ( !candidates )
+        return NULL;
+    char *quoted = regexp ? NULL: regexp_quote( pattern );
+    regexp_entry *re = regexp_compile( quoted ? quoted: pattern, error );
+    g_free( quoted );
+    g_assert( re );
+
+    GPtrArray *hits = g_ptr_array_new();
+    int n = 0;
+    for (; candidates[n]; ++n) {
+        char *text = NULL;
+        gsize len = 0;
+        if ( !g_file_get_contents(candidates[n], &text, &len, NULL) )
+            continue;
+        if ( regexp_search(re, text, len, 0, NULL) >= 0 )
+            g_ptr_array_add( hits, g_strdup(candidates[n]) );
+        g_free( text );
+    }
+    if ( nr_candidates )
+        *nr_candidates = n;
+    regexp_free( re );
+    g_strfreev( candidates );
+    g_ptr_array_add( hits, NULL );
+    return (char**)g_ptr_array_free( hits, FALSE );
+}
+
+static void se_tindex_job_unref( se_tindex_job* job )
+{
+    if ( !g_atomic_int_dec_and_test(&job->refs) )
+        return;
+    g_strfreev( job->hits );
+    g_free( job->root );
+    g_free( job->pattern );
+    g_free( job );
+}
+
+static gpointer se_tindex_job_run( gpointer data )
+{
+    se_tindex_job *job = data;
+    const char *error = NULL;
+    se_tindex *idx = se_tindex_update( job->root, &error );
+    if ( idx && !g_atomic_int_get(&job->cancelled) ) {
+        job->hits = se_tindex_search( idx, job->pattern, job->regexp,
+                                      &job->nr_candidates, &error );
+        job->nr_reused = idx->nr_reused;
+        job->nr_scanned = idx->nr_scanned;
+    }
+    if ( idx )
+        se_tindex_free( idx );
+    job->error = error;
+    g_atomic_int_set( &job->done, 1 );
+    se_tindex_job_unref( job );
+    return NULL;
+}
+
+se_tindex_job* se_tindex_job_start( const char* root, const char* pattern, gboolean regexp )
+{
+    g_assert( root && pattern );
+    se_tindex_job *job = g_malloc0( sizeof(se_tindex_job) );
+    job->root = g_strdup( root );
+    job->pattern = g_strdup( pattern );
+    job->regexp = regexp;
+    job->refs = 2;
+    g_thread_unref( g_thread_new("tindex", se_tindex_job_run, job) );
+    return job;
+}
+
+gboolean se_tindex_job_poll( se_tindex_job* job )
+{
+    g_assert( job );
+    return g_atomic_int_get( &job->done ) != 0;
+}
+
+void se_tindex_job_free( se_tindex_job* job )
+{
+    if ( job ) {
+        g_atomic_int_set( &job->cancelled, 1 );
+        se_tindex_job_unref( job );
+    }
+}
@@ -0,0 +1,163 @@
+/**
+ * Trigram index - shortlist files of a project for searching
+ * Copyright (C) 2010 Sian Cao <sycao@redflag-linux.com>
+ *  
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *  
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *  
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/**
+ * an index of a directory tree, from each trigram (3 bytes in a row) to the
+ * files containing it. a literal needs all of its trigrams in a file to
+ * occur there, so intersecting their lists leaves few files to search.
+ *
+ * index is kept in a single file under root, laid out to be mapped and used
+ * in place: a header, files sorted by name, trigrams sorted, and posting
+ * lists of file ids as varint coded gaps. updating takes files whose mtime
+ * and size did not change from the old index, and only reads the others.
+ * dot files and directories are not indexed, so neither is the index itself.
+ */
+
+#ifndef _semacs_tindex_h
+#define _semacs_tindex_h
+
+#include "util.h"
+#include "submatch.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SE_TINDEX_FILE_NAME  ".semacs-index"
+#define SE_TINDEX_MAGIC      "SETRI001"
+// larger files are listed but not indexed, so they are always searched
+#define SE_TINDEX_MAX_FILE   (64 << 20)
+
+DEF_CLS(se_tindex_header);
+struct se_tindex_header
+{
+    char magic[8];
+    guint32 nr_files;
+    guint32 nr_trigrams;
+    // offsets of sections from start of file
+    guint64 files;
+    guint64 names;
+    guint64 trigrams;
+    guint64 postings;
+    guint64 size;
+};
+
+enum {
+    SE_TINDEX_BINARY = 1,    // has a NUL byte, never searched
+    SE_TINDEX_UNINDEXED = 2, // too large, a candidate of every search
+    SE_TINDEX_UNREADABLE = 4, // could not be read, tried again by every update
+};
+
+DEF_CLS(se_tindex_file);
+struct se_tindex_file
+{
+    gint64 mtime;   // in nanoseconds
+    gint64 size;
+    guint32 name;   // offset in names, relative to root and NUL terminated
+    guint32 flags;
+};
+
+DEF_CLS(se_tindex_trigram);
+struct se_tindex_trigram
+{
+    guint32 trigram;  // bytes in order from high to low
+    guint32 nr_files;
+    guint64 postings; // offset in postings
+};
+
+DEF_CLS(se_tindex);
+struct se_tindex
+{
+    char *root;
+    GMappedFile *map;
+    const se_tindex_header *header;
+    const se_tindex_file *files;
+    const char *names;
+    const se_tindex_trigram *trigrams;
+    const guchar *postings;
+
+    // by last update
+    int nr_reused;   // taken from old index
+    int nr_scanned;  // read again
+};
+
+/**
+ * map index of root, return NULL if there is none or it is not valid.
+ */
+extern se_tindex* se_tindex_open( const char* root );
+/**
+ * bring index of root up to date with the tree, and map it. return NULL and
+ * set *error to a static message if it can't be written.
+ */
+extern se_tindex* se_tindex_update( const char* root, const char** error );
+extern void se_tindex_free( se_tindex* );
+// nearest of dir and its parents having an index, or dir if none has, g_free() it
+extern char* se_tindex_find_root( const char* dir );
+
+// a file name relative to root
+extern const char* se_tindex_file_name( se_tindex*, int id );
+/**
+ * full names of files which may have a match of pattern, g_strfreev() it.
+ * a regexp is narrowed by the literal its matches start with, if any.
+ * return NULL and set *error if pattern is invalid.
+ */
+extern char** se_tindex_candidates( se_tindex*, const char* pattern, gboolean regexp,
+                                    const char** error );
+/**
+ * candidates which really have a match, searched in turn. *nr_candidates
+ * tells how many were searched.
+ */
+extern char** se_tindex_search( se_tindex*, const char* pattern, gboolean regexp,
+                                int* nr_candidates, const char** error );
+
+/**
+ * updating index of root and searching it, done in a thread of its own, as
+ * walking a large tree and reading what changed takes long. owner polls it
+ * and takes results once done; one dropped while running is thrown away by
+ * its thread when that finishes.
+ */
+DEF_CLS(se_tindex_job);
+struct se_tindex_job
+{
+    char *root;
+    char *pattern;
+    gboolean regexp;
+    int refs;      // owner and thread
+    int cancelled;
+    int done;
+
+    // set by thread before done, read by owner after
+    char **hits;   // NULL if failed, error then tells why
+    const char *error;
+    int nr_reused;
+    int nr_scanned;
+    int nr_candidates;
+};
+
+extern se_tindex_job* se_tindex_job_start( const char* root, const char* pattern,
+                                           gboolean regexp );
+// TRUE once job is done
+extern gboolean se_tindex_job_poll( se_tindex_job* );
+extern void se_tindex_job_free( se_tindex_job* );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
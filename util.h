@@ -34,24 +34,52 @@
 
 #define SE_UNUSED __attribute__ ((unused))
 
+/**
+ * offsets, lengths and line numbers inside a buffer are 64 bits wide, so files
+ * larger than 2G can be represented, and so are counts of commands moving
+ * over them. print them with %lld.
+ */
+typedef long long se_off_t;
+
 #ifdef G_LOG_DOMAIN
 #undef G_LOG_DOMAIN
 #define G_LOG_DOMAIN "semacs"
 #endif
 
+/**
+ * g_debug formats message before it is dropped, which is most of the time.
+ * debug messages are only wanted with G_MESSAGES_DEBUG set, so look at it
+ * once, and skip formatting (and args) otherwise.
+ */
+static inline gboolean se_debug_on()
+{
+    static int on = -1;
+    if ( on < 0 ) {
+        const char *domains = g_getenv( "G_MESSAGES_DEBUG" );
+        on = domains && *domains;
+    }
+    return on;
+}
+
 #ifdef __cplusplus
 
 #define se_error(fmt, ...) g_error( "[%s]: "#fmt, __FILE__, ##__VA_ARGS__ )
 #define se_msg(fmt, ...)   g_message( "[%s]: "#fmt, __FILE__, ##__VA_ARGS__ )
 #define se_warn(fmt, ...)  g_warning( "[%s]: "#fmt, __FILE__, ##__VA_ARGS__ )
-#define se_debug(fmt, ...) g_debug( "[%s]: "#fmt, __FILE__, ##__VA_ARGS__ )
+#define se_debug(fmt, ...) do {                                          \
+        if ( se_debug_on() )                                            \
+            g_debug( "[%s]: "#fmt, __FILE__, ##__VA_ARGS__ );           \
+    } while (0)
 
 #else
 
 #define se_error(fmt, ...) g_error( "[%s]: "#fmt, __func__, ##__VA_ARGS__ )
 #define se_msg(fmt, ...)   g_message( fmt, ##__VA_ARGS__ )
 #define se_warn(fmt, ...)  g_warning( "[%s]: "#fmt, __func__, ##__VA_ARGS__ )
-#define se_debug(fmt, ...) g_debug( "[%s]: "#fmt, __func__, ##__VA_ARGS__ )
+#define se_debug(fmt, ...) do {                                          \
+        if ( se_debug_on() )                                            \
+            g_debug( "[%s]: "#fmt, __func__, ##__VA_ARGS__ );           \
+    } while (0)
 
 #endif
 
@@ -102,6 +130,7 @@
 #define BETWEEN_EX(mem, min, max)  ((mem > (min)) && (mem < (max)))
 
 #define SE_DYNAMIC __attribute__((weak))
-#define SE_ATTR_RELOC  __attribute__(( __section__(".editorcmds") ))
+// no dot in section name, so the linker defines __start_ and __stop_ of it
+#define SE_ATTR_RELOC  __attribute__(( __section__("editorcmds"), __used__ ))
 #endif // ~end of file
 
@@ -20,6 +20,8 @@
 #include "xview.h"
 #include "key.h"
 #include "editor.h"
+#include "occur.h"
+#include "highlight.h"
 #include <locale.h>
 
 SE_VIEW_HANDLER( se_text_xviewer_key_event );
@@ -119,6 +121,25 @@ static void se_draw_buffer_point( se_text_xviewer* viewer )
     XftColorFree( env->display, env->visual, env->colormap, &clr );
 }
 
+// paint matches on row under its text
+static void se_draw_highlights( se_text_xviewer* viewer, XftColor* color, int row )
+{
+    se_env *env = viewer->env;
+    se_buffer *cur_buf = env->world->current;
+    if ( !cur_buf->highlight )
+        return;
+
+    int nr_spans = 0;
+    const se_highlight_span *spans = se_highlight_line_spans( cur_buf->highlight, row,
+                                                              &nr_spans );
+    for (int i = 0; i < nr_spans && spans[i].start < viewer->columns; ++i) {
+        int end = MIN( spans[i].end, viewer->columns );
+        se_position pos = se_text_cursor_to_physical( viewer, (se_cursor){ spans[i].start, row } );
+        XftDrawRect( viewer->xftDraw, color, pos.x, pos.y,
+                     (end - spans[i].start) * env->glyphMaxWidth, env->glyphMaxHeight );
+    }
+}
+
 // send draw event and do real update in redisplay routine
 static void se_text_xviewer_repaint( se_text_xviewer* viewer )
 {
@@ -135,18 +156,22 @@ static void se_text_xviewer_repaint( se_text_xviewer* viewer )
 
     //FIXME: this is slow algo just as a demo, change it later
     se_line* lp = cur_buf->lines;
-    int nr_lines = cur_buf->getLineCount( cur_buf );
+    int nr_lines = (int)MIN( cur_buf->getLineCount( cur_buf ), SE_MAX_ROWS );
     se_debug( "paint rect: rows: %d", nr_lines );
     
     for (int r = 0; r < MIN(viewer->rows, nr_lines); ++r) {
         const char* buf = se_line_getData( lp );
-        int cols = se_line_getLineLength( lp );
+        se_off_t cols = MIN( se_line_getLineLength( lp ), SE_MAX_COLUMNS-1 );
         if ( buf[cols-1] == '\n' ) cols--;
-        memcpy( (viewer->content + r*SE_MAX_ROWS), buf, cols );
-        *(viewer->content + r*SE_MAX_ROWS+cols) = '\0';
+        memcpy( (viewer->content + r*SE_MAX_COLUMNS), buf, cols );
+        *(viewer->content + r*SE_MAX_COLUMNS+cols) = '\0';
         /* se_debug( "draw No.%d: [%s]", r, buf ); */
         lp = lp->next;
     }
+
+    // only edited lines are matched again
+    if ( cur_buf->highlight )
+        se_highlight_update( cur_buf->highlight, MIN(viewer->rows, nr_lines) );
 }
 
 static void se_text_xviewer_redisplay(se_text_xviewer* viewer )
@@ -164,11 +189,20 @@ static void se_text_xviewer_redisplay(se_text_xviewer* viewer )
     XftColor clr;
     XftColorAllocValue( env->display, env->visual, env->colormap, &renderClr, &clr );
 
+    XRenderColor matchRenderClr = {
+        .red = 0xffff,
+        .green = 0xe000,
+        .blue = 0x4000,
+        .alpha = 0xffff
+    };
+    XftColor match_clr;
+    XftColorAllocValue( env->display, env->visual, env->colormap, &matchRenderClr, &match_clr );
+
     se_world *world = viewer->env->world;
     g_assert( world );
     se_buffer *cur_buf = world->current;
     g_assert( cur_buf );
-    int nr_lines = cur_buf->getLineCount( cur_buf );
+    int nr_lines = (int)MIN( cur_buf->getLineCount( cur_buf ), SE_MAX_ROWS );
     se_debug( "update buf %s [%d, %d]", cur_buf->getBufferName(cur_buf),
               viewer->columns, MIN(viewer->rows, nr_lines) );    
 
@@ -177,8 +211,9 @@ static void se_text_xviewer_redisplay(se_text_xviewer* viewer )
     
     viewer->cursor = (se_cursor){ 0, 0 };
     for (int r = 0; r < MIN(viewer->rows, nr_lines); ++r) {
-        char *data = viewer->content + r*SE_MAX_ROWS;
+        char *data = viewer->content + r*SE_MAX_COLUMNS;
         int data_len = strlen( data );
+        se_draw_highlights( viewer, &match_clr, r );
         se_draw_text_utf8( viewer, &clr, viewer->cursor,
                            data, MIN(data_len, viewer->columns) );
         viewer->cursor = (se_cursor){0, viewer->cursor.row + 1};
@@ -186,6 +221,7 @@ static void se_text_xviewer_redisplay(se_text_xviewer* viewer )
 
     se_draw_buffer_point( viewer );
     XftColorFree( env->display, env->visual, env->colormap, &clr );
+    XftColorFree( env->display, env->visual, env->colormap, &match_clr );
 }
 
 void se_text_xviewer_configure_change_handler(se_text_xviewer* viewer, XEvent* ev )
@@ -215,85 +251,15 @@ void se_text_xviewer_configure_change_handler(se_text_xviewer* viewer, XEvent* e
     }
 }
 
-static se_key se_key_event_process( Display *display, XKeyEvent kev )
-{
-    int index = 0;
-    int mask = 0;
-    
-    if ( kev.state & ShiftMask ) {
-        mask = 0x01;
-    }
-    if ( kev.state & LockMask ) {
-        mask |= 0x02;
-    }
-    if ( mask ) index = 1;
-    
-    KeySym key_sym = XKeycodeToKeysym( display, kev.keycode, index );
-    if ( key_sym == NoSymbol ) {
-        se_debug( "NoSymbol for keycode %d", kev.keycode );
-    }
-
-    se_key sekey = se_key_null_init();
-    char *key_str = XKeysymToString( key_sym );
-
-    // FIXME: this is a simplified version, since KeySym actually follow latin-1
-    // except for some terminal control keys
-    if ( g_str_has_prefix(key_str, "Alt")
-         || g_str_has_prefix(key_str, "Meta")
-         || g_str_has_prefix(key_str, "Super")
-         || g_str_has_prefix(key_str, "Control")
-         || g_str_has_prefix(key_str, "Shift") ) {
-        return sekey;
-    }
-    sekey.ascii = key_sym;
-    
-    if ( kev.state & ControlMask ) {
-        sekey.modifiers |= ControlDown;
-    }
-    if ( kev.state & ShiftMask ) {
-        sekey.modifiers |= ShiftDown;
-    }
-    if ( kev.state & Mod1Mask ) {
-        sekey.modifiers |= MetaDown;
-    }
-
-    if ( kev.state & Mod4Mask ) {
-        // this is no good, Mod4 can be map to other keysym
-        sekey.modifiers |= SuperDown;
-    }
-
-    if ( sekey.modifiers == ShiftDown ) { // here Shift is not part of combination
-                                        // only change case of char
-        sekey.modifiers = 0;
-    }
-    
-    se_debug( "sekey(%s): %s", key_str, se_key_to_string(sekey) );
-    return sekey;
-}
-
-static se_key se_delayed_wait_key(se_text_xviewer* viewer)
-{
-    se_debug( "waiting for a key..." );    
-    XEvent ev;
-    while ( XCheckWindowEvent( viewer->env->display, viewer->view,
-                               KeyPressMask, &ev ) == False ) {
-        usleep( 100 );
-    }
-
-    /* g_assert( ev.type == KeyPress ); */
-    se_debug( "wait for a key done" );
-    return se_key_event_process( viewer->env->display, ev.xkey );
-}
-
 // return TRUE if input is a composed str from IM, and returned from arg str
 static gboolean se_text_xviewer_lookup_string(se_text_xviewer* viewer, XKeyEvent* kev,
-                                             GString *str)
+                                              char* buf, int buf_len)
 {
-    char buf[64] = "";
-    int buf_len = sizeof buf - 1;
+    buf[0] = '\0';
     KeySym keysym;
     Status status;
-    Xutf8LookupString( viewer->xic, kev, buf, buf_len, &keysym, &status );
+    int len = Xutf8LookupString( viewer->xic, kev, buf, buf_len - 1, &keysym, &status );
+    buf[status == XBufferOverflow ? 0: len] = '\0';
     gboolean composed_input = FALSE;
     switch (status) {
     case XBufferOverflow:
@@ -321,7 +287,6 @@ static gboolean se_text_xviewer_lookup_string(se_text_xviewer* viewer, XKeyEvent
                 
     case XLookupChars:
         se_debug( "XLookupChars: buf: [%s]", buf );
-        g_string_printf( str, "%s", buf );
         composed_input = TRUE;
         break;
     }
@@ -329,6 +294,74 @@ static gboolean se_text_xviewer_lookup_string(se_text_xviewer* viewer, XKeyEvent
     return composed_input;
 }
 
+// take keys already queued after first one, so a burst of typing or
+// auto-repeat is dispatched at once and redrawn once. never waits.
+static int se_text_xviewer_drain_keys(se_text_xviewer* viewer, se_key* keys, int nr)
+{
+    XEvent ev;
+    while ( nr < SE_MAX_KEY_BURST
+            && XCheckWindowEvent(viewer->env->display, viewer->view,
+                                 KeyPressMask | KeyReleaseMask, &ev) ) {
+        if ( XFilterEvent( &ev, None ) == True || ev.type != KeyPress )
+            continue;
+        se_key sekey = se_keyboard_map_key( viewer->env->keyboard, &ev.xkey );
+        if ( se_key_is_null(sekey) )
+            continue;
+        if ( sekey.ascii == XK_Escape )
+            se_env_quit( viewer->env );
+        keys[nr++] = sekey;
+    }
+    return nr;
+}
+
+// show keys of a command typed so far, once user pauses in the middle
+static void se_text_xviewer_echo_keys(se_text_xviewer* viewer)
+{
+    char *echo = se_command_args_echo( &viewer->args );
+    if ( echo )
+        se_msg( "%s-", echo );
+    g_free( echo );
+    viewer->keysEchoed = TRUE;
+}
+
+static gboolean se_text_xviewer_echo_timeout(gpointer data)
+{
+    se_text_xviewer_echo_keys( data );
+    return TRUE;
+}
+
+static gboolean se_text_xviewer_redisplay_idle(gpointer data)
+{
+    se_text_xviewer *viewer = data;
+    if ( viewer->needRepaint )
+        viewer->repaint( viewer );
+    viewer->needRepaint = FALSE;
+    viewer->redisplay( viewer );
+    return TRUE;
+}
+
+// draw once input queued is handled, however many times it is asked for
+static void se_text_xviewer_queue_redisplay(se_text_xviewer* viewer, gboolean repaint)
+{
+    viewer->needRepaint |= repaint;
+    se_env_deferred_schedule( viewer->redisplaySource, 0 );
+}
+
+// report a search running in background till it is done
+static gboolean se_text_xviewer_poll_search(gpointer data)
+{
+    se_text_xviewer *viewer = data;
+    se_world *world = viewer->env->world;
+    gboolean running = world->pollSearch( world );
+    // *occur* fills up as buffers are searched
+    if ( world->occur && world->current == world->occur->output
+         && world->current->isModified(world->current) )
+        se_text_xviewer_queue_redisplay( viewer, TRUE );
+    if ( !running )
+        viewer->searchTimer = 0;
+    return running;
+}
+
 void se_text_xviewer_key_event(se_text_xviewer* viewer, XEvent* ev )
 {
     assert( viewer && ev );
@@ -337,12 +370,13 @@ void se_text_xviewer_key_event(se_text_xviewer* viewer, XEvent* ev )
     if ( kev.type == KeyPress ) {
         se_key sekey = se_key_null_init();
         
-        GString *chars = g_string_new("");
-        gboolean composed_input = se_text_xviewer_lookup_string(viewer, &kev, chars );
+        char chars[64];
+        gboolean composed_input = se_text_xviewer_lookup_string( viewer, &kev, chars,
+                                                                 sizeof chars );
         //FIXME: right now, do not handle Unicode before I finish basic facilities
         composed_input = FALSE; 
         if ( !composed_input ) {
-            sekey = se_key_event_process( viewer->env->display, kev );
+            sekey = se_keyboard_map_key( viewer->env->keyboard, &kev );
             if ( se_key_is_null(sekey) )
                 return;
     
@@ -351,30 +385,46 @@ void se_text_xviewer_key_event(se_text_xviewer* viewer, XEvent* ev )
         }
         
         se_world *world = viewer->env->world;
-        se_command_args args;
-        bzero( &args, sizeof args );
-        args.composedStr = g_string_new("");
-        args.universalArg = g_string_new("");
+        se_command_args *args = &viewer->args;
+        se_highlight *highlight = world->current->highlight;
+        int ret;
         
         if ( composed_input ) {
-            args.flags |= SE_IM_ARG;
-            g_string_assign( args.composedStr, chars->str );
-            g_string_free( chars, TRUE );
+            args->flags |= SE_IM_ARG;
+            g_string_assign( args->composedStr, chars );
+            if ( (ret = world->dispatchCommand(world, args, sekey)) )
+                se_command_args_clear( args );
+        } else {
+            se_key keys[SE_MAX_KEY_BURST];
+            keys[0] = sekey;
+            int nr = se_text_xviewer_drain_keys( viewer, keys, 1 );
+            ret = world->dispatchKeys( world, args, keys, nr );
         }
-        
-        while ( world->dispatchCommand( world, &args, sekey ) != TRUE ) {
-            sekey = se_delayed_wait_key( viewer );
-            if ( sekey.ascii == XK_Escape )
-                se_env_quit( viewer->env );
+
+        // rest of keys come as events, echoed if they are slow
+        se_env_deferred_cancel( viewer->echoSource );
+        switch ( se_command_echo_after(ret, viewer->keysEchoed) ) {
+        case SE_ECHO_NONE:
+            viewer->keysEchoed = FALSE;
+            break;
+        case SE_ECHO_NOW:
+            se_text_xviewer_echo_keys( viewer );
+            break;
+        case SE_ECHO_LATER:
+            se_env_deferred_schedule( viewer->echoSource, SE_ECHO_KEYSTROKES_DELAY );
+            break;
         }
 
-        g_string_free( args.composedStr, TRUE );
-        g_string_free( args.universalArg, TRUE );
+        if ( (world->psearch || (world->occur && world->occur->pool) || world->projectSearch)
+             && !viewer->searchTimer )
+            viewer->searchTimer = se_env_timeout_add( viewer->env, SE_PRIORITY_BACKGROUND,
+                                                      SE_SEARCH_POLL_INTERVAL,
+                                                      se_text_xviewer_poll_search, viewer );
         
-        if ( world->current->isModified(world->current) ) {
-            viewer->repaint( viewer );
-            viewer->redisplay( viewer );
-        }
+        // painted matches follow isearch as it goes, and go when dropped
+        if ( world->current->isModified(world->current) || world->isearch
+             || world->current->highlight != highlight )
+            se_text_xviewer_queue_redisplay( viewer, TRUE );
     }    
 }
 
@@ -484,6 +534,11 @@ se_text_xviewer* se_text_xviewer_create( se_env* env )
     }
 
     viewer->env = env;
+    viewer->args = se_command_args_init();
+    viewer->echoSource = se_env_deferred_new( env, SE_PRIORITY_INPUT,
+                                              se_text_xviewer_echo_timeout, viewer );
+    viewer->redisplaySource = se_env_deferred_new( env, SE_PRIORITY_REDISPLAY,
+                                                   se_text_xviewer_redisplay_idle, viewer );
     
     int width = 800;
     int height = 600;
@@ -543,6 +598,97 @@ se_text_xviewer* se_text_xviewer_create( se_env* env )
     return viewer;
 }
 
+static void se_text_xviewer_handle_event(se_text_xviewer* viewer, XEvent* ev)
+{
+    if ( XFilterEvent( ev, None ) == True ) {
+        se_debug("IM filtered event: %s", XEventTypeString(ev->type) );
+        return;
+    }
+
+    // sent to every client for no window in particular
+    if ( ev->type == MappingNotify ) {
+        XRefreshKeyboardMapping( &ev->xmapping );
+        if ( ev->xmapping.request == MappingKeyboard )
+            se_keyboard_map_refresh( viewer->env->keyboard, viewer->env->display );
+        return;
+    }
+        
+    if ( ev->xany.window != viewer->view ) {
+        se_msg( "skip event does not forward to view" );
+        return;
+    }
+        
+    switch( ev->type ) {
+    case Expose:
+        se_debug( "Expose" );
+        if ( ev->xexpose.count > 0 )
+            break;
+
+        se_text_xviewer_queue_redisplay( viewer, FALSE );
+        break;
+
+    case KeyPress:
+    case KeyRelease:
+        viewer->key_handler( viewer, ev );
+        break;
+
+    case ConfigureNotify:
+    case MapNotify:
+        se_debug( "confiugration changed" );
+        viewer->configure_change_handler( viewer, ev );
+        break;
+
+    default:
+        break;
+    }
+}
+
+/**
+ * X connection as a source of main context. events already read by Xlib
+ * leave nothing on fd, so queue of Xlib is looked at too. all events queued
+ * are handled in one dispatch, before any idle or timer of lower priority.
+ */
+DEF_CLS(se_xsource);
+struct se_xsource
+{
+    GSource source;
+    GPollFD pollfd;
+    se_text_xviewer *viewer;
+};
+
+static gboolean se_xsource_prepare(GSource* source, gint* timeout)
+{
+    *timeout = -1;
+    return XPending( ((se_xsource*)source)->viewer->env->display ) > 0;
+}
+
+static gboolean se_xsource_check(GSource* source)
+{
+    se_xsource *xsource = (se_xsource*)source;
+    if ( xsource->pollfd.revents & (G_IO_HUP | G_IO_ERR) )
+        return TRUE; // let Xlib find the connection lost
+    return XPending( xsource->viewer->env->display ) > 0;
+}
+
+static gboolean se_xsource_dispatch(GSource* source, GSourceFunc callback, gpointer data)
+{
+    se_text_xviewer *viewer = ((se_xsource*)source)->viewer;
+    Display *display = viewer->env->display;
+    do {
+        XEvent ev;
+        XNextEvent( display, &ev );
+        se_text_xviewer_handle_event( viewer, &ev );
+    } while ( XPending(display) );
+    return TRUE;
+}
+
+static GSourceFuncs se_xsource_funcs = {
+    se_xsource_prepare,
+    se_xsource_check,
+    se_xsource_dispatch,
+    NULL,
+};
+
 int main_loop(int argc, char *argv[])
 {
     setup_language();
@@ -571,45 +717,25 @@ int main_loop(int argc, char *argv[])
         }
     }
 
-    while( !env->exitLoop ) {
-        XEvent ev;
-        XNextEvent( env->display, &ev );
-        if ( XFilterEvent( &ev, None ) == True ) {
-            se_debug("IM filtered event: %s", XEventTypeString(ev.type) );
-            continue;
-        }
-        
-        if ( ev.xany.window != viewer->view ) {
-            se_msg( "skip event does not forward to view" );
-            continue;
-        }
-        
-        switch( ev.type ) {
-        case Expose:
-            se_debug( "Expose" );
-            if ( ev.xexpose.count > 0 )
-                break;
-
-            viewer->redisplay( viewer );
-            break;
-
-        case KeyPress:
-        case KeyRelease:
-            viewer->key_handler( viewer, &ev );
-            break;
-
-        case ConfigureNotify:
-        case MapNotify:
-            se_debug( "confiugration changed" );
-            viewer->configure_change_handler( viewer, &ev );
-            break;
-
-        default:
-            break;
-        }
-    }
+    GSource *source = g_source_new( &se_xsource_funcs, sizeof(se_xsource) );
+    se_xsource *xsource = (se_xsource*)source;
+    xsource->viewer = viewer;
+    xsource->pollfd.fd = ConnectionNumber( env->display );
+    xsource->pollfd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+    g_source_add_poll( source, &xsource->pollfd );
+    g_source_set_priority( source, SE_PRIORITY_INPUT );
+    g_source_attach( source, env->context );
+    g_main_loop_run( env->loop );
+    g_source_destroy( source );
+    g_source_unref( source );
 
     se_debug( "exit loop" );
+    g_source_destroy( viewer->echoSource );
+    g_source_unref( viewer->echoSource );
+    g_source_destroy( viewer->redisplaySource );
+    g_source_unref( viewer->redisplaySource );
+
+    se_command_args_release( &viewer->args );
 
     XUnsetICFocus( viewer->xic );
     XDestroyIC( viewer->xic );
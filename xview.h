@@ -24,6 +24,9 @@
 #include "env.h"
 #include "view.h"
 
+// most keys taken from input queue at once, see dispatchKeys of se_world
+#define SE_MAX_KEY_BURST  256
+
 se_position se_cursor_to_pixels_pos(se_env* env, se_cursor cur);
 
 DEF_CLS(se_text_xviewer);
@@ -48,6 +51,16 @@ struct se_text_xviewer
     se_cursor cursor; // where cursor is, pos in logical (row, col),
                       // this is not point of editor
 
+    // keys of a command are dispatched as their events come, what is typed
+    // so far is kept here until it is done
+    se_command_args args;
+    GSource *echoSource; // echoes keys typed so far if they pause
+    gboolean keysEchoed; // keys typed so far were echoed after a delay
+
+    GSource *redisplaySource; // redisplays once input queued is handled
+    gboolean needRepaint; // content is refilled from buffer before it
+    guint searchTimer; // polls search running in background, 0 if none
+
     void (*show)( se_text_xviewer* viewer );
     void (*repaint)( se_text_xviewer* viewer );
     void (*redisplay)( se_text_xviewer* viewer );    